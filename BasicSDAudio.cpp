@@ -55,9 +55,19 @@
 
 #include <BasicSDAudio.h>
 
+#if BSDA_USE_MULTIBLOCK && !SD_ENABLE_MULTIBLOCK_ACCESS
+  #error "BSDA_USE_MULTIBLOCK requires SD_ENABLE_MULTIBLOCK_ACCESS in sd_l1.h"
+#endif
+
 // ************* Instantiations ********************
 SdPlayClass SdPlay;
 
+#if SD_ENABLE_DIR_VIEW && (SD_L2_CACHE_SECTORS > 0)
+// SD_L2 block device while dirNext() reads the directory, see dirReadBlock()
+SD_BLK_Dev_t        SdPlayDirDev;
+const SD_BLK_Dev_t *SdPlayDirBase;
+#endif
+
 /* This is ISR corresponding to the Timer2 interrupt */
 extern "C"
 {
@@ -76,10 +86,10 @@ void __ISR(_TIMER_2_VECTOR,ipl3) playSamp(void)
  * Hardly optimized, therefore badly readable
  */
 void SdPlayClass::interrupt(void) {
-  uint8_t  flags = _flags;  // local copy for faster access
+  uint16_t flags = _flags;  // local copy for faster access
   if(flags & BSDA_F_PLAYING) {
     if(!(flags & BSDA_F_HALFRATE) || ((flags ^= BSDA_F_HRFLAG) & BSDA_F_HRFLAG)) {
-      if(_Buflen > 1) {
+      if((_BufPut - _BufTaken) > 1) {
          #ifdef BSDA_OC1H
            //>>BSDA_OC1H = 0;
          #endif
@@ -87,11 +97,11 @@ void SdPlayClass::interrupt(void) {
          temp = *_pBufout++;
 		 BSDA_OC1L(temp);		//set PWM duty
          if(flags & BSDA_F_STEREO) {
-            _Buflen-=2; 
+            _BufTaken+=2; 
             temp = *_pBufout++;
 			BSDA_OC2L(temp);
          } else {
-           _Buflen--;
+           _BufTaken++;
            if(flags & BSDA_F_BRIDGE) {
 			BSDA_OC2L(temp);
            }
@@ -102,12 +112,35 @@ void SdPlayClass::interrupt(void) {
       }            
     } 
     _flags = flags;
+  } else if(flags & BSDA_F_RECORDING) {
+    if(!(flags & BSDA_F_HALFRATE) || ((flags ^= BSDA_F_HRFLAG) & BSDA_F_HRFLAG)) {
+      if((_BufPut - _BufTaken) < _Bufsize) {
+         *_pBufout++ = BSDA_ADC_RESULT;
+         _BufPut++;
+         if(_pBufout >= _pBufoutend) _pBufout -= _Bufsize;
+      } else {
+        flags |= BSDA_F_OVERRUN;
+      }
+      BSDA_ADC_START;
+    }
+    _flags = flags;
   }
 }
 
 SdPlayClass::SdPlayClass(void) {
   _pBuf = NULL;
   _BufViaMalloc = false;
+  _mbActive = false;
+  _readPending = false;
+  _statSectors = 0;
+  _statMicros = 0;
+  _recMax = 0;
+  _pExt = _extBuf;
+  _extMax = BSDA_EXTENTS;
+  _extCount = 0;
+#if SD_ENABLE_DIR_VIEW
+  _dirCursor.Done = 1;
+#endif
   SD_L0_CSPin = SD_L0_CHIP_SELECT_PIN_DEFAULT;
   _debug = 0;
 }
@@ -120,11 +153,32 @@ void SdPlayClass::setSDCSPin(uint8_t csPin) {
   SD_L0_CSPin = csPin;
 }
 
-void SdPlayClass::setWorkBuffer(uint8_t *pBuf, uint16_t bufSize) {
+void SdPlayClass::setWorkBuffer(uint8_t *pBuf, uint32_t bufSize) {
   _pBuf = pBuf;
   _Bufsize = bufSize;
 }
 
+/**
+ * Sets the table for the extents (runs of contiguous sectors) of the 
+ * file to play, use this for files fragmented into more than 
+ * BSDA_EXTENTS pieces. Playback stops, select the file again with
+ * setFile() afterwards. Pass NULL to use the built-in table again.
+ */
+void SdPlayClass::setExtentBuffer(SD_L2_Extent_t *pExt, uint16_t count) {
+  if(_pBuf) {
+    stop();
+    _fileinfo.Size = 0;
+  }
+  _extCount = 0;
+  if(pExt && count) {
+    _pExt = pExt;
+    _extMax = count;
+  } else {
+    _pExt = _extBuf;
+    _extMax = BSDA_EXTENTS;
+  }
+}
+
 boolean SdPlayClass::init(uint8_t soundMode) {
   // make backup of control registers
   //>>_oc_cr1_bup = BSDA_OC_CR1_REG;
@@ -149,7 +203,7 @@ boolean SdPlayClass::init(uint8_t soundMode) {
   // hardcore SPI pin Init
   //SPI.begin();
   
-  _Bufsize = _Bufsize & 0xfe00;  // clamp to 512 byte units
+  _Bufsize = _Bufsize & ~511UL;  // clamp to 512 byte units
   
   // Init SD card, many errors can occur here...
   uint8_t ret;
@@ -214,6 +268,7 @@ boolean SdPlayClass::init(uint8_t soundMode) {
   
   //BSDA_CFG_TMRINTON;	//config int on macro
   _fileinfo.Size = 0;
+  _recMax = 0;
 
   return(true);
 }
@@ -235,22 +290,150 @@ void SdPlayClass::deInit(void) {
   }  
 
   _fileinfo.Size = 0;   // used as indicator that file has been selected
+  _recMax = 0;
   _pBuf = NULL;         // used as indicator that class has been initialized
 }
 
 
+#if SD_ENABLE_DIR_VIEW
+/**
+ * Outputs the files of the root directory, one name per callback.
+ * Playback goes on, see dirNext().
+ */
 void SdPlayClass::dir(void (*callback)(char *))
 {
+  if(dirOpen(NULL)) {
+    dirNext(callback, 0xffff);
+    dirClose();
+  }
+}
+
+/**
+ * Opens a directory to list it with dirNext(), a path like "/dir/sub"
+ * or NULL for the root directory. Only entries with all attributes of
+ * maskSet and none of maskUnset are listed (default: files only).
+ *
+ * \return true if successfull, false if not (fetch error-code using getLastError)
+ */
+boolean SdPlayClass::dirOpen(char *dirName, uint8_t maskSet, uint8_t maskUnset) {
+  SD_L2_File_t dirinfo;
+  uint8_t retval = 0;
+  
+  _dirCursor.Done = 1;
   if(!_pBuf) {
     _lastError = BSDA_ERROR_NOT_INIT;
+    return(false);
+  }
+  if(_flags & BSDA_F_RECORDING) {
+    _lastError = BSDA_ERROR_BUSY;
+    return(false);
+  }
+#if SD_L2_CACHE_SECTORS == 0
+  stop();       // directory sectors are read into the buffer
+#else
+  readFinish();
+#endif
+  while(dirName && ((*dirName == '/') || (*dirName == '\\'))) dirName++;
+  if(dirName && *dirName) {
+    retval = SD_L2_SearchPath((uint8_t *)dirName, 0x10, 0x08, &dirinfo);
+    if(!retval) retval = SD_L2_DirOpen(&_dirCursor, &dirinfo, maskSet, maskUnset);
   } else {
-      stop();
-      SD_L2_Dir(0, 0x00, 0x18, callback);
+    retval = SD_L2_DirOpen(&_dirCursor, NULL, maskSet, maskUnset);
+  }
+  if(retval) {
+    _lastError = retval;
+    return(false);
   }
+  return(true);
 }
 
 /**
- * Sets file to play.
+ * Outputs the next count entries of the directory opened by dirOpen(),
+ * one name per callback. A NULL callback skips them, e.g. to get to a 
+ * page of a long listing.
+ *
+ * Playback goes on: the directory is read one sector at a time and 
+ * worker() refills the buffer in between, also while the callback 
+ * takes its time. The running read of the card is only finished and 
+ * stopped when a sector has to be read for the directory, entries of
+ * a sector in the cache are listed without a card command. Other 
+ * calls like setFile() may come between dirNext() calls. With 
+ * SD_L2_CACHE_SECTORS 0 the directory is read into the buffer, so 
+ * playback is stopped.
+ *
+ * \return Number of entries output, less than count at the end of
+ *         the directory or on errors (fetch error-code using getLastError)
+ */
+uint16_t SdPlayClass::dirNext(void (*callback)(char *), uint16_t count) {
+  char     name[SD_L2_NAME_MAX];
+  uint16_t n = 0;
+  
+  if(!_pBuf) {
+    _lastError = BSDA_ERROR_NOT_INIT;
+    return(0);
+  }
+  if(_flags & BSDA_F_RECORDING) {
+    _lastError = BSDA_ERROR_BUSY;
+    return(0);
+  }
+#if SD_L2_CACHE_SECTORS == 0
+  stop();
+#else
+  SdPlayDirBase = SD_L2_dev;
+  SdPlayDirDev = *SD_L2_dev;
+  SdPlayDirDev.ReadBlock = dirReadBlock;
+#endif
+  while(n < count) {
+    uint8_t ret;
+    
+#if SD_L2_CACHE_SECTORS > 0
+    worker();
+    SD_L2_dev = &SdPlayDirDev;
+    ret = SD_L2_DirNext(&_dirCursor, name, NULL);
+    SD_L2_dev = SdPlayDirBase;
+#else
+    ret = SD_L2_DirNext(&_dirCursor, name, NULL);
+#endif
+    if(ret == SD_L2_ERROR_DIR_EOC) continue;   // nothing in this sector
+    if(ret == SD_L2_ERROR_FILE_NOT_FOUND) break;
+    if(ret) {
+      _lastError = ret;
+      break;
+    }
+    n++;
+    if(callback) callback(name);
+  }
+  return(n);
+}
+
+#if SD_L2_CACHE_SECTORS > 0
+/**
+ * ReadBlock of the block device SD_L2 uses in dirNext(). The card can
+ * not take the command while a read started by worker() is running, 
+ * so that read is finished and stopped first. Whether SD_L2_DirNext() 
+ * needs the card is not known before: a long name may go on in the 
+ * next sector, the sector may have left the cache since the last call
+ * and the FAT is read at the end of a cluster.
+ */
+uint8_t SdPlayClass::dirReadBlock(uint32_t block, uint8_t *dst) {
+  SD_L2_dev = SdPlayDirBase;
+  SdPlay.readFinish();
+  SD_L2_dev = &SdPlayDirDev;
+  return(SdPlayDirBase->ReadBlock(block, dst));
+}
+#endif
+
+/**
+ * Ends listing the directory opened by dirOpen().
+ */
+void SdPlayClass::dirClose(void) {
+  _dirCursor.Done = 1;
+}
+#endif /* SD_ENABLE_DIR_VIEW */
+
+/**
+ * Sets file to play, a name in root directory or a path like 
+ * "/ann/gate12/board.raw" (8.3 or long names).
  *
  * \return true if successfull, false if not (fetch error-code using getLastError)
  */
@@ -262,45 +445,306 @@ boolean SdPlayClass::setFile(char *fileName) {
   uint8_t retval;
   stop();
   _fileinfo.Size = 0;
-  retval = SD_L2_SearchFile((uint8_t *)fileName, 0UL, 0x00, 0x18, &_fileinfo);
+  retval = SD_L2_SearchPath((uint8_t *)fileName, 0x00, 0x18, &_fileinfo);
+  
+  // walk the cluster chain once, worker() follows the extents then
+  if(!retval) retval = SD_L2_GetExtents(&_fileinfo, _pExt, _extMax, &_extCount);
   
   if(retval) {
+     _fileinfo.Size = 0;
+     _extCount = 0;
      _lastError = retval;
      return(false);
   } else {
+     seekSector(0);
      return(true);
   }
 }
 
+#if SD_ENABLE_WRITE_ACCESS && SD_ENABLE_MULTIBLOCK_ACCESS
+/**
+ * Sets file to record to. The file is created in root folder with 
+ * maxBytes preallocated in one piece. An existing file is 
+ * overwritten in place if it is not fragmented, then its allocated 
+ * size limits the recording.
+ *
+ * \return true if successfull, false if not (fetch error-code using getLastError)
+ */
+boolean SdPlayClass::setRecordFile(char *fileName, uint32_t maxBytes) {
+  if(!_pBuf) {
+    _lastError = BSDA_ERROR_NOT_INIT;
+    return(false);
+  }
+  uint8_t retval;
+  stop();
+  _recMax = 0;
+  retval = SD_L2_CreateFile((uint8_t *)fileName, 0UL, maxBytes, &_recinfo);
+  if(retval == SD_L2_ERROR_FILE_EXISTS) {
+    retval = SD_L2_SearchFile((uint8_t *)fileName, 0UL, 0x00, 0x18, &_recinfo);
+  }
+  
+  if(retval) {
+     _lastError = retval;
+     return(false);
+  }
+  _recMax = maxBytes;
+  return(true);
+}
+
+/**
+ * Starts recording 8 bit mono samples from analogPin at the sample 
+ * rate of playback. Stops automatically when maxBytes are recorded.
+ * Call worker() continually to write the samples to the card.
+ *
+ * \return true if successfull, false if not (fetch error-code using getLastError)
+ */
+boolean SdPlayClass::record(uint8_t analogPin) {
+  if(!_pBuf) {
+    _lastError = BSDA_ERROR_NOT_INIT;
+    return(false);
+  }
+  if(!_recMax) {
+    _lastError = BSDA_ERROR_NO_FILE;
+    return(false);
+  }
+  uint8_t retval;
+  stop();
+  
+  // also sets _recinfo.Size to the allocated size
+  retval = SD_L2_WriteOpen(&_recinfo);
+  if(retval) {
+    _lastError = retval;
+    return(false);
+  }
+  if(_recinfo.Size > _recMax) _recinfo.Size = _recMax;
+  
+  // let the core select the channel, then sample continuously
+  analogRead(analogPin);
+  BSDA_ADC_OPEN;
+  BSDA_ADC_START;
+  
+  _statSectors = 0;
+  _statMicros = 0;
+  _flags &= ~(BSDA_F_STOPPED | BSDA_F_OVERRUN);
+  _flags |= BSDA_F_RECORDING;
+  BSDA_CFG_TMRINTON;	//config int on macro
+  return(true);
+}
+
+/**
+ * Writes a full sector from buffer to the record file.
+ */
+void SdPlayClass::recordWorker(void) {
+  uint8_t  ret;
+  uint32_t t0;
+  
+  if((_BufPut - _BufTaken) < 512) return;
+  
+  t0 = micros();
+  ret = SD_L2_WriteSector(&_recinfo, _pBuf + _Bufin);
+  if(ret) {
+    // file full or card error
+    stop();
+    if(ret != SD_L2_ERROR_EOF) _lastError = ret;
+    return;
+  }
+  _statMicros += micros() - t0;
+  _statSectors++;
+  
+  _Bufin += 512;
+  if(_Bufin >= _Bufsize) _Bufin -= _Bufsize;
+  _BufTaken += 512;   // only written here while recording, no need to lock
+  
+  if(_recinfo.ActBytePos >= _recinfo.Size) stop();
+}
+
+/**
+ * Ends recording: writes the rest of the buffer and sets file size.
+ * After a write error the file keeps the sectors written before it.
+ */
+void SdPlayClass::recordFinish(void) {
+  uint8_t  ret = 0;
+  uint8_t  closeRet;
+  uint32_t size;
+  
+  _flags &= ~BSDA_F_RECORDING;
+  BSDA_ADC_CLOSE;
+  
+  while(!ret && (_BufPut != _BufTaken) && (_recinfo.ActBytePos < _recinfo.Size)) {
+    uint32_t len = _BufPut - _BufTaken;
+    if(len > 512) len = 512;
+    ret = SD_L2_WriteSector(&_recinfo, _pBuf + _Bufin);
+    if(ret) break;
+    _Bufin += 512;
+    if(_Bufin >= _Bufsize) _Bufin -= _Bufsize;
+    _BufTaken += len;
+    if(len < 512) _recinfo.ActBytePos -= 512 - len;   // last sector is partly valid
+  }
+  
+  // ActBytePos counts the sectors written successfully only
+  size = _recinfo.ActBytePos;
+  if(size > _recMax) size = _recMax;
+  closeRet = SD_L2_WriteClose(&_recinfo, size);
+  if(!ret) ret = closeRet;
+  if(ret) _lastError = ret;
+}
+#endif /* SD_ENABLE_WRITE_ACCESS && SD_ENABLE_MULTIBLOCK_ACCESS */
+
+/**
+ * Starts reading the sector at ActSector to dst in background,
+ * poll SD_L2_dev->ReadPoll() for completion.
+ *
+ * With BSDA_USE_MULTIBLOCK a CMD18 transfer is kept open over contiguous
+ * sectors. It is closed at extent boundaries, where the file continues
+ * somewhere else on the card. Devices without read runs (ReadRunStart
+ * is NULL) are read sector by sector.
+ *
+ * \return Zero if read is running, error code otherwise
+ */
+uint8_t SdPlayClass::readSectorStart(uint8_t *dst) {
+  uint8_t ret;
+#if BSDA_USE_MULTIBLOCK
+  if(_mbActive && (_fileinfo.ActSector != _mbNextSector)) streamStop();
+  if(SD_L2_dev->ReadRunStart == NULL) {
+    ret = SD_L2_dev->ReadBlockAsync(_fileinfo.ActSector, dst);
+  } else {
+    if(!_mbActive) {
+      ret = SD_L2_dev->ReadRunStart(_fileinfo.ActSector);
+      if(ret) return(ret);
+      _mbActive = true;
+    }
+    ret = SD_L2_dev->ReadRunAsync(dst);
+    if(ret) streamStop();
+  }
+#else
+  ret = SD_L2_dev->ReadBlockAsync(_fileinfo.ActSector, dst);
+#endif
+  if(!ret) _readPending = true;
+  return(ret);
+}
+
+/**
+ * Accounts a completely read sector: advances ActSector and makes
+ * the data available for playback.
+ */
+void SdPlayClass::readSectorDone(void) {
+  uint32_t BytesLeft = _fileinfo.Size - _fileinfo.ActBytePos;
+  if(BytesLeft > 512UL) BytesLeft = 512UL;
+  _fileinfo.ActSector++;
+  _fileinfo.ActBytePos += 512;
+  if(--_extLeft == 0) {
+    // continue with next extent
+    streamStop();
+    if(++_extIndex < _extCount) {
+      _fileinfo.ActSector = _pExt[_extIndex].StartSector;
+      _extLeft = _pExt[_extIndex].Sectors;
+    }
+  }
+  _statSectors++;
+  _Bufin += 512;
+  if(_Bufin >= _Bufsize) _Bufin -= _Bufsize; 
+  // after a seek the first bytes of the sector are not played
+  _BufPut += BytesLeft - _skip;
+  _skip = 0;
+#if BSDA_USE_MULTIBLOCK
+  _mbNextSector = _fileinfo.ActSector;
+#endif
+  // Last sector fetched, free the card
+  if(_fileinfo.ActBytePos >= _fileinfo.Size) streamStop();
+}
+
+/**
+ * Completes a running sector read like worker() does, so the data is
+ * not lost, and closes an open multiple block read. The card is free 
+ * for other commands afterwards, playback continues with the next 
+ * worker() call.
+ */
+void SdPlayClass::readFinish(void) {
+  while(_readPending) worker();
+  streamStop();
+}
+
+/**
+ * Finishes a running sector read and closes an open multiple block read, 
+ * card is free for other commands afterwards.
+ */
+void SdPlayClass::streamStop(void) {
+  if(_readPending) {
+    // data is dropped, but transfer has to be completed
+    while(SD_L2_dev->ReadPoll() == SD_CARD_READ_PENDING) ;
+    _readPending = false;
+  }
+#if BSDA_USE_MULTIBLOCK
+  // only set if the device has read runs
+  if(_mbActive) {
+    uint8_t ret = 0;
+    _mbActive = false;
+    if(SD_L2_dev->ReadRunStop) ret = SD_L2_dev->ReadRunStop();
+    if(ret) _lastError = ret;
+  }
+#endif
+}
+
+/**
+ * Refills the buffer, call this continually in main loop. 
+ *
+ * Sector reads run in background if the SPI supports it, so
+ * worker() returns while the data block is still transferred.
+ */
 void SdPlayClass::worker(void) {
+#if SD_ENABLE_WRITE_ACCESS && SD_ENABLE_MULTIBLOCK_ACCESS
+  if(_flags & BSDA_F_RECORDING) {
+    recordWorker();
+    return;
+  }
+#endif
   if(_pBuf && _fileinfo.Size) {
-    uint16_t buflencpy;
-	buflencpy = _Buflen; 
-
-    if(_fileinfo.ActBytePos < _fileinfo.Size) {
+    uint8_t ret;
+    
+    if(!_readPending) {
+      if(_fileinfo.ActBytePos < _fileinfo.Size) {
         // At least space for 1 sector?
-        if(buflencpy < (_Bufsize - 512)) {
-            int16_t ret;
-            ret = SD_L1_ReadBlock(_fileinfo.ActSector++, _pBuf + _Bufin);
-            if(!ret) {
-               uint32_t BytesLeft = _fileinfo.Size - _fileinfo.ActBytePos;
-               _Bufin += 512;
-               _fileinfo.ActBytePos += 512;
-               if(_Bufin >= _Bufsize) _Bufin -= _Bufsize; 
-               if(BytesLeft >= 512UL) {	 
-					_Buflen += 512; 
-                } else {
-					_Buflen += BytesLeft; 
-                }
-            } else {
-              stop();
-              _lastError = ret;
+        if((_BufPut - _BufTaken) < (_Bufsize - 512)) {
+          _readStart = micros();
+          ret = readSectorStart(_pBuf + _Bufin);
+          if(ret) {
+            // retry on next call, e.g. with slower SPI clock
+            if(SD_L2_dev->Recover()) {
+              streamStop();
+              return;
             }
+            stop();
+            _lastError = ret;
+            return;
+          }
+        }
+      } else {
+        // Playback done
+        if((_BufPut - _BufTaken) <= 1) {
+          stop();
+        }
+      }
+    }
+    
+    if(_readPending) {
+      ret = SD_L2_dev->ReadPoll();
+#if !BSDA_WORKER_NONBLOCKING
+      // release the bus before returning
+      while(ret == SD_CARD_READ_PENDING) ret = SD_L2_dev->ReadPoll();
+#endif
+      if(ret == SD_CARD_READ_PENDING) return;
+      _readPending = false;
+      _statMicros += micros() - _readStart;
+      if(ret) {
+        // retry sector, e.g. with slower SPI clock
+        if(SD_L2_dev->Recover()) {
+          streamStop();
+          return;
         }
-    } else {
-      // Playback done
-      if(buflencpy <= 1) {
         stop();
+        _lastError = ret;
+      } else {
+        readSectorDone();
       }
     }
   }
@@ -311,32 +755,125 @@ void SdPlayClass::worker(void) {
  */
 void SdPlayClass::stop(void) {
 	//BSDA_CFG_TMRINTOFF;	//config int on macro
+#if SD_ENABLE_WRITE_ACCESS && SD_ENABLE_MULTIBLOCK_ACCESS
+	if(_flags & BSDA_F_RECORDING) recordFinish();
+#endif
+	streamStop();
 	pinMode(BSDA_OC1L_PIN, OUTPUT);
 	
 	_flags &= ~BSDA_F_PLAYING;
 	_flags |= BSDA_F_STOPPED;
 
-    _Buflen = 0;
+    _BufPut = 0;
+    _BufTaken = 0;
     _Bufin = 0;
     _pBufout = _pBuf;
     _pBufoutend = _pBuf + _Bufsize;
+    _skip = 0;
     
-    if(_fileinfo.Size) {
-        _fileinfo.ActSector = SD_L2_Cluster2Sector(_fileinfo.FirstCluster);
-        _fileinfo.ActBytePos = 0;
-    }
+    if(_fileinfo.Size) seekSector(0);
 	
 }
 
+/**
+ * Sets read position to a sector of the file (0 = first sector)
+ * by a binary search in the extent table.
+ */
+void SdPlayClass::seekSector(uint32_t fileSector) {
+  uint16_t i = SD_L2_FindExtent(_pExt, _extCount, fileSector);
+  if(i >= _extCount) return;
+  _extIndex = i;
+  _fileinfo.ActSector = _pExt[i].StartSector + (fileSector - _pExt[i].FileSector);
+  _extLeft = _pExt[i].Sectors - (fileSector - _pExt[i].FileSector);
+  _fileinfo.ActBytePos = fileSector << 9;
+}
+
+/**
+ * Samples per second of the current sound mode.
+ */
+uint32_t SdPlayClass::sampleRate(void) {
+  return((_flags & BSDA_F_HALFRATE) ? (BSDA_SAMPLE_RATE / 2) : BSDA_SAMPLE_RATE);
+}
+
+/**
+ * Jumps to a sample of the file (0 = first sample, a stereo sample
+ * has two bytes). The buffer is dropped and refilled by worker() 
+ * from the new position, playback continues there if playing. If 
+ * stopped, the next play() starts there.
+ *
+ * \return true if successfull, false if not (fetch error-code using getLastError)
+ */
+boolean SdPlayClass::seek(uint32_t sampleIndex) {
+  uint32_t pos = (_flags & BSDA_F_STEREO) ? (sampleIndex << 1) : sampleIndex;
+  uint16_t playing;
+  
+  if(!_fileinfo.Size) {
+    _lastError = BSDA_ERROR_NO_FILE;
+    return(false);
+  }
+  if(pos >= _fileinfo.Size) {
+    _lastError = SD_L2_ERROR_EOF;
+    return(false);
+  }
+  if(_flags & BSDA_F_RECORDING) stop();
+  
+  // hold output while the buffer is reset
+  playing = _flags & BSDA_F_PLAYING;
+  _flags &= ~BSDA_F_PLAYING;
+  streamStop();
+  
+  seekSector(pos >> 9);
+  _BufPut = 0;
+  _BufTaken = 0;
+  _Bufin = 0;
+  _skip = pos & 511;
+  _pBufout = _pBuf + _skip;
+  
+  _flags |= playing;
+  return(true);
+}
+
+/**
+ * Jumps to a time of the file in ms, see seek().
+ */
+boolean SdPlayClass::seekMs(uint32_t ms) {
+  uint32_t rate = sampleRate();
+  return(seek((ms / 1000UL) * rate + (ms % 1000UL) * rate / 1000UL));
+}
+
+/**
+ * Returns the number of the sample played next (0 = first sample).
+ */
+uint32_t SdPlayClass::getPosition(void) {
+  uint32_t pos;
+  
+  if(!_fileinfo.Size) return(0);
+  // bytes read minus bytes still in buffer, the last sector is partly valid
+  pos = (_fileinfo.ActBytePos < _fileinfo.Size) ? _fileinfo.ActBytePos : _fileinfo.Size;
+  pos = pos + _skip - (_BufPut - _BufTaken);
+  return((_flags & BSDA_F_STEREO) ? (pos >> 1) : pos);
+}
+
+/**
+ * Returns the time of the sample played next in ms.
+ */
+uint32_t SdPlayClass::getPositionMs(void) {
+  uint32_t rate = sampleRate();
+  uint32_t samples = getPosition();
+  return((samples / rate) * 1000UL + (samples % rate) * 1000UL / rate);
+}
+
 /**
  * if not playing, start playing. if playing start from zero again
  */
 void SdPlayClass::play(void) {
 	
     if(_fileinfo.Size) {
-        if(_flags & BSDA_F_PLAYING) {
+        if(_flags & (BSDA_F_PLAYING | BSDA_F_RECORDING)) {
             stop();
         }
+		_statSectors = 0;
+		_statMicros = 0;
 		_flags |= BSDA_F_PLAYING;
 		_flags &= ~BSDA_F_STOPPED;
     }
@@ -347,8 +884,9 @@ void SdPlayClass::play(void) {
  * pauses playing if not playing, resumes playing if was paused
  */
 void SdPlayClass::pause(void) {
-  if(!(_flags & BSDA_F_STOPPED)) {
+  if(!(_flags & (BSDA_F_STOPPED | BSDA_F_RECORDING))) {
 	_flags ^= BSDA_F_PLAYING;
+	if(!(_flags & BSDA_F_PLAYING)) streamStop();   // don't keep card busy while paused
   }
 }
 
@@ -379,7 +917,18 @@ boolean SdPlayClass::isPlaying(void) {
  */
 boolean SdPlayClass::isPaused(void) {
     boolean ret = false;
-    if(!(_flags & BSDA_F_PLAYING) && !(_flags & BSDA_F_STOPPED)) {
+    if(!(_flags & BSDA_F_PLAYING) && !(_flags & BSDA_F_STOPPED) && !(_flags & BSDA_F_RECORDING)) {
+        ret = true;       
+    }
+    return(ret);
+}
+
+/** 
+ * Return if recording 
+ */
+boolean SdPlayClass::isRecording(void) {
+    boolean ret = false;
+    if(_flags & BSDA_F_RECORDING) {
         ret = true;       
     }
     return(ret);
@@ -397,6 +946,18 @@ boolean SdPlayClass::isUnderrunOccured(void) {
     return(ret);
 }
 
+/** 
+ * Returns and clears overrun flag state (samples lost while recording)
+ */
+boolean SdPlayClass::isOverrunOccured(void) {
+    boolean ret = false;
+    if(_flags & BSDA_F_OVERRUN) {
+        ret = true;
+		_flags &= ~BSDA_F_OVERRUN;       
+    }
+    return(ret);
+}
+
 /** 
  * Returns and clears last error code
  */
@@ -406,5 +967,15 @@ uint8_t SdPlayClass::getLastError(void) {
     return(temp);
 }
 
+/** 
+ * Returns sustained card read rate in sectors/s, based on the time
+ * spent inside card reads since play() was called, or the write rate
+ * since record() was called
+ */
+uint32_t SdPlayClass::getSectorRate(void) {
+    if(!_statMicros) return(0);
+    return((uint32_t)(((uint64_t)_statSectors * 1000000UL) / _statMicros));
+}
+
 
 
@@ -117,15 +117,36 @@
 #define BSDA_ERROR_NULL         0x80    // Null pointer
 #define BSDA_ERROR_BUFTOSMALL   0x81    // Buffer to small
 #define BSDA_ERROR_NOT_INIT     0x82    // System not initialized properly
+#define BSDA_ERROR_NO_FILE      0x83    // No file selected
+#define BSDA_ERROR_BUSY         0x84    // Card is busy with recording
 
 // Flags
-uint8_t const BSDA_F_PLAYING  = 0x01;   // 1 if playing active
-uint8_t const BSDA_F_STOPPED  = 0x02;   // 1 if stopped or file reached end
-uint8_t const BSDA_F_UNDERRUN = 0x04;   // 1 if buffer underrun occured
-uint8_t const BSDA_F_HALFRATE = 0x08;   // If 1, only every 2nd interrupt is used for sample refresh
-uint8_t const BSDA_F_HRFLAG   = 0x10;   // Flag to find every 2nd interrupt
-uint8_t const BSDA_F_STEREO   = 0x20;   // If 1, OCxB outputs the second channel
-uint8_t const BSDA_F_BRIDGE   = 0x40;   // If 1, OCxB outputs the same signal but inverted (for more output power)
+uint16_t const BSDA_F_PLAYING  = 0x01;   // 1 if playing active
+uint16_t const BSDA_F_STOPPED  = 0x02;   // 1 if stopped or file reached end
+uint16_t const BSDA_F_UNDERRUN = 0x04;   // 1 if buffer underrun occured
+uint16_t const BSDA_F_HALFRATE = 0x08;   // If 1, only every 2nd interrupt is used for sample refresh
+uint16_t const BSDA_F_HRFLAG   = 0x10;   // Flag to find every 2nd interrupt
+uint16_t const BSDA_F_STEREO   = 0x20;   // If 1, OCxB outputs the second channel
+uint16_t const BSDA_F_BRIDGE   = 0x40;   // If 1, OCxB outputs the same signal but inverted (for more output power)
+uint16_t const BSDA_F_RECORDING = 0x80;  // 1 if recording active
+uint16_t const BSDA_F_OVERRUN  = 0x100;  // 1 if buffer overrun occured while recording
+
+// Streaming settings
+// If 1, worker() keeps a CMD18 multiple block read open over contiguous sectors
+// instead of issuing one CMD17 per sector (needs SD_ENABLE_MULTIBLOCK_ACCESS)
+#define BSDA_USE_MULTIBLOCK     1
+// If 1, worker() returns right away while the card is busy or a sector is
+// still transferred and continues on the next call. The SD card keeps CS
+// asserted meanwhile, so only set this to 1 (e.g. with -D on the compiler
+// command line) if no other device on its SPI bus is accessed between
+// worker() calls, unlike the Ethernet controller of BSDAWebServer.
+#ifndef BSDA_WORKER_NONBLOCKING
+#define BSDA_WORKER_NONBLOCKING 0
+#endif
+// Number of extents (runs of contiguous sectors) a file to play may be
+// fragmented into, each takes 12 bytes. Larger tables can be set with
+// setExtentBuffer().
+#define BSDA_EXTENTS            8
 
 
 //------------------------------------------------------------------------------
@@ -180,6 +201,9 @@ uint8_t const BSDA_F_BRIDGE   = 0x40;   // If 1, OCxB outputs the same signal bu
 
 // timer settings
 #define BSDA_USE_TIMER 2
+// Samples per second with BSDA_MODE_FULLRATE: PBCLK (= F_CPU on chipKIT) 
+// divided by the timer prescaler 4 and the timer period 256
+#define BSDA_SAMPLE_RATE (F_CPU / 4UL / 256UL)
 
 
 #if BSDA_USE_TIMER == 3
@@ -191,6 +215,13 @@ uint8_t const BSDA_F_BRIDGE   = 0x40;   // If 1, OCxB outputs the same signal bu
 	#define BSDA_CFG_TMRINTON	ConfigIntTimer2(T2_INT_ON | T2_INT_PRIOR_3)
 	#define BSDA_CFG_TMRINTOFF	ConfigIntTimer2(T2_INT_OFF | T2_INT_PRIOR_3)
 #endif
+
+// ADC settings for recording (channel is selected by analogRead() before)
+// auto convert after 2 TAD sampling, TAD = 8 * TPB
+#define BSDA_ADC_OPEN	{ AD1CON1 = 0; AD1CON2 = 0; AD1CON3 = (2 << 8) | 3; AD1CON1 = (7 << 5) | (1 << 15); }
+#define BSDA_ADC_CLOSE	{ AD1CON1 = 0; }
+#define BSDA_ADC_START	{ AD1CON1SET = (1 << 1); }	// set SAMP, conversion follows automatically
+#define BSDA_ADC_RESULT	((uint8_t)(ADC1BUF0 >> 2))	// 10 bit result to 8 bit sample
   
     
 class SdPlayClass {
@@ -198,17 +229,54 @@ class SdPlayClass {
     uint8_t _oc_cr1_bup;        // Backup of 1st control register 
     uint8_t _oc_cr2_bup;        // Backup of 2nd control register 
     uint8_t *_pBuf;             // pointer to working buffer, used for audio and all kind of file access
-    uint16_t _Bufsize;          // size of working buffer, must be a multiple of 512, at least 1024
+    uint32_t _Bufsize;          // size of working buffer, must be a multiple of 512, at least 1024
     uint8_t *_pBufoutend;       // points to _pBuf + _Bufsize
-    volatile uint16_t _Buflen;  // how much bytes are availible in buffer
-    uint16_t _Bufin;            // index where next byte can put into the buffer
-    volatile uint8_t *_pBufout; // pointer where next byte can read from the buffer
+    // Fill level is _BufPut - _BufTaken, both count free running and have one writer each:
+    // worker() puts and interrupt() takes while playing, the other way round while recording
+    volatile uint32_t _BufPut;  // bytes put into the buffer since reset
+    volatile uint32_t _BufTaken;// bytes taken out of the buffer since reset
+    uint32_t _Bufin;            // index of the worker() side: next sector to fill (playing) or to write (recording)
+    volatile uint8_t *_pBufout; // pointer of the interrupt() side: next byte to play (playing) or to sample (recording)
     boolean  _BufViaMalloc;     // Set to true if Buf created dynamically
     
-    volatile uint8_t  _flags;
+    volatile uint16_t _flags;
     
     SD_L2_File_t _fileinfo;
+    SD_L2_File_t _recinfo;      // file to record to
+    uint32_t _recMax;           // maximum number of bytes to record, 0 if no file selected
     uint8_t _lastError;
+    
+    boolean  _mbActive;         // true while a multiple block read is open on the card
+    uint32_t _mbNextSector;     // sector the open multiple block read delivers next
+    boolean  _readPending;      // true while a sector is transferred in background
+    uint32_t _readStart;        // micros() when pending read was started
+    uint32_t _statSectors;      // sectors read since play()
+    uint32_t _statMicros;       // time spent in card reads since play()
+    
+    SD_L2_Extent_t _extBuf[BSDA_EXTENTS]; // default extent table
+    SD_L2_Extent_t *_pExt;      // extent table of the file to play, built by setFile()
+    uint16_t _extMax;           // size of extent table
+    uint16_t _extCount;         // number of extents of the file
+    uint16_t _extIndex;         // extent ActSector belongs to
+    uint32_t _extLeft;          // sectors left in this extent, including ActSector
+    uint16_t _skip;             // bytes of the next read sector before the seek position
+#if SD_ENABLE_DIR_VIEW
+    SD_L2_DirCursor_t _dirCursor; // directory listed by dirNext()
+#endif
+    
+    uint8_t readSectorStart(uint8_t *dst);
+    void    readSectorDone(void);
+    void    streamStop(void);
+    void    readFinish(void);
+#if SD_ENABLE_DIR_VIEW
+    static uint8_t dirReadBlock(uint32_t block, uint8_t *dst);
+#endif
+    void    seekSector(uint32_t fileSector);
+    uint32_t sampleRate(void);
+#if SD_ENABLE_WRITE_ACCESS && SD_ENABLE_MULTIBLOCK_ACCESS
+    void    recordWorker(void);
+    void    recordFinish(void);
+#endif
   
   public:
     SdPlayClass(void);  // constructor
@@ -219,8 +287,12 @@ class SdPlayClass {
     // Optional: call this before init to set SD-Cards CS-Pin to other than default    
     void    setSDCSPin(uint8_t csPin); 
     
-    // Optional: call this if you want to use your own buffer (at least 1024 bytes, must be multiple of 512)
-    void    setWorkBuffer(uint8_t *pBuf, uint16_t bufSize); 
+    // Optional: call this if you want to use your own buffer (at least 1024 bytes, must be multiple of 512,
+    // may be larger than 64 KB to ride out long card stalls)
+    void    setWorkBuffer(uint8_t *pBuf, uint32_t bufSize); 
+    
+    // Optional: call this before setFile to play files with more than BSDA_EXTENTS fragments
+    void    setExtentBuffer(SD_L2_Extent_t *pExt, uint16_t count); 
     
     // Call this to set sound mode, see BSDA_MODE_* flags above for modes
     boolean init(uint8_t soundMode);
@@ -228,26 +300,56 @@ class SdPlayClass {
     // Optional: call this to free resources 
     void    deInit(void);
     
-    // Optional: output directory list
+#if SD_ENABLE_DIR_VIEW
+    // Optional: output directory list (root directory, playback goes on)
     void    dir(void (*callback)(char *));  
+    
+    // Optional: list a directory ("/dir", NULL for root) in steps of count entries, playback goes on,
+    // attributes filter like SD_L2_SearchFile, a NULL callback skips entries (e.g. to show a later page)
+    // (needs SD_ENABLE_DIR_VIEW in sd_l2.h)
+    boolean  dirOpen(char *dirName, uint8_t maskSet = 0x00, uint8_t maskUnset = 0x18);
+    uint16_t dirNext(void (*callback)(char *), uint16_t count);
+    void     dirClose(void);
+#endif
 
-    // After  init, call this to select audio file
+    // After  init, call this to select audio file (name in root directory or path like "/dir/file.raw")
+    // (for large root directories set up an index with SD_L2_IndexSetup(0, slots, count) before,
+    // or load an index file made by tools/bsda_mkindex.py with SD_L2_IndexFileLoad())
     boolean setFile(char *fileName);
     
+#if SD_ENABLE_WRITE_ACCESS && SD_ENABLE_MULTIBLOCK_ACCESS
+    // After init, call this to select (and create) file to record to
+    // (needs SD_ENABLE_WRITE_ACCESS and SD_ENABLE_MULTIBLOCK_ACCESS in sd_l1.h)
+    boolean setRecordFile(char *fileName, uint32_t maxBytes);
+    
+    // Starts recording from analog pin to selected record file
+    boolean record(uint8_t analogPin);
+#endif
+    
     // Call this continually in main loop 
     void    worker(void);    
     
-    void    stop(void);  // stops playback if playing, sets playposition to zero
+    void    stop(void);  // stops playback if playing, sets playposition to zero, closes record file if recording
     void    play(void);  // if not playing, start playing. if playing start from zero again
     void    pause(void); // pauses playing if not playing, resumes playing if was paused
     
+    // Jump to a sample (0 = first) or a time of the file, playback continues there if playing
+    boolean seek(uint32_t sampleIndex);
+    boolean seekMs(uint32_t ms);
+    uint32_t getPosition(void);   // number of the sample played next
+    uint32_t getPositionMs(void);
+    
     boolean isStopped(void);
     boolean isPlaying(void);
     boolean isPaused(void);
+    boolean isRecording(void);
     
     boolean isUnderrunOccured(void); 
+    boolean isOverrunOccured(void); 
     uint8_t getLastError(void);
     
+    uint32_t getSectorRate(void); // sustained card read/write rate in sectors/s since play()/record()
+    
     uint8_t _debug;
 };
 
@@ -42,12 +42,22 @@
 
 #define OPT_BOARD_INTERNAL
 #include	<sys/attribs.h>
+#include	<sys/kmem.h>
 #include	<DSPI.h>
 
 /* ------------------------------------------------------------ */
 /*				Local Type and Constant Definitions				*/
 /* ------------------------------------------------------------ */
 
+/* DMA controller register bits
+*/
+#define	_DMACON_ON			15		// DMA module on
+#define	_DCHCON_CHEN		7		// channel enable
+#define	_DCHECON_CHSIRQ		8		// start IRQ number, 8 bits
+#define	_DCHECON_CFORCE		7		// force a single cell transfer
+#define	_DCHECON_CABORT		6		// abort transfer
+#define	_DCHECON_SIRQEN		4		// start transfer on IRQ match
+#define	_DCHINT_CHBCIF		3		// block transfer complete flag
 
 /* ------------------------------------------------------------ */
 /*				Global Variables								*/
@@ -110,6 +120,8 @@ DSPI::DSPI() {
 
 	pspi = 0;
 	cbCur = 0;
+	cbDmaCur = 0;
+	fDmaAct = 0;
 
 }
 
@@ -150,6 +162,12 @@ DSPI::init(uint8_t irqErr, uint8_t irqRx, uint8_t irqTx) {
 	bitRx  = 1 << (irqRx % 32);		// rx interrupt flag/enable bit
 	bitTx  = 1 << (irqTx % 32);		// tx interrupt flag/enable bit
 
+	/* The DMA controller is triggered by the IRQ numbers themselves.
+	*/
+	irqRcv = irqRx;
+	irqSnd = irqTx;
+	setDmaChannels(_DSPI_DMA_CH_RCV, _DSPI_DMA_CH_SND);
+
 }
 
 /* ------------------------------------------------------------ */
@@ -200,7 +218,6 @@ DSPI::begin(uint8_t pinT) {
 
 	p32_regset *	pregIpc;
 	int				bnVec;
-	uint8_t			bTmp;
 	uint16_t		brg;
 
 	/* Initialize the pins. The pin directions for SDO, SDI and SCK
@@ -220,7 +237,7 @@ DSPI::begin(uint8_t pinT) {
 
 	/* Clear the receive buffer.
 	*/
-	bTmp = pspi->sxBuf.reg;
+	(void)(uint32_t)pspi->sxBuf.reg;
 
 	/* Clear all SPI interrupt flags.
 	*/
@@ -527,6 +544,193 @@ DSPI::transfer(uint16_t cbReq, uint8_t bPad, uint8_t * pbRcv) {
 
 }
 
+/* ------------------------------------------------------------ */
+/***	DSPI::bulkBegin
+**
+**	Parameters:
+**		none
+**
+**	Return Value:
+**		none
+**
+**	Errors:
+**		none
+**
+**	Description:
+**		Switches the SPI controller to 32 bit mode, with the
+**		enhanced buffer (FIFO) enabled if the part has one. The
+**		mode bits may only be changed while the controller is off,
+**		so it is switched off once the last byte is shifted. SCK
+**		stays at its idle level meanwhile, the pin is an output
+**		driven low (SD_L0_Init).
+*/
+
+void
+DSPI::bulkBegin() {
+
+	while ((pspi->sxStat.reg & (1 << _SPISTAT_SPIBUSY)) != 0) {
+	}
+	pspi->sxCon.clr = (1 << _SPICON_ON);
+#if (_DSPI_FIFO_SUPPORT != 0)
+	pspi->sxCon.set = (1 << _SPICON_MODE32) | (1 << _SPICON_ENHBUF);
+#else
+	pspi->sxCon.set = (1 << _SPICON_MODE32);
+#endif
+	pspi->sxCon.set = (1 << _SPICON_ON);
+
+}
+
+/* ------------------------------------------------------------ */
+/***	DSPI::bulkEnd
+**
+**	Parameters:
+**		none
+**
+**	Return Value:
+**		none
+**
+**	Errors:
+**		none
+**
+**	Description:
+**		Returns the SPI controller to 8 bit mode without FIFO,
+**		like bulkBegin once the last word is shifted.
+*/
+
+void
+DSPI::bulkEnd() {
+
+	while ((pspi->sxStat.reg & (1 << _SPISTAT_SPIBUSY)) != 0) {
+	}
+	pspi->sxCon.clr = (1 << _SPICON_ON);
+#if (_DSPI_FIFO_SUPPORT != 0)
+	pspi->sxCon.clr = (1 << _SPICON_MODE32) | (1 << _SPICON_ENHBUF);
+#else
+	pspi->sxCon.clr = (1 << _SPICON_MODE32);
+#endif
+	pspi->sxCon.set = (1 << _SPICON_ON);
+
+}
+
+/* ------------------------------------------------------------ */
+/***	DSPI::transferBulk
+**
+**	Parameters:
+**		cbReq	- number of bytes to receive from the slave
+**		bPadT	- pad byte to send to slave
+**		pbRcv	- buffer to hold received bytes
+**
+**	Return Value:
+**		none
+**
+**	Errors:
+**		none
+**
+**	Description:
+**		Same as transfer(cbReq, bPad, pbRcv), but the bytes are
+**		moved as 32 bit words while keeping the FIFO filled, so
+**		the bus doesn't idle between bytes. cbReq must be a
+**		multiple of 4 and pbRcv word aligned, otherwise the
+**		bytes are transferred one at a time.
+*/
+
+void
+DSPI::transferBulk(uint16_t cbReq, uint8_t bPadT, uint8_t * pbRcv) {
+
+	uint32_t	wPad;
+	uint32_t *	pwRcv;
+	uint16_t	cwSnd;
+	uint16_t	cwRcv;
+
+	if (((cbReq & 3) != 0) || (((uintptr_t)pbRcv & 3) != 0)) {
+		transfer(cbReq, bPadT, pbRcv);
+		return;
+	}
+
+	wPad = bPadT * 0x01010101UL;
+	pwRcv = (uint32_t *)pbRcv;
+	cwSnd = cbReq / 4;
+	cwRcv = cwSnd;
+
+	bulkBegin();
+
+	while (cwRcv > 0) {
+		/* Keep the transmit FIFO filled, but never have more words
+		** on the way than the receive FIFO can hold.
+		*/
+		if ((cwSnd > 0) && ((cwRcv - cwSnd) < _DSPI_FIFO_DEPTH) &&
+			((pspi->sxStat.reg & (1 << _SPISTAT_SPITBF)) == 0)) {
+			pspi->sxBuf.reg = wPad;
+			cwSnd -= 1;
+		}
+
+		if (_DSPI_RCV_READY(pspi->sxStat.reg)) {
+			/* The first byte on the wire is the most significant one.
+			*/
+			*pwRcv++ = __builtin_bswap32(pspi->sxBuf.reg);
+			cwRcv -= 1;
+		}
+	}
+
+	bulkEnd();
+
+}
+
+/* ------------------------------------------------------------ */
+/***	DSPI::transferBulk
+**
+**	Parameters:
+**		cbReq	- number of bytes to send to the slave
+**		pbSnd	- buffer containing bytes to send
+**
+**	Return Value:
+**		none
+**
+**	Errors:
+**		none
+**
+**	Description:
+**		Same as transfer(cbReq, pbSnd), but the bytes are moved
+**		as 32 bit words while keeping the FIFO filled. cbReq must
+**		be a multiple of 4 and pbSnd word aligned, otherwise the
+**		bytes are transferred one at a time.
+*/
+
+void
+DSPI::transferBulk(uint16_t cbReq, uint8_t * pbSnd) {
+
+	uint32_t *	pwSnd;
+	uint16_t	cwSnd;
+	uint16_t	cwRcv;
+
+	if (((cbReq & 3) != 0) || (((uintptr_t)pbSnd & 3) != 0)) {
+		transfer(cbReq, pbSnd);
+		return;
+	}
+
+	pwSnd = (uint32_t *)pbSnd;
+	cwSnd = cbReq / 4;
+	cwRcv = cwSnd;
+
+	bulkBegin();
+
+	while (cwRcv > 0) {
+		if ((cwSnd > 0) && ((cwRcv - cwSnd) < _DSPI_FIFO_DEPTH) &&
+			((pspi->sxStat.reg & (1 << _SPISTAT_SPITBF)) == 0)) {
+			pspi->sxBuf.reg = __builtin_bswap32(*pwSnd++);
+			cwSnd -= 1;
+		}
+
+		if (_DSPI_RCV_READY(pspi->sxStat.reg)) {
+			(void)(uint32_t)pspi->sxBuf.reg;
+			cwRcv -= 1;
+		}
+	}
+
+	bulkEnd();
+
+}
+
 /* ------------------------------------------------------------ */
 /*					Interrupt Control Functions					*/
 /* ------------------------------------------------------------ */
@@ -607,11 +811,9 @@ DSPI::disableInterruptTransfer() {
 void
 DSPI::cancelIntTransfer() {
 
-	uint8_t		bTmp;
-
 	/* Clear the receive buffer.
 	*/
-	bTmp = pspi->sxBuf.reg;
+	(void)(uint32_t)pspi->sxBuf.reg;
 
 	/* Clear the interrupt flags.
 	*/
@@ -745,6 +947,292 @@ DSPI::intTransfer(uint16_t cbReq, uint8_t bPadT, uint8_t * pbRcv) {
 
 }
 
+/* ------------------------------------------------------------ */
+/*					DMA Driven I/O Functions					*/
+/* ------------------------------------------------------------ */
+/***	DSPI::setDmaChannels
+**
+**	Parameters:
+**		chRcv		- DMA channel used to store received bytes
+**		chSnd		- DMA channel used to feed the transmitter
+**
+**	Return Value:
+**		none
+**
+**	Errors:
+**		none
+**
+**	Description:
+**		Selects the two DMA channels used by dmaTransfer. The
+**		defaults are _DSPI_DMA_CH_RCV and _DSPI_DMA_CH_SND. Each
+**		SPI port doing DMA transfers at the same time needs its
+**		own pair of channels.
+*/
+
+void
+DSPI::setDmaChannels(uint8_t chRcv, uint8_t chSnd) {
+
+#if (_DSPI_DMA_SUPPORT != 0)
+	pdchRcv = ((p32_dch *)_DMAC0_BASE_ADDRESS) + chRcv;
+	pdchSnd = ((p32_dch *)_DMAC0_BASE_ADDRESS) + chSnd;
+#else
+	pdchRcv = 0;
+	pdchSnd = 0;
+#endif
+
+}
+
+/* ------------------------------------------------------------ */
+/***	DSPI::dmaTransfer
+**
+**	Parameters:
+**		cbReq		- number of bytes to receive
+**		bPadT		- pad byte to send to the slave device
+**		pbRcv		- pointer to buffer to receive returned bytes
+**
+**	Return Value:
+**		none
+**
+**	Errors:
+**		none
+**
+**	Description:
+**		This function will set up and begin a DMA driven transfer
+**		that receives cbReq bytes from the slave, sending the pad
+**		byte for each of them. The function returns immediately,
+**		use isDmaBusy to find out when the transfer is complete.
+**		On parts without DMA controller the transfer is done
+**		before this function returns.
+*/
+
+void
+DSPI::dmaTransfer(uint16_t cbReq, uint8_t bPadT, uint8_t * pbRcv) {
+
+#if (_DSPI_DMA_SUPPORT != 0)
+	uint16_t	ib;
+
+	/* The transmit channel sends the contents of the receive buffer,
+	** so fill it with the pad byte. Each byte is sent before the
+	** receive channel overwrites it with the byte from the slave.
+	*/
+	for (ib = 0; ib < cbReq; ib++) {
+		pbRcv[ib] = bPadT;
+	}
+
+	pbDmaBuf = pbRcv;
+	pbDmaCur = pbRcv;
+	cbDmaCur = cbReq;
+	fDmaAct = 1;
+
+	DMACONSET = (1 << _DMACON_ON);
+	dmaStartBlock();
+#else
+	transfer(cbReq, bPadT, pbRcv);
+#endif
+
+}
+
+/* ------------------------------------------------------------ */
+/***	DSPI::dmaStartBlock
+**
+**	Parameters:
+**		none
+**
+**	Return Value:
+**		none
+**
+**	Errors:
+**		none
+**
+**	Description:
+**		Programs both DMA channels for the next block of the
+**		current DMA transfer and starts it. Blocks are limited to
+**		_DSPI_DMA_BLOCK bytes, as some parts only have 8 bit size
+**		registers.
+*/
+
+void
+DSPI::dmaStartBlock() {
+
+#if (_DSPI_DMA_SUPPORT != 0)
+	uint16_t	cb;
+
+	cb = (cbDmaCur > _DSPI_DMA_BLOCK) ? _DSPI_DMA_BLOCK : cbDmaCur;
+
+	pdchRcv->dchCon.clr = (1 << _DCHCON_CHEN);
+	pdchSnd->dchCon.clr = (1 << _DCHCON_CHEN);
+	pdchRcv->dchInt.reg = 0;
+	pdchSnd->dchInt.reg = 0;
+
+	/* Receive channel: one byte from the SPI buffer to memory
+	** on each receive event.
+	*/
+	pdchRcv->dchEcon.reg = (irqRcv << _DCHECON_CHSIRQ) | (1 << _DCHECON_SIRQEN);
+	pdchRcv->dchSsa.reg = KVA_TO_PA(&pspi->sxBuf.reg);
+	pdchRcv->dchDsa.reg = KVA_TO_PA(pbDmaCur);
+	pdchRcv->dchSsiz.reg = 1;
+	pdchRcv->dchDsiz.reg = cb;
+	pdchRcv->dchCsiz.reg = 1;
+
+	/* Transmit channel: one byte from memory to the SPI buffer
+	** on each transmit event.
+	*/
+	pdchSnd->dchEcon.reg = (irqSnd << _DCHECON_CHSIRQ) | (1 << _DCHECON_SIRQEN);
+	pdchSnd->dchSsa.reg = KVA_TO_PA(pbDmaCur);
+	pdchSnd->dchDsa.reg = KVA_TO_PA(&pspi->sxBuf.reg);
+	pdchSnd->dchSsiz.reg = cb;
+	pdchSnd->dchDsiz.reg = 1;
+	pdchSnd->dchCsiz.reg = 1;
+
+	pbDmaCur += cb;
+	cbDmaCur -= cb;
+	cbDmaBlk = cb;
+
+	/* Make sure no stale byte or event starts the channels early.
+	** The cast makes the discarded value a read of the register.
+	*/
+	(void)(uint32_t)pspi->sxBuf.reg;
+	pregIfs->clr = bitRx + bitTx;
+
+	pdchRcv->dchCon.set = (1 << _DCHCON_CHEN);
+	pdchSnd->dchCon.set = (1 << _DCHCON_CHEN);
+
+	/* The transmit buffer is already empty, so force the first byte.
+	** The following ones are triggered by the transmit events.
+	*/
+	pdchSnd->dchEcon.set = (1 << _DCHECON_CFORCE);
+#endif
+
+}
+
+/* ------------------------------------------------------------ */
+/***	DSPI::isDmaBusy
+**
+**	Parameters:
+**		none
+**
+**	Return Value:
+**		returns nonzero while a DMA transfer is in progress
+**
+**	Errors:
+**		none
+**
+**	Description:
+**		Checks the state of the current DMA transfer. This must
+**		be called until it returns 0, as it also starts the next
+**		block of transfers longer than _DSPI_DMA_BLOCK.
+*/
+
+int
+DSPI::isDmaBusy() {
+
+#if (_DSPI_DMA_SUPPORT != 0)
+	if (fDmaAct == 0) {
+		return 0;
+	}
+
+	if ((pdchRcv->dchInt.reg & (1 << _DCHINT_CHBCIF)) == 0) {
+		return 1;
+	}
+
+	if (cbDmaCur > 0) {
+		dmaStartBlock();
+		return 1;
+	}
+
+	pdchRcv->dchCon.clr = (1 << _DCHCON_CHEN);
+	pdchSnd->dchCon.clr = (1 << _DCHCON_CHEN);
+	fDmaAct = 0;
+#endif
+
+	return 0;
+
+}
+
+/* ------------------------------------------------------------ */
+/***	DSPI::dmaCount
+**
+**	Parameters:
+**		none
+**
+**	Return Value:
+**		returns the number of bytes of the current DMA transfer
+**		that are already in the receive buffer
+**
+**	Errors:
+**		none
+**
+**	Description:
+**		Lets the caller work on the received bytes while the
+**		transfer goes on. Only valid while isDmaBusy returns
+**		nonzero. The count is never more than what is stored:
+**		if a block ends while it is read, the bytes of that
+**		block are counted on the next call.
+*/
+
+uint16_t
+DSPI::dmaCount() {
+
+#if (_DSPI_DMA_SUPPORT != 0)
+	uint16_t	cb;
+
+	cb = pbDmaCur - pbDmaBuf;
+	if ((pdchRcv->dchInt.reg & (1 << _DCHINT_CHBCIF)) == 0) {
+		cb -= cbDmaBlk;
+		cb += pdchRcv->dchDptr.reg;
+	}
+	return cb;
+#else
+	return 0;
+#endif
+
+}
+
+/* ------------------------------------------------------------ */
+/***	DSPI::cancelDmaTransfer
+**
+**	Parameters:
+**		none
+**
+**	Return Value:
+**		none
+**
+**	Errors:
+**		none
+**
+**	Description:
+**		This will abort a DMA driven transfer. It is still
+**		the caller's responsibility to drive SS high to release
+**		the slave device.
+*/
+
+void
+DSPI::cancelDmaTransfer() {
+
+#if (_DSPI_DMA_SUPPORT != 0)
+	if (fDmaAct != 0) {
+		pdchSnd->dchEcon.set = (1 << _DCHECON_CABORT);
+		pdchRcv->dchEcon.set = (1 << _DCHECON_CABORT);
+		pdchSnd->dchCon.clr = (1 << _DCHCON_CHEN);
+		pdchRcv->dchCon.clr = (1 << _DCHCON_CHEN);
+
+		/* A byte may still be in the transmit buffer or the shift
+		** register. Drop what is received until the bus is idle, so
+		** the last byte neither overruns the receive buffer nor is
+		** returned by the next transfer.
+		*/
+		while ((pspi->sxStat.reg & ((1 << _SPISTAT_SPIBUSY) | (1 << _SPISTAT_SPIRBF))) != 0) {
+			(void)(uint32_t)pspi->sxBuf.reg;
+		}
+		pregIfs->clr = bitRx + bitTx;
+	}
+
+	cbDmaCur = 0;
+	fDmaAct = 0;
+#endif
+
+}
+
 /* ------------------------------------------------------------ */
 /***	DSPI::doDspiInterrupt
 **
@@ -53,6 +53,69 @@
 
 #define	_DSPI_SPD_DEFAULT	1000000L
 
+/* DMA driven transfers are only available on parts with a DMA controller.
+** On other parts dmaTransfer() falls back to a blocking transfer.
+*/
+#if defined(_DMAC0_BASE_ADDRESS)
+#define	_DSPI_DMA_SUPPORT	1
+#else
+#define	_DSPI_DMA_SUPPORT	0
+#endif
+
+#define	_DSPI_DMA_CH_RCV	0		// default DMA channel for received bytes
+#define	_DSPI_DMA_CH_SND	1		// default DMA channel for sent bytes
+#define	_DSPI_DMA_BLOCK		256		// largest block size that fits all DMA size registers
+
+/* Bits used by the bulk and DMA transfer functions, in case the board
+** definitions don't have them.
+*/
+#if !defined(_SPICON_ENHBUF)
+#define	_SPICON_ENHBUF		16
+#endif
+#if !defined(_SPICON_MODE32)
+#define	_SPICON_MODE32		11
+#endif
+#if !defined(_SPISTAT_SPIRBE)
+#define	_SPISTAT_SPIRBE		5
+#endif
+#if !defined(_SPISTAT_SPITBF)
+#define	_SPISTAT_SPITBF		1
+#endif
+#if !defined(_SPISTAT_SPIBUSY)
+#define	_SPISTAT_SPIBUSY	11
+#endif
+
+/* The enhanced buffer (FIFO) is not available on all parts. It holds
+** four 32 bit words. Without it, only one word may be on the way.
+*/
+#if defined(_SPI1CON_ENHBUF_POSITION) || defined(_SPI2CON_ENHBUF_POSITION)
+#define	_DSPI_FIFO_SUPPORT	1
+#define	_DSPI_FIFO_DEPTH	4
+#define	_DSPI_RCV_READY(stat)	(((stat) & (1 << _SPISTAT_SPIRBE)) == 0)
+#else
+#define	_DSPI_FIFO_SUPPORT	0
+#define	_DSPI_FIFO_DEPTH	1
+#define	_DSPI_RCV_READY(stat)	(((stat) & (1 << _SPISTAT_SPIRBF)) != 0)
+#endif
+
+/* Register layout of one DMA channel. Each register has its own
+** CLR, SET and INV register, like in p32_regset.
+*/
+typedef struct {
+	p32_regset	dchCon;
+	p32_regset	dchEcon;
+	p32_regset	dchInt;
+	p32_regset	dchSsa;
+	p32_regset	dchDsa;
+	p32_regset	dchSsiz;
+	p32_regset	dchDsiz;
+	p32_regset	dchSptr;
+	p32_regset	dchDptr;
+	p32_regset	dchCsiz;
+	p32_regset	dchCptr;
+	p32_regset	dchDat;
+} p32_dch;
+
 /* ------------------------------------------------------------ */
 /*					Variable Declarations						*/
 /* ------------------------------------------------------------ */
@@ -96,8 +159,20 @@ private:
 	volatile uint16_t	cbCur;		//count of bytes left to transfer
 	uint8_t				bPad;		//pad byte for some transfers
 	uint8_t				fRov;		//receive overflow error flag
+	uint8_t				irqRcv;		//receive interrupt number, used as DMA trigger
+	uint8_t				irqSnd;		//transmit interrupt number, used as DMA trigger
+	p32_dch *			pdchRcv;	//DMA channel moving received bytes to memory
+	p32_dch *			pdchSnd;	//DMA channel feeding the transmit buffer
+	uint8_t *			pbDmaBuf;	//start of the current DMA transfer
+	uint8_t *			pbDmaCur;	//start of next DMA block
+	uint16_t			cbDmaCur;	//count of bytes not yet started by DMA
+	uint16_t			cbDmaBlk;	//size of the DMA block in progress
+	uint8_t				fDmaAct;	//DMA transfer in progress flag
 
 	void	doDspiInterrupt();
+	void	dmaStartBlock();
+	void	bulkBegin();
+	void	bulkEnd();
 
 protected:
 	p32_spi *			pspi;		//pointer to the SPI object
@@ -126,6 +201,8 @@ uint8_t		transfer(uint8_t bVal);
 void		transfer(uint16_t cbReq, uint8_t * pbSnd, uint8_t * pbRcv);
 void		transfer(uint16_t cbReq, uint8_t * pbSnd);
 void		transfer(uint16_t cbReq, uint8_t bPad, uint8_t * pbRcv);
+void		transferBulk(uint16_t cbReq, uint8_t bPadT, uint8_t * pbRcv);
+void		transferBulk(uint16_t cbReq, uint8_t * pbSnd);
 
 /* Interrupt control and interrupt driven I/O functions
 */
@@ -138,6 +215,14 @@ void		cancelIntTransfer();
 uint16_t	transCount() { return cbCur; };
 int			isOverflow() { return fRov; };
 void		clearOverflow() { fRov = 0; };
+
+/* DMA driven I/O functions
+*/
+void		setDmaChannels(uint8_t chRcv, uint8_t chSnd);
+void		dmaTransfer(uint16_t cbReq, uint8_t bPadT, uint8_t * pbRcv);
+int			isDmaBusy();
+uint16_t	dmaCount();
+void		cancelDmaTransfer();
 };
 
 /* Object class for DSPI port 0
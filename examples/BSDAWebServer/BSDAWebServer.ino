@@ -9,6 +9,12 @@
   Don't use stereo on non-mega Arduinos as a pin collision between
   Eth-CS and second audio output will occur (both pin 10)!
   
+  SD card and Ethernet share the SPI bus here, so leave
+  BSDA_WORKER_NONBLOCKING at its default of 0 (see BasicSDAudio.h).
+  
+  The file list is sent in pages of PAGE_ENTRIES files, read in small
+  steps with dirNext(), so a playing file goes on while it is sent.
+  
   created  01 Jul 2012 by Lutz Lisseck, 
   with help from Ladyada SD webserver example.
   
@@ -99,6 +105,8 @@ void dir_callback(char *buf) {
 
 // How big our line buffer should be. 100 is plenty!
 #define BUFSIZ 100
+// Files listed per page
+#define PAGE_ENTRIES 20
 boolean playflag = false;
 
 void loop() {
@@ -137,18 +145,39 @@ void loop() {
         Serial.println(clientline);
         
         // Look for substring such as a request to get the root file
-        if (strstr(clientline, "GET / ") != 0) {
+        // or a page of the file list (GET /?p=2)
+        if ((strstr(clientline, "GET / ") != 0) || (strstr(clientline, "GET /?p=") != 0)) {
+          int page = 0;
+          uint16_t count;
+          char *p = strstr(clientline, "GET /?p=");
+          if (p) page = atoi(p + 8);
+          
           // send a standard http response header
           client.println(F("HTTP/1.1 200 OK"));
           client.println(F("Content-Type: text/html"));
           client.println();
           
-          // print all the files, use a helper to keep it clean
+          // print the files of this page, use a helper to keep it clean
           client.println(F("<a href=\"http://www.hackerspace-ffm.de/wiki/index.php?title=SimpleSDAudio\">SimpleSDAudio</a> V" BSDA_VERSIONSTRING " Webinterface, Free RAM: "));
           client.println(freeRam());
           client.println(F("<br /><h2>Pick file to play:</h2><ul>"));
-          SdPlay.dir(&dir_callback);
+          count = 0;
+          if (SdPlay.dirOpen(NULL)) {
+            SdPlay.dirNext(NULL, page * PAGE_ENTRIES);    // skip earlier pages
+            count = SdPlay.dirNext(&dir_callback, PAGE_ENTRIES);
+            SdPlay.dirClose();
+          }
           client.println(F("</ul>"));
+          if (page > 0) {
+            client.print(F("<a href=\"/?p="));
+            client.print(page - 1);
+            client.println(F("\">previous</a> "));
+          }
+          if (count == PAGE_ENTRIES) {
+            client.print(F("<a href=\"/?p="));
+            client.print(page + 1);
+            client.println(F("\">next</a>"));
+          }
           
         } else if (strstr(clientline, "GET /") != 0) {
           // this time no space after the /, so a sub-file!
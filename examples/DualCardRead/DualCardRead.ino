@@ -0,0 +1,92 @@
+/*
+ Reads two SD cards on two SPI ports in parallel and reports the 
+ combined read rate via terminal at serial communication port.
+ 
+ Card A is at the default port (DSPI0) with the default CS pin, card B
+ at DSPI1. Both transfers run in background (DMA where available), so 
+ the blocks of both cards are received at the same time. Striping one
+ stream over both cards doubles the read bandwidth this way.
+ 
+ Only the card layer (SD_L1_*) is used, the file system and SdPlay
+ work on the card selected by default (SD_L1_card0).
+ 
+ See BasicSDAudio.h or our website for more information:
+ http://www.hackerspace-ffm.de/wiki/index.php?title=SimpleSDAudio
+ */
+#include <BasicSDAudio.h>
+
+// Chip select pin of card B, adapt this to your wiring
+#define CARD_B_CS_PIN 3
+
+// Number of blocks read from each card
+#define BLOCKS 2048UL
+
+// Card B gets its own port with its own DMA channels
+DSPI1        spiB;
+SD_L0_Port_t portB = { &spiB, 2, 3, CARD_B_CS_PIN };
+SD_L1_Card_t cardB;
+
+uint8_t bufA[512];
+uint8_t bufB[512];
+
+void setup()
+{
+  uint8_t  retA, retB;
+  uint32_t t0;
+  uint32_t blockA = 0, blockB = 0;
+  boolean  busyA = false, busyB = false;
+  
+  Serial.begin(9600);
+  
+  // Card A: default card and port
+  SD_L1_SelectCard(&SD_L1_card0);
+  retA = SD_L1_Init();
+  // Card B
+  SD_L1_CardSetup(&cardB, &portB);
+  SD_L1_SelectCard(&cardB);
+  retB = SD_L1_Init();
+  if(retA || retB) {
+    Serial.print("Init failed, error codes: ");
+    Serial.print(retA);
+    Serial.print(" ");
+    Serial.println(retB);
+    while(1);
+  }
+  
+  t0 = micros();
+  while((blockA < BLOCKS) || (blockB < BLOCKS) || busyA || busyB) {
+    // Card A
+    SD_L1_SelectCard(&SD_L1_card0);
+    if(busyA) {
+      retA = SD_L1_ReadPoll();
+      if(retA != SD_CARD_READ_PENDING) busyA = false;
+    } else if(blockA < BLOCKS) {
+      retA = SD_L1_ReadBlockAsync(blockA++, bufA);
+      busyA = (retA == 0);
+    }
+    // Card B
+    SD_L1_SelectCard(&cardB);
+    if(busyB) {
+      retB = SD_L1_ReadPoll();
+      if(retB != SD_CARD_READ_PENDING) busyB = false;
+    } else if(blockB < BLOCKS) {
+      retB = SD_L1_ReadBlockAsync(blockB++, bufB);
+      busyB = (retB == 0);
+    }
+    if((retA && (retA != SD_CARD_READ_PENDING)) || (retB && (retB != SD_CARD_READ_PENDING))) {
+      Serial.print("Read failed, error codes: ");
+      Serial.print(retA);
+      Serial.print(" ");
+      Serial.println(retB);
+      while(1);
+    }
+  }
+  t0 = micros() - t0;
+  
+  Serial.print("Combined read rate [kB/s]: ");
+  Serial.println(BLOCKS * 1000UL / (t0 / 1000UL));
+}
+
+
+void loop(void) {
+}
@@ -0,0 +1,176 @@
+/*
+ SD card read benchmark, compares the read strategies of the library
+ and prints MB/s, sectors/s and the per-sector latency (50th, 90th and
+ 99th percentile and maximum) via terminal at serial communication port:
+
+ - single:  one CMD17 per sector (SD_L2_dev->ReadBlock)
+ - multi:   one CMD18 run over all sectors
+ - cluster: one CMD18 run per cluster
+ - worker:  playback of the file with SdPlay.worker(), reports the
+            card read rate and the longest worker() call
+
+ Reads file BENCH.BIN in root folder of SD card, e.g. written by the
+ WriteBenchmark example before. The file must not be fragmented.
+ The same strategies run on a PC with tools/hostbench/readbench.cpp.
+
+ See BasicSDAudio.h or our website for more information:
+ http://www.hackerspace-ffm.de/wiki/index.php?title=SimpleSDAudio
+ */
+#include <BasicSDAudio.h>
+
+#define BENCH_FILE "BENCH.BIN"
+
+// Number of sectors read by each strategy
+#define BENCH_SECTORS 512
+
+// Playback time for the worker strategy in ms
+#define BENCH_PLAY_MS 5000
+
+// Work buffer for SdPlay / file system
+#define BIGBUFSIZE (4*512)
+uint8_t bigbuf[BIGBUFSIZE];
+
+uint8_t  databuf[512];
+uint16_t latency[BENCH_SECTORS];
+
+SD_L2_File_t fileinfo;
+uint32_t firstSector;
+uint16_t sectors;
+
+int compareU16(const void *a, const void *b) {
+  uint16_t x = *(const uint16_t *)a, y = *(const uint16_t *)b;
+  return (x > y) - (x < y);
+}
+
+uint8_t poll() {
+  uint8_t ret;
+  while((ret = SD_L2_dev->ReadPoll()) == SD_CARD_READ_PENDING) ;
+  return ret;
+}
+
+uint8_t benchSingle() {
+  for(uint16_t i = 0; i < sectors; i++) {
+    uint32_t t = micros();
+    uint8_t ret = SD_L2_dev->ReadBlock(firstSector + i, databuf);
+    if(ret) return ret;
+    latency[i] = micros() - t;
+  }
+  return 0;
+}
+
+uint8_t benchRun(uint16_t runLength) {
+  uint8_t ret;
+  for(uint16_t i = 0; i < sectors; i++) {
+    uint32_t t = micros();
+    if((i % runLength) == 0) {
+      if(i) {
+        ret = SD_L2_dev->ReadRunStop();
+        if(ret) return ret;
+      }
+      ret = SD_L2_dev->ReadRunStart(firstSector + i);
+      if(ret) return ret;
+    }
+    ret = SD_L2_dev->ReadRunAsync(databuf);
+    if(!ret) ret = poll();
+    if(ret) return ret;
+    latency[i] = micros() - t;
+  }
+  return SD_L2_dev->ReadRunStop();
+}
+
+void report(const char *name, uint8_t ret, uint32_t us) {
+  Serial.print(name);
+  if(ret) {
+    Serial.print(" error code: ");
+    Serial.println(ret);
+    return;
+  }
+  qsort(latency, sectors, sizeof(latency[0]), compareU16);
+  Serial.print(" kB/s: ");
+  Serial.print((uint32_t)sectors * 512UL * 1000UL / 1024UL / (us / 1000UL + 1));
+  Serial.print(" sectors/s: ");
+  Serial.print((uint32_t)sectors * 1000UL / (us / 1000UL + 1));
+  Serial.print(" latency us p50: ");
+  Serial.print(latency[sectors / 2]);
+  Serial.print(" p90: ");
+  Serial.print(latency[sectors * 9UL / 10]);
+  Serial.print(" p99: ");
+  Serial.print(latency[sectors * 99UL / 100]);
+  Serial.print(" max: ");
+  Serial.println(latency[sectors - 1]);
+}
+
+void setup()
+{
+  uint8_t  ret;
+  uint32_t t0, t, tmax = 0;
+
+  Serial.begin(9600);
+
+  SdPlay.setWorkBuffer(bigbuf, BIGBUFSIZE);
+
+  // If your SD card CS-Pin is not at Pin 4, enable and adapt the following line:
+  //SdPlay.setSDCSPin(10);
+
+  if (!SdPlay.init(BSDA_MODE_FULLRATE | BSDA_MODE_MONO)) {
+    Serial.print("Init failed, error code: ");
+    Serial.println(SdPlay.getLastError());
+    while(1);
+  }
+  Serial.print("SPI clock [Hz]: ");
+  Serial.println(SD_L1_GetSpeed());
+
+  ret = SD_L2_SearchFile((uint8_t *)BENCH_FILE, 0, 0x00, 0x18, &fileinfo);
+  if(!ret) ret = SD_L2_IsFileFragmented(&fileinfo);
+  if(ret) {
+    Serial.print(BENCH_FILE " not usable, error code: ");
+    Serial.println(ret);
+    while(1);
+  }
+  firstSector = SD_L2_Cluster2Sector(fileinfo.FirstCluster);
+  sectors = (fileinfo.Size / 512 < BENCH_SECTORS) ? fileinfo.Size / 512 : BENCH_SECTORS;
+  if(sectors == 0) {
+    Serial.println(BENCH_FILE " too small");
+    while(1);
+  }
+
+  t0 = micros();
+  ret = benchSingle();
+  report("single", ret, micros() - t0);
+
+  t0 = micros();
+  ret = benchRun(sectors);
+  report("multi", ret, micros() - t0);
+
+  t0 = micros();
+  ret = benchRun(SD_L2_FAT.SecPerClus);
+  report("cluster", ret, micros() - t0);
+
+  // worker: playback limits the rate, getSectorRate() tells what the card could do
+  if(!SdPlay.setFile((char *)BENCH_FILE)) {
+    Serial.print("setFile failed, error code: ");
+    Serial.println(SdPlay.getLastError());
+    while(1);
+  }
+  SdPlay.play();
+  t0 = millis();
+  while(!SdPlay.isStopped() && (millis() - t0 < BENCH_PLAY_MS)) {
+    t = micros();
+    SdPlay.worker();
+    t = micros() - t;
+    if(t > tmax) tmax = t;
+  }
+  SdPlay.stop();
+  Serial.print("worker sectors/s: ");
+  Serial.print(SdPlay.getSectorRate());
+  Serial.print(" kB/s: ");
+  Serial.print(SdPlay.getSectorRate() / 2);
+  Serial.print(" longest worker() call us: ");
+  Serial.print(tmax);
+  Serial.print(" error code: ");
+  Serial.println(SdPlay.getLastError());
+}
+
+
+void loop(void) {
+}
@@ -0,0 +1,83 @@
+/*
+ Records 10 seconds from analog pin A0 to file RECORD.AFM and reports
+ whether the card kept up, plus the maximum sustainable sample rate
+ via terminal at serial communication port.
+ 
+ Samples are 8 bit mono at the playback sample rate, so the recording
+ can be played back by SdPlay right away.
+ 
+ Max. sustainable sample rate is the card write rate (sectors/s while
+ writing) * 512. The longest card busy time tells the buffer needed:
+ buffer bytes > sample rate * longest busy time.
+ 
+ Needs SD_ENABLE_WRITE_ACCESS and SD_ENABLE_MULTIBLOCK_ACCESS 
+ set to 1 in sd_l1.h.
+ 
+ See BasicSDAudio.h or our website for more information:
+ http://www.hackerspace-ffm.de/wiki/index.php?title=SimpleSDAudio
+ */
+#include <BasicSDAudio.h>
+
+// Timer 2 runs at PBCLK / 4 / 256
+#define SAMPLE_RATE (F_CPU / 4UL / 256UL)
+#define RECORD_SECONDS 10UL
+
+// Work buffer, also holds the samples until they are written
+#define BIGBUFSIZE (8*512)
+uint8_t bigbuf[BIGBUFSIZE];
+
+void setup()
+{
+  uint32_t rate;
+  
+  Serial.begin(9600);
+  
+  SdPlay.setWorkBuffer(bigbuf, BIGBUFSIZE); 
+  
+  // If your SD card CS-Pin is not at Pin 4, enable and adapt the following line:
+  //SdPlay.setSDCSPin(10);
+  
+  if (!SdPlay.init(BSDA_MODE_FULLRATE | BSDA_MODE_MONO)) {
+    Serial.print("Init failed, error code: ");
+    Serial.println(SdPlay.getLastError());
+    while(1);
+  }
+  
+  if(!SdPlay.setRecordFile("RECORD.AFM", SAMPLE_RATE * RECORD_SECONDS)) {
+    Serial.print("Can't create file, error code: ");
+    Serial.println(SdPlay.getLastError());
+    while(1);
+  }
+  
+  SD_L1_ResetMaxBusyTime();
+  if(!SdPlay.record(A0)) {
+    Serial.print("Can't record, error code: ");
+    Serial.println(SdPlay.getLastError());
+    while(1);
+  }
+  
+  Serial.println("Recording...");
+  while(SdPlay.isRecording()) {
+    SdPlay.worker();
+  }
+  rate = SdPlay.getSectorRate();
+  
+  Serial.print("Error code: ");
+  Serial.println(SdPlay.getLastError());
+  Serial.print("Sample rate [Hz]: ");
+  Serial.println(SAMPLE_RATE);
+  Serial.print("Overrun occured: ");
+  Serial.println(SdPlay.isOverrunOccured() ? "yes" : "no");
+  Serial.print("Card write rate [sectors/s]: ");
+  Serial.println(rate);
+  Serial.print("Max. sustainable sample rate [Hz]: ");
+  Serial.println(rate * 512UL);
+  Serial.print("Longest card busy time [us]: ");
+  Serial.println(SD_L1_GetMaxBusyTime());
+  Serial.print("Buffer needed [bytes]: ");
+  Serial.println(SD_L1_GetMaxBusyTime() * (SAMPLE_RATE / 1000UL) / 1000UL + 512UL);
+}
+
+
+void loop(void) {
+}
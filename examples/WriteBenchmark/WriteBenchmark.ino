@@ -0,0 +1,97 @@
+/*
+ SD card write benchmark, measures sustained write throughput and 
+ the worst-case busy time of the card via terminal at serial 
+ communication port.
+ 
+ Creates (or rewrites) file BENCH.BIN in root folder of SD card, 
+ preallocated as one contiguous cluster run and written by a 
+ pre-erased multiple block write.
+ 
+ The longest busy time tells how much data has to be buffered
+ while capturing: buffer bytes > data rate * longest busy time.
+ 
+ Needs SD_ENABLE_WRITE_ACCESS and SD_ENABLE_MULTIBLOCK_ACCESS 
+ set to 1 in sd_l1.h.
+ 
+ See BasicSDAudio.h or our website for more information:
+ http://www.hackerspace-ffm.de/wiki/index.php?title=SimpleSDAudio
+ */
+#include <BasicSDAudio.h>
+
+// File size in sectors of 512 bytes
+#define BENCH_SECTORS 2048UL
+
+// Work buffer for SdPlay / file system
+#define BIGBUFSIZE (2*512)
+uint8_t bigbuf[BIGBUFSIZE];
+
+// Data to be written
+uint8_t databuf[512];
+
+SD_L2_File_t fileinfo;
+
+void setup()
+{
+  uint8_t  ret;
+  uint32_t t0, t, tmax = 0;
+  
+  Serial.begin(9600);
+  
+  SdPlay.setWorkBuffer(bigbuf, BIGBUFSIZE); 
+  
+  // If your SD card CS-Pin is not at Pin 4, enable and adapt the following line:
+  //SdPlay.setSDCSPin(10);
+  
+  if (!SdPlay.init(BSDA_MODE_FULLRATE | BSDA_MODE_MONO)) {
+    Serial.print("Init failed, error code: ");
+    Serial.println(SdPlay.getLastError());
+    while(1);
+  }
+  Serial.print("SPI clock [Hz]: ");
+  Serial.println(SD_L1_GetSpeed());
+  
+  // Create file or rewrite it if it exists already
+  ret = SD_L2_CreateFile((uint8_t *)"BENCH.BIN", 0, BENCH_SECTORS * 512, &fileinfo);
+  if(ret == SD_L2_ERROR_FILE_EXISTS) {
+    ret = SD_L2_SearchFile((uint8_t *)"BENCH.BIN", 0, 0x00, 0x18, &fileinfo);
+  }
+  if(!ret) ret = SD_L2_WriteOpen(&fileinfo);
+  if(ret) {
+    Serial.print("Open failed, error code: ");
+    Serial.println(ret);
+    while(1);
+  }
+  
+  for(uint16_t i = 0; i < 512; i++) databuf[i] = i;
+  
+  SD_L1_ResetMaxBusyTime();
+  t0 = micros();
+  for(uint32_t i = 0; i < BENCH_SECTORS; i++) {
+    t = micros();
+    ret = SD_L2_WriteSector(&fileinfo, databuf);
+    if(ret) break;
+    t = micros() - t;
+    if(t > tmax) tmax = t;
+  }
+  if(!ret) ret = SD_L2_WriteClose(&fileinfo, fileinfo.ActBytePos);
+  t0 = micros() - t0;
+  
+  if(ret) {
+    Serial.print("Write failed, error code: ");
+    Serial.println(ret);
+    while(1);
+  }
+  
+  Serial.print("Written [bytes]: ");
+  Serial.println(fileinfo.Size);
+  Serial.print("Throughput [kB/s]: ");
+  Serial.println((fileinfo.Size / 1024UL) * 1000UL / (t0 / 1000UL));
+  Serial.print("Longest sector write [us]: ");
+  Serial.println(tmax);
+  Serial.print("Longest card busy time [us]: ");
+  Serial.println(SD_L1_GetMaxBusyTime());
+}
+
+
+void loop(void) {
+}
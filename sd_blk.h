@@ -0,0 +1,53 @@
+#ifndef SD_BLK_H
+#define SD_BLK_H
+
+#include <stdint.h>
+
+/**
+ * Block device the file system (SD_L2_*) and SdPlay work on.
+ *
+ * The SD card itself is SD_L1_BlkDev, the host backend over an
+ * image file (SD_BLK_FileDev) allows to run and measure the upper
+ * layers without hardware. All functions return zero if successful,
+ * an SD_CARD_ERROR_* code otherwise. Functions not supported by a
+ * device are NULL.
+ */
+typedef struct {
+    /** Initialize the device, pWorkBuf (512 bytes) may be used for tests */
+    uint8_t     (*Init)(uint8_t *pWorkBuf);
+    void        (*DeInit)();
+
+    // read single 512 byte blocks
+    uint8_t     (*ReadBlock)(uint32_t block, uint8_t *dst);
+    /** Start reading a block in background, poll ReadPoll until done */
+    uint8_t     (*ReadBlockAsync)(uint32_t block, uint8_t *dst);
+
+    // read runs of consecutive blocks
+    uint8_t     (*ReadRunStart)(uint32_t block);
+    /** Start reading the next block of the run in background */
+    uint8_t     (*ReadRunAsync)(uint8_t *dst);
+    uint8_t     (*ReadRunStop)();
+
+    /** Returns SD_CARD_READ_PENDING until a background read is done */
+    uint8_t     (*ReadPoll)();
+    /** Try to get over read errors (e.g. lower the SPI clock), nonzero if a retry makes sense */
+    uint8_t     (*Recover)();
+
+    // write single blocks and runs of consecutive blocks
+    uint8_t     (*WriteBlock)(uint32_t block, const uint8_t *src);
+    uint8_t     (*WriteRunStart)(uint32_t block, uint32_t count);
+    uint8_t     (*WriteRun)(const uint8_t *src);
+    uint8_t     (*WriteRunStop)();
+} SD_BLK_Dev_t;
+
+#if !defined(ARDUINO)
+// host backend over a raw image file (e.g. dd of a card or mkfs.vfat -C)
+// ***************************************
+extern const SD_BLK_Dev_t SD_BLK_FileDev;
+
+uint8_t     SD_BLK_FileOpen(const char *path);
+void        SD_BLK_FileClose();
+void        SD_BLK_FileSetLatency(uint32_t commandUs, uint32_t blockUs);
+#endif /* !ARDUINO */
+
+#endif
@@ -0,0 +1,263 @@
+/*
+ * Block device backend over a raw image file for host builds.
+ *
+ * Lets SD_L2 and SdPlay run on a PC, e.g. to measure mount, lookup
+ * and streaming in CI. A card like latency can be configured: every
+ * command costs commandUs, every transferred block blockUs. Reads
+ * started in background finish after that time in ReadPoll.
+ *
+ * Usage:
+ *   SD_BLK_FileOpen("card.img");
+ *   SD_L2_dev = &SD_BLK_FileDev;
+ *   SD_L2_Init(workBuf);
+ */
+#if !defined(ARDUINO)
+
+// fseeko() with a 64 bit off_t, block * 512 overflows a 32 bit long
+#define _FILE_OFFSET_BITS 64
+
+#include "sd_l1.h"
+#include "sd_blk.h"
+
+#include <stdio.h>
+#include <time.h>
+#include <sys/types.h>
+
+// prototypes for internal usage
+uint32_t SD_BLK_FileMicros();
+void     SD_BLK_FileWait(uint32_t until);
+void     SD_BLK_FileFlush();
+uint8_t  SD_BLK_FileRead(uint32_t block, uint8_t *dst);
+uint8_t  SD_BLK_FileWrite(uint32_t block, const uint8_t *src);
+uint8_t  SD_BLK_FileInit(uint8_t *pWorkBuf);
+void     SD_BLK_FileDeInit();
+uint8_t  SD_BLK_FileReadBlock(uint32_t block, uint8_t *dst);
+uint8_t  SD_BLK_FileReadBlockAsync(uint32_t block, uint8_t *dst);
+uint8_t  SD_BLK_FileReadRunStart(uint32_t block);
+uint8_t  SD_BLK_FileReadRunAsync(uint8_t *dst);
+uint8_t  SD_BLK_FileReadRunStop();
+uint8_t  SD_BLK_FileReadPoll();
+uint8_t  SD_BLK_FileRecover();
+uint8_t  SD_BLK_FileWriteBlock(uint32_t block, const uint8_t *src);
+uint8_t  SD_BLK_FileWriteRunStart(uint32_t block, uint32_t count);
+uint8_t  SD_BLK_FileWriteRun(const uint8_t *src);
+uint8_t  SD_BLK_FileWriteRunStop();
+
+FILE     *SD_BLK_file = NULL;
+uint32_t SD_BLK_commandUs = 0;
+uint32_t SD_BLK_blockUs = 0;
+
+uint32_t SD_BLK_runBlock;       // next block of an open read or write run
+uint8_t  SD_BLK_runActive = 0;
+
+// background read
+uint8_t  *SD_BLK_asyncDst = NULL;
+uint32_t SD_BLK_asyncBlock;
+uint32_t SD_BLK_asyncDone;      // time in us the read is finished
+uint8_t  SD_BLK_asyncResult = 0;  // result of a finished read for ReadPoll
+
+const SD_BLK_Dev_t SD_BLK_FileDev = {
+  SD_BLK_FileInit,
+  SD_BLK_FileDeInit,
+  SD_BLK_FileReadBlock,
+  SD_BLK_FileReadBlockAsync,
+  SD_BLK_FileReadRunStart,
+  SD_BLK_FileReadRunAsync,
+  SD_BLK_FileReadRunStop,
+  SD_BLK_FileReadPoll,
+  SD_BLK_FileRecover,
+  SD_BLK_FileWriteBlock,
+  SD_BLK_FileWriteRunStart,
+  SD_BLK_FileWriteRun,
+  SD_BLK_FileWriteRunStop,
+};
+
+/**
+ * Open an image file, it is written as well if writable.
+ *
+ * \return Zero if successful, SD_CARD_ERROR_CMD0 otherwise
+ */
+uint8_t SD_BLK_FileOpen(const char *path)
+{
+  SD_BLK_FileClose();
+  SD_BLK_file = fopen(path, "r+b");
+  if (SD_BLK_file == NULL) SD_BLK_file = fopen(path, "rb");
+  return (SD_BLK_file == NULL) ? SD_CARD_ERROR_CMD0 : 0;
+}
+
+/**
+ * Close the image file.
+ */
+void SD_BLK_FileClose()
+{
+  if (SD_BLK_file) fclose(SD_BLK_file);
+  SD_BLK_file = NULL;
+  SD_BLK_asyncDst = NULL;
+  SD_BLK_runActive = 0;
+}
+
+/**
+ * Set the simulated card latency.
+ *
+ * \param[in] commandUs Time for every command (read, write, run start) in us.
+ * \param[in] blockUs Time for every transferred 512 byte block in us.
+ */
+void SD_BLK_FileSetLatency(uint32_t commandUs, uint32_t blockUs)
+{
+  SD_BLK_commandUs = commandUs;
+  SD_BLK_blockUs = blockUs;
+}
+
+/** Monotonic time in us, wraps like micros() */
+uint32_t SD_BLK_FileMicros()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint32_t)((uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000);
+}
+
+/** Busy wait like the card does, sleeping would be too coarse */
+void SD_BLK_FileWait(uint32_t until)
+{
+  while ((int32_t)(until - SD_BLK_FileMicros()) > 0) ;
+}
+
+uint8_t SD_BLK_FileRead(uint32_t block, uint8_t *dst)
+{
+  if (SD_BLK_file == NULL) return(SD_CARD_ERROR_READ);
+  if (fseeko(SD_BLK_file, (off_t)block << 9, SEEK_SET)) return(SD_CARD_ERROR_READ);
+  if (fread(dst, 1, 512, SD_BLK_file) != 512) return(SD_CARD_ERROR_READ);
+  return 0;
+}
+
+uint8_t SD_BLK_FileWrite(uint32_t block, const uint8_t *src)
+{
+  if (SD_BLK_file == NULL) return(SD_CARD_ERROR_WRITE);
+  if (fseeko(SD_BLK_file, (off_t)block << 9, SEEK_SET)) return(SD_CARD_ERROR_WRITE);
+  if (fwrite(src, 1, 512, SD_BLK_file) != 512) return(SD_CARD_ERROR_WRITE);
+  return 0;
+}
+
+uint8_t SD_BLK_FileInit(uint8_t *pWorkBuf)
+{
+  (void)pWorkBuf;
+  return (SD_BLK_file == NULL) ? SD_CARD_ERROR_CMD0 : 0;
+}
+
+void SD_BLK_FileDeInit()
+{
+  SD_BLK_FileFlush();
+  SD_BLK_runActive = 0;
+  if (SD_BLK_file) fflush(SD_BLK_file);
+}
+
+uint8_t SD_BLK_FileReadBlock(uint32_t block, uint8_t *dst)
+{
+  SD_BLK_FileFlush();
+  SD_BLK_FileWait(SD_BLK_FileMicros() + SD_BLK_commandUs + SD_BLK_blockUs);
+  return SD_BLK_FileRead(block, dst);
+}
+
+uint8_t SD_BLK_FileReadBlockAsync(uint32_t block, uint8_t *dst)
+{
+  SD_BLK_FileFlush();
+  SD_BLK_asyncDst = dst;
+  SD_BLK_asyncBlock = block;
+  SD_BLK_asyncDone = SD_BLK_FileMicros() + SD_BLK_commandUs + SD_BLK_blockUs;
+  return 0;
+}
+
+uint8_t SD_BLK_FileReadRunStart(uint32_t block)
+{
+  SD_BLK_FileFlush();
+  SD_BLK_FileWait(SD_BLK_FileMicros() + SD_BLK_commandUs);
+  SD_BLK_runBlock = block;
+  SD_BLK_runActive = 1;
+  return 0;
+}
+
+uint8_t SD_BLK_FileReadRunAsync(uint8_t *dst)
+{
+  SD_BLK_FileFlush();
+  if (!SD_BLK_runActive) return(SD_CARD_ERROR_CMD18);
+  SD_BLK_asyncDst = dst;
+  SD_BLK_asyncBlock = SD_BLK_runBlock++;
+  SD_BLK_asyncDone = SD_BLK_FileMicros() + SD_BLK_blockUs;
+  return 0;
+}
+
+uint8_t SD_BLK_FileReadRunStop()
+{
+  SD_BLK_FileFlush();
+  SD_BLK_runActive = 0;
+  SD_BLK_FileWait(SD_BLK_FileMicros() + SD_BLK_commandUs);
+  return 0;
+}
+
+/**
+ * Finish a background read, the result is kept for ReadPoll.
+ * Other functions call this first and wait like the card does.
+ */
+void SD_BLK_FileFlush()
+{
+  uint8_t *dst = SD_BLK_asyncDst;
+
+  if (dst == NULL) return;
+  SD_BLK_FileWait(SD_BLK_asyncDone);
+  SD_BLK_asyncDst = NULL;
+  SD_BLK_asyncResult = SD_BLK_FileRead(SD_BLK_asyncBlock, dst);
+}
+
+uint8_t SD_BLK_FileReadPoll()
+{
+  uint8_t ret;
+
+  if ((SD_BLK_asyncDst != NULL) && ((int32_t)(SD_BLK_asyncDone - SD_BLK_FileMicros()) > 0)) {
+    return(SD_CARD_READ_PENDING);
+  }
+  SD_BLK_FileFlush();
+  ret = SD_BLK_asyncResult;
+  SD_BLK_asyncResult = 0;
+  return(ret);
+}
+
+uint8_t SD_BLK_FileRecover()
+{
+  return 0;
+}
+
+uint8_t SD_BLK_FileWriteBlock(uint32_t block, const uint8_t *src)
+{
+  SD_BLK_FileFlush();
+  SD_BLK_FileWait(SD_BLK_FileMicros() + SD_BLK_commandUs + SD_BLK_blockUs);
+  return SD_BLK_FileWrite(block, src);
+}
+
+uint8_t SD_BLK_FileWriteRunStart(uint32_t block, uint32_t count)
+{
+  (void)count;           // nothing to pre-erase
+  SD_BLK_FileFlush();
+  SD_BLK_FileWait(SD_BLK_FileMicros() + SD_BLK_commandUs);
+  SD_BLK_runBlock = block;
+  SD_BLK_runActive = 1;
+  return 0;
+}
+
+uint8_t SD_BLK_FileWriteRun(const uint8_t *src)
+{
+  SD_BLK_FileFlush();
+  if (!SD_BLK_runActive) return(SD_CARD_ERROR_WRITE_MB);
+  SD_BLK_FileWait(SD_BLK_FileMicros() + SD_BLK_blockUs);
+  return SD_BLK_FileWrite(SD_BLK_runBlock++, src);
+}
+
+uint8_t SD_BLK_FileWriteRunStop()
+{
+  SD_BLK_FileFlush();
+  SD_BLK_runActive = 0;
+  SD_BLK_FileWait(SD_BLK_FileMicros() + SD_BLK_commandUs);
+  if (SD_BLK_file) fflush(SD_BLK_file);
+  return 0;
+}
+
+#endif /* !ARDUINO */
@@ -1,3 +1,5 @@
+#if defined(ARDUINO)    /* host builds use sd_l0_emu.cpp */
+
 #if (ARDUINO >= 100)
 #include <Arduino.h>
 #else
@@ -18,10 +20,23 @@
 #include "pins_arduino.h"
 #include "sd_l0.h"
 
-uint8_t SD_L0_CSPin;
-
 DSPI0    spi;
 
+#if defined(__PIC32MX__)
+SD_L0_Port_t SD_L0_port0 = { &spi, _DSPI_DMA_CH_RCV, _DSPI_DMA_CH_SND, SD_L0_CHIP_SELECT_PIN_DEFAULT };
+#else
+SD_L0_Port_t SD_L0_port0 = { SD_L0_CHIP_SELECT_PIN_DEFAULT };
+#endif
+SD_L0_Port_t *SD_L0_port = &SD_L0_port0;
+
+/**
+ * Select the port following SD_L0_* calls work on.
+ */
+void SD_L0_SelectPort(SD_L0_Port_t *port)
+{
+	SD_L0_port = port;
+}
+
 /**
  * Setup pins and SPI for operation with sd-card.
  *
@@ -53,22 +68,26 @@ void SD_L0_Init(void)
    // pinMode(SD_L0_SPI_SCK_PIN, OUTPUT);
    // pinMode(SD_L0_SPI_SS_FORCE_OUTPUT, OUTPUT);
    
-   pinMode(MISO, INPUT);
-   pinMode(SCK, OUTPUT);
-   pinMode(MOSI, OUTPUT);
-   pinMode(SS, OUTPUT);
+   // pins of other ports are taken over by the SPI module
+   if(SD_L0_port == &SD_L0_port0) {
+     pinMode(MISO, INPUT);
+     pinMode(SCK, OUTPUT);
+     pinMode(MOSI, OUTPUT);
+     pinMode(SS, OUTPUT);
   
-   digitalWrite(SCK, LOW);
-   digitalWrite(MOSI, LOW);
-   digitalWrite(SS, HIGH);
+     digitalWrite(SCK, LOW);
+     digitalWrite(MOSI, LOW);
+     digitalWrite(SS, HIGH);
+   }
    
     /* Powering up takes at least 500us for capacitors to charge */
     // not for arduino
 	/* initialize SPI with lowest frequency; max. 400kHz during identification mode of card */
 	
 	#if defined(__PIC32MX__)
-		spi.begin(SD_L0_CSPin);
-		spi.setSpeed(400000); //400kHz SCK
+		SD_L0_port->Spi->begin(SD_L0_CSPin);
+		SD_L0_port->Spi->setDmaChannels(SD_L0_port->DmaChRcv, SD_L0_port->DmaChSnd);
+		SD_L0_port->Spi->setSpeed(400000); //400kHz SCK
 	#else
     SPCR = (0 << SPIE) | /* SPI Interrupt Enable */
            (1 << SPE)  | /* SPI Enable */
@@ -89,7 +108,7 @@ void SD_L0_Init(void)
 void SD_L0_DeInit(void)
 {
 	#if defined(__PIC32MX__)
-		spi.end();
+		SD_L0_port->Spi->end();
 	#else
 	SPCR &= ~(1 << SPE);
 	#endif
@@ -97,11 +116,13 @@ void SD_L0_DeInit(void)
 	/* Setup ports */
 	/* for safe eject */
    pinMode(SD_L0_CSPin, INPUT);
-   pinMode(MISO, INPUT);
-   pinMode(MOSI, INPUT);
-   pinMode(SCK, INPUT);
    digitalWrite(SD_L0_CSPin, HIGH); // Set CS high
-   digitalWrite(SCK, HIGH); 
+   if(SD_L0_port == &SD_L0_port0) {
+     pinMode(MISO, INPUT);
+     pinMode(MOSI, INPUT);
+     pinMode(SCK, INPUT);
+     digitalWrite(SCK, HIGH); 
+   }
 	
 	/* Power down card */
 	// not for arduino
@@ -116,13 +137,41 @@ void SD_L0_DeInit(void)
 void SD_L0_SpiSetHighSpeed(void)
 {
 	#if defined(__PIC32MX__)
-		spi.setSpeed(10000000);	//10MHz SCK
+		SD_L0_SpiSetSpeed(SD_L0_SPI_BASE_SPEED);
 	#else
     SPCR &= ~((1 << SPR1) | (1 << SPR0)); /* Clock Frequency: f_OSC / 4 */
     SPSR |= (1 << SPI2X);         /* Doubled Clock Frequency: f_OSC / 2 */
 	#endif
 }
 
+/**
+ * Set SPI clock to the fastest supported value not above hz.
+ *
+ * \param[in] hz Requested SPI clock in Hz.
+ *
+ * \return The SPI clock that has been set in Hz.
+ */
+uint32_t SD_L0_SpiSetSpeed(uint32_t hz)
+{
+	#if defined(__PIC32MX__)
+		uint32_t brg;
+		
+		// round divider up, so the clock never exceeds hz
+		if(hz == 0) hz = 1;
+		brg = (F_CPU / 2 + hz - 1) / hz;
+		if(brg) brg--;
+		if(brg > 0x1FF) brg = 0x1FF;
+		hz = F_CPU / (2 * (brg + 1));
+		SD_L0_port->Spi->setSpeed(hz);
+		return hz;
+	#else
+	// only f_OSC / 2 is used here
+	SPCR &= ~((1 << SPR1) | (1 << SPR0)); /* Clock Frequency: f_OSC / 4 */
+	SPSR |= (1 << SPI2X);         /* Doubled Clock Frequency: f_OSC / 2 */
+	return F_CPU / 2;
+	#endif
+}
+
 /**
  * Receives a raw byte from the SPI.
  *
@@ -133,7 +182,7 @@ uint8_t SD_L0_SpiRecvByte()
     /* send dummy data for receiving some */
 	#if defined(__PIC32MX__)
 		uint8_t rx;
-		rx = spi.transfer(0xFF);
+		rx = SD_L0_port->Spi->transfer(0xFF);
 		return rx;
 	#else
     SPDR = 0xff;
@@ -153,7 +202,7 @@ uint8_t SD_L0_SpiRecvByte()
 void SD_L0_SpiSendByte(uint8_t b)
 {
 	#if defined(__PIC32MX__)
-		spi.transfer(b);
+		SD_L0_port->Spi->transfer(b);
 	#else
     SPDR = b;
     /* wait for byte to be shifted out */
@@ -170,8 +219,10 @@ void SD_L0_SpiSendByte(uint8_t b)
 //inline __attribute__((always_inline)) 
 void SD_L0_SpiRecvBlock(uint8_t *buf, uint16_t nbyte) 
 {
-  #if defined(__PIC32MX__)
-	spi.transfer(nbyte,0xFF,buf);
+  #if defined(__PIC32MX__) && SD_L0_USE_BULK
+	SD_L0_port->Spi->transferBulk(nbyte,0xFF,buf);
+  #elif defined(__PIC32MX__)
+	SD_L0_port->Spi->transfer(nbyte,0xFF,buf);
   #else
   if (nbyte-- == 0) return;
   SPDR = 0xFF;
@@ -185,6 +236,49 @@ void SD_L0_SpiRecvBlock(uint8_t *buf, uint16_t nbyte)
   #endif
 }
 
+/** 
+ * SPI read data in background
+ *
+ * Starts receiving nbytes in buf. Send 0xff all the time.
+ * Poll SD_L0_SpiIsBusy() until it returns 0 before using the
+ * data or the SPI.
+ */
+void SD_L0_SpiRecvBlockAsync(uint8_t *buf, uint16_t nbyte) 
+{
+  #if defined(__PIC32MX__) && SD_L0_USE_DMA
+	SD_L0_port->Spi->dmaTransfer(nbyte,0xFF,buf);
+  #else
+	SD_L0_SpiRecvBlock(buf, nbyte);
+  #endif
+}
+
+/** 
+ * Tests if a block started by SD_L0_SpiRecvBlockAsync() is still in progress.
+ *
+ * \returns 1 if busy, 0 if done.
+ */
+uint8_t SD_L0_SpiIsBusy(void) 
+{
+  #if defined(__PIC32MX__) && SD_L0_USE_DMA
+	return(SD_L0_port->Spi->isDmaBusy() ? 1 : 0);
+  #else
+	return 0;
+  #endif
+}
+
+/** 
+ * Bytes of a block started by SD_L0_SpiRecvBlockAsync() that are 
+ * already in the buffer, while SD_L0_SpiIsBusy() returns 1.
+ */
+uint16_t SD_L0_SpiRecvCount(void) 
+{
+  #if defined(__PIC32MX__) && SD_L0_USE_DMA
+	return(SD_L0_port->Spi->dmaCount());
+  #else
+	return 0;
+  #endif
+}
+
 /** 
  * SPI send block - only one call so force inline 
  *
@@ -194,8 +288,12 @@ void SD_L0_SpiRecvBlock(uint8_t *buf, uint16_t nbyte)
 void SD_L0_SpiSendBlock(uint8_t token, const uint8_t *buf) //>>was was "const uint8_t *buf" 
 {
   #if defined(__PIC32MX__)
-	spi.transfer(token);
-	spi.transfer(512,(uint8_t*)buf);
+	SD_L0_port->Spi->transfer(token);
+	#if SD_L0_USE_BULK
+	SD_L0_port->Spi->transferBulk(512,(uint8_t*)buf);
+	#else
+	SD_L0_port->Spi->transfer(512,(uint8_t*)buf);
+	#endif
   #else
   SPDR = token;
   for (uint16_t i = 0; i < 512; i += 2) {
@@ -208,3 +306,4 @@ void SD_L0_SpiSendBlock(uint8_t token, const uint8_t *buf) //>>was was "const ui
   #endif
 }
 
+#endif /* ARDUINO */
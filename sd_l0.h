@@ -1,7 +1,11 @@
 #ifndef SD_L0_H
 #define SD_L0_H
 
-#if (ARDUINO >= 100)
+#if !defined(ARDUINO)
+/* Host builds (file backend, emulator, benchmarks) */
+#include <stdint.h>
+#include <stddef.h>
+#elif (ARDUINO >= 100)
 #include <Arduino.h>
 #else
 #include <WProgram.h>
@@ -16,7 +20,7 @@
 #if defined(__PIC32MX__)
 //    #include <p32xxxx.h>    /* this gives all the CPU/hardware definitions */
 //    #include <plib.h>       /* this gives the i/o definitions */
-	
+	#include <DSPI.h>
 #endif
 /**
  * SD Chip Select pin
@@ -53,6 +57,19 @@ uint8_t const SD_L0_CHIP_SELECT_PIN_DEFAULT = 39;
 
 #endif  
 
+#if !defined(ARDUINO)
+/*
+ * Host builds: chip select and time come from the card 
+ * emulator (sd_l0_emu.cpp), time passes with the SPI clocks.
+ */
+#define SD_L0_SetCSLow()	{ SD_L0_EmuSetCS(0); }
+#define SD_L0_SetCSHigh()	{ SD_L0_EmuSetCS(1); }
+#define SD_L0_GetTimestamp()	((uint16_t)(SD_L0_EmuMicros() / 1000))
+#define SD_L0_GetMicros()	SD_L0_EmuMicros()
+#define SD_L0_GetTicks()	SD_L0_EmuMicros()
+#define SD_L0_TICKS_PER_US	1
+
+#else
 /**
  * Set chip-select from sd-card to low.
  * Can be a makro or a function.
@@ -76,6 +93,26 @@ uint8_t const SD_L0_CHIP_SELECT_PIN_DEFAULT = 39;
  */
 #define SD_L0_GetTimestamp()	((uint16_t)millis())
 
+/**
+ * Get timestamp in microseconds, only used for statistics.
+ */
+#define SD_L0_GetMicros()	((uint32_t)micros())
+
+/**
+ * Get a fine grained timestamp, only used for latency histograms.
+ * The PIC32 core timer counts with half the CPU clock and is read
+ * with a single instruction, elsewhere micros() is used.
+ */
+#if defined(__PIC32MX__)
+	#define SD_L0_GetTicks()	((uint32_t)_CP0_GET_COUNT())
+	#define SD_L0_TICKS_PER_US	(F_CPU / 2000000UL)
+#else
+	#define SD_L0_GetTicks()	((uint32_t)micros())
+	#define SD_L0_TICKS_PER_US	1
+#endif
+
+#endif /* !ARDUINO */
+
 /** 
  * Define timeouts for different functions here
  * based on your GetTimestamp value.
@@ -92,15 +129,109 @@ uint8_t const SD_L0_CHIP_SELECT_PIN_DEFAULT = 39;
 /** command timeout typ. 300 ms */
 #define SD_COMMAND_TIMEOUT 300
 
+/**
+ * SPI clock after card initialization, should work with every card.
+ */
+#define SD_L0_SPI_BASE_SPEED 10000000
+
+/**
+ * Upper limit for the SPI clock negotiated by SD_L1_NegotiateSpeed().
+ * 25 MHz is the maximum of SD cards in default speed mode. Lower it 
+ * if long wires or level shifters don't allow fast clocks.
+ */
+#define SD_L0_SPI_MAX_SPEED 25000000
+
+/**
+ * If 1, SD_L0_SpiRecvBlockAsync() lets the DMA controller
+ * receive the block (PIC32 parts with DMA only, others 
+ * receive the block before the function returns).
+ */
+#define SD_L0_USE_DMA 1
+
+/**
+ * If 1, SD_L0_SpiRecvBlock() and SD_L0_SpiSendBlock() move the
+ * data as 32 bit words through the SPI FIFO (PIC32 only).
+ */
+#define SD_L0_USE_BULK 1
+
 void SD_L0_Init(void);
 void SD_L0_DeInit(void);
 void SD_L0_SpiSetHighSpeed(void);
+uint32_t SD_L0_SpiSetSpeed(uint32_t hz);
 uint8_t SD_L0_SpiRecvByte();
 void SD_L0_SpiSendByte(uint8_t b);
 void SD_L0_SpiRecvBlock(uint8_t *buf, uint16_t nbyte);
 void SD_L0_SpiSendBlock(uint8_t token, const uint8_t *buf);
+void SD_L0_SpiRecvBlockAsync(uint8_t *buf, uint16_t nbyte);
+uint8_t SD_L0_SpiIsBusy(void);
+uint16_t SD_L0_SpiRecvCount(void);
 
-extern uint8_t SD_L0_CSPin;
+/**
+ * SPI port a card is connected to. Every port needs its own
+ * DMA channels if cards are read in parallel.
+ */
+typedef struct {
+#if defined(__PIC32MX__)
+	DSPI        *Spi;           // SPI port object, e.g. a DSPI1 instance
+	uint8_t     DmaChRcv;       // DMA channel for received bytes
+	uint8_t     DmaChSnd;       // DMA channel for sent bytes
+#endif
+	uint8_t     CSPin;          // Chip select pin of the card
+} SD_L0_Port_t;
+
+void SD_L0_SelectPort(SD_L0_Port_t *port);
+
+/** Default port (DSPI0), used until SD_L0_SelectPort() is called */
+extern SD_L0_Port_t SD_L0_port0;
+/** Port all SD_L0_* functions work on */
+extern SD_L0_Port_t *SD_L0_port;
+
+/** Chip select pin of the selected port */
+#define SD_L0_CSPin	(SD_L0_port->CSPin)
+
+#if !defined(ARDUINO)
+// SD card emulator for host builds, see sd_l0_emu.cpp
+// ***************************************
+
+/** Behaviour of the emulated card, may be changed at any time */
+typedef struct {
+	uint32_t    TokenUs;        // delay of the data token after CMD17/CMD18
+	uint32_t    RunTokenUs;     // delay of the data token of following CMD18 blocks
+	uint32_t    BusyUs;         // busy time after CMD12 and after every written block
+	uint8_t     TranSpeed;      // TRAN_SPEED of the CSD, 0x32 = 25 MHz
+	uint8_t     InitPolls;      // number of ACMD41 answered with idle state
+} SD_L0_EmuConfig_t;
+
+/** Counters of the emulated card */
+typedef struct {
+	uint32_t    Commands;       // commands received
+	uint32_t    Blocks;         // data blocks sent or written
+	uint32_t    Bytes;          // bytes clocked with CS low
+	uint32_t    CrcErrors;      // command and data CRC errors seen by the card
+} SD_L0_EmuStats_t;
+
+/** data token of the block comes value us later */
+#define SD_L0_EMU_FAULT_TOKEN_DELAY	1
+/** card is busy for value us after the block (write or CMD12) */
+#define SD_L0_EMU_FAULT_BUSY		2
+/** error token value is sent instead of the block */
+#define SD_L0_EMU_FAULT_ERROR_TOKEN	3
+/** CRC of the block is sent wrong */
+#define SD_L0_EMU_FAULT_CRC		4
+/** Number of faults that can be pending at the same time */
+#define SD_L0_EMU_FAULTS		16
+
+extern SD_L0_EmuConfig_t SD_L0_emuConfig;
+extern SD_L0_EmuStats_t SD_L0_emuStats;
+
+uint8_t SD_L0_EmuOpen(const char *path);
+void SD_L0_EmuClose(void);
+uint8_t SD_L0_EmuInject(uint8_t fault, uint32_t block, uint32_t value);
+void SD_L0_EmuClearFaults(void);
+void SD_L0_EmuAdvance(uint32_t us);
+uint32_t SD_L0_EmuMicros(void);
+void SD_L0_EmuSetCS(uint8_t high);
+#endif /* !ARDUINO */
 
 #endif
 
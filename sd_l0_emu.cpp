@@ -0,0 +1,633 @@
+/*
+ * SD card emulator for host builds, replaces sd_l0.cpp.
+ *
+ * Implements the SD_L0_* functions and answers the SPI protocol of
+ * a SDHC card backed by an image file, so the real SD_L1 code runs
+ * unmodified on a PC: CMD0, CMD8, CMD9, CMD12, CMD13, CMD16, CMD17,
+ * CMD18, CMD24, CMD25, CMD55, CMD58, CMD59, ACMD23 and ACMD41 with
+ * command and data CRCs. Time is virtual and passes with every SPI
+ * byte at the selected clock, so timeouts and the command overhead
+ * per sector are measured exactly and independent of the host.
+ *
+ * Latencies can be set in SD_L0_emuConfig, single faults (token delay,
+ * busy period, error token, bad CRC) are injected for a block number
+ * with SD_L0_EmuInject() and removed once they hit.
+ *
+ * Usage:
+ *   SD_L0_EmuOpen("card.img");
+ *   SD_L0_EmuInject(SD_L0_EMU_FAULT_TOKEN_DELAY, 1000, 50000);
+ *   SD_L1_Init();
+ */
+#if !defined(ARDUINO)
+
+// 64 bit file offsets on 32 bit hosts, images may exceed 2 GB
+#define _FILE_OFFSET_BITS 64
+
+#include "sd_l0.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+
+/** Peripheral clock the SPI divider is emulated for */
+#define SD_L0_EMU_PBCLK 80000000UL
+/** CPU time of one SD_L0_SpiIsBusy() call, a few register reads */
+#define SD_L0_EMU_POLL_NS 250
+
+// card states
+/** waiting for commands */
+#define SD_L0_EMU_IDLE      0
+/** sending data blocks of CMD17/CMD18 */
+#define SD_L0_EMU_READ      1
+/** receiving data blocks of CMD24/CMD25 */
+#define SD_L0_EMU_WRITE     2
+
+typedef struct {
+	uint8_t     Fault;          // SD_L0_EMU_FAULT_*, 0 if unused
+	uint32_t    Block;
+	uint32_t    Value;
+} SD_L0_EmuFault_t;
+
+// prototypes for internal usage
+uint8_t  SD_L0_EmuXfer(uint8_t mosi);
+uint8_t  SD_L0_EmuExchange(uint8_t mosi);
+void     SD_L0_EmuDmaRun(void);
+uint8_t  SD_L0_EmuOutput(void);
+void     SD_L0_EmuInput(uint8_t b);
+void     SD_L0_EmuCommand(void);
+void     SD_L0_EmuLoadBlock(void);
+void     SD_L0_EmuReceiveBlock(void);
+void     SD_L0_EmuQueue(const uint8_t *data, uint16_t count, uint32_t delayUs, uint8_t fill);
+uint32_t SD_L0_EmuTakeFault(uint8_t fault, uint32_t block);
+uint8_t  SD_L0_EmuCrc7(const uint8_t *data, uint8_t count);
+uint16_t SD_L0_EmuCrc16(const uint8_t *data, uint16_t count);
+
+SD_L0_Port_t SD_L0_port0 = { SD_L0_CHIP_SELECT_PIN_DEFAULT };
+SD_L0_Port_t *SD_L0_port = &SD_L0_port0;
+
+SD_L0_EmuConfig_t SD_L0_emuConfig = { 100, 5, 500, 0x32, 2 };
+SD_L0_EmuStats_t SD_L0_emuStats;
+
+FILE     *SD_L0_emuFile = NULL;
+uint32_t SD_L0_emuBlocks;
+SD_L0_EmuFault_t SD_L0_emuFaults[SD_L0_EMU_FAULTS];
+
+// bus
+uint64_t SD_L0_emuNs = 0;           // virtual time
+uint32_t SD_L0_emuByteNs = 32000;   // time of one byte at 250 kHz
+uint8_t  SD_L0_emuCS = 1;
+
+// block received in background like by DMA, the bytes arrive as time passes
+uint8_t  *SD_L0_emuDmaBuf;
+uint16_t SD_L0_emuDmaLen = 0;
+uint16_t SD_L0_emuDmaPos = 0;
+uint64_t SD_L0_emuDmaStart;
+
+// card
+uint8_t  SD_L0_emuState = SD_L0_EMU_IDLE;
+uint8_t  SD_L0_emuIdle = 1;         // in idle state until ACMD41 succeeds
+uint8_t  SD_L0_emuAcmd = 0;         // last command was CMD55
+uint8_t  SD_L0_emuCrcOn = 0;
+uint8_t  SD_L0_emuInitPolls;
+uint8_t  SD_L0_emuMulti;            // CMD18/CMD25 running
+uint8_t  SD_L0_emuFirst;            // next block is the first one after the command
+uint32_t SD_L0_emuBlock;            // next block to read or write
+uint8_t  SD_L0_emuCmd[6];
+uint8_t  SD_L0_emuCmdLen = 0;
+uint8_t  SD_L0_emuRx[514];          // received data block and CRC
+uint16_t SD_L0_emuRxLen = 0;
+uint8_t  SD_L0_emuRxActive = 0;
+
+// output queue, sent after outAt, fill byte before
+uint8_t  SD_L0_emuOut[520];
+uint16_t SD_L0_emuOutLen = 0;
+uint16_t SD_L0_emuOutPos = 0;
+uint64_t SD_L0_emuOutAt = 0;
+uint8_t  SD_L0_emuOutFill = 0xFF;
+uint32_t SD_L0_emuBusyUs = 0;       // busy time starting when the queue is sent
+uint64_t SD_L0_emuBusyUntil = 0;
+uint32_t SD_L0_emuOutBlock;         // block number if the queue holds a read block
+uint32_t SD_L0_emuLastBlock;        // last read block sent completely
+
+/**
+ * Open the image file of the card, it is written by CMD24/CMD25 if writable.
+ *
+ * \return Zero if successful, 1 otherwise
+ */
+uint8_t SD_L0_EmuOpen(const char *path)
+{
+	off_t size;
+
+	SD_L0_EmuClose();
+	SD_L0_emuFile = fopen(path, "r+b");
+	if(SD_L0_emuFile == NULL) SD_L0_emuFile = fopen(path, "rb");
+	if(SD_L0_emuFile == NULL) return 1;
+	fseeko(SD_L0_emuFile, 0, SEEK_END);
+	size = ftello(SD_L0_emuFile);
+	SD_L0_emuBlocks = (uint32_t)(size / 512);
+	SD_L0_EmuClearFaults();
+	memset(&SD_L0_emuStats, 0, sizeof(SD_L0_emuStats));
+	return 0;
+}
+
+/**
+ * Close the image file, the card does not answer afterwards.
+ */
+void SD_L0_EmuClose(void)
+{
+	if(SD_L0_emuFile) fclose(SD_L0_emuFile);
+	SD_L0_emuFile = NULL;
+	SD_L0_emuBlocks = 0;
+}
+
+/**
+ * Inject a fault for the next access of a block.
+ *
+ * \param[in] fault SD_L0_EMU_FAULT_*.
+ * \param[in] block Block number the fault hits.
+ * \param[in] value Delay in us or error token, see SD_L0_EMU_FAULT_*.
+ * \return 1 if the fault has been added, 0 if the table is full.
+ */
+uint8_t SD_L0_EmuInject(uint8_t fault, uint32_t block, uint32_t value)
+{
+	for(uint8_t i = 0; i < SD_L0_EMU_FAULTS; i++) {
+		if(SD_L0_emuFaults[i].Fault) continue;
+		SD_L0_emuFaults[i].Fault = fault;
+		SD_L0_emuFaults[i].Block = block;
+		SD_L0_emuFaults[i].Value = value;
+		return 1;
+	}
+	return 0;
+}
+
+/**
+ * Remove all pending faults.
+ */
+void SD_L0_EmuClearFaults(void)
+{
+	memset(SD_L0_emuFaults, 0, sizeof(SD_L0_emuFaults));
+}
+
+/**
+ * Let time pass without SPI traffic, e.g. for the CPU time of the caller.
+ */
+void SD_L0_EmuAdvance(uint32_t us)
+{
+	SD_L0_emuNs += (uint64_t)us * 1000;
+}
+
+/**
+ * Virtual time in microseconds.
+ */
+uint32_t SD_L0_EmuMicros(void)
+{
+	return (uint32_t)(SD_L0_emuNs / 1000);
+}
+
+/**
+ * Chip select line, a partly received command is dropped if it goes high.
+ */
+void SD_L0_EmuSetCS(uint8_t high)
+{
+	SD_L0_emuCS = high;
+	if(high) SD_L0_emuCmdLen = 0;
+}
+
+void SD_L0_SelectPort(SD_L0_Port_t *port)
+{
+	SD_L0_port = port;
+}
+
+void SD_L0_Init(void)
+{
+	SD_L0_EmuSetCS(1);
+	SD_L0_SpiSetSpeed(400000);
+}
+
+void SD_L0_DeInit(void)
+{
+	SD_L0_EmuSetCS(1);
+	if(SD_L0_emuFile) fflush(SD_L0_emuFile);
+}
+
+void SD_L0_SpiSetHighSpeed(void)
+{
+	SD_L0_SpiSetSpeed(SD_L0_SPI_BASE_SPEED);
+}
+
+/**
+ * Same divider steps as the PIC32 SPI: PBCLK / (2 * (brg + 1)).
+ */
+uint32_t SD_L0_SpiSetSpeed(uint32_t hz)
+{
+	uint32_t brg;
+
+	if(hz == 0) hz = 1;
+	brg = (SD_L0_EMU_PBCLK / 2 + hz - 1) / hz;
+	hz = SD_L0_EMU_PBCLK / (2 * brg);
+	SD_L0_emuByteNs = (uint32_t)(8000000000ULL / hz);
+	return hz;
+}
+
+uint8_t SD_L0_SpiRecvByte()
+{
+	return SD_L0_EmuXfer(0xFF);
+}
+
+void SD_L0_SpiSendByte(uint8_t b)
+{
+	SD_L0_EmuXfer(b);
+}
+
+void SD_L0_SpiRecvBlock(uint8_t *buf, uint16_t nbyte)
+{
+	while(nbyte--) *buf++ = SD_L0_EmuXfer(0xFF);
+}
+
+/**
+ * Works like the DMA transfer on the PIC32: the bytes arrive in buf
+ * while virtual time passes, by SD_L0_EmuAdvance() or with every
+ * SD_L0_SpiIsBusy() call.
+ */
+void SD_L0_SpiRecvBlockAsync(uint8_t *buf, uint16_t nbyte)
+{
+	SD_L0_emuDmaBuf = buf;
+	SD_L0_emuDmaLen = nbyte;
+	SD_L0_emuDmaPos = 0;
+	SD_L0_emuDmaStart = SD_L0_emuNs;
+}
+
+uint8_t SD_L0_SpiIsBusy(void)
+{
+	SD_L0_emuNs += SD_L0_EMU_POLL_NS;
+	SD_L0_EmuDmaRun();
+	return (SD_L0_emuDmaPos < SD_L0_emuDmaLen) ? 1 : 0;
+}
+
+uint16_t SD_L0_SpiRecvCount(void)
+{
+	SD_L0_EmuDmaRun();
+	return SD_L0_emuDmaPos;
+}
+
+/**
+ * Receive the bytes of the background transfer that are due by now.
+ */
+void SD_L0_EmuDmaRun(void)
+{
+	uint64_t due = (SD_L0_emuNs - SD_L0_emuDmaStart) / SD_L0_emuByteNs;
+
+	while((SD_L0_emuDmaPos < SD_L0_emuDmaLen) && (SD_L0_emuDmaPos < due)) {
+		SD_L0_emuDmaBuf[SD_L0_emuDmaPos++] = SD_L0_EmuExchange(0xFF);
+	}
+}
+
+void SD_L0_SpiSendBlock(uint8_t token, const uint8_t *buf)
+{
+	SD_L0_EmuXfer(token);
+	for(uint16_t i = 0; i < 512; i++) SD_L0_EmuXfer(buf[i]);
+}
+
+/**
+ * Exchange one byte with the card, the time of one byte passes.
+ */
+uint8_t SD_L0_EmuXfer(uint8_t mosi)
+{
+	SD_L0_emuNs += SD_L0_emuByteNs;
+	return SD_L0_EmuExchange(mosi);
+}
+
+/**
+ * Exchange one byte with the card without time passing.
+ */
+uint8_t SD_L0_EmuExchange(uint8_t mosi)
+{
+	uint8_t miso;
+
+	if(SD_L0_emuCS || (SD_L0_emuFile == NULL)) return 0xFF;
+	SD_L0_emuStats.Bytes++;
+	miso = SD_L0_EmuOutput();
+	SD_L0_EmuInput(mosi);
+	return miso;
+}
+
+/**
+ * Next byte on MISO: queued bytes, busy (0x00) or idle (0xFF).
+ */
+uint8_t SD_L0_EmuOutput(void)
+{
+	if(SD_L0_emuOutPos >= SD_L0_emuOutLen) {
+		if(SD_L0_emuBusyUntil > SD_L0_emuNs) return 0x00;
+		if(SD_L0_emuState != SD_L0_EMU_READ) return 0xFF;
+		SD_L0_EmuLoadBlock();
+	}
+	if(SD_L0_emuOutAt > SD_L0_emuNs) return SD_L0_emuOutFill;
+	if(SD_L0_emuOutPos >= SD_L0_emuOutLen) return 0xFF;
+
+	if(++SD_L0_emuOutPos == SD_L0_emuOutLen) {
+		// card goes busy after the last byte
+		if(SD_L0_emuOutBlock != 0xFFFFFFFFUL) SD_L0_emuLastBlock = SD_L0_emuOutBlock;
+		SD_L0_emuBusyUntil = SD_L0_emuNs + (uint64_t)SD_L0_emuBusyUs * 1000;
+		SD_L0_emuBusyUs = 0;
+	}
+	return SD_L0_emuOut[SD_L0_emuOutPos - 1];
+}
+
+/**
+ * Byte on MOSI: command frames, data blocks of writes.
+ */
+void SD_L0_EmuInput(uint8_t b)
+{
+	if((SD_L0_emuState == SD_L0_EMU_WRITE) && (SD_L0_emuCmdLen == 0)) {
+		if(SD_L0_emuRxActive) {
+			SD_L0_emuRx[SD_L0_emuRxLen++] = b;
+			if(SD_L0_emuRxLen == sizeof(SD_L0_emuRx)) SD_L0_EmuReceiveBlock();
+			return;
+		}
+		if(SD_L0_emuBusyUntil > SD_L0_emuNs) return;
+		if((b == 0xFE) || (SD_L0_emuMulti && (b == 0xFC))) {
+			SD_L0_emuRxActive = 1;
+			SD_L0_emuRxLen = 0;
+			return;
+		}
+		if(SD_L0_emuMulti && (b == 0xFD)) {
+			// stop token
+			SD_L0_emuState = SD_L0_EMU_IDLE;
+			SD_L0_emuBusyUntil = SD_L0_emuNs + (uint64_t)SD_L0_emuConfig.BusyUs * 1000;
+			return;
+		}
+	}
+
+	if((SD_L0_emuCmdLen == 0) && ((b & 0xC0) != 0x40)) return;
+	SD_L0_emuCmd[SD_L0_emuCmdLen++] = b;
+	if(SD_L0_emuCmdLen == 6) {
+		SD_L0_emuCmdLen = 0;
+		SD_L0_EmuCommand();
+	}
+}
+
+/**
+ * Execute a complete command frame.
+ */
+void SD_L0_EmuCommand(void)
+{
+	uint8_t  cmd = SD_L0_emuCmd[0] & 0x3F;
+	uint32_t arg = ((uint32_t)SD_L0_emuCmd[1] << 24) | ((uint32_t)SD_L0_emuCmd[2] << 16)
+	             | ((uint32_t)SD_L0_emuCmd[3] << 8) | SD_L0_emuCmd[4];
+	uint8_t  acmd = SD_L0_emuAcmd;
+	uint8_t  resp[6];
+	uint8_t  len = 1;
+
+	SD_L0_emuStats.Commands++;
+	SD_L0_emuAcmd = 0;
+	resp[0] = SD_L0_emuIdle ? 0x01 : 0x00;
+
+	// drop data of a running read, CMD12 has a stuff byte first
+	SD_L0_emuOutLen = SD_L0_emuOutPos = 0;
+	SD_L0_emuOutAt = 0;
+	if((SD_L0_emuState == SD_L0_EMU_READ) && (cmd == 12)) {
+		SD_L0_emuState = SD_L0_EMU_IDLE;
+		SD_L0_emuBusyUs = SD_L0_emuConfig.BusyUs + SD_L0_EmuTakeFault(SD_L0_EMU_FAULT_BUSY, SD_L0_emuLastBlock);
+		resp[0] = 0xFF;
+		resp[1] = 0x00;
+		SD_L0_EmuQueue(resp, 2, 0, 0xFF);
+		return;
+	}
+	SD_L0_emuState = SD_L0_EMU_IDLE;
+
+	if((SD_L0_emuCrcOn || (cmd == 0) || (cmd == 8)) &&
+	   (SD_L0_EmuCrc7(SD_L0_emuCmd, 5) != SD_L0_emuCmd[5])) {
+		SD_L0_emuStats.CrcErrors++;
+		resp[0] |= 0x08;
+		SD_L0_EmuQueue(resp, 1, 0, 0xFF);
+		return;
+	}
+
+	if(acmd) {
+		switch(cmd) {
+			case 41:
+				if(SD_L0_emuInitPolls) {
+					SD_L0_emuInitPolls--;
+				} else {
+					SD_L0_emuIdle = 0;
+				}
+				resp[0] = SD_L0_emuIdle;
+				break;
+			case 23:
+				break;
+			default:
+				resp[0] |= 0x04;
+				break;
+		}
+		SD_L0_EmuQueue(resp, 1, 0, 0xFF);
+		return;
+	}
+
+	switch(cmd) {
+		case 0:
+			SD_L0_emuIdle = 1;
+			SD_L0_emuCrcOn = 0;
+			SD_L0_emuInitPolls = SD_L0_emuConfig.InitPolls;
+			resp[0] = 0x01;
+			break;
+		case 8:
+			resp[1] = 0;
+			resp[2] = 0;
+			resp[3] = (arg >> 8) & 0x0F;
+			resp[4] = arg & 0xFF;
+			len = 5;
+			break;
+		case 9: {
+			// CSD version 2.0
+			uint32_t csize = (SD_L0_emuBlocks >> 10) - 1;
+			uint8_t  csd[19];
+			uint16_t crc;
+			csd[0] = 0xFE;
+			csd[1] = 0x40; csd[2] = 0x0E; csd[3] = 0x00;
+			csd[4] = SD_L0_emuConfig.TranSpeed;
+			csd[5] = 0x5B; csd[6] = 0x59; csd[7] = 0x00;
+			csd[8] = (csize >> 16) & 0x3F; csd[9] = (csize >> 8) & 0xFF; csd[10] = csize & 0xFF;
+			csd[11] = 0x7F; csd[12] = 0x80; csd[13] = 0x0A; csd[14] = 0x40; csd[15] = 0x00;
+			csd[16] = SD_L0_EmuCrc7(&csd[1], 15);
+			crc = SD_L0_EmuCrc16(&csd[1], 16);
+			csd[17] = crc >> 8;
+			csd[18] = crc & 0xFF;
+			SD_L0_EmuQueue(resp, 1, 0, 0xFF);
+			// token follows right after the response
+			memcpy(&SD_L0_emuOut[1], csd, sizeof(csd));
+			SD_L0_emuOutLen += sizeof(csd);
+			return;
+		}
+		case 12:
+			resp[1] = resp[0];
+			resp[0] = 0xFF;
+			len = 2;
+			break;
+		case 13:
+			resp[1] = 0x00;
+			len = 2;
+			break;
+		case 16:
+			if(arg != 512) resp[0] |= 0x40;
+			break;
+		case 17:
+		case 18:
+		case 24:
+		case 25:
+			if(SD_L0_emuIdle) {
+				resp[0] |= 0x04;
+			} else if(arg >= SD_L0_emuBlocks) {
+				resp[0] |= 0x40;
+			} else {
+				SD_L0_emuBlock = arg;
+				SD_L0_emuMulti = (cmd == 18) || (cmd == 25);
+				SD_L0_emuState = (cmd < 24) ? SD_L0_EMU_READ : SD_L0_EMU_WRITE;
+				SD_L0_emuRxActive = 0;
+				SD_L0_emuFirst = 1;
+			}
+			break;
+		case 55:
+			SD_L0_emuAcmd = 1;
+			break;
+		case 58:
+			// OCR: powered up, CCS (SDHC), 2.7 - 3.6 V
+			resp[1] = 0xC0;
+			resp[2] = 0xFF;
+			resp[3] = 0x80;
+			resp[4] = 0x00;
+			len = 5;
+			break;
+		case 59:
+			SD_L0_emuCrcOn = arg & 1;
+			break;
+		default:
+			resp[0] |= 0x04;
+			break;
+	}
+	SD_L0_EmuQueue(resp, len, 0, 0xFF);
+}
+
+/**
+ * Queue the next block of a read: token after the token delay, data and CRC.
+ */
+void SD_L0_EmuLoadBlock(void)
+{
+	uint32_t block = SD_L0_emuBlock;
+	uint32_t delayUs = SD_L0_emuFirst ? SD_L0_emuConfig.TokenUs : SD_L0_emuConfig.RunTokenUs;
+	uint8_t  token = (uint8_t)SD_L0_EmuTakeFault(SD_L0_EMU_FAULT_ERROR_TOKEN, block);
+	uint16_t crc;
+
+	delayUs += SD_L0_EmuTakeFault(SD_L0_EMU_FAULT_TOKEN_DELAY, block);
+	SD_L0_emuFirst = 0;
+	if(!SD_L0_emuMulti) SD_L0_emuState = SD_L0_EMU_IDLE;
+	if(block >= SD_L0_emuBlocks) token = 0x08;     // out of range
+	if(token) {
+		SD_L0_emuState = SD_L0_EMU_IDLE;
+		SD_L0_EmuQueue(&token, 1, delayUs, 0xFF);
+		return;
+	}
+
+	SD_L0_emuOut[0] = 0xFE;
+	fseeko(SD_L0_emuFile, (off_t)block << 9, SEEK_SET);
+	if(fread(&SD_L0_emuOut[1], 1, 512, SD_L0_emuFile) != 512) memset(&SD_L0_emuOut[1], 0, 512);
+	crc = SD_L0_EmuCrc16(&SD_L0_emuOut[1], 512);
+	if(SD_L0_EmuTakeFault(SD_L0_EMU_FAULT_CRC, block)) crc ^= 0x0001;
+	SD_L0_emuOut[513] = crc >> 8;
+	SD_L0_emuOut[514] = crc & 0xFF;
+	SD_L0_emuOutLen = 515;
+	SD_L0_emuOutPos = 0;
+	SD_L0_emuOutAt = SD_L0_emuNs + (uint64_t)delayUs * 1000;
+	SD_L0_emuOutFill = 0xFF;
+	SD_L0_emuOutBlock = block;
+	SD_L0_emuBlock++;
+	SD_L0_emuStats.Blocks++;
+}
+
+/**
+ * A data block of a write is complete: check, store and answer it.
+ */
+void SD_L0_EmuReceiveBlock(void)
+{
+	uint8_t  resp = 0x05;
+	uint32_t block = SD_L0_emuBlock;
+	uint16_t crc = ((uint16_t)SD_L0_emuRx[512] << 8) | SD_L0_emuRx[513];
+
+	SD_L0_emuRxActive = 0;
+	if(SD_L0_emuCrcOn && (crc != SD_L0_EmuCrc16(SD_L0_emuRx, 512))) {
+		SD_L0_emuStats.CrcErrors++;
+		resp = 0x0B;
+	} else {
+		fseeko(SD_L0_emuFile, (off_t)block << 9, SEEK_SET);
+		if(fwrite(SD_L0_emuRx, 1, 512, SD_L0_emuFile) != 512) resp = 0x0D;
+		SD_L0_emuBlock++;
+		SD_L0_emuStats.Blocks++;
+	}
+	if(!SD_L0_emuMulti || (resp != 0x05)) SD_L0_emuState = SD_L0_EMU_IDLE;
+	SD_L0_EmuQueue(&resp, 1, 0, 0xFF);
+	SD_L0_emuBusyUs = SD_L0_emuConfig.BusyUs + SD_L0_EmuTakeFault(SD_L0_EMU_FAULT_BUSY, block);
+}
+
+/**
+ * Replace the output queue.
+ */
+void SD_L0_EmuQueue(const uint8_t *data, uint16_t count, uint32_t delayUs, uint8_t fill)
+{
+	memcpy(SD_L0_emuOut, data, count);
+	SD_L0_emuOutLen = count;
+	SD_L0_emuOutPos = 0;
+	SD_L0_emuOutAt = SD_L0_emuNs + (uint64_t)delayUs * 1000;
+	SD_L0_emuOutFill = fill;
+	SD_L0_emuOutBlock = 0xFFFFFFFFUL;
+}
+
+/**
+ * Remove a pending fault.
+ *
+ * \return Value of the fault, 0 if there is none for block.
+ */
+uint32_t SD_L0_EmuTakeFault(uint8_t fault, uint32_t block)
+{
+	for(uint8_t i = 0; i < SD_L0_EMU_FAULTS; i++) {
+		if((SD_L0_emuFaults[i].Fault == fault) && (SD_L0_emuFaults[i].Block == block)) {
+			SD_L0_emuFaults[i].Fault = 0;
+			return SD_L0_emuFaults[i].Value;
+		}
+	}
+	return 0;
+}
+
+/**
+ * CRC7 of a command frame or register, with end bit.
+ */
+uint8_t SD_L0_EmuCrc7(const uint8_t *data, uint8_t count)
+{
+	uint8_t crc = 0;
+
+	while(count--) {
+		uint8_t d = *data++;
+		for(uint8_t b = 0; b < 8; b++) {
+			crc <<= 1;
+			if((d ^ crc) & 0x80) crc ^= 0x09;
+			d <<= 1;
+		}
+	}
+	return (crc << 1) | 0x01;
+}
+
+/**
+ * CRC16-CCITT of a data block, bitwise to be independent of SD_L1.
+ */
+uint16_t SD_L0_EmuCrc16(const uint8_t *data, uint16_t count)
+{
+	uint16_t crc = 0;
+
+	while(count--) {
+		crc ^= (uint16_t)*data++ << 8;
+		for(uint8_t b = 0; b < 8; b++) {
+			crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+		}
+	}
+	return crc;
+}
+
+#endif /* !ARDUINO */
@@ -2,6 +2,8 @@
 #include "sd_l0.h"
 #include "sd_l1.h"
 
+#include <string.h>
+
 // SD card commands
 /** GO_IDLE_STATE - init card in spi mode if CS low */
 #define SD_CMD0 0x00
@@ -64,14 +66,163 @@
 /** write data accepted token */
 //#define SD_DATA_RES_ACCEPTED 0x05
 
+//------------------------------------------------------------------------------
+/** no asynchronous read running */
+#define SD_L1_ASYNC_IDLE 0
+/** read command sent, waiting for the start block token */
+#define SD_L1_ASYNC_TOKEN 1
+/** data block of asynchronous read is transferred in background */
+#define SD_L1_ASYNC_XFER 2
+/** asynchronous read finished, result not yet fetched by SD_L1_ReadPoll */
+#define SD_L1_ASYNC_DONE 3
+
+/** Number of additional reads of a block after CRC errors */
+#define SD_L1_CRC_RETRIES 3
+
+/** Number of test reads that must pass before a SPI clock is used */
+#define SD_L1_SPEED_TEST_READS 4
+
+/** 
+ * Number of bytes checked for the start token per SD_L1_ReadPoll() call. 
+ * Bounds the time spent in one poll while the card is still busy.
+ */
+#define SD_L1_TOKEN_POLLS 8
+
+#if SD_ENABLE_L1_HISTOGRAM
+  #define SD_L1_HistStart(t)    uint32_t t = SD_L0_GetTicks()
+  #define SD_L1_HistAdd(p, t)   SD_L1_HistRecord(p, t)
+  #define SD_L1_HistTokenAdd(t, s)  SD_L1_HistToken(t, s)
+#else
+  #define SD_L1_HistStart(t)
+  #define SD_L1_HistAdd(p, t)
+  #define SD_L1_HistTokenAdd(t, s)
+#endif
+
 // prototypes for internal usage
 uint8_t SD_L1_WaitNotBusy(uint16_t timeout);
 uint8_t SD_L1_CardCommand(uint8_t cmd, uint32_t arg);
 uint8_t SD_L1_CardACommand(uint8_t cmd, uint32_t arg);
 uint8_t SD_L1_ReadData(uint8_t *dst, uint16_t count);
 uint8_t SD_L1_WriteData(uint8_t token, const uint8_t *src);
+uint8_t SD_L1_WaitStartToken();
+void    SD_L1_ReadDataAsync(uint8_t *dst);
+void    SD_L1_AsyncStep();
+void    SD_L1_AsyncFlush();
+uint16_t SD_L1_BlockSum(const uint8_t *buf);
+uint8_t SD_L1_BlkInit(uint8_t *pWorkBuf);
+uint8_t SD_L1_BlkRecover();
+#if SD_ENABLE_WRITE_ACCESS
+  uint8_t  SD_L1_WaitWriteDone(uint16_t timeout);
+#endif
+#if SD_ENABLE_CRC_CHECK
+  uint8_t  SD_L1_CommandCrc(uint8_t cmd, uint32_t arg);
+  uint16_t SD_L1_Crc16(uint16_t crc, const uint8_t *buf, uint16_t count);
+  uint8_t  SD_L1_CrcRecv(uint16_t count);
+  void     SD_L1_AsyncRetry();
+  #if SD_ENABLE_MULTIBLOCK_ACCESS
+    uint8_t SD_L1_ReadMBRestart();
+  #endif
+#endif
+#if SD_ENABLE_L1_HISTOGRAM
+  void     SD_L1_HistRecord(uint8_t phase, uint32_t t0);
+  void     SD_L1_HistToken(uint32_t t0, uint8_t status);
+  char     *SD_L1_HistUtoa(char *buf, uint32_t value);
+#endif
+
+// zero-initialized, the port is set when it is selected or initialized
+SD_L1_Card_t SD_L1_card0;
+SD_L1_Card_t *SD_L1_card = &SD_L1_card0;
+
+#if SD_ENABLE_CRC_CHECK
+/** CRC16-CCITT (polynom 0x1021) for one byte, indexed by the upper CRC byte xor data */
+const uint16_t SD_L1_crc16Table[256] = {
+  0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+  0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF,
+  0x1231, 0x0210, 0x3273, 0x2252, 0x52B5, 0x4294, 0x72F7, 0x62D6,
+  0x9339, 0x8318, 0xB37B, 0xA35A, 0xD3BD, 0xC39C, 0xF3FF, 0xE3DE,
+  0x2462, 0x3443, 0x0420, 0x1401, 0x64E6, 0x74C7, 0x44A4, 0x5485,
+  0xA56A, 0xB54B, 0x8528, 0x9509, 0xE5EE, 0xF5CF, 0xC5AC, 0xD58D,
+  0x3653, 0x2672, 0x1611, 0x0630, 0x76D7, 0x66F6, 0x5695, 0x46B4,
+  0xB75B, 0xA77A, 0x9719, 0x8738, 0xF7DF, 0xE7FE, 0xD79D, 0xC7BC,
+  0x48C4, 0x58E5, 0x6886, 0x78A7, 0x0840, 0x1861, 0x2802, 0x3823,
+  0xC9CC, 0xD9ED, 0xE98E, 0xF9AF, 0x8948, 0x9969, 0xA90A, 0xB92B,
+  0x5AF5, 0x4AD4, 0x7AB7, 0x6A96, 0x1A71, 0x0A50, 0x3A33, 0x2A12,
+  0xDBFD, 0xCBDC, 0xFBBF, 0xEB9E, 0x9B79, 0x8B58, 0xBB3B, 0xAB1A,
+  0x6CA6, 0x7C87, 0x4CE4, 0x5CC5, 0x2C22, 0x3C03, 0x0C60, 0x1C41,
+  0xEDAE, 0xFD8F, 0xCDEC, 0xDDCD, 0xAD2A, 0xBD0B, 0x8D68, 0x9D49,
+  0x7E97, 0x6EB6, 0x5ED5, 0x4EF4, 0x3E13, 0x2E32, 0x1E51, 0x0E70,
+  0xFF9F, 0xEFBE, 0xDFDD, 0xCFFC, 0xBF1B, 0xAF3A, 0x9F59, 0x8F78,
+  0x9188, 0x81A9, 0xB1CA, 0xA1EB, 0xD10C, 0xC12D, 0xF14E, 0xE16F,
+  0x1080, 0x00A1, 0x30C2, 0x20E3, 0x5004, 0x4025, 0x7046, 0x6067,
+  0x83B9, 0x9398, 0xA3FB, 0xB3DA, 0xC33D, 0xD31C, 0xE37F, 0xF35E,
+  0x02B1, 0x1290, 0x22F3, 0x32D2, 0x4235, 0x5214, 0x6277, 0x7256,
+  0xB5EA, 0xA5CB, 0x95A8, 0x8589, 0xF56E, 0xE54F, 0xD52C, 0xC50D,
+  0x34E2, 0x24C3, 0x14A0, 0x0481, 0x7466, 0x6447, 0x5424, 0x4405,
+  0xA7DB, 0xB7FA, 0x8799, 0x97B8, 0xE75F, 0xF77E, 0xC71D, 0xD73C,
+  0x26D3, 0x36F2, 0x0691, 0x16B0, 0x6657, 0x7676, 0x4615, 0x5634,
+  0xD94C, 0xC96D, 0xF90E, 0xE92F, 0x99C8, 0x89E9, 0xB98A, 0xA9AB,
+  0x5844, 0x4865, 0x7806, 0x6827, 0x18C0, 0x08E1, 0x3882, 0x28A3,
+  0xCB7D, 0xDB5C, 0xEB3F, 0xFB1E, 0x8BF9, 0x9BD8, 0xABBB, 0xBB9A,
+  0x4A75, 0x5A54, 0x6A37, 0x7A16, 0x0AF1, 0x1AD0, 0x2AB3, 0x3A92,
+  0xFD2E, 0xED0F, 0xDD6C, 0xCD4D, 0xBDAA, 0xAD8B, 0x9DE8, 0x8DC9,
+  0x7C26, 0x6C07, 0x5C64, 0x4C45, 0x3CA2, 0x2C83, 0x1CE0, 0x0CC1,
+  0xEF1F, 0xFF3E, 0xCF5D, 0xDF7C, 0xAF9B, 0xBFBA, 0x8FD9, 0x9FF8,
+  0x6E17, 0x7E36, 0x4E55, 0x5E74, 0x2E93, 0x3EB2, 0x0ED1, 0x1EF0
+};
+
+/**
+ * Calculate the CRC7 byte of a command frame (CRC in bits 7:1, end bit set).
+ */
+uint8_t SD_L1_CommandCrc(uint8_t cmd, uint32_t arg) 
+{
+  uint8_t crc = 0;
+  uint8_t d, i, b;
+  
+  for (i = 0; i < 5; i++) {
+    d = (i == 0) ? (cmd | 0x40) : (uint8_t)(arg >> (8 * (4 - i)));
+    for (b = 0; b < 8; b++) {
+      crc <<= 1;
+      if ((d ^ crc) & 0x80) crc ^= 0x09;
+      d <<= 1;
+    }
+  }
+  return (crc << 1) | 0x01;
+}
 
-uint8_t SD_L1_type;
+/**
+ * Continue the CRC16 of a data block over count more bytes, one table 
+ * lookup per byte. Start with crc 0.
+ */
+uint16_t SD_L1_Crc16(uint16_t crc, const uint8_t *buf, uint16_t count) 
+{
+  while (count--) {
+    crc = (crc << 8) ^ SD_L1_crc16Table[(uint8_t)(crc >> 8) ^ *buf++];
+  }
+  return crc;
+}
+
+/**
+ * Extend the CRC16 of the block being received by DMA over the bytes 
+ * that arrived since the last call, so only the last few are left
+ * when the transfer ends. The blocking read uses it as well, no 
+ * background read runs at the same time.
+ *
+ * \param[in] count Size of the block.
+ * \return 1 while the transfer is running, 0 when AsyncCrc covers the block.
+ */
+uint8_t SD_L1_CrcRecv(uint16_t count) 
+{
+  uint8_t busy = SD_L0_SpiIsBusy();
+  uint16_t n = busy ? SD_L0_SpiRecvCount() : count;
+  
+  if (n > SD_L1_card->AsyncCrcCount) {
+    SD_L1_card->AsyncCrc = SD_L1_Crc16(SD_L1_card->AsyncCrc, 
+      SD_L1_card->AsyncDst + SD_L1_card->AsyncCrcCount, n - SD_L1_card->AsyncCrcCount);
+    SD_L1_card->AsyncCrcCount = n;
+  }
+  return busy;
+}
+#endif /* SD_ENABLE_CRC_CHECK */
 
 /** Sends also one dummy byte to ensure MISO goes high impedance */
 void SD_L1_SetCSHigh() {
@@ -81,6 +232,30 @@ void SD_L1_SetCSHigh() {
 
 #define SD_L1_SetCSLow() SD_L0_SetCSLow()
 
+/**
+ * Prepare a card structure for a card at the given port.
+ * Call SD_L1_SelectCard() and SD_L1_Init() afterwards.
+ */
+void SD_L1_CardSetup(SD_L1_Card_t *card, SD_L0_Port_t *port) 
+{
+  memset(card, 0, sizeof(SD_L1_Card_t));
+  card->Port = port;
+}
+
+/**
+ * Select the card following SD_L1_* calls work on. An asynchronous 
+ * read of the previously selected card keeps running, so several
+ * cards on different ports can be read in parallel by selecting 
+ * them in turn and polling with SD_L1_ReadPoll(). A card without
+ * port (SD_L1_card0) gets the default port SD_L0_port0.
+ */
+void SD_L1_SelectCard(SD_L1_Card_t *card) 
+{
+  if (card->Port == NULL) card->Port = &SD_L0_port0;
+  SD_L1_card = card;
+  SD_L0_SelectPort(card->Port);
+}
+
 /** wait for card to go not busy */
 uint8_t SD_L1_WaitNotBusy(uint16_t timeout) 
 {
@@ -91,6 +266,22 @@ uint8_t SD_L1_WaitNotBusy(uint16_t timeout)
   return 1;
 }
 
+#if SD_ENABLE_WRITE_ACCESS
+/** 
+ * Wait for card to finish programming, the longest wait 
+ * is kept for SD_L1_GetMaxBusyTime().
+ */
+uint8_t SD_L1_WaitWriteDone(uint16_t timeout) 
+{
+  uint32_t t0 = SD_L0_GetMicros();
+  uint8_t ret = SD_L1_WaitNotBusy(timeout);
+  
+  t0 = SD_L0_GetMicros() - t0;
+  if (t0 > SD_L1_card->BusyMax) SD_L1_card->BusyMax = t0;
+  return ret;
+}
+#endif
+
 /**
  * Send a command to the memory card which responses with a R1 response (and possibly others).
  *
@@ -102,12 +293,25 @@ uint8_t SD_L1_CardCommand(uint8_t cmd, uint32_t arg)
 {
   uint8_t response;
   uint8_t crc = 0xFF;
+  
+  // a running asynchronous read must be finished first
+  SD_L1_AsyncFlush();
       
   // select card
   SD_L1_SetCSLow();
 
-  // wait up to timeout if busy
+  // wait up to timeout if busy, counted for the previous command
+  SD_L1_HistStart(tBusy);
   SD_L1_WaitNotBusy(SD_COMMAND_TIMEOUT);
+  SD_L1_HistAdd(SD_L1_HIST_BUSY, tBusy);
+#if SD_ENABLE_L1_HISTOGRAM
+  switch (cmd) {
+    case SD_CMD17: SD_L1_card->HistCmd = SD_L1_HIST_CMD17 + 1; break;
+    case SD_CMD18: SD_L1_card->HistCmd = SD_L1_HIST_CMD18 + 1; break;
+    case SD_CMD12: SD_L1_card->HistCmd = SD_L1_HIST_CMD12 + 1; break;
+    default:       SD_L1_card->HistCmd = 0; break;
+  }
+#endif
 
   // send command
   SD_L0_SpiSendByte(cmd | 0x40);
@@ -118,9 +322,14 @@ uint8_t SD_L1_CardCommand(uint8_t cmd, uint32_t arg)
   SD_L0_SpiSendByte((arg >> 8) & 0xff);
   SD_L0_SpiSendByte((arg >> 0) & 0xff);
   
+#if SD_ENABLE_CRC_CHECK
+  // send CRC, checked by the card for all commands
+  crc = SD_L1_CommandCrc(cmd, arg);
+#else
   // send CRC, only required for commands 0 and 8
   if (cmd == SD_CMD0) crc = 0x95;  // correct crc for CMD0 with arg 0
   if (cmd == SD_CMD8) crc = 0x87;  // correct crc for CMD8 with arg 0X1AA
+#endif
   SD_L0_SpiSendByte(crc);
 
   // skip stuff byte for stop read
@@ -150,13 +359,12 @@ uint8_t SD_L1_CardACommand(uint8_t cmd, uint32_t arg)
 }
 
 /**
- * Read one block of data from card.
+ * Wait for the start block token of a data block.
  *
  * \return Error code, 0 if ok.
  */
-uint8_t SD_L1_ReadData(uint8_t *dst, uint16_t count) 
+uint8_t SD_L1_WaitStartToken() 
 {
-  // wait for start block token
   uint8_t status;
   uint16_t t0 = SD_L0_GetTimestamp();
   
@@ -171,18 +379,182 @@ uint8_t SD_L1_ReadData(uint8_t *dst, uint16_t count)
     SD_L1_SetCSHigh();
     return(SD_CARD_ERROR_READ);
   }
+  return 0;
+}
+
+/**
+ * Read one block of data from card.
+ *
+ * \return Error code, 0 if ok.
+ */
+uint8_t SD_L1_ReadData(uint8_t *dst, uint16_t count) 
+{
+  uint8_t status;
+  
+  // wait for start block token
+  SD_L1_HistStart(t0);
+  status = SD_L1_WaitStartToken();
+  SD_L1_HistTokenAdd(t0, status);
+  if (status) return(status);
   
   // transfer data
+  SD_L1_HistStart(t1);
+#if SD_ENABLE_CRC_CHECK
+  // by DMA if available, the CRC is computed meanwhile
+  uint16_t crc;
+  SD_L1_card->AsyncDst = dst;
+  SD_L1_card->AsyncCrc = 0;
+  SD_L1_card->AsyncCrcCount = 0;
+  SD_L0_SpiRecvBlockAsync(dst, count);
+  while (SD_L1_CrcRecv(count)) ;
+  crc = (uint16_t)SD_L0_SpiRecvByte() << 8;
+  crc |= SD_L0_SpiRecvByte();
+  SD_L1_SetCSHigh();
+  SD_L1_HistAdd(SD_L1_HIST_XFER, t1);
+  if (crc != SD_L1_card->AsyncCrc) return(SD_CARD_ERROR_CRC);
+#else
   SD_L0_SpiRecvBlock(dst, count);
 
   // discard CRC
   SD_L0_SpiRecvByte();
   SD_L0_SpiRecvByte();
   SD_L1_SetCSHigh();
+  SD_L1_HistAdd(SD_L1_HIST_XFER, t1);
+#endif
 
   return 0;
 }
 
+/**
+ * Start reading one 512 byte block of data from card in background.
+ * The read command must have been sent already.
+ */
+void SD_L1_ReadDataAsync(uint8_t *dst) 
+{
+  SD_L1_card->AsyncDst = dst;
+  SD_L1_card->AsyncT0 = SD_L0_GetTimestamp();
+  SD_L1_card->AsyncState = SD_L1_ASYNC_TOKEN;
+#if SD_ENABLE_L1_HISTOGRAM
+  SD_L1_card->HistTicks = SD_L0_GetTicks();
+#endif
+  
+  // the token is often there already
+  SD_L1_AsyncStep();
+}
+
+/**
+ * Advance a running asynchronous read without waiting.
+ */
+void SD_L1_AsyncStep() 
+{
+  if (SD_L1_card->AsyncState == SD_L1_ASYNC_TOKEN) {
+    uint8_t status = 0xFF;
+    uint8_t i;
+    
+    // look for start block token, but only for a few bytes
+    for (i = 0; (i < SD_L1_TOKEN_POLLS) && (status == 0xFF); i++) {
+      status = SD_L0_SpiRecvByte();
+    }
+    if (status == 0xFF) {
+      if ((SD_L0_GetTimestamp() - SD_L1_card->AsyncT0) > SD_READ_TIMEOUT) {
+#if SD_ENABLE_L1_HISTOGRAM
+        SD_L1_HistToken(SD_L1_card->HistTicks, SD_CARD_ERROR_READ_TIMEOUT);
+#endif
+        SD_L1_SetCSHigh();
+        SD_L1_card->AsyncResult = SD_CARD_ERROR_READ_TIMEOUT;
+        SD_L1_card->AsyncState = SD_L1_ASYNC_DONE;
+      }
+      return;
+    }
+#if SD_ENABLE_L1_HISTOGRAM
+    SD_L1_HistToken(SD_L1_card->HistTicks, 0);
+#endif
+    if (status != SD_DATA_START_BLOCK) {
+      SD_L1_SetCSHigh();
+      SD_L1_card->AsyncResult = SD_CARD_ERROR_READ;
+      SD_L1_card->AsyncState = SD_L1_ASYNC_DONE;
+      return;
+    }
+    
+    // transfer data in background
+#if SD_ENABLE_L1_HISTOGRAM
+    SD_L1_card->HistTicks = SD_L0_GetTicks();
+#endif
+    SD_L1_card->AsyncCrc = 0;
+    SD_L1_card->AsyncCrcCount = 0;
+    SD_L0_SpiRecvBlockAsync(SD_L1_card->AsyncDst, 512);
+    SD_L1_card->AsyncState = SD_L1_ASYNC_XFER;
+  }
+  
+  if (SD_L1_card->AsyncState == SD_L1_ASYNC_XFER) {
+#if SD_ENABLE_CRC_CHECK
+    // CRC of the bytes received so far
+    if (SD_L1_CrcRecv(512)) return;
+    uint16_t crc;
+    crc = (uint16_t)SD_L0_SpiRecvByte() << 8;
+    crc |= SD_L0_SpiRecvByte();
+    SD_L1_SetCSHigh();
+    SD_L1_HistAdd(SD_L1_HIST_XFER, SD_L1_card->HistTicks);
+    if (crc != SD_L1_card->AsyncCrc) {
+      SD_L1_AsyncRetry();
+      return;
+    }
+#else
+    if (SD_L0_SpiIsBusy()) return;
+    // discard CRC
+    SD_L0_SpiRecvByte();
+    SD_L0_SpiRecvByte();
+    SD_L1_SetCSHigh();
+    SD_L1_HistAdd(SD_L1_HIST_XFER, SD_L1_card->HistTicks);
+#endif
+#if SD_ENABLE_MULTIBLOCK_ACCESS
+    if (SD_L1_card->AsyncMB) SD_L1_card->MBBlock++;
+#endif
+    SD_L1_card->AsyncResult = 0;
+    SD_L1_card->AsyncState = SD_L1_ASYNC_DONE;
+  }
+}
+
+#if SD_ENABLE_CRC_CHECK
+/**
+ * Read the block of an asynchronous read again after a CRC error.
+ */
+void SD_L1_AsyncRetry() 
+{
+  uint8_t status = 0;
+  
+  SD_L1_card->AsyncState = SD_L1_ASYNC_IDLE;
+  if (!SD_L1_card->AsyncRetries) {
+    status = SD_CARD_ERROR_CRC;
+#if SD_ENABLE_MULTIBLOCK_ACCESS
+  } else if (SD_L1_card->AsyncMB) {
+    status = SD_L1_ReadMBRestart();
+    if (!status) SD_L1_SetCSLow();
+#endif
+  } else if (SD_L1_CardCommand(SD_CMD17, SD_L1_card->AsyncBlock)) {
+    SD_L1_SetCSHigh();
+    status = SD_CARD_ERROR_CMD17;
+  }
+  
+  if (status) {
+    SD_L1_card->AsyncResult = status;
+    SD_L1_card->AsyncState = SD_L1_ASYNC_DONE;
+    return;
+  }
+  SD_L1_card->AsyncRetries--;
+  SD_L1_ReadDataAsync(SD_L1_card->AsyncDst);
+}
+#endif /* SD_ENABLE_CRC_CHECK */
+
+/**
+ * Finish a running asynchronous read, the result is kept for SD_L1_ReadPoll.
+ */
+void SD_L1_AsyncFlush() 
+{
+  while ((SD_L1_card->AsyncState == SD_L1_ASYNC_TOKEN) || 
+         (SD_L1_card->AsyncState == SD_L1_ASYNC_XFER)) SD_L1_AsyncStep();
+}
+
 /**
  * Write one block of data to card.
  *
@@ -194,8 +566,14 @@ uint8_t SD_L1_WriteData(uint8_t token, const uint8_t *src)
   
   SD_L0_SpiSendBlock(token, src);
 
+#if SD_ENABLE_CRC_CHECK
+  uint16_t crc = SD_L1_Crc16(0, src, 512);
+  SD_L0_SpiSendByte(crc >> 8);
+  SD_L0_SpiSendByte(crc & 0xff);
+#else
   SD_L0_SpiSendByte(0xff);  // dummy crc
   SD_L0_SpiSendByte(0xff);  // dummy crc
+#endif
 
   status = SD_L0_SpiRecvByte();
   if ((status & 0x1f) != 0x05) {
@@ -225,7 +603,9 @@ uint8_t SD_L1_Init()
   uint16_t t0 = SD_L0_GetTimestamp();
   uint32_t arg;
   
-  SD_L1_type = 0;
+  if (SD_L1_card->Port == NULL) SD_L1_SelectCard(SD_L1_card);
+  SD_L1_card->Type = 0;
+  SD_L1_card->AsyncState = SD_L1_ASYNC_IDLE;
 
   // set pin modes
   SD_L0_Init();
@@ -244,7 +624,7 @@ uint8_t SD_L1_Init()
   
   // check SD version ( 2.7V - 3.6V + test pattern )
   if ((SD_L1_CardCommand(SD_CMD8, 0x1AA) & SD_R1_ILLEGAL_COMMAND)) {
-    SD_L1_type = SD_CARD_TYPE_SD1;
+    SD_L1_card->Type = SD_CARD_TYPE_SD1;
     // Not done here: Test if SD or MMC card here using CMD55 + CMD1
   } else {
     // only need last byte of r7 response
@@ -260,14 +640,14 @@ uint8_t SD_L1_Init()
       SD_L1_SetCSHigh();
       return(SD_CARD_ERROR_CMD8);
     }
-    SD_L1_type = SD_CARD_TYPE_SD2;
+    SD_L1_card->Type = SD_CARD_TYPE_SD2;
   }
   
-  // Turn CRC option off
-  SD_L1_CardCommand(SD_CMD59, 0);
+  // Turn CRC option on or off
+  SD_L1_CardCommand(SD_CMD59, SD_ENABLE_CRC_CHECK);
   
   // initialize card and send host supports SDHC if SD2
-  arg = (SD_L1_type == SD_CARD_TYPE_SD2) ? 0X40000000 : 0;
+  arg = (SD_L1_card->Type == SD_CARD_TYPE_SD2) ? 0X40000000 : 0;
   while ((SD_L1_CardACommand(SD_ACMD41, arg)) != SD_R1_READY_STATE) {
     // check for timeout
     if ((SD_L0_GetTimestamp() - t0) > SD_INIT_TIMEOUT) {
@@ -277,13 +657,13 @@ uint8_t SD_L1_Init()
   }
   
   // if SD2 read OCR register to check for SDHC card
-  if (SD_L1_type == SD_CARD_TYPE_SD2) {
+  if (SD_L1_card->Type == SD_CARD_TYPE_SD2) {
     if (SD_L1_CardCommand(SD_CMD58, 0)) {
       SD_L1_SetCSHigh();
       return(SD_CARD_ERROR_CMD58);
     }
     // other implementation test only against 0x40 for SDHC detection...
-    if ((SD_L0_SpiRecvByte() & 0xC0) == 0xC0) SD_L1_type = SD_CARD_TYPE_SDHC;
+    if ((SD_L0_SpiRecvByte() & 0xC0) == 0xC0) SD_L1_card->Type = SD_CARD_TYPE_SDHC;
     // discard rest of ocr - contains allowed voltage range
     SD_L0_SpiRecvByte();
     SD_L0_SpiRecvByte();
@@ -299,6 +679,7 @@ uint8_t SD_L1_Init()
   
   SD_L1_SetCSHigh();
   SD_L0_SpiSetHighSpeed();
+  SD_L1_card->Speed = SD_L0_SPI_BASE_SPEED;
   return 0;
 }
 
@@ -307,7 +688,7 @@ uint8_t SD_L1_Init()
  */
 void SD_L1_DeInit()
 {
-  SD_L1_type = 0;
+  SD_L1_card->Type = 0;
   
   // must supply min of 74 clock cycles with CS high.
   SD_L1_SetCSHigh();
@@ -321,7 +702,7 @@ void SD_L1_DeInit()
  */
 uint8_t SD_L1_GetCardType() 
 {
-    return(SD_L1_type);
+    return(SD_L1_card->Type);
 }
 
 /**
@@ -334,13 +715,19 @@ uint8_t SD_L1_GetCardType()
  */
 uint8_t SD_L1_ReadBlock(uint32_t blockNumber, uint8_t *dst) 
 {
+  uint8_t status;
+  uint8_t retries = SD_L1_CRC_RETRIES;
+  
   // use address if not SDHC card
-  if (SD_L1_type != SD_CARD_TYPE_SDHC) blockNumber <<= 9;
-  if (SD_L1_CardCommand(SD_CMD17, blockNumber)) {
-    SD_L1_SetCSHigh();
-    return(SD_CARD_ERROR_CMD17);
-  }
-  return SD_L1_ReadData(dst, 512);
+  if (SD_L1_card->Type != SD_CARD_TYPE_SDHC) blockNumber <<= 9;
+  do {
+    if (SD_L1_CardCommand(SD_CMD17, blockNumber)) {
+      SD_L1_SetCSHigh();
+      return(SD_CARD_ERROR_CMD17);
+    }
+    status = SD_L1_ReadData(dst, 512);
+  } while ((status == SD_CARD_ERROR_CRC) && retries--);
+  return(status);
 }
 
 #if SD_ENABLE_MULTIBLOCK_ACCESS
@@ -356,7 +743,8 @@ uint8_t SD_L1_ReadBlock(uint32_t blockNumber, uint8_t *dst)
  */
 uint8_t SD_L1_ReadMBStart(uint32_t blockNumber) 
 {
-  if (SD_L1_type != SD_CARD_TYPE_SDHC) blockNumber <<= 9;
+  SD_L1_card->MBBlock = blockNumber;
+  if (SD_L1_card->Type != SD_CARD_TYPE_SDHC) blockNumber <<= 9;
   if (SD_L1_CardCommand(SD_CMD18, blockNumber)) {
     SD_L1_SetCSHigh();
     return(SD_CARD_ERROR_CMD18);
@@ -374,8 +762,21 @@ uint8_t SD_L1_ReadMBStart(uint32_t blockNumber)
  */
 uint8_t SD_L1_ReadMB(uint8_t *dst) 
 {
+  uint8_t status;
+  
+  SD_L1_AsyncFlush();
   SD_L1_SetCSLow();
-  return SD_L1_ReadData(dst, 512);
+  status = SD_L1_ReadData(dst, 512);
+#if SD_ENABLE_CRC_CHECK
+  for (uint8_t retries = SD_L1_CRC_RETRIES; (status == SD_CARD_ERROR_CRC) && retries; retries--) {
+    status = SD_L1_ReadMBRestart();
+    if (status) break;
+    SD_L1_SetCSLow();
+    status = SD_L1_ReadData(dst, 512);
+  }
+#endif
+  if (!status) SD_L1_card->MBBlock++;
+  return(status);
 }
 
 /** 
@@ -393,14 +794,95 @@ uint8_t SD_L1_ReadMBStop()
   SD_L1_SetCSHigh();
   return 0;  
 }
+
+#if SD_ENABLE_CRC_CHECK
+/** 
+ * Restart a multiple block read sequence at the block that failed.
+ *
+ * \return 0 is returned for success, error code otherwise
+ */
+uint8_t SD_L1_ReadMBRestart() 
+{
+  SD_L1_ReadMBStop();
+  return SD_L1_ReadMBStart(SD_L1_card->MBBlock);
+}
+#endif /* SD_ENABLE_CRC_CHECK */
 #endif /* SD_ENABLE_MULTIBLOCK_ACCESS */
 
-#if SD_ENABLE_L1_INFORMATIVE
+/**
+ * Start reading a 512 byte block from an SD card in background.
+ *
+ * Only the command is sent before returning. The wait for the start 
+ * token and the data block are handled by SD_L1_ReadPoll(), so a busy 
+ * card does not block the caller. The card keeps CS asserted until the 
+ * read is finished, so don't access other devices on the same SPI bus 
+ * meanwhile. Call SD_L1_ReadPoll() until it returns something other than 
+ * SD_CARD_READ_PENDING before touching dst. Other card functions
+ * called meanwhile finish the transfer first.
+ *
+ * \param[in] blockNumber Logical block to be read.
+ * \param[out] dst Pointer to the location that will receive the data.
+ *
+ * \return 0 if transfer is running, error code otherwise
+ */
+uint8_t SD_L1_ReadBlockAsync(uint32_t blockNumber, uint8_t *dst) 
+{
+  // use address if not SDHC card
+  if (SD_L1_card->Type != SD_CARD_TYPE_SDHC) blockNumber <<= 9;
+  if (SD_L1_CardCommand(SD_CMD17, blockNumber)) {
+    SD_L1_SetCSHigh();
+    return(SD_CARD_ERROR_CMD17);
+  }
+  SD_L1_card->AsyncBlock = blockNumber;
+  SD_L1_card->AsyncMB = 0;
+  SD_L1_card->AsyncRetries = SD_L1_CRC_RETRIES;
+  SD_L1_ReadDataAsync(dst);
+  return 0;
+}
+
+#if SD_ENABLE_MULTIBLOCK_ACCESS
+/** 
+ * Start reading the next data block of a multiple block read sequence 
+ * in background, see SD_L1_ReadBlockAsync().
+ *
+ * \param[out] dst Pointer to the location that will receive the data.
+ *
+ * \return 0 if transfer is running, error code otherwise
+ */
+uint8_t SD_L1_ReadMBAsync(uint8_t *dst) 
+{
+  SD_L1_AsyncFlush();
+  SD_L1_SetCSLow();
+  SD_L1_card->AsyncMB = 1;
+  SD_L1_card->AsyncRetries = SD_L1_CRC_RETRIES;
+  SD_L1_ReadDataAsync(dst);
+  return 0;
+}
+#endif /* SD_ENABLE_MULTIBLOCK_ACCESS */
+
+/** 
+ * Poll an asynchronous read.
+ *
+ * \return SD_CARD_READ_PENDING while waiting for the card or the block 
+ *         is still transferred,
+ *         0 if it has been read successfully, error code otherwise
+ */
+uint8_t SD_L1_ReadPoll() 
+{
+  uint8_t ret;
+  SD_L1_AsyncStep();
+  if ((SD_L1_card->AsyncState == SD_L1_ASYNC_TOKEN) || 
+      (SD_L1_card->AsyncState == SD_L1_ASYNC_XFER)) return(SD_CARD_READ_PENDING);
+  ret = (SD_L1_card->AsyncState == SD_L1_ASYNC_DONE) ? SD_L1_card->AsyncResult : 0;
+  SD_L1_card->AsyncState = SD_L1_ASYNC_IDLE;
+  return(ret);
+}
+
 /**
  * Read the 16 byte CSD register of SD card.
  *
- * Remark: It seems that the only usefull information stored in CSD
- *         is the actual card size only as other fields are 
+ * Remark: Besides the actual card size the maximum transfer 
+ *         rate (TRAN_SPEED) is used from CSD, other fields are 
  *         typically filled with too general values.
  *
  * \param[out] dst Pointer to the location that will receive the data.
@@ -415,6 +897,128 @@ uint8_t SD_L1_ReadCSD(uint8_t *dst)
   return SD_L1_ReadData(dst, 16);
 }
 
+/**
+ * Get the actual SPI clock.
+ *
+ * \return SPI clock in Hz, 0 if card is not initialized.
+ */
+uint32_t SD_L1_GetSpeed() 
+{
+  return (SD_L1_card->Type) ? SD_L1_card->Speed : 0;
+}
+
+#if SD_ENABLE_SPEED_NEGOTIATION
+/**
+ * Determine the maximum transfer rate of the card from the 
+ * TRAN_SPEED field of its CSD.
+ *
+ * \return The maximum SPI clock in Hz or zero if an error occurs.
+ */
+uint32_t SD_L1_GetMaxSpeed() 
+{
+  // time values of TRAN_SPEED multiplied by 10
+  static const uint8_t timeval[16] = 
+    { 0, 10, 12, 13, 15, 20, 25, 30, 35, 40, 45, 50, 55, 60, 70, 80 };
+  uint8_t csddata[16];
+  uint32_t unit;
+  uint8_t i;
+  
+  if (SD_L1_ReadCSD(&csddata[0])) return 0;
+  
+  // transfer rate unit: 100 kbit/s, 1, 10 or 100 Mbit/s (divided by 10)
+  if ((csddata[3] & 0x07) > 3) return 0;
+  unit = 10000;
+  for (i = 0; i < (csddata[3] & 0x07); i++) unit *= 10;
+  return unit * timeval[(csddata[3] >> 3) & 0x0f];
+}
+
+/**
+ * Simple checksum over one block to compare test reads.
+ */
+uint16_t SD_L1_BlockSum(const uint8_t *buf) 
+{
+  uint8_t sum1 = 0, sum2 = 0;
+  uint16_t i;
+  
+  // Fletcher-16 without modulo, sufficient to catch bit errors
+  for (i = 0; i < 512; i++) {
+    sum1 += buf[i];
+    sum2 += sum1;
+  }
+  return ((uint16_t)sum2 << 8) | sum1;
+}
+
+/**
+ * Set the SPI clock to the fastest value allowed by the card 
+ * (TRAN_SPEED from CSD) and SD_L0_SPI_MAX_SPEED that passes 
+ * repeated test reads of block 0. Slower clocks are tried if 
+ * a test read fails, SD_L0_SPI_BASE_SPEED is used as last resort.
+ *
+ * Must be called after SD_L1_Init().
+ *
+ * \param[out] pWorkBuf Pointer to a 512 byte buffer for the test reads.
+ * \return 0 is returned for success, error code otherwise
+ */
+uint8_t SD_L1_NegotiateSpeed(uint8_t *pWorkBuf) 
+{
+  uint32_t speed;
+  uint16_t sum;
+  uint8_t retval, i;
+  
+  // reference read with the safe clock
+  SD_L1_card->Speed = SD_L0_SpiSetSpeed(SD_L0_SPI_BASE_SPEED);
+  retval = SD_L1_ReadBlock(0, pWorkBuf);
+  if (retval) return(retval);
+  sum = SD_L1_BlockSum(pWorkBuf);
+  
+  // CSD not readable: stay with the safe clock
+  speed = SD_L1_GetMaxSpeed();
+  if (speed > SD_L0_SPI_MAX_SPEED) speed = SD_L0_SPI_MAX_SPEED;
+  
+  while (speed > SD_L1_card->Speed) {
+    speed = SD_L0_SpiSetSpeed(speed);
+    if (speed <= SD_L1_card->Speed) break;
+    
+    for (i = 0; i < SD_L1_SPEED_TEST_READS; i++) {
+      if (SD_L1_ReadBlock(0, pWorkBuf)) break;
+      if (SD_L1_BlockSum(pWorkBuf) != sum) break;
+    }
+    if (i == SD_L1_SPEED_TEST_READS) {
+      SD_L1_card->Speed = speed;
+      return 0;
+    }
+    
+    // try next slower clock
+    speed--;
+  }
+  
+  SD_L0_SpiSetSpeed(SD_L1_card->Speed);
+  return 0;
+}
+
+/**
+ * Switch to the next slower SPI clock after a transfer error.
+ * Call it when reads fail and retry the access if it returns 1.
+ *
+ * \return 1 if the clock has been lowered, 0 if SD_L0_SPI_BASE_SPEED 
+ *         is already used.
+ */
+uint8_t SD_L1_SpeedFallback() 
+{
+  if (SD_L1_card->Speed <= SD_L0_SPI_BASE_SPEED) return 0;
+  
+  // never change the clock during a transfer
+  SD_L1_AsyncFlush();
+  SD_L1_card->Speed = SD_L0_SpiSetSpeed(SD_L1_card->Speed - 1);
+  if (SD_L1_card->Speed < SD_L0_SPI_BASE_SPEED) {
+    SD_L1_card->Speed = SD_L0_SpiSetSpeed(SD_L0_SPI_BASE_SPEED);
+  }
+  return 1;
+}
+#endif /* SD_ENABLE_SPEED_NEGOTIATION */
+
+#if SD_ENABLE_L1_INFORMATIVE
+
 /**
  * Read the 16 byte CID register of SD card.
  *
@@ -480,7 +1084,7 @@ uint8_t SD_L1_WriteBlock(uint32_t blockNumber, const uint8_t *src)
   uint8_t response;
 
   // use address if not SDHC card
-  if (SD_L1_type != SD_CARD_TYPE_SDHC) blockNumber <<= 9;
+  if (SD_L1_card->Type != SD_CARD_TYPE_SDHC) blockNumber <<= 9;
   if (SD_L1_CardCommand(SD_CMD24, blockNumber)) {
     SD_L1_SetCSHigh();
     return(SD_CARD_ERROR_CMD24);
@@ -491,7 +1095,7 @@ uint8_t SD_L1_WriteBlock(uint32_t blockNumber, const uint8_t *src)
   if (response) return(response);
 
   // wait for flash programming to complete
-  if (!SD_L1_WaitNotBusy(SD_WRITE_TIMEOUT)) {
+  if (!SD_L1_WaitWriteDone(SD_WRITE_TIMEOUT)) {
     SD_L1_SetCSHigh();
     return(SD_CARD_ERROR_WRITE_TIMEOUT);
   }
@@ -528,7 +1132,7 @@ uint8_t SD_L1_WriteMBStart(uint32_t blockNumber, uint32_t eraseCount)
       }
   }
   // use address if not SDHC card
-  if (SD_L1_type != SD_CARD_TYPE_SDHC) blockNumber <<= 9;
+  if (SD_L1_card->Type != SD_CARD_TYPE_SDHC) blockNumber <<= 9;
   if (SD_L1_CardCommand(SD_CMD25, blockNumber)) {
     SD_L1_SetCSHigh();
     return(SD_CARD_ERROR_CMD25);
@@ -546,9 +1150,10 @@ uint8_t SD_L1_WriteMBStart(uint32_t blockNumber, uint32_t eraseCount)
  */
 uint8_t SD_L1_WriteMB(const uint8_t* src) 
 {
+  SD_L1_AsyncFlush();
   SD_L1_SetCSLow();
   // wait for previous write to finish
-  if (!SD_L1_WaitNotBusy(SD_WRITE_TIMEOUT)) {
+  if (!SD_L1_WaitWriteDone(SD_WRITE_TIMEOUT)) {
     SD_L1_SetCSHigh();
     return(SD_CARD_ERROR_WRITE_MB);
   }
@@ -568,13 +1173,14 @@ uint8_t SD_L1_WriteMB(const uint8_t* src)
  */
 uint8_t SD_L1_WriteMBStop() 
 {
+  SD_L1_AsyncFlush();
   SD_L1_SetCSLow();
-  if (!SD_L1_WaitNotBusy(SD_WRITE_TIMEOUT)) {
+  if (!SD_L1_WaitWriteDone(SD_WRITE_TIMEOUT)) {
     SD_L1_SetCSHigh();
     return(SD_CARD_ERROR_STOP_TRAN);
   }
   SD_L0_SpiSendByte(0xfd); // 0xfd = STOP_TRAN_TOKEN
-  if (!SD_L1_WaitNotBusy(SD_WRITE_TIMEOUT)) {
+  if (!SD_L1_WaitWriteDone(SD_WRITE_TIMEOUT)) {
     SD_L1_SetCSHigh();
     return(SD_CARD_ERROR_STOP_TRAN);
   }
@@ -582,7 +1188,206 @@ uint8_t SD_L1_WriteMBStop()
   return 0; 
 }
 #endif /* SD_ENABLE_MULTIBLOCK_ACCESS */
+
+/** 
+ * Get the longest time the card was busy programming since
+ * the last call of SD_L1_ResetMaxBusyTime(). Use it to size
+ * the buffers of streaming writes.
+ *
+ * \return Longest busy time in microseconds.
+ */
+uint32_t SD_L1_GetMaxBusyTime() 
+{
+  return SD_L1_card->BusyMax;
+}
+
+/** 
+ * Reset the longest busy time, see SD_L1_GetMaxBusyTime().
+ */
+void SD_L1_ResetMaxBusyTime() 
+{
+  SD_L1_card->BusyMax = 0;
+}
 #endif /* SD_ENABLE_WRITE_ACCESS */
 
+/**
+ * Initialize the card for block device usage, with the
+ * fastest SPI clock the card and the wiring can handle.
+ */
+uint8_t SD_L1_BlkInit(uint8_t *pWorkBuf) 
+{
+  uint8_t retval = SD_L1_Init();
+  if (retval) return(retval);
+#if SD_ENABLE_SPEED_NEGOTIATION
+  retval = SD_L1_NegotiateSpeed(pWorkBuf);
+#endif
+  return(retval);
+}
+
+/**
+ * Lower the SPI clock after a read error.
+ *
+ * \return Nonzero if the read should be retried.
+ */
+uint8_t SD_L1_BlkRecover() 
+{
+#if SD_ENABLE_SPEED_NEGOTIATION
+  return SD_L1_SpeedFallback();
+#else
+  return 0;
+#endif
+}
+
+const SD_BLK_Dev_t SD_L1_BlkDev = {
+  SD_L1_BlkInit,
+  SD_L1_DeInit,
+  SD_L1_ReadBlock,
+  SD_L1_ReadBlockAsync,
+#if SD_ENABLE_MULTIBLOCK_ACCESS
+  SD_L1_ReadMBStart,
+  SD_L1_ReadMBAsync,
+  SD_L1_ReadMBStop,
+#else
+  NULL, NULL, NULL,
+#endif
+  SD_L1_ReadPoll,
+  SD_L1_BlkRecover,
+#if SD_ENABLE_WRITE_ACCESS
+  SD_L1_WriteBlock,
+  #if SD_ENABLE_MULTIBLOCK_ACCESS
+  SD_L1_WriteMBStart,
+  SD_L1_WriteMB,
+  SD_L1_WriteMBStop,
+  #else
+  NULL, NULL, NULL,
+  #endif
+#else
+  NULL, NULL, NULL, NULL,
+#endif
+};
+
+#if SD_ENABLE_L1_HISTOGRAM
+/** 
+ * Count the time since t0 in the histogram of the last command 
+ * (only CMD17, CMD18 and CMD12 are recorded).
+ */
+void SD_L1_HistRecord(uint8_t phase, uint32_t t0) 
+{
+  uint32_t us;
+  uint8_t  bucket = 0;
+  
+  if (!SD_L1_card->HistCmd) return;
+  us = (SD_L0_GetTicks() - t0) / SD_L0_TICKS_PER_US;
+  while (us && (bucket < SD_L1_HIST_BUCKETS - 1)) {
+    us >>= 1;
+    bucket++;
+  }
+  SD_L1_card->Hist[SD_L1_card->HistCmd - 1][phase][bucket]++;
+}
+
+/** 
+ * Count the wait for the start block token ending with status, 
+ * whether the token came or not. Timeouts go to the last bucket.
+ */
+void SD_L1_HistToken(uint32_t t0, uint8_t status) 
+{
+  if (status != SD_CARD_ERROR_READ_TIMEOUT) {
+    SD_L1_HistRecord(SD_L1_HIST_TOKEN, t0);
+  } else if (SD_L1_card->HistCmd) {
+    SD_L1_card->Hist[SD_L1_card->HistCmd - 1][SD_L1_HIST_TOKEN][SD_L1_HIST_BUCKETS - 1]++;
+  }
+}
+
+/** 
+ * Get one histogram bucket of the selected card.
+ *
+ * The token time of asynchronous reads includes the delay until 
+ * the next SD_L1_ReadPoll() call, so it depends on the polling rate.
+ *
+ * \param[in] cmd SD_L1_HIST_CMD17, SD_L1_HIST_CMD18 or SD_L1_HIST_CMD12.
+ * \param[in] phase SD_L1_HIST_TOKEN, SD_L1_HIST_XFER or SD_L1_HIST_BUSY.
+ * \param[in] bucket 0 .. SD_L1_HIST_BUCKETS - 1, see SD_L1_HIST_BUCKETS.
+ *
+ * \return Number of measured times in bucket, 0 for invalid arguments.
+ */
+uint32_t SD_L1_HistGet(uint8_t cmd, uint8_t phase, uint8_t bucket) 
+{
+  if ((cmd >= SD_L1_HIST_CMDS) || (phase >= SD_L1_HIST_PHASES) || 
+      (bucket >= SD_L1_HIST_BUCKETS)) return 0;
+  return SD_L1_card->Hist[cmd][phase][bucket];
+}
+
+/** 
+ * Clear all histograms of the selected card.
+ */
+void SD_L1_HistReset() 
+{
+  memset(SD_L1_card->Hist, 0, sizeof(SD_L1_card->Hist));
+}
+
+/** 
+ * Print the histograms of the selected card, one line per non 
+ * empty bucket like "CMD18 token <128us 1234", the first bucket 
+ * is shown as "<1us", the last one as ">=262144us".
+ *
+ * \param[in] callback Function called with every line, e.g. one 
+ *            that prints it with Serial.println().
+ */
+void SD_L1_HistDump(void (*callback)(char *line)) 
+{
+  static const char *cmdNames[SD_L1_HIST_CMDS] = { "CMD17", "CMD18", "CMD12" };
+  static const char *phaseNames[SD_L1_HIST_PHASES] = { " token ", " xfer ", " busy " };
+  char buf[40];
+  
+  for (uint8_t c = 0; c < SD_L1_HIST_CMDS; c++) {
+    for (uint8_t p = 0; p < SD_L1_HIST_PHASES; p++) {
+      for (uint8_t b = 0; b < SD_L1_HIST_BUCKETS; b++) {
+        uint32_t count = SD_L1_card->Hist[c][p][b];
+        uint32_t limit;
+        char *pos;
+        
+        if (!count) continue;
+        strcpy(buf, cmdNames[c]);
+        strcat(buf, phaseNames[p]);
+        pos = buf + strlen(buf);
+        if (b < SD_L1_HIST_BUCKETS - 1) {
+          *pos++ = '<';
+          limit = 1UL << b;
+        } else {
+          *pos++ = '>';
+          *pos++ = '=';
+          limit = 1UL << (b - 1);
+        }
+        pos = SD_L1_HistUtoa(pos, limit);
+        *pos++ = 'u';
+        *pos++ = 's';
+        *pos++ = ' ';
+        pos = SD_L1_HistUtoa(pos, count);
+        *pos = 0;
+        callback(buf);
+      }
+    }
+  }
+}
+
+/** 
+ * Write value as decimal number to buf.
+ *
+ * \return Pointer behind the last digit.
+ */
+char *SD_L1_HistUtoa(char *buf, uint32_t value) 
+{
+  char digits[10];
+  uint8_t n = 0;
+  
+  do {
+    digits[n++] = '0' + (value % 10);
+    value /= 10;
+  } while (value);
+  while (n) *buf++ = digits[--n];
+  return buf;
+}
+#endif /* SD_ENABLE_L1_HISTOGRAM */
+
 //------------------------------------------------------------------------------
 
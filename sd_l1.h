@@ -1,15 +1,94 @@
 #ifndef SD_L1_H
 #define SD_L1_H
 
-#define SD_ENABLE_WRITE_ACCESS          0
+#include "sd_l0.h"
+#include "sd_blk.h"
+
+#define SD_ENABLE_WRITE_ACCESS          1
 #define SD_ENABLE_MULTIBLOCK_ACCESS     1
 #define SD_ENABLE_L1_INFORMATIVE        0
+#define SD_ENABLE_SPEED_NEGOTIATION     1
+#define SD_ENABLE_CRC_CHECK             1
+#ifndef SD_ENABLE_L1_HISTOGRAM
+#define SD_ENABLE_L1_HISTOGRAM          0
+#endif
+
+#if SD_ENABLE_L1_HISTOGRAM
+/** 
+ * Latency histograms: commands, phases and log2 buckets.
+ * Bucket 0 counts times below 1 us, bucket b times from 2^(b-1) 
+ * to 2^b - 1 us, the last bucket everything from 2^(b-1) us on and
+ * read timeouts. Waits ending with an error token are counted too.
+ */
+#define SD_L1_HIST_CMD17    0
+#define SD_L1_HIST_CMD18    1
+#define SD_L1_HIST_CMD12    2
+#define SD_L1_HIST_CMDS     3
+/** wait for the start block token after the command */
+#define SD_L1_HIST_TOKEN    0
+/** data block and CRC transfer */
+#define SD_L1_HIST_XFER     1
+/** card busy after the command, measured before the next command */
+#define SD_L1_HIST_BUSY     2
+#define SD_L1_HIST_PHASES   3
+#define SD_L1_HIST_BUCKETS  20
+#endif /* SD_ENABLE_L1_HISTOGRAM */
+
+/**
+ * State of one SD card. SD_L1_* functions work on the card selected 
+ * by SD_L1_SelectCard(), SD_L1_card0 at DSPI0 is used by default.
+ */
+typedef struct {
+    SD_L0_Port_t *Port;         // SPI port the card is connected to
+    uint8_t     Type;           // SD_CARD_TYPE_*, 0 if not initialized
+    uint32_t    Speed;          // SPI clock in Hz
+    
+    // asynchronous read
+    uint8_t     AsyncState;
+    uint8_t     AsyncResult;
+    uint8_t     *AsyncDst;
+    uint16_t    AsyncT0;        // timestamp of command for read timeout
+    uint32_t    AsyncBlock;     // address used for CMD17, for retries
+    uint8_t     AsyncMB;        // 1 if part of a multiple block read
+    uint8_t     AsyncRetries;
+    uint16_t    AsyncCrc;       // CRC16 of the first AsyncCrcCount bytes received
+    uint16_t    AsyncCrcCount;
+    
+    uint32_t    MBBlock;        // next block of multiple block read
+    uint32_t    BusyMax;        // longest busy time while writing in us
+    
+#if SD_ENABLE_L1_HISTOGRAM
+    uint8_t     HistCmd;        // SD_L1_HIST_CMD* + 1 of the last command, 0 if not recorded
+    uint32_t    HistTicks;      // start of the running asynchronous phase
+    uint32_t    Hist[SD_L1_HIST_CMDS][SD_L1_HIST_PHASES][SD_L1_HIST_BUCKETS];
+#endif
+} SD_L1_Card_t;
+
+extern SD_L1_Card_t SD_L1_card0;
+extern SD_L1_Card_t *SD_L1_card;
+
+/** The selected card as block device for SD_L2 and SdPlay */
+extern const SD_BLK_Dev_t SD_L1_BlkDev;
+
+// card selection
+// ***************************************
+void        SD_L1_CardSetup(SD_L1_Card_t *card, SD_L0_Port_t *port);
+void        SD_L1_SelectCard(SD_L1_Card_t *card);
 
 // init/deinit functions
 // ***************************************
 uint8_t     SD_L1_Init();
 void        SD_L1_DeInit();
 
+// SPI clock negotiation
+// ***************************************
+#if SD_ENABLE_SPEED_NEGOTIATION
+  uint8_t   SD_L1_NegotiateSpeed(uint8_t *pWorkBuf);
+  uint8_t   SD_L1_SpeedFallback();
+  uint32_t  SD_L1_GetMaxSpeed();
+#endif /* SD_ENABLE_SPEED_NEGOTIATION */
+uint32_t    SD_L1_GetSpeed();
+
 // read access to 512 byte blocks
 // ***************************************
 uint8_t     SD_L1_ReadBlock(uint32_t blockNumber, uint8_t *dst);
@@ -19,6 +98,16 @@ uint8_t     SD_L1_ReadBlock(uint32_t blockNumber, uint8_t *dst);
   uint8_t   SD_L1_ReadMBStop();
 #endif /* SD_ENABLE_MULTIBLOCK_ACCESS */
 
+// asynchronous read access to 512 byte blocks
+// (only the command is sent, waiting for the card and receiving the
+// data block is done in background, poll until done)
+// ***************************************
+uint8_t     SD_L1_ReadBlockAsync(uint32_t blockNumber, uint8_t *dst);
+#if SD_ENABLE_MULTIBLOCK_ACCESS
+  uint8_t   SD_L1_ReadMBAsync(uint8_t *dst);
+#endif /* SD_ENABLE_MULTIBLOCK_ACCESS */
+uint8_t     SD_L1_ReadPoll();
+
 // write access to 512 byte blocks
 // ***************************************
 #if SD_ENABLE_WRITE_ACCESS
@@ -28,15 +117,24 @@ uint8_t     SD_L1_ReadBlock(uint32_t blockNumber, uint8_t *dst);
     uint8_t SD_L1_WriteMB(const uint8_t* src);
     uint8_t SD_L1_WriteMBStop();
   #endif /* SD_ENABLE_MULTIBLOCK_ACCESS */
+  uint32_t  SD_L1_GetMaxBusyTime();
+  void      SD_L1_ResetMaxBusyTime();
 #endif /* SD_ENABLE_WRITE_ACCESS */
 
+// latency histograms of the selected card
+// ***************************************
+#if SD_ENABLE_L1_HISTOGRAM
+  uint32_t  SD_L1_HistGet(uint8_t cmd, uint8_t phase, uint8_t bucket);
+  void      SD_L1_HistReset();
+  void      SD_L1_HistDump(void (*callback)(char *line));
+#endif /* SD_ENABLE_L1_HISTOGRAM */
 
 // other functions, just informative
 // ***************************************
 uint8_t     SD_L1_GetCardType();
+uint8_t     SD_L1_ReadCSD(uint8_t *dst);
 #if SD_ENABLE_L1_INFORMATIVE
     uint32_t    SD_L1_GetCardSize();
-    uint8_t     SD_L1_ReadCSD(uint8_t *dst);
     uint8_t     SD_L1_ReadCID(uint8_t *dst);
 #endif
 
@@ -84,6 +182,10 @@ uint8_t     SD_L1_GetCardType();
 #define SD_CARD_ERROR_WRITE_MB      0x14 
 /** timeout after sending STOP_TRAN_TOKEN after write multi block data */
 #define SD_CARD_ERROR_STOP_TRAN     0x15
+/** asynchronous read still in progress (not a real error, call SD_L1_ReadPoll again) */
+#define SD_CARD_READ_PENDING        0x16
+/** CRC16 of a data block still wrong after retries */
+#define SD_CARD_ERROR_CRC           0x17
 
 // card types
 /** Standard capacity V1 SD card */
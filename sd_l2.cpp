@@ -6,14 +6,131 @@
 // #include "dbg_uart.h"
 #include <stdio.h>
 
+// Bytes 8..10 (extension) of the word at offset 8 of a directory entry,
+// byte 11 is the attribute
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+  #define SD_L2_EXT_MASK    0xffffff00UL
+#else
+  #define SD_L2_EXT_MASK    0x00ffffffUL
+#endif
+
 uint8_t  *SD_L2_workBuf;
 SD_L2_FAT_t SD_L2_FAT;
 
-// This both will share same buffer -> NextCluster not public availible!
-uint8_t  *SD_L2_FatCache;
-uint32_t SD_L2_LastFatSect;
+#if defined(ARDUINO)
+const SD_BLK_Dev_t *SD_L2_dev = &SD_L1_BlkDev;
+#else
+const SD_BLK_Dev_t *SD_L2_dev = NULL;   // host builds select their device
+#endif
+
+// Sector cache for directory reads, SD_L2_cacheOrder[0] is the
+// most recently used entry, the last one gets replaced on a miss.
+// Words keep the sectors aligned for SD_L2_ScanSector()
+#if SD_L2_CACHE_SECTORS > 0
+uint32_t SD_L2_cacheData[SD_L2_CACHE_SECTORS][128];
+#define SD_L2_CACHE_ENTRIES     SD_L2_CACHE_SECTORS
+#define SD_L2_CacheData(i)      ((uint8_t *)SD_L2_cacheData[i])
+#else
+// the work buffer is the only entry, see SD_L2_Init()
+#define SD_L2_CACHE_ENTRIES     1
+#define SD_L2_CacheData(i)      SD_L2_workBuf
+#endif
+uint32_t SD_L2_cacheSector[SD_L2_CACHE_ENTRIES];
+uint8_t  SD_L2_cacheOrder[SD_L2_CACHE_ENTRIES];
+SD_L2_CacheStats_t SD_L2_cacheStats;
+
+#if SD_L2_FAT_WINDOW_SECTORS > 0
+// FAT window, SD_L2_FAT_WINDOW_SECTORS consecutive FAT sectors starting
+// at SD_L2_fatWinStart, read in one go for NextCluster
+uint8_t  SD_L2_fatWin[SD_L2_FAT_WINDOW_SECTORS][512];
+uint32_t SD_L2_fatWinStart = 0xffffffffUL;
+uint16_t SD_L2_fatWinCount = 0;
+#endif
+
+// Hashed index of one directory, see SD_L2_IndexSetup()
+SD_L2_IndexSlot_t *SD_L2_indexSlots = NULL;
+uint16_t SD_L2_indexCount;
+uint16_t SD_L2_indexUsed;
+uint32_t SD_L2_indexCluster;
+uint8_t  SD_L2_indexBuilt = 0;
+uint8_t  SD_L2_indexComplete;     // 0 if not all entries fit, lookups fall back to searching then
+
+// Index file of the root directory, see SD_L2_IndexFileLoad()
+uint8_t  SD_L2_idxLoaded = 0;
+uint32_t SD_L2_idxStart;            // first sector of the index file (header)
+uint32_t SD_L2_idxRecords;
+uint32_t SD_L2_idxFenceSectors;
+uint32_t SD_L2_idxDataSectors;
+
+#if SD_ENABLE_LFN
+// Long file name searched or collected for SD_L2_Dir, see SD_L2_LfnFeed()
+uint16_t SD_L2_lfnName[SD_L2_LFN_MAX];    // UCS-2, upper case for a search
+uint8_t  SD_L2_lfnLength;
+uint8_t  SD_L2_lfnNext = 0;       // order of the next entry expected, SD_L2_LFN_DONE after the last one
+uint8_t  SD_L2_lfnChecksum;       // checksum of the short name all entries of the name carry
+uint8_t  SD_L2_lfnContinue = 0;   // set by SD_L2_SearchDir, a name may go on in the next cluster
+
+#define SD_L2_LFN_DONE  0x80
 
+// Offsets of the 13 characters in a long name entry
+const uint8_t SD_L2_lfnOffsets[13] = { 1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24, 28, 30 };
+#endif
+
+#if SD_ENABLE_EXFAT
+  #if !SD_ENABLE_LFN
+    #error "SD_ENABLE_EXFAT requires SD_ENABLE_LFN in sd_l2.h"
+  #endif
+// exFAT entry set (file, stream extension and name entries) being 
+// matched or collected, see SD_L2_ExFeed()
+SD_L2_File_t SD_L2_exFile;
+uint8_t  SD_L2_exLeft = 0;        // secondary entries left in the set
+uint8_t  SD_L2_exMatch;           // 1 while the set matches
+uint8_t  SD_L2_exNamePos;         // characters of the name seen, 0xff before the stream extension
+uint16_t SD_L2_exHash;            // name hash of the searched name
+uint8_t  SD_L2_exHashValid;       // 0 if the name has characters SD_L2_ExNameHash() can not up-case
+uint32_t SD_L2_exDirLast = 0;     // cluster SD_L2_ExDir() ended with, a set may go on in the next one
+#endif
+
+uint8_t     SD_L2_CacheRead(uint32_t sector, uint8_t **data);
+uint8_t     SD_L2_CacheWrite(uint32_t sector, const uint8_t *src);
+uint8_t     SD_L2_FatWindowRead(uint32_t sector, uint8_t **data);
 uint8_t     SD_L2_NextCluster(uint32_t *cluster);
+uint8_t     SD_L2_DirSector(const uint32_t cluster, uint32_t index, uint32_t *sector);
+void        SD_L2_ConvertName(uint8_t *filename, char *fnentry);
+uint8_t     SD_L2_MatchEntry(const uint8_t *entry, const char *fnentry, const uint8_t maskSet, const uint8_t maskUnset);
+uint8_t     SD_L2_ScanSector(const uint8_t *dir, const uint32_t *name, const uint8_t maskSet, const uint8_t maskUnset, uint16_t *offset);
+void        SD_L2_FillFileInfo(const uint8_t *entry, uint32_t sector, uint16_t offset, SD_L2_File_t *fileinfo);
+#if SD_ENABLE_LFN
+uint8_t     SD_L2_LfnPrepare(uint8_t *filename);
+uint8_t     SD_L2_LfnChecksum(const uint8_t *entry);
+uint8_t     SD_L2_LfnFeed(const uint8_t *entry, const uint8_t collect);
+void        SD_L2_LfnGetName(char *buf);
+#endif
+#if SD_ENABLE_EXFAT
+uint8_t     SD_L2_ExInit();
+uint8_t     SD_L2_ExNameHash(uint16_t *hash);
+uint8_t     SD_L2_ExFeed(const uint8_t *entry, uint32_t sector, uint16_t offset, const uint8_t collect);
+uint8_t     SD_L2_ExSearchFile(uint8_t *filename, const uint32_t cluster, const uint8_t maskSet, const uint8_t maskUnset, SD_L2_File_t *fileinfo);
+  #if SD_ENABLE_DIR_VIEW
+uint8_t     SD_L2_ExDir(const uint32_t cluster, const uint8_t maskSet, const uint8_t maskUnset, void (*callback)(char *entryLine));
+  #endif
+#endif
+uint16_t    SD_L2_IndexHash(const char *fnentry);
+void        SD_L2_IndexInsert(uint16_t hash, uint16_t entry);
+uint8_t     SD_L2_IndexSearch(const char *fnentry, const uint8_t maskSet, const uint8_t maskUnset, SD_L2_File_t *fileinfo);
+uint32_t    SD_L2_Get32(const uint8_t *p);
+uint64_t    SD_L2_Get64(const uint8_t *p);
+uint8_t     SD_L2_IndexFileSearch(uint8_t *filename, const uint8_t maskSet, const uint8_t maskUnset, SD_L2_File_t *fileinfo);
+uint8_t     SD_L2_SearchRun(uint8_t *filename, const uint32_t cluster, const uint32_t clusters, const uint8_t maskSet, const uint8_t maskUnset, SD_L2_File_t *fileinfo);
+#if SD_ENABLE_WRITE_ACCESS && SD_ENABLE_MULTIBLOCK_ACCESS
+uint8_t     SD_L2_FindFreeEntry(const uint32_t cluster, uint32_t *sector, uint16_t *offset, uint16_t *entry);
+uint8_t     SD_L2_FindFreeRun(uint32_t count, uint32_t *first);
+uint8_t     SD_L2_WriteFatRun(uint32_t first, uint32_t count);
+#endif
+#if SD_ENABLE_DIR_VIEW
+void        SD_L2_EntryName(const uint8_t *entry, char *buf);
+uint8_t     SD_L2_DirAdvance(SD_L2_DirCursor_t *cursor);
+#endif
 
 /**
  * Returns the first sector of a given cluster
@@ -23,6 +140,201 @@ uint32_t SD_L2_Cluster2Sector(uint32_t cluster)
     return((cluster << SD_L2_FAT.ClusterSizeShift) + SD_L2_FAT.DataStart);
 }
 
+#if SD_ENABLE_EXFAT
+/**
+ * Parse the exFAT boot sector in SD_L2_workBuf (part of SD_L2_Init).
+ * Only 512 byte sectors and clusters of up to 16 MB are supported.
+ *
+ * return Zero if successful, error code otherwise
+ */
+uint8_t SD_L2_ExInit()
+{
+    uint8_t shift = SD_L2_workBuf[0x6d];
+    
+    // MustBeZero area where FAT has its BPB
+    for(uint8_t i = 0x0b; i < 0x40; i++) {
+        if(SD_L2_workBuf[i]) return(SD_L2_ERROR_INVAL_BS);
+    }
+    if((SD_L2_workBuf[0x6c] != 9) || (shift > 15)) return(SD_L2_ERROR_INVAL_BS);
+    if((SD_L2_workBuf[0x6e] != 1) && (SD_L2_workBuf[0x6e] != 2)) return(SD_L2_ERROR_INVAL_BS);
+    
+    SD_L2_FAT.SecPerClus = 1 << shift;
+    SD_L2_FAT.ClusterSizeShift = shift;
+    SD_L2_FAT.NumFATs = SD_L2_workBuf[0x6e];
+    SD_L2_FAT.RsvdSecCnt = 0;
+    SD_L2_FAT.RootEntryCount = 0;
+    SD_L2_FAT.TotalSec = SD_L2_Get32(SD_L2_workBuf + 0x48);     // lower 32 bit of the volume length
+    SD_L2_FAT.SecPerFAT = SD_L2_Get32(SD_L2_workBuf + 0x54);
+    SD_L2_FAT.FatStart = SD_L2_FAT.BootSectorStart + SD_L2_Get32(SD_L2_workBuf + 0x50);
+    if((SD_L2_FAT.NumFATs == 2) && (SD_L2_workBuf[0x6a] & 0x01)) {
+        SD_L2_FAT.FatStart += SD_L2_FAT.SecPerFAT;     // second FAT is the active one
+    }
+    SD_L2_FAT.DataStart = SD_L2_FAT.BootSectorStart + SD_L2_Get32(SD_L2_workBuf + 0x58) - (2UL << shift);
+    SD_L2_FAT.ClusterCount = SD_L2_Get32(SD_L2_workBuf + 0x5c);
+    SD_L2_FAT.RootClus = SD_L2_Get32(SD_L2_workBuf + 0x60);
+    if((SD_L2_FAT.RootClus < 2) || (SD_L2_FAT.RootClus >= SD_L2_FAT.ClusterCount + 2)) return(SD_L2_ERROR_INVAL_BS);
+    SD_L2_FAT.RootDirStart = SD_L2_Cluster2Sector(SD_L2_FAT.RootClus);
+    SD_L2_FAT.ClusterEndMarker = 0xfffffff8UL;
+    SD_L2_FAT.PartType = SD_L2_PARTTYPE_EXFAT;
+    SD_L2_exDirLast = 0;
+    return(0);
+}
+#endif
+
+/**
+ * Forget all cached sectors, e.g. after the card was changed or
+ * written by other means than SD_L2_*. The counters are reset too.
+ */
+void SD_L2_CacheInvalidate()
+{
+    for(uint8_t i = 0; i < SD_L2_CACHE_ENTRIES; i++) {
+        SD_L2_cacheSector[i] = 0xffffffffUL;
+        SD_L2_cacheOrder[i] = i;
+    }
+#if SD_L2_FAT_WINDOW_SECTORS > 0
+    SD_L2_fatWinStart = 0xffffffffUL;
+    SD_L2_fatWinCount = 0;
+#endif
+    SD_L2_cacheStats.Hits = 0;
+    SD_L2_cacheStats.Misses = 0;
+    SD_L2_cacheStats.FatHits = 0;
+    SD_L2_cacheStats.FatLoads = 0;
+}
+
+/**
+ * Get a sector through the cache. On a miss the least recently used
+ * entry is replaced. Data points into the cache and stays valid until
+ * the next cache access. It may only be modified if it is written back
+ * with SD_L2_CacheWrite() right after.
+ *
+ * return Zero if successful, error code otherwise
+ */
+uint8_t SD_L2_CacheRead(uint32_t sector, uint8_t **data)
+{
+    uint8_t i, entry;
+    uint8_t retval;
+    
+    for(i = 0; i < SD_L2_CACHE_ENTRIES - 1; i++) {
+        if(SD_L2_cacheSector[SD_L2_cacheOrder[i]] == sector) break;
+    }
+    entry = SD_L2_cacheOrder[i];
+    
+    // Move entry to front
+    for(; i > 0; i--) SD_L2_cacheOrder[i] = SD_L2_cacheOrder[i-1];
+    SD_L2_cacheOrder[0] = entry;
+    *data = SD_L2_CacheData(entry);
+    
+    if(SD_L2_cacheSector[entry] == sector) {
+        SD_L2_cacheStats.Hits++;
+        return(0);
+    }
+    SD_L2_cacheStats.Misses++;
+    SD_L2_cacheSector[entry] = 0xffffffffUL;
+    retval = SD_L2_dev->ReadBlock(sector, SD_L2_CacheData(entry));
+    if(retval) return(retval);
+    SD_L2_cacheSector[entry] = sector;
+    return(0);
+}
+
+/**
+ * Write a sector through to the device and keep a cached copy
+ * of it up to date. If writing fails the cached copy is dropped,
+ * it may have been modified already.
+ *
+ * return Zero if successful, error code otherwise
+ */
+uint8_t SD_L2_CacheWrite(uint32_t sector, const uint8_t *src)
+{
+    uint8_t retval = SD_L2_dev->WriteBlock(sector, src);
+    
+    for(uint8_t i = 0; i < SD_L2_CACHE_ENTRIES; i++) {
+        if(SD_L2_cacheSector[i] != sector) continue;
+        if(retval) {
+            SD_L2_cacheSector[i] = 0xffffffffUL;
+        } else if(SD_L2_CacheData(i) != src) {
+            uint8_t *data = SD_L2_CacheData(i);
+            for(uint16_t k = 0; k < 512; k++) data[k] = src[k];
+        }
+    }
+#if SD_L2_FAT_WINDOW_SECTORS > 0
+    // FAT sectors are read through the FAT window
+    if((sector >= SD_L2_fatWinStart) && (sector - SD_L2_fatWinStart < SD_L2_fatWinCount)) {
+        if(retval) {
+            SD_L2_fatWinCount = 0;
+        } else {
+            uint8_t *win = SD_L2_fatWin[sector - SD_L2_fatWinStart];
+            for(uint16_t k = 0; k < 512; k++) win[k] = src[k];
+        }
+    }
+#endif
+    return(retval);
+}
+
+/**
+ * Get a FAT sector through the FAT window. On a miss the window is
+ * loaded with the sector and the ones following it in a single read
+ * run (one sector with a single block read), so walking a cluster 
+ * chain forward finds the next FAT sectors there already. Near the end of the FAT the window is moved back to
+ * stay within it. Data stays valid until the next window load.
+ * With SD_L2_FAT_WINDOW_SECTORS 0 FAT sectors are read through the
+ * sector cache instead.
+ *
+ * return Zero if successful, error code otherwise
+ */
+uint8_t SD_L2_FatWindowRead(uint32_t sector, uint8_t **data)
+{
+#if SD_L2_FAT_WINDOW_SECTORS == 0
+    return(SD_L2_CacheRead(sector, data));
+#else
+    uint32_t start = sector;
+    uint32_t fatEnd = SD_L2_FAT.FatStart + SD_L2_FAT.SecPerFAT;
+    uint16_t count = SD_L2_FAT_WINDOW_SECTORS;
+    uint16_t i;
+    uint8_t  retval;
+    
+    if((sector >= SD_L2_fatWinStart) && (sector - SD_L2_fatWinStart < SD_L2_fatWinCount)) {
+        SD_L2_cacheStats.FatHits++;
+        *data = SD_L2_fatWin[sector - SD_L2_fatWinStart];
+        return(0);
+    }
+    SD_L2_cacheStats.FatLoads++;
+    SD_L2_fatWinCount = 0;
+    
+    if((sector >= SD_L2_FAT.FatStart) && (sector < fatEnd)) {
+        if(count > SD_L2_FAT.SecPerFAT) count = SD_L2_FAT.SecPerFAT;
+        if(start + count > fatEnd) start = fatEnd - count;
+    } else {
+        count = 1;
+    }
+    
+    if((count == 1) || (SD_L2_dev->ReadRunStart == NULL)) {
+        for(i = 0; i < count; i++) {
+            retval = SD_L2_dev->ReadBlock(start + i, SD_L2_fatWin[i]);
+            if(retval) return(retval);
+        }
+    } else {
+        retval = SD_L2_dev->ReadRunStart(start);
+        if(retval) return(retval);
+        for(i = 0; i < count; i++) {
+            retval = SD_L2_dev->ReadRunAsync(SD_L2_fatWin[i]);
+            if(retval) break;
+            while((retval = SD_L2_dev->ReadPoll()) == SD_CARD_READ_PENDING) ;
+            if(retval) break;
+        }
+        if(retval) {
+            SD_L2_dev->ReadRunStop();
+            return(retval);
+        }
+        retval = SD_L2_dev->ReadRunStop();
+        if(retval) return(retval);
+    }
+    SD_L2_fatWinStart = start;
+    SD_L2_fatWinCount = count;
+    *data = SD_L2_fatWin[sector - start];
+    return(0);
+#endif
+}
+
 /** 
  * Returns next cluster of a given cluster
  *
@@ -34,37 +346,508 @@ uint8_t SD_L2_NextCluster(uint32_t *cluster)
 {
     uint32_t sector;
     uint16_t offset;
+    uint8_t  *fat;
     uint8_t  retval;
     
     // calculate sector where cluster information can be found
     if(SD_L2_FAT.PartType == SD_L2_PARTTYPE_FAT16) {
         sector = (*cluster >> 8) + SD_L2_FAT.FatStart;
         offset = (uint16_t)(*cluster & 0xff) << 1;
-    } else if(SD_L2_FAT.PartType == SD_L2_PARTTYPE_FAT32) {
+    } else if((SD_L2_FAT.PartType == SD_L2_PARTTYPE_FAT32) || (SD_L2_FAT.PartType == SD_L2_PARTTYPE_EXFAT)) {
         sector = (*cluster >> 7) + SD_L2_FAT.FatStart;
         offset = (uint16_t)(*cluster & 0x7f) << 2;
     } else {
         return(SD_L2_ERROR_FAT_NOT_INIT);
     }
     
-    // Read FAT sector if not already buffered
-    if(sector != SD_L2_LastFatSect) {
-        retval = SD_L1_ReadBlock(sector, SD_L2_FatCache);
-        if(retval) return(retval);
-        SD_L2_LastFatSect = sector;
-    }
+    retval = SD_L2_FatWindowRead(sector, &fat);
+    if(retval) return(retval);
     
     // Get FAT entry
-    if(SD_L2_FAT.PartType == SD_L2_PARTTYPE_FAT32) {
-        *cluster = ((uint32_t)SD_L2_FatCache[offset+3] << 24U) | ((uint32_t)SD_L2_FatCache[offset+2] << 16U);
+    if(SD_L2_FAT.PartType != SD_L2_PARTTYPE_FAT16) {
+        *cluster = ((uint32_t)fat[offset+3] << 24U) | ((uint32_t)fat[offset+2] << 16U);
     } else {
         *cluster = 0;
     }
-    *cluster += ((uint32_t)SD_L2_FatCache[offset+1] << 8U) | ((uint32_t)SD_L2_FatCache[offset]);
+    *cluster += ((uint32_t)fat[offset+1] << 8U) | ((uint32_t)fat[offset]);
+    
+    return(0);
+}
+
+/**
+ * Get the sector of the index-th sector (0 = first) of a directory, 
+ * following its cluster chain. Set cluster to 0 for root directory.
+ *
+ * return Zero if successful, SD_L2_ERROR_DIR_EOC behind the last 
+ *        sector of the directory, error code otherwise
+ */
+uint8_t SD_L2_DirSector(const uint32_t cluster, uint32_t index, uint32_t *sector)
+{
+    uint32_t clus = cluster;
+    uint8_t  retval;
+    
+    if(cluster == 0) {
+        if(SD_L2_FAT.PartType == SD_L2_PARTTYPE_FAT16) {
+            if(index >= ((32 * (uint32_t)SD_L2_FAT.RootEntryCount + 511)/512)) return(SD_L2_ERROR_DIR_EOC);
+            *sector = SD_L2_FAT.RootDirStart + index;
+            return(0);
+        }
+        clus = SD_L2_FAT.RootClus;
+    }
+    for(uint32_t i = index >> SD_L2_FAT.ClusterSizeShift; i > 0; i--) {
+        retval = SD_L2_NextCluster(&clus);
+        if(retval) return(retval);
+        if((clus < 2) || (clus >= SD_L2_FAT.ClusterCount + 2)) return(SD_L2_ERROR_DIR_EOC);
+    }
+    *sector = SD_L2_Cluster2Sector(clus) + (index & (SD_L2_FAT.SecPerClus - 1));
+    return(0);
+}
+
+/**
+ * Convert filename in 8.3 format to space-filled uppercase 
+ * format of directory entries, fnentry must hold 12 chars.
+ * A leading 0xE5 is converted to 0x05 like it is stored.
+ */
+void SD_L2_ConvertName(uint8_t *filename, char *fnentry)
+{
+    for(uint8_t i = 0; i < 11; i++) fnentry[i] = ' ';
+    for(uint8_t i = 0; i < 9; i++) {
+        uint8_t c = *filename++;
+        if(c < 0x20) {
+            filename--;     // no extension, do not read past the end
+            break;
+        }
+        if(c == '.') break;
+        if((c>='a') && (c<='z')) c -= 0x20;  // to upper case
+        fnentry[i] = c;
+    }
+    if((uint8_t)fnentry[0] == 0xE5) fnentry[0] = 0x05;  // stored as 0x05, 0xE5 marks deleted entries
+    for(uint8_t i = 8; i < 11; i++) {
+        uint8_t c = *filename++;
+        if(c < 0x20) break;
+        if((c>='a') && (c<='z')) c -= 0x20;  // to upper case
+        fnentry[i] = c;
+    }
+    fnentry[11] = 0;
+}
+
+/**
+ * Test if a directory entry is the file fnentry (see SD_L2_ConvertName)
+ * with attributes matching maskSet/maskUnset (see SD_L2_SearchFile).
+ * fnentry NULL tests the attributes only.
+ *
+ * return 1 if it matches, 0 otherwise
+ */
+uint8_t SD_L2_MatchEntry(const uint8_t *entry, const char *fnentry, const uint8_t maskSet, const uint8_t maskUnset)
+{
+    uint8_t attrib = entry[0x0b];
+    
+    if((entry[0] == 0) || (entry[0] == 0xe5)) return(0);   // free or deleted
+    // Test masks (skip long file name entries also)
+    if(((attrib & maskSet) != maskSet) || ((attrib & maskUnset) != 0) || (attrib == 0x0f)) return(0);
+    if(fnentry == NULL) return(1);
+    for(uint8_t k = 0; k < 11; k++) if(entry[k] != (uint8_t)fnentry[k]) return(0);
+    return(1);
+}
+
+/**
+ * Search a directory sector for the 8.3 name given as three words
+ * (SD_L2_ConvertName() output, byte 11 is ignored). The name is
+ * compared as 32 bit words, the sector must be word aligned.
+ * Free (0x00) and deleted (0xE5) entries fail the compare of the
+ * first word, a name never starts with these bytes. The first byte
+ * is only looked at then to find the end of the directory.
+ *
+ * return Zero if found with offset of the entry, SD_L2_ERROR_FILE_NOT_FOUND
+ *        at the end of the directory, SD_L2_ERROR_DIR_EOC if the
+ *        directory goes on in the next sector
+ */
+uint8_t SD_L2_ScanSector(const uint8_t *dir, const uint32_t *name, const uint8_t maskSet, const uint8_t maskUnset, uint16_t *offset)
+{
+    const uint32_t *entry = (const uint32_t *)dir;
+    
+    for(uint16_t j = 0; j < 512; j += 32, entry += 8) {
+        if(entry[0] != name[0]) {
+            if(dir[j] == 0) return(SD_L2_ERROR_FILE_NOT_FOUND);    // Last entry when first character of filename == 0
+            continue;
+        }
+        if((entry[1] != name[1]) || ((entry[2] ^ name[2]) & SD_L2_EXT_MASK)) continue;
+        // Test masks, a long file name entry may look like the name
+        if(!SD_L2_MatchEntry(dir + j, NULL, maskSet, maskUnset)) continue;
+        *offset = j;
+        return(0);
+    }
+    return(SD_L2_ERROR_DIR_EOC);
+}
+
+/**
+ * Fill fileinfo from a directory entry found at sector/offset.
+ */
+void SD_L2_FillFileInfo(const uint8_t *entry, uint32_t sector, uint16_t offset, SD_L2_File_t *fileinfo)
+{
+    fileinfo->Attributes = entry[0x0b];
+    fileinfo->Size = (uint32_t)entry[0x1c] | (((uint32_t)entry[0x1d])<<8) 
+                    | (((uint32_t)entry[0x1e])<<16) | (((uint32_t)entry[0x1f])<<24);
+    if(SD_L2_FAT.PartType == SD_L2_PARTTYPE_FAT16) {
+        fileinfo->FirstCluster = (uint32_t)entry[0x1a] | (((uint32_t)entry[0x1b])<<8);
+    } else {
+        fileinfo->FirstCluster = (uint32_t)entry[0x1a] | (((uint32_t)entry[0x1b])<<8) 
+             | (((uint32_t)entry[0x14])<<16) | (((uint32_t)entry[0x15])<<24);
+    }	
+    
+    // Initialize some things
+    fileinfo->ActSector = SD_L2_Cluster2Sector(fileinfo->FirstCluster);
+    fileinfo->ActBytePos = 0;
+    fileinfo->DirSector = sector;
+    fileinfo->DirOffset = offset;
+    fileinfo->Contiguous = 0;
+}
+
+#if SD_ENABLE_LFN
+/**
+ * Prepare the search of a long name: filename (UTF-8) is put into
+ * SD_L2_lfnName in upper case (a-z only). Names longer than 
+ * SD_L2_LFN_MAX can not be found.
+ *
+ * return 1 if filename has to be searched as long name, 0 if it is
+ * a valid 8.3 name (or no UTF-8, e.g. OEM characters of a short name)
+ */
+uint8_t SD_L2_LfnPrepare(uint8_t *filename)
+{
+    uint8_t n = 0, base = 0, ext = 0, dots = 0, isLong = 0;
+    
+    for(;;) {
+        uint16_t c = *filename++;
+        
+        if(c < 0x20) break;
+        if(c >= 0x80) {
+            // two or three byte UTF-8 sequence
+            isLong = 1;
+            if((c >= 0xc0) && (c < 0xe0) && ((filename[0] & 0xc0) == 0x80)) {
+                c = ((c & 0x1f) << 6) | (filename[0] & 0x3f);
+                filename += 1;
+            } else if((c >= 0xe0) && (c < 0xf0) && ((filename[0] & 0xc0) == 0x80) && ((filename[1] & 0xc0) == 0x80)) {
+                c = ((c & 0x0f) << 12) | ((uint16_t)(filename[0] & 0x3f) << 6) | (filename[1] & 0x3f);
+                filename += 2;
+            } else {
+                SD_L2_lfnLength = 0;
+                return(0);
+            }
+        } else if(c == '.') {
+            if((dots++ > 0) || (base == 0)) isLong = 1;
+        } else {
+            if((c == ' ') || (c == '+') || (c == ',') || (c == ';') || (c == '=') || (c == '[') || (c == ']')) isLong = 1;
+            if(dots) ext++; else base++;
+        }
+        if(n >= SD_L2_LFN_MAX) {
+            SD_L2_lfnLength = 0;    // too long, matches nothing
+            return(1);
+        }
+        if((c >= 'a') && (c <= 'z')) c -= 0x20;  // to upper case
+        SD_L2_lfnName[n++] = c;
+    }
+    SD_L2_lfnLength = n;
+    return(isLong || (base > 8) || (ext > 3));
+}
+
+/**
+ * Checksum of the 8.3 name of a directory entry as stored in the 
+ * entries of its long name.
+ */
+uint8_t SD_L2_LfnChecksum(const uint8_t *entry)
+{
+    uint8_t sum = 0;
+    
+    for(uint8_t i = 0; i < 11; i++) sum = (uint8_t)(((sum & 1) << 7) + (sum >> 1) + entry[i]);
+    return(sum);
+}
+
+/**
+ * Feed the entries of a directory one by one to match (collect = 0) 
+ * the name prepared by SD_L2_LfnPrepare() or to collect (collect = 1) 
+ * long names in SD_L2_lfnName.
+ *
+ * The entries of a long name come in reverse order right before the 
+ * short name entry of the file, each one with 13 characters and the 
+ * checksum of the short name. The first one holds the end of the name
+ * and the number of entries, so a search drops names of another 
+ * length before comparing any character. The others are compared as
+ * they come, the checksum ties them to the short name entry at last.
+ *
+ * return 1 if entry is a short name entry with a matching (collected)
+ * long name in front of it, 0 otherwise
+ */
+uint8_t SD_L2_LfnFeed(const uint8_t *entry, const uint8_t collect)
+{
+    uint8_t order = entry[0] & 0x3f;
+    uint8_t pos;
     
+    if(entry[0] == 0xe5) {
+        SD_L2_lfnNext = 0;      // deleted
+        return(0);
+    }
+    if(entry[0x0b] != 0x0f) {
+        // short name entry, complete if the checksum matches
+        uint8_t done = (SD_L2_lfnNext == SD_L2_LFN_DONE) && (SD_L2_LfnChecksum(entry) == SD_L2_lfnChecksum);
+        SD_L2_lfnNext = 0;
+        return(done);
+    }
+    
+    if(entry[0] & 0x40) {
+        // end of the name, first entry
+        SD_L2_lfnNext = 0;
+        if((order == 0) || (order > 20)) return(0);
+        if(collect) {
+            SD_L2_lfnLength = order * 13;   // unless a terminator comes
+        } else if((SD_L2_lfnLength > order * 13) || (SD_L2_lfnLength <= (order - 1) * 13)) {
+            return(0);
+        }
+        SD_L2_lfnNext = order;
+        SD_L2_lfnChecksum = entry[13];
+    }
+    if((order != SD_L2_lfnNext) || (entry[13] != SD_L2_lfnChecksum)) {
+        SD_L2_lfnNext = 0;
+        return(0);
+    }
+    
+    pos = (order - 1) * 13;
+    for(uint8_t i = 0; i < 13; i++, pos++) {
+        uint16_t c = (uint16_t)entry[SD_L2_lfnOffsets[i]] | ((uint16_t)entry[SD_L2_lfnOffsets[i] + 1] << 8);
+        
+        if(collect) {
+            if(c == 0) {
+                SD_L2_lfnLength = pos;
+                break;
+            }
+            if(pos >= SD_L2_LFN_MAX) {
+                SD_L2_lfnNext = 0;  // too long to show
+                return(0);
+            }
+            SD_L2_lfnName[pos] = c;
+        } else {
+            if(pos == SD_L2_lfnLength) {
+                if(c != 0) SD_L2_lfnNext = 0;
+                break;
+            }
+            if((c >= 'a') && (c <= 'z')) c -= 0x20;  // to upper case
+            if(c != SD_L2_lfnName[pos]) {
+                SD_L2_lfnNext = 0;
+                return(0);
+            }
+        }
+    }
+    if(SD_L2_lfnNext) SD_L2_lfnNext = (order == 1) ? SD_L2_LFN_DONE : order - 1;
     return(0);
 }
 
+#if SD_ENABLE_DIR_VIEW
+/**
+ * Long name collected by SD_L2_LfnFeed() as UTF-8, buf must hold
+ * SD_L2_NAME_MAX bytes.
+ */
+void SD_L2_LfnGetName(char *buf)
+{
+    for(uint8_t i = 0; i < SD_L2_lfnLength; i++) {
+        uint16_t c = SD_L2_lfnName[i];
+        
+        if(c < 0x80) {
+            *buf++ = (char)c;
+        } else if(c < 0x800) {
+            *buf++ = (char)(0xc0 | (c >> 6));
+            *buf++ = (char)(0x80 | (c & 0x3f));
+        } else {
+            *buf++ = (char)(0xe0 | (c >> 12));
+            *buf++ = (char)(0x80 | ((c >> 6) & 0x3f));
+            *buf++ = (char)(0x80 | (c & 0x3f));
+        }
+    }
+    *buf = 0;
+}
+#endif  /* SD_ENABLE_DIR_VIEW */
+#endif  /* SD_ENABLE_LFN */
+
+#if SD_ENABLE_EXFAT
+/**
+ * Name hash of exFAT stream extension entries for the name in 
+ * SD_L2_lfnName (see SD_L2_LfnPrepare). exFAT hashes the up-cased name
+ * with the up-case table of the volume, only a-z are known here.
+ *
+ * return 1 if successful, 0 if the name has other characters than ASCII
+ */
+uint8_t SD_L2_ExNameHash(uint16_t *hash)
+{
+    uint16_t h = 0;
+    
+    for(uint8_t i = 0; i < SD_L2_lfnLength; i++) {
+        uint16_t c = SD_L2_lfnName[i];
+        
+        if(c >= 0x80) return(0);
+        h = ((h & 1) ? 0x8000 : 0) + (h >> 1) + (uint8_t)c;
+        h = ((h & 1) ? 0x8000 : 0) + (h >> 1);     // high byte is 0
+    }
+    *hash = h;
+    return(1);
+}
+
+/**
+ * Feed the entries of an exFAT directory one by one to match 
+ * (collect = 0) the name prepared by SD_L2_LfnPrepare() or to collect
+ * (collect = 1) the names in SD_L2_lfnName, names longer than 
+ * SD_L2_LFN_MAX are cut then.
+ *
+ * A file is a set of a file entry, a stream extension entry and name 
+ * entries of 15 characters each. The stream extension holds length 
+ * and hash of the name, so a search drops other names before 
+ * comparing any character.
+ *
+ * return 1 if entry completes a set with a matching (collected) name,
+ * SD_L2_exFile holds the file then, 0 otherwise
+ */
+uint8_t SD_L2_ExFeed(const uint8_t *entry, uint32_t sector, uint16_t offset, const uint8_t collect)
+{
+    uint8_t type = entry[0];
+    
+    if(type == 0x85) {
+        // file entry starts a set
+        SD_L2_exLeft = entry[1];
+        SD_L2_exMatch = (entry[1] >= 2);
+        SD_L2_exNamePos = 0xff;
+        SD_L2_exFile.Attributes = entry[4];
+        SD_L2_exFile.DirSector = sector;
+        SD_L2_exFile.DirOffset = offset;
+        return(0);
+    }
+    if(!(type & 0x80)) {
+        SD_L2_exLeft = 0;   // deleted entry, breaks a set
+        return(0);
+    }
+    if(SD_L2_exLeft == 0) return(0);    // no set, e.g. bitmap or up-case table
+    SD_L2_exLeft--;
+    if(!SD_L2_exMatch) return(0);
+    
+    if(type == 0xc0) {
+        // stream extension, first secondary entry
+        uint8_t  length = entry[3];
+        uint16_t hash = (uint16_t)entry[4] | ((uint16_t)entry[5] << 8);
+        
+        if(collect) {
+            SD_L2_lfnLength = (length > SD_L2_LFN_MAX) ? SD_L2_LFN_MAX : length;
+        } else if((length != SD_L2_lfnLength) || (SD_L2_exHashValid && (hash != SD_L2_exHash))) {
+            SD_L2_exMatch = 0;
+            return(0);
+        }
+        // ValidDataLength, bytes behind it up to DataLength (entry + 24) 
+        // are allocated but undefined; 4 GB and more can not be handled
+        if(SD_L2_Get32(entry + 12)) SD_L2_exMatch = 0;
+        SD_L2_exFile.FirstCluster = SD_L2_Get32(entry + 20);
+        SD_L2_exFile.Size = SD_L2_Get32(entry + 8);
+        SD_L2_exFile.Contiguous = (entry[1] & 0x02) ? 1 : 0;    // NoFatChain
+        SD_L2_exFile.ActSector = SD_L2_Cluster2Sector(SD_L2_exFile.FirstCluster);
+        SD_L2_exFile.ActBytePos = 0;
+        SD_L2_exNamePos = 0;
+    } else if(type == 0xc1) {
+        // file name entry
+        if(SD_L2_exNamePos == 0xff) {
+            SD_L2_exMatch = 0;
+            return(0);
+        }
+        for(uint8_t i = 2; (i < 32) && (SD_L2_exNamePos < SD_L2_lfnLength); i += 2) {
+            uint16_t c = (uint16_t)entry[i] | ((uint16_t)entry[i + 1] << 8);
+            
+            if(collect) {
+                SD_L2_lfnName[SD_L2_exNamePos++] = c;
+            } else {
+                if((c >= 'a') && (c <= 'z')) c -= 0x20;  // to upper case
+                if(c != SD_L2_lfnName[SD_L2_exNamePos++]) {
+                    SD_L2_exMatch = 0;
+                    return(0);
+                }
+            }
+        }
+    }
+    return((SD_L2_exLeft == 0) && (SD_L2_exNamePos == SD_L2_lfnLength));
+}
+
+/**
+ * SD_L2_SearchFile() for exFAT, long names only. Files with the 
+ * NoFatChain flag come with fileinfo->Contiguous set.
+ *
+ * return Zero if successful, error code otherwise
+ */
+uint8_t SD_L2_ExSearchFile(uint8_t *filename, const uint32_t cluster, const uint8_t maskSet, const uint8_t maskUnset, SD_L2_File_t *fileinfo)
+{
+    uint32_t startsect = SD_L2_Cluster2Sector(cluster ? cluster : SD_L2_FAT.RootClus);
+    
+    SD_L2_LfnPrepare(filename);
+    SD_L2_exHashValid = SD_L2_ExNameHash(&SD_L2_exHash);
+    if(!SD_L2_lfnContinue) SD_L2_exLeft = 0;
+    SD_L2_lfnContinue = 0;
+    
+    for(uint16_t i = 0; i < SD_L2_FAT.SecPerClus; i++) {
+        uint8_t *dir;
+        uint8_t retval = SD_L2_CacheRead(startsect + i, &dir);
+        if(retval) return(retval);
+        
+        for(uint16_t j = 0; j<512; j+=32) {
+            uint8_t attrib;
+            
+            if(dir[j] == 0) return(SD_L2_ERROR_FILE_NOT_FOUND);    // end of directory
+            if(!SD_L2_ExFeed(dir + j, startsect + i, j, 0)) continue;
+            attrib = SD_L2_exFile.Attributes;
+            if(((attrib & maskSet) == maskSet) && ((attrib & maskUnset) == 0)) {
+                *fileinfo = SD_L2_exFile;
+                return(0);
+            }
+        }
+    }
+    return(SD_L2_ERROR_DIR_EOC);
+}
+
+#if SD_ENABLE_DIR_VIEW
+/**
+ * SD_L2_Dir() for exFAT. A file split over two clusters is shown if 
+ * the next call is for the following cluster of the directory.
+ */
+uint8_t SD_L2_ExDir(const uint32_t cluster, const uint8_t maskSet, const uint8_t maskUnset, void (*callback)(char *entryLine))
+{
+    uint32_t clus = cluster ? cluster : SD_L2_FAT.RootClus;
+    uint32_t startsect = SD_L2_Cluster2Sector(clus);
+    char buf[SD_L2_NAME_MAX];
+    
+    // a set of the last call goes on if this is its next cluster (contiguous or chained)
+    if(SD_L2_exDirLast == 0) {
+        SD_L2_exLeft = 0;
+    } else if(clus != SD_L2_exDirLast + 1) {
+        uint32_t next = SD_L2_exDirLast;
+        uint8_t retval = SD_L2_NextCluster(&next);
+        if(retval) return(retval);
+        if(next != clus) SD_L2_exLeft = 0;
+    }
+    SD_L2_exDirLast = 0;
+    
+    for(uint16_t i = 0; i < SD_L2_FAT.SecPerClus; i++) {
+        uint8_t *dir;
+        uint8_t retval = SD_L2_CacheRead(startsect + i, &dir);
+        if(retval) return(retval);
+        
+        for(uint16_t j = 0; j<512; j+=32) {
+            uint8_t attrib;
+            
+            if(dir[j] == 0) return(0);    // end of directory
+            if(!SD_L2_ExFeed(dir + j, startsect + i, j, 1)) continue;
+            attrib = SD_L2_exFile.Attributes;
+            if(((attrib & maskSet) == maskSet) && ((attrib & maskUnset) == 0)) {
+                SD_L2_LfnGetName(buf);
+                callback(buf);
+            }
+        }
+    }
+    SD_L2_exDirLast = clus;
+    return(SD_L2_ERROR_DIR_EOC);
+}
+#endif  /* SD_ENABLE_DIR_VIEW */
+#endif  /* SD_ENABLE_EXFAT */
+
 /**
  * Test if file is completely not fragmented.
  *
@@ -77,8 +860,8 @@ uint8_t SD_L2_IsFileFragmented(SD_L2_File_t *fileinfo)
     uint32_t bytecount = 0;
     uint32_t bytepercluster = 512 * SD_L2_FAT.SecPerClus;
     uint8_t  retval = 0;
-    SD_L2_FatCache = SD_L2_workBuf;
-    SD_L2_LastFatSect = 0xffffffffUL;
+    
+    if(fileinfo->Contiguous) return(0);
     while(retval == 0) {
         retval = SD_L2_NextCluster(&startCluster);
         if(retval) return(retval);
@@ -96,6 +879,76 @@ uint8_t SD_L2_IsFileFragmented(SD_L2_File_t *fileinfo)
     }
 }
 
+/**
+ * Get the runs of contiguous sectors of a file by walking its cluster
+ * chain once. Adjacent clusters are merged, the last extent ends with
+ * the last sector holding file data. An empty file has no extents.
+ *
+ * return Zero if successful, SD_L2_ERROR_EXTENTS_FULL if the file has
+ *        more than maxExtents extents, error code otherwise
+ */
+uint8_t SD_L2_GetExtents(SD_L2_File_t *fileinfo, SD_L2_Extent_t *extents, uint16_t maxExtents, uint16_t *count)
+{
+    uint32_t cluster = fileinfo->FirstCluster;
+    uint32_t sectorsLeft = (fileinfo->Size + 511) >> 9;
+    uint16_t n = 0;
+    uint8_t  retval;
+    
+    *count = 0;
+    if(fileinfo->Contiguous && sectorsLeft) {
+        // known to be one run, e.g. from the index file
+        if((cluster < 2) || (cluster >= SD_L2_FAT.ClusterCount + 2)) return(SD_L2_ERROR_FAT_ENTRY);
+        if(maxExtents == 0) return(SD_L2_ERROR_EXTENTS_FULL);
+        extents[0].StartSector = SD_L2_Cluster2Sector(cluster);
+        extents[0].Sectors = sectorsLeft;
+        extents[0].FileSector = 0;
+        *count = 1;
+        return(0);
+    }
+    while(sectorsLeft) {
+        uint32_t sector = SD_L2_Cluster2Sector(cluster);
+        uint32_t len = (sectorsLeft < SD_L2_FAT.SecPerClus) ? sectorsLeft : SD_L2_FAT.SecPerClus;
+        
+        if((cluster < 2) || (cluster >= SD_L2_FAT.ClusterCount + 2)) return(SD_L2_ERROR_FAT_ENTRY);
+        if(n && (extents[n-1].StartSector + extents[n-1].Sectors == sector)) {
+            extents[n-1].Sectors += len;
+        } else {
+            if(n >= maxExtents) return(SD_L2_ERROR_EXTENTS_FULL);
+            extents[n].StartSector = sector;
+            extents[n].Sectors = len;
+            extents[n].FileSector = ((fileinfo->Size + 511) >> 9) - sectorsLeft;
+            n++;
+        }
+        sectorsLeft -= len;
+        if(sectorsLeft) {
+            retval = SD_L2_NextCluster(&cluster);
+            if(retval) return(retval);
+        }
+    }
+    *count = n;
+    return(0);
+}
+
+/**
+ * Binary search the extent holding the given sector of the file 
+ * (0 = first sector) in a table of SD_L2_GetExtents().
+ *
+ * return Index of the extent, count if fileSector is behind the file
+ */
+uint16_t SD_L2_FindExtent(const SD_L2_Extent_t *extents, uint16_t count, uint32_t fileSector)
+{
+    uint16_t lo = 0, hi = count;
+    
+    if((count == 0) || (fileSector >= extents[count-1].FileSector + extents[count-1].Sectors)) return(count);
+    
+    // find last extent starting at or before fileSector
+    while(hi - lo > 1) {
+        uint16_t mid = (lo + hi) >> 1;
+        if(extents[mid].FileSector <= fileSector) lo = mid; else hi = mid;
+    }
+    return(lo);
+}
+
 /**
  * DeInitialize the file system (for safe power down mode)
  *
@@ -104,19 +957,23 @@ uint8_t SD_L2_IsFileFragmented(SD_L2_File_t *fileinfo)
 void SD_L2_DeInit()
 {
     SD_L2_FAT.PartType = SD_L2_PARTTYPE_UNKNOWN;
-    SD_L1_DeInit();
+    SD_L2_CacheInvalidate();
+    if(SD_L2_dev) SD_L2_dev->DeInit();
 }
 
 /**
  * Initialize the file system .
  *
  * Does the lower level initialization and
- * tries to find the boot sector of the first FAT16
- * or FAT32 partition and parse it.
- * Workbuf must hold at least 512 bytes.
- * Workbuf will be used later also for following functions:
- * - SD_L2_SearchFile
- * - SD_L2_Dir
+ * tries to find the boot sector of the first FAT16,
+ * FAT32 or exFAT (read only) partition and parse it.
+ * Workbuf must hold at least 512 bytes, it is only used during
+ * initialization. Directory sectors are read through a cache of
+ * SD_L2_CACHE_SECTORS sectors later, FAT sectors through a window of
+ * SD_L2_FAT_WINDOW_SECTORS sectors. Both are emptied here.
+ * With SD_L2_CACHE_SECTORS 0 the work buffer is the only cache sector,
+ * it is overwritten by every directory or FAT read later and must be
+ * 4 byte aligned.
  *
  * \return Zero if successful, error code otherwise
  */
@@ -128,19 +985,25 @@ uint8_t SD_L2_Init(uint8_t *pWorkBuf)
     uint32_t temp32;
     
     SD_L2_FAT.PartType = SD_L2_PARTTYPE_UNKNOWN;
-    SD_L2_LastFatSect = 0;
+    SD_L2_CacheInvalidate();
+    SD_L2_indexBuilt = 0;
+    SD_L2_idxLoaded = 0;
     
     if(pWorkBuf == NULL) return(SD_L2_ERROR_WORKBUF);
+#if SD_L2_CACHE_SECTORS == 0
+    if((uintptr_t)pWorkBuf & 3) return(SD_L2_ERROR_WORKBUF);
+#endif
     SD_L2_workBuf = pWorkBuf;
     
     // Try init SD-Card
-    retval = SD_L1_Init();
+    if(SD_L2_dev == NULL) return(SD_L2_ERROR_NO_DEVICE);
+    retval = SD_L2_dev->Init(SD_L2_workBuf);
     if(retval) return(retval);
     
     // ==== MBR (partition table) access here =====
     
     // Read sector 0 
-    retval = SD_L1_ReadBlock(0, SD_L2_workBuf);
+    retval = SD_L2_dev->ReadBlock(0, SD_L2_workBuf);
     if(retval) return(retval);
 
     // Test for signature (valid not only for MBR, but FAT Boot Sector as well!)
@@ -153,10 +1016,10 @@ uint8_t SD_L2_Init(uint8_t *pWorkBuf)
                              | ((uint32_t)SD_L2_workBuf[0x1be + 0x0a] << 16UL)
                              | ((uint32_t)SD_L2_workBuf[0x1be + 0x0b] << 24UL);
     
-    // Check MBR values for plausibility
+    // Check MBR values for plausibility (0x07 is exFAT or NTFS)
     if(  ((SD_L2_workBuf[0x1be] & 0x7f) == 0)
       && ((PartType == 0x04) || (PartType == 0x06) || (PartType == 0x0B) 
-           || (PartType == 0x0C) || (PartType == 0x0E)) )  
+           || (PartType == 0x0C) || (PartType == 0x0E) || (PartType == 0x07)) )  
     {
         // MBR seems to contain valid FAT16/FAT32 partition entry
         SD_L2_FAT.PartType = ((PartType == 0x0B) || (PartType == 0x0C)) ? SD_L2_PARTTYPE_FAT32 : SD_L2_PARTTYPE_FAT16;
@@ -171,12 +1034,21 @@ uint8_t SD_L2_Init(uint8_t *pWorkBuf)
     // ====== FAT access here ======
     
     // Read Boot-Sector and test for signature
-    retval = SD_L1_ReadBlock(SD_L2_FAT.BootSectorStart, SD_L2_workBuf);
+    retval = SD_L2_dev->ReadBlock(SD_L2_FAT.BootSectorStart, SD_L2_workBuf);
     if(retval) return(retval);  
 
     // Test for signature (valid not only for MBR, but FAT Boot Sector as well!)
     if((SD_L2_workBuf[0x1fe] != 0x55) || (SD_L2_workBuf[0x1ff] != 0xaa)) return(SD_L2_ERROR_INVAL_BS);
     
+#if SD_ENABLE_EXFAT
+    // exFAT boot sectors have no BPB, but their own name
+    if(  (SD_L2_workBuf[3] == 'E') && (SD_L2_workBuf[4] == 'X') && (SD_L2_workBuf[5] == 'F') 
+      && (SD_L2_workBuf[6] == 'A') && (SD_L2_workBuf[7] == 'T') && (SD_L2_workBuf[8] == ' ') ) 
+    {
+        return(SD_L2_ExInit());
+    }
+#endif
+    
     // Plausibility checks for FAT
     if((SD_L2_workBuf[0x0b] != 0x00) || (SD_L2_workBuf[0x0c] != 0x02) || (SD_L2_workBuf[0x15] != 0xf8)) return(SD_L2_ERROR_INVAL_BS);
 
@@ -225,22 +1097,340 @@ uint8_t SD_L2_Init(uint8_t *pWorkBuf)
         SD_L2_FAT.ClusterEndMarker = 0xfff8UL;
     } else {
         temp32 = (uint32_t)SD_L2_workBuf[0x2c] | ((uint32_t)SD_L2_workBuf[0x2d]<<8U) | ((uint32_t)SD_L2_workBuf[0x2e]<<16U) | ((uint32_t)SD_L2_workBuf[0x2f]<<24U);
+        SD_L2_FAT.RootClus = temp32;
         SD_L2_FAT.RootDirStart = SD_L2_Cluster2Sector(temp32);
         SD_L2_FAT.PartType = SD_L2_PARTTYPE_FAT32;
         SD_L2_FAT.ClusterEndMarker = 0xffffff8UL;
     }
-      
-    return 0;
+      
+    return 0;
+}
+
+/**
+ * Set up a hashed index for lookups in one directory (0 = root 
+ * directory). It maps the 8.3 names to their directory entries and
+ * is built on the next lookup in that directory or by SD_L2_IndexBuild().
+ * slots must hold count entries of 4 bytes each, they are filled up 
+ * to 3/4 at most. If the directory has more entries, lookups of names
+ * not in the index search the directory as usual.
+ *
+ * The index stays valid for files created by SD_L2_CreateFile(), 
+ * SD_L2_Init() drops it. Pass NULL as slots to remove the index.
+ */
+void SD_L2_IndexSetup(const uint32_t cluster, SD_L2_IndexSlot_t *slots, uint16_t count)
+{
+    SD_L2_indexSlots = (count > 1) ? slots : NULL;
+    SD_L2_indexCount = count;
+    SD_L2_indexCluster = cluster;
+    SD_L2_indexBuilt = 0;
+}
+
+/**
+ * Hash of an 8.3 name in directory entry format (FNV-1a folded to 16 bit).
+ */
+uint16_t SD_L2_IndexHash(const char *fnentry)
+{
+    uint32_t h = 2166136261UL;
+    for(uint8_t k = 0; k < 11; k++) {
+        h ^= (uint8_t)fnentry[k];
+        h *= 16777619UL;
+    }
+    return((uint16_t)(h ^ (h >> 16)));
+}
+
+/**
+ * Add directory entry number entry to the index (linear probing).
+ */
+void SD_L2_IndexInsert(uint16_t hash, uint16_t entry)
+{
+    uint16_t slot = hash % SD_L2_indexCount;
+    
+    if((uint32_t)SD_L2_indexUsed + 1 > ((uint32_t)SD_L2_indexCount * 3) / 4) {
+        SD_L2_indexComplete = 0;
+        return;
+    }
+    while(SD_L2_indexSlots[slot].Entry) {
+        if(++slot >= SD_L2_indexCount) slot = 0;
+    }
+    SD_L2_indexSlots[slot].Hash = hash;
+    SD_L2_indexSlots[slot].Entry = entry + 1;
+    SD_L2_indexUsed++;
+}
+
+/**
+ * Build the index set up by SD_L2_IndexSetup() by reading the whole
+ * directory once. SD_L2_SearchFile() does this on its first lookup
+ * in that directory, call it after init to take that time at startup.
+ *
+ * return Zero if successful, error code otherwise
+ */
+uint8_t SD_L2_IndexBuild()
+{
+    uint8_t retval;
+    
+    if((SD_L2_FAT.PartType != SD_L2_PARTTYPE_FAT16) && (SD_L2_FAT.PartType != SD_L2_PARTTYPE_FAT32)) return(SD_L2_ERROR_FAT_NOT_INIT);
+    if(SD_L2_indexSlots == NULL) return(0);
+    
+    for(uint16_t i = 0; i < SD_L2_indexCount; i++) SD_L2_indexSlots[i].Entry = 0;
+    SD_L2_indexUsed = 0;
+    SD_L2_indexComplete = 1;
+    SD_L2_indexBuilt = 0;
+    
+    // a directory has 65536 entries at most (4096 sectors)
+    for(uint16_t i = 0; i < 4096; i++) {
+        uint32_t sector;
+        uint8_t  *dir;
+        
+        // a chained directory is followed from its start for each 
+        // sector, the FAT sectors are in the FAT window
+        retval = SD_L2_DirSector(SD_L2_indexCluster, i, &sector);
+        if(retval == SD_L2_ERROR_DIR_EOC) break;
+        if(retval) return(retval);
+        retval = SD_L2_CacheRead(sector, &dir);
+        if(retval) return(retval);
+        
+        for(uint16_t j = 0; j<512; j+=32) {
+            if(dir[j] == 0) {
+                // Last entry
+                SD_L2_indexBuilt = 1;
+                return(0);
+            }
+            if((dir[j] == 0xe5) || (dir[j+0x0b] == 0x0f)) continue;
+            SD_L2_IndexInsert(SD_L2_IndexHash((const char *)dir + j), (i << 4) | (j >> 5));
+        }
+    }
+    SD_L2_indexBuilt = 1;
+    return(0);
+}
+
+/**
+ * Look up fnentry in the index, each candidate with the same hash 
+ * is compared with its directory entry.
+ *
+ * return Zero if found, SD_L2_ERROR_FILE_NOT_FOUND if not in the index,
+ *        error code otherwise
+ */
+uint8_t SD_L2_IndexSearch(const char *fnentry, const uint8_t maskSet, const uint8_t maskUnset, SD_L2_File_t *fileinfo)
+{
+    uint16_t hash = SD_L2_IndexHash(fnentry);
+    uint16_t slot = hash % SD_L2_indexCount;
+    uint8_t  retval;
+    
+    while(SD_L2_indexSlots[slot].Entry) {
+        if(SD_L2_indexSlots[slot].Hash == hash) {
+            uint16_t entry = SD_L2_indexSlots[slot].Entry - 1;
+            uint32_t sector;
+            uint8_t  *dir;
+            
+            retval = SD_L2_DirSector(SD_L2_indexCluster, entry >> 4, &sector);
+            if(retval) return(retval);
+            retval = SD_L2_CacheRead(sector, &dir);
+            if(retval) return(retval);
+            dir += (entry & 15) << 5;
+            if(SD_L2_MatchEntry(dir, fnentry, maskSet, maskUnset)) {
+                SD_L2_FillFileInfo(dir, sector, (entry & 15) << 5, fileinfo);
+                return(0);
+            }
+        }
+        if(++slot >= SD_L2_indexCount) slot = 0;
+    }
+    return(SD_L2_ERROR_FILE_NOT_FOUND);
+}
+
+/** Little endian 32 bit value */
+uint32_t SD_L2_Get32(const uint8_t *p)
+{
+    return((uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24));
+}
+
+/** Little endian 64 bit value */
+uint64_t SD_L2_Get64(const uint8_t *p)
+{
+    return((uint64_t)SD_L2_Get32(p) | ((uint64_t)SD_L2_Get32(p + 4) << 32));
+}
+
+/**
+ * Load the index file of the root directory written by 
+ * tools/bsda_mkindex.py (default name BSDAIDX.BIN). SD_L2_SearchFile()
+ * looks up names in the root directory there first, long names
+ * included, with a binary search of two block reads and one read of 
+ * the directory entry to verify the hit. Names not found in the index 
+ * are searched in the directory as usual.
+ *
+ * The index is checked against the directory sector holding its last
+ * entry, so adding or removing files at the end of the directory is 
+ * detected at load time. Any other change is detected when the entry 
+ * of a hit does not match, the index is not used from then on.
+ *
+ * SD_L2_Init() unloads the index.
+ *
+ * return Zero if successful, error code otherwise
+ */
+uint8_t SD_L2_IndexFileLoad(uint8_t *filename)
+{
+    SD_L2_File_t idxinfo;
+    uint32_t dirEntries, checksum, sector;
+    uint32_t h = 2166136261UL;
+    uint8_t  *buf;
+    uint8_t  retval;
+    
+    SD_L2_idxLoaded = 0;
+    if((SD_L2_FAT.PartType != SD_L2_PARTTYPE_FAT16) && (SD_L2_FAT.PartType != SD_L2_PARTTYPE_FAT32)) return(SD_L2_ERROR_FAT_NOT_INIT);
+    retval = SD_L2_SearchFile(filename, 0, 0x00, 0x18, &idxinfo);
+    if(retval) return(retval);
+    retval = SD_L2_IsFileFragmented(&idxinfo);
+    if(retval) return(retval);
+    
+    // Header
+    SD_L2_idxStart = SD_L2_Cluster2Sector(idxinfo.FirstCluster);
+    retval = SD_L2_CacheRead(SD_L2_idxStart, &buf);
+    if(retval) return(retval);
+    if((buf[0] != 'B') || (buf[1] != 'S') || (buf[2] != 'D') || (buf[3] != 'A') 
+      || (buf[4] != 'I') || (buf[5] != 'D') || (buf[6] != 'X') || (buf[7] != '1')) return(SD_L2_ERROR_INDEX_INVALID);
+    SD_L2_idxRecords      = SD_L2_Get32(buf + 8);
+    SD_L2_idxFenceSectors = SD_L2_Get32(buf + 12);
+    SD_L2_idxDataSectors  = SD_L2_Get32(buf + 16);
+    dirEntries            = SD_L2_Get32(buf + 20);
+    checksum              = SD_L2_Get32(buf + 24);
+    if((SD_L2_idxDataSectors != (SD_L2_idxRecords + 15) >> 4) 
+      || (SD_L2_idxFenceSectors != (SD_L2_idxDataSectors + 63) >> 6)
+      || ((1 + SD_L2_idxFenceSectors + SD_L2_idxDataSectors) << 9 > idxinfo.Size)
+      || (SD_L2_Get32(buf + 28) != 0)) return(SD_L2_ERROR_INDEX_INVALID);
+    
+    // Checksum (FNV-1a) of directory sector holding the last entry
+    retval = SD_L2_DirSector(0, dirEntries ? (dirEntries - 1) >> 4 : 0, &sector);
+    if(retval) return((retval == SD_L2_ERROR_DIR_EOC) ? SD_L2_ERROR_INDEX_INVALID : retval);
+    retval = SD_L2_CacheRead(sector, &buf);
+    if(retval) return(retval);
+    for(uint16_t k = 0; k < 512; k++) {
+        h ^= buf[k];
+        h *= 16777619UL;
+    }
+    if(h != checksum) return(SD_L2_ERROR_INDEX_INVALID);
+    // Last entry has to be followed by the end marker
+    if((dirEntries & 15) == 0) {
+        retval = SD_L2_DirSector(0, dirEntries >> 4, &sector);
+        if(retval == 0) {
+            retval = SD_L2_CacheRead(sector, &buf);
+            if(retval) return(retval);
+            if(buf[0] != 0) return(SD_L2_ERROR_INDEX_INVALID);
+        } else if(retval != SD_L2_ERROR_DIR_EOC) {
+            return(retval);
+        }
+    }
+    
+    SD_L2_idxLoaded = 1;
+    return(0);
+}
+
+/**
+ * Look up a name (8.3 or long, case insensitive for a-z) in the 
+ * index file and verify the hit against its directory entry.
+ *
+ * return Zero if found, SD_L2_ERROR_FILE_NOT_FOUND if not in the index,
+ *        error code otherwise
+ */
+uint8_t SD_L2_IndexFileSearch(uint8_t *filename, const uint8_t maskSet, const uint8_t maskUnset, SD_L2_File_t *fileinfo)
+{
+    uint64_t key = 0xcbf29ce484222325ULL;
+    uint32_t lo, hi, fence, data, count, sector;
+    uint16_t entry;
+    uint8_t  *buf, *rec = NULL;
+    uint8_t  retval;
+    
+    for(uint8_t *p = filename; *p; p++) {
+        uint8_t c = *p;
+        if((c>='a') && (c<='z')) c -= 0x20;  // to upper case
+        key ^= c;
+        key *= 0x100000001b3ULL;
+    }
+    if(SD_L2_idxRecords == 0) return(SD_L2_ERROR_FILE_NOT_FOUND);
+    
+    // Fence sector: the last one whose first key is <= key
+    lo = 0;
+    hi = SD_L2_idxFenceSectors;
+    while(hi - lo > 1) {
+        uint32_t mid = (lo + hi) >> 1;
+        retval = SD_L2_CacheRead(SD_L2_idxStart + 1 + mid, &buf);
+        if(retval) return(retval);
+        if(SD_L2_Get64(buf) <= key) lo = mid; else hi = mid;
+    }
+    fence = lo;
+    retval = SD_L2_CacheRead(SD_L2_idxStart + 1 + fence, &buf);
+    if(retval) return(retval);
+    
+    // Data sector: the last one in this fence sector whose first key is <= key
+    count = SD_L2_idxDataSectors - (fence << 6);
+    if(count > 64) count = 64;
+    if(SD_L2_Get64(buf) > key) return(SD_L2_ERROR_FILE_NOT_FOUND);
+    lo = 0;
+    hi = count;
+    while(hi - lo > 1) {
+        uint32_t mid = (lo + hi) >> 1;
+        if(SD_L2_Get64(buf + (mid << 3)) <= key) lo = mid; else hi = mid;
+    }
+    data = (fence << 6) + lo;
+    
+    // Record
+    retval = SD_L2_CacheRead(SD_L2_idxStart + 1 + SD_L2_idxFenceSectors + data, &buf);
+    if(retval) return(retval);
+    count = SD_L2_idxRecords - (data << 4);
+    if(count > 16) count = 16;
+    for(uint8_t i = 0; i < count; i++) {
+        if(SD_L2_Get64(buf + (i << 5)) == key) {
+            rec = buf + (i << 5);
+            break;
+        }
+    }
+    if(rec == NULL) return(SD_L2_ERROR_FILE_NOT_FOUND);
+    
+    // Verify with directory entry
+    {
+        char     fnentry[12];
+        uint32_t firstCluster = SD_L2_Get32(rec + 20);
+        uint32_t clus;
+        uint32_t size = SD_L2_Get32(rec + 24);
+        uint8_t  contiguous = (rec[30] == 1) && (rec[31] == 0);
+        
+        entry = (uint16_t)rec[28] | ((uint16_t)rec[29] << 8);
+        for(uint8_t k = 0; k < 11; k++) fnentry[k] = rec[8 + k];
+        fnentry[11] = 0;
+        
+        retval = SD_L2_DirSector(0, entry >> 4, &sector);
+        if(retval == SD_L2_ERROR_DIR_EOC) {
+            // entry behind the end of the directory, it was changed
+            SD_L2_idxLoaded = 0;
+            return(SD_L2_ERROR_FILE_NOT_FOUND);
+        }
+        if(retval == 0) retval = SD_L2_CacheRead(sector, &buf);
+        if(retval) return(retval);
+        buf += (entry & 15) << 5;
+        clus = (uint32_t)buf[0x1a] | ((uint32_t)buf[0x1b] << 8);
+        if(SD_L2_FAT.PartType == SD_L2_PARTTYPE_FAT32) {
+            clus |= ((uint32_t)buf[0x14] << 16) | ((uint32_t)buf[0x15] << 24);
+        }
+        if(!SD_L2_MatchEntry(buf, fnentry, 0x00, 0x00)
+          || (SD_L2_Get32(buf + 0x1c) != size) || (clus != firstCluster)) {
+            // directory was changed
+            SD_L2_idxLoaded = 0;
+            return(SD_L2_ERROR_FILE_NOT_FOUND);
+        }
+        if(!SD_L2_MatchEntry(buf, fnentry, maskSet, maskUnset)) return(SD_L2_ERROR_FILE_NOT_FOUND);
+        SD_L2_FillFileInfo(buf, sector, (entry & 15) << 5, fileinfo);
+        fileinfo->Contiguous = contiguous;
+    }
+    return(0);
 }
 
 /**
  * Search a file in the directory.
- * Filename must be 8.3 format, terminated by \0 
- * (can not access ".." now...)
+ * Filename is an 8.3 name or a long name (UTF-8, see SD_L2_LFN_MAX), 
+ * terminated by \0 (can not access ".." now...)
  *
  * Works only over one cluster of directory information. If 
  * SD_L2_ERROR_DIR_EOC is returned call function again with next
- * cluster number. 
+ * cluster number. The directory set by SD_L2_IndexSetup() is 
+ * searched as a whole through its index instead.
  *
  * Set cluster to 0 to access root directory.
  *
@@ -265,76 +1455,478 @@ uint8_t SD_L2_SearchFile(uint8_t *filename, const uint32_t cluster, const uint8_
 {
     uint16_t maxsect = SD_L2_FAT.SecPerClus;
     uint32_t startsect = SD_L2_Cluster2Sector(cluster);
-    char fnentry[12];
+    uint32_t fnwords[3];    // name as words for SD_L2_ScanSector()
+    char *fnentry = (char *)fnwords;
+    uint8_t lfn = 0;    // 1 if filename is searched as long name
     
+#if SD_ENABLE_EXFAT
+    if(SD_L2_FAT.PartType == SD_L2_PARTTYPE_EXFAT) return(SD_L2_ExSearchFile(filename, cluster, maskSet, maskUnset, fileinfo));
+#endif
     if((SD_L2_FAT.PartType != SD_L2_PARTTYPE_FAT16) && (SD_L2_FAT.PartType != SD_L2_PARTTYPE_FAT32)) return(SD_L2_ERROR_FAT_NOT_INIT);
     if(cluster == 0) {
         // Set root dir sector
         startsect = SD_L2_FAT.RootDirStart;
         if(SD_L2_FAT.PartType == SD_L2_PARTTYPE_FAT16) maxsect = (uint16_t)((32 * (uint32_t)SD_L2_FAT.RootEntryCount + 511)/512);
+        
+        // try index file first, it knows long names as well
+        if(SD_L2_idxLoaded) {
+            uint8_t retval = SD_L2_IndexFileSearch(filename, maskSet, maskUnset, fileinfo);
+            if(retval != SD_L2_ERROR_FILE_NOT_FOUND) return(retval);
+        }
     }
     
     // convert filename to space-filled uppercase format
-    for(uint8_t i = 0; i < 11; i++) fnentry[i] = ' ';
-    for(uint8_t i = 0; i < 9; i++) {
-        uint8_t c = *filename++;
-        if((c < 0x20) || (c == '.')) break;
-        if((c>='a') && (c<='z')) c -= 0x20;  // to upper case
-        fnentry[i] = c;
-    }
-    for(uint8_t i = 8; i < 11; i++) {
-        uint8_t c = *filename++;
-        if(c < 0x20) break;
-        if((c>='a') && (c<='z')) c -= 0x20;  // to upper case
-        fnentry[i] = c;
-    }
-    fnentry[11] = 0;
+    SD_L2_ConvertName(filename, fnentry);
     //Serial.println(fnentry);
+#if SD_ENABLE_LFN
+    lfn = SD_L2_LfnPrepare(filename);
+    if(!SD_L2_lfnContinue) SD_L2_lfnNext = 0;
+    SD_L2_lfnContinue = 0;
+#endif
+    
+    // use index of this directory if there is one (8.3 names only)
+    if(SD_L2_indexSlots && (cluster == SD_L2_indexCluster) && !lfn) {
+        uint8_t retval = 0;
+        if(!SD_L2_indexBuilt) retval = SD_L2_IndexBuild();
+        if(!retval) retval = SD_L2_IndexSearch(fnentry, maskSet, maskUnset, fileinfo);
+        if((retval != SD_L2_ERROR_FILE_NOT_FOUND) || SD_L2_indexComplete) return(retval);
+    }
     
     // go through sectors
     for(uint16_t i = 0; i<maxsect; i++) {
-        uint8_t retval = SD_L1_ReadBlock(startsect + i, SD_L2_workBuf);
+        uint8_t *dir;
+        uint8_t retval = SD_L2_CacheRead(startsect + i, &dir);
         if(retval) return(retval);
         
-        for(uint16_t j = 0; j<512; j+=32) {
-            uint8_t attrib;
-            if(SD_L2_workBuf[j] == 0) return(SD_L2_ERROR_FILE_NOT_FOUND);    // Last entry when first character of filename == 0
-            if(SD_L2_workBuf[j] == 0xe5) continue;  // Skip deleted files
-            if(SD_L2_workBuf[j] == 0x05) SD_L2_workBuf[j] = 0xE5;
-            
-            attrib = SD_L2_workBuf[j+0x0b];
-            
-            // Test masks (skip long file name entries also)
-            if(((attrib & maskSet) == maskSet) && ((attrib & maskUnset) == 0) && (attrib != 0x0f)) {
-                uint16_t k;
+#if SD_ENABLE_LFN
+        if(lfn) {
+            for(uint16_t j = 0; j<512; j+=32) {
+                if(dir[j] == 0) return(SD_L2_ERROR_FILE_NOT_FOUND);    // Last entry when first character of filename == 0
+                if(!SD_L2_LfnFeed(dir + j, 0) || !SD_L2_MatchEntry(dir + j, NULL, maskSet, maskUnset)) continue;
                 
-                // compare filename
-                for(k = 0; k < 11; k++) if(SD_L2_workBuf[j+k] != fnentry[k]) break;
-                if(k >= 11) {
-                    // found it
-                    fileinfo->Attributes = attrib;
-                    fileinfo->Size = (uint32_t)SD_L2_workBuf[j+0x1c] | (((uint32_t)SD_L2_workBuf[j+0x1d])<<8) 
-                                    | (((uint32_t)SD_L2_workBuf[j+0x1e])<<16) | (((uint32_t)SD_L2_workBuf[j+0x1f])<<24);
-                    if(SD_L2_FAT.PartType == SD_L2_PARTTYPE_FAT16) {
-                        fileinfo->FirstCluster = (uint32_t)SD_L2_workBuf[j+0x1a] | (((uint32_t)SD_L2_workBuf[j+0x1b])<<8);
-                    } else {
-                        fileinfo->FirstCluster = (uint32_t)SD_L2_workBuf[j+0x1a] | (((uint32_t)SD_L2_workBuf[j+0x1b])<<8) 
-                             | (((uint32_t)SD_L2_workBuf[j+0x14])<<16) | (((uint32_t)SD_L2_workBuf[j+0x15])<<24);
-                    }	
-                    
-                    // Initialize some things
-                    fileinfo->ActSector = SD_L2_Cluster2Sector(fileinfo->FirstCluster);
-                    fileinfo->ActBytePos = 0;
+                // found it
+                SD_L2_FillFileInfo(dir + j, startsect + i, j, fileinfo);
+                return(0);
+            }
+            continue;
+        }
+#endif
+        uint16_t offset;
+        retval = SD_L2_ScanSector(dir, fnwords, maskSet, maskUnset, &offset);
+        if(retval == SD_L2_ERROR_DIR_EOC) continue;
+        if(retval) return(retval);
+        
+        // found it
+        SD_L2_FillFileInfo(dir + offset, startsect + i, offset, fileinfo);
+        return(0);
+    }
+    if((cluster == 0) && (SD_L2_FAT.PartType == SD_L2_PARTTYPE_FAT16)) return(SD_L2_ERROR_FILE_NOT_FOUND);
+    return(SD_L2_ERROR_DIR_EOC);
+}
+
+/**
+ * Search a file in a whole directory, following its cluster chain
+ * (see SD_L2_SearchFile for parameters). Set cluster to 0 to access 
+ * root directory.
+ *
+ * return Zero if successful, error code otherwise
+ */
+uint8_t SD_L2_SearchDir(uint8_t *filename, const uint32_t cluster, const uint8_t maskSet, const uint8_t maskUnset, SD_L2_File_t *fileinfo)
+{
+    uint32_t clus = cluster;
+    uint8_t  retval;
+    
+    for(;;) {
+        retval = SD_L2_SearchFile(filename, clus, maskSet, maskUnset, fileinfo);
+        if(retval != SD_L2_ERROR_DIR_EOC) return(retval);
+        
+        // continue with next cluster of the directory
+        if(clus == 0) clus = SD_L2_FAT.RootClus;
+        retval = SD_L2_NextCluster(&clus);
+        if(retval) return(retval);
+        if((clus < 2) || (clus >= SD_L2_FAT.ClusterCount + 2)) return(SD_L2_ERROR_FILE_NOT_FOUND);
+#if SD_ENABLE_LFN
+        SD_L2_lfnContinue = 1;  // a long name may go on in the next cluster
+#endif
+    }
+}
+
+/**
+ * SD_L2_SearchDir() for a directory of clusters contiguous clusters 
+ * with no FAT chain (exFAT NoFatChain), 0 follows the FAT instead.
+ *
+ * return Zero if successful, error code otherwise
+ */
+uint8_t SD_L2_SearchRun(uint8_t *filename, const uint32_t cluster, const uint32_t clusters, const uint8_t maskSet, const uint8_t maskUnset, SD_L2_File_t *fileinfo)
+{
+    uint8_t retval;
+    
+    if(clusters == 0) return(SD_L2_SearchDir(filename, cluster, maskSet, maskUnset, fileinfo));
+    for(uint32_t i = 0; ; i++) {
+        retval = SD_L2_SearchFile(filename, cluster + i, maskSet, maskUnset, fileinfo);
+        if(retval != SD_L2_ERROR_DIR_EOC) return(retval);
+        if(i + 1 >= clusters) return(SD_L2_ERROR_FILE_NOT_FOUND);
+#if SD_ENABLE_LFN
+        SD_L2_lfnContinue = 1;  // a long name may go on in the next cluster
+#endif
+    }
+}
+
+/**
+ * Search a file by its path starting at root directory, e.g. 
+ * "/ann/gate12/boarding.raw" ('/' or '\', the leading one is optional).
+ * Parts are 8.3 or long names, "." and ".." are not supported.
+ * The directories are searched as a whole (see SD_L2_SearchDir), 
+ * maskSet/maskUnset apply to the last part only (see SD_L2_SearchFile).
+ *
+ * return Zero if successful, error code otherwise
+ */
+uint8_t SD_L2_SearchPath(uint8_t *path, const uint8_t maskSet, const uint8_t maskUnset, SD_L2_File_t *fileinfo)
+{
+    uint8_t  part[SD_L2_NAME_MAX];
+    uint32_t cluster = 0;
+    uint32_t clusters = 0;  // of a directory without FAT chain
+    uint8_t  retval;
+    
+    for(;;) {
+        uint8_t n = 0;
+        
+        // copy next part of path
+        while((*path == '/') || (*path == '\\')) path++;
+        while((*path >= 0x20) && (*path != '/') && (*path != '\\')) {
+            if(n >= sizeof(part) - 1) return(SD_L2_ERROR_FILE_NOT_FOUND);
+            part[n++] = *path++;
+        }
+        part[n] = 0;
+        if(n == 0) return(SD_L2_ERROR_FILE_NOT_FOUND);
+        while((*path == '/') || (*path == '\\')) path++;
+        
+        if(*path < 0x20) {
+            // last part
+            return(SD_L2_SearchRun(part, cluster, clusters, maskSet, maskUnset, fileinfo));
+        }
+        retval = SD_L2_SearchRun(part, cluster, clusters, 0x10, 0x08, fileinfo);
+        if(retval) return(retval);
+        cluster = fileinfo->FirstCluster;
+        clusters = 0;
+        if(fileinfo->Contiguous) {
+            clusters = (fileinfo->Size + (512UL << SD_L2_FAT.ClusterSizeShift) - 1) >> (9 + SD_L2_FAT.ClusterSizeShift);
+        }
+    }
+}
+
+#if SD_ENABLE_WRITE_ACCESS && SD_ENABLE_MULTIBLOCK_ACCESS
+/**
+ * Find a free entry in the directory, following its cluster chain
+ * (the root directory of FAT16 has a fixed size). entry is set to
+ * the number of the entry within the directory.
+ *
+ * return Zero if successful, error code otherwise
+ */
+uint8_t SD_L2_FindFreeEntry(const uint32_t cluster, uint32_t *sector, uint16_t *offset, uint16_t *entry)
+{
+    uint16_t maxsect = SD_L2_FAT.SecPerClus;
+    uint32_t clus = cluster;
+    uint32_t startsect = SD_L2_FAT.RootDirStart;
+    uint32_t index = 0;     // of the first sector of clus within the directory
+    uint8_t  retval;
+    
+    if(cluster == 0) {
+        // FAT16 root dir has no cluster chain
+        if(SD_L2_FAT.PartType == SD_L2_PARTTYPE_FAT16) maxsect = (uint16_t)((32 * (uint32_t)SD_L2_FAT.RootEntryCount + 511)/512);
+        else clus = SD_L2_FAT.RootClus;
+    }
+    
+    // a directory has 65536 entries at most (4096 sectors)
+    while(index < 4096) {
+        if(clus) startsect = SD_L2_Cluster2Sector(clus);
+        
+        for(uint16_t i = 0; i<maxsect; i++) {
+            uint8_t *dir;
+            retval = SD_L2_CacheRead(startsect + i, &dir);
+            if(retval) return(retval);
+            
+            for(uint16_t j = 0; j<512; j+=32) {
+                // Free if never used or deleted
+                if((dir[j] == 0) || (dir[j] == 0xe5)) {
+                    *sector = startsect + i;
+                    *offset = j;
+                    *entry = ((index + i) << 4) | (j >> 5);
                     return(0);
                 }
+            }
+        }
+        if(clus == 0) break;
+        
+        // continue with next cluster of the directory
+        index += maxsect;
+        retval = SD_L2_NextCluster(&clus);
+        if(retval) return(retval);
+        if((clus < 2) || (clus >= SD_L2_FAT.ClusterCount + 2)) break;
+    }
+    return(SD_L2_ERROR_DIR_FULL);
+}
 
+/**
+ * Search the FAT for count free clusters in a row (first fit).
+ * The FAT is read sector by sector through the FAT window.
+ *
+ * return Zero if successful, error code otherwise
+ */
+uint8_t SD_L2_FindFreeRun(uint32_t count, uint32_t *first)
+{
+    uint32_t cluster = 2;
+    uint32_t end = SD_L2_FAT.ClusterCount + 2;
+    uint32_t run = 0;
+    uint8_t  shift = (SD_L2_FAT.PartType == SD_L2_PARTTYPE_FAT16) ? 8 : 7;
+    uint8_t  *fat;
+    uint8_t  retval;
+    
+    while(cluster < end) {
+        uint32_t sector = cluster >> shift;
+        
+        retval = SD_L2_FatWindowRead(SD_L2_FAT.FatStart + sector, &fat);
+        if(retval) return(retval);
+        
+        // Check all entries of this FAT sector
+        do {
+            uint32_t entry;
+            if(SD_L2_FAT.PartType == SD_L2_PARTTYPE_FAT16) {
+                uint16_t offset = (uint16_t)(cluster & 0xff) << 1;
+                entry = ((uint32_t)fat[offset+1] << 8U) | (uint32_t)fat[offset];
+            } else {
+                uint16_t offset = (uint16_t)(cluster & 0x7f) << 2;
+                // upper 4 bits are reserved
+                entry = ((uint32_t)(fat[offset+3] & 0x0f) << 24U) | ((uint32_t)fat[offset+2] << 16U) |
+                        ((uint32_t)fat[offset+1] << 8U) | (uint32_t)fat[offset];
             }
-            
+            if(entry) {
+                run = 0;
+            } else {
+                if(run == 0) *first = cluster;
+                if(++run >= count) return(0);
+            }
+            cluster++;
+        } while((cluster < end) && ((cluster >> shift) == sector));
+    }
+    return(SD_L2_ERROR_DISK_FULL);
+}
+
+/**
+ * Link count clusters starting at first to a chain and write it
+ * to all FAT copies.
+ *
+ * return Zero if successful, error code otherwise
+ */
+uint8_t SD_L2_WriteFatRun(uint32_t first, uint32_t count)
+{
+    uint32_t cluster = first;
+    uint32_t last = first + count - 1;
+    uint8_t  shift = (SD_L2_FAT.PartType == SD_L2_PARTTYPE_FAT16) ? 8 : 7;
+    uint8_t  *fat;
+    uint8_t  retval;
+    
+    while(cluster <= last) {
+        uint32_t sector = cluster >> shift;
+        
+        retval = SD_L2_CacheRead(SD_L2_FAT.FatStart + sector, &fat);
+        if(retval) return(retval);
+        
+        // Set all entries of this FAT sector, last one gets end marker
+        do {
+            uint32_t next = (cluster == last) ? 0x0fffffffUL : (cluster + 1);
+            if(SD_L2_FAT.PartType == SD_L2_PARTTYPE_FAT16) {
+                uint16_t offset = (uint16_t)(cluster & 0xff) << 1;
+                fat[offset]   = next & 0xff;
+                fat[offset+1] = (next >> 8) & 0xff;
+            } else {
+                uint16_t offset = (uint16_t)(cluster & 0x7f) << 2;
+                fat[offset]   = next & 0xff;
+                fat[offset+1] = (next >> 8) & 0xff;
+                fat[offset+2] = (next >> 16) & 0xff;
+                // upper 4 bits are reserved
+                fat[offset+3] = (fat[offset+3] & 0xf0) | ((next >> 24) & 0x0f);
+            }
+            cluster++;
+        } while((cluster <= last) && ((cluster >> shift) == sector));
+        
+        for(uint8_t i = 0; i < SD_L2_FAT.NumFATs; i++) {
+            retval = SD_L2_CacheWrite(SD_L2_FAT.FatStart + sector + i * SD_L2_FAT.SecPerFAT, fat);
+            if(retval) return(retval);
         }
     }
-    if(SD_L2_FAT.PartType == SD_L2_PARTTYPE_FAT16) return(SD_L2_ERROR_FILE_NOT_FOUND);
-    return(SD_L2_ERROR_DIR_EOC);
+    return(0);
+}
+
+/**
+ * Create a file with size bytes preallocated as one contiguous 
+ * cluster run.
+ * Filename must be 8.3 format, terminated by \0.
+ *
+ * Set cluster to 0 to create the file in root directory. The whole
+ * directory is searched for the name and a free entry (like 
+ * SD_L2_SearchDir does), it is not extended if it is full.
+ *
+ * The FAT chain is written to all FAT copies first, then the 
+ * directory entry with a file size of 0. The size is set by 
+ * SD_L2_WriteClose(). On FAT32 the free cluster count in FSInfo
+ * is not updated (it is only a hint anyway).
+ *
+ * If successful fileinfo is ready for SD_L2_WriteOpen(), 
+ * fileinfo->Size holds the allocated bytes.
+ *
+ * return Zero if successful, error code otherwise
+ */
+uint8_t SD_L2_CreateFile(uint8_t *filename, const uint32_t cluster, uint32_t size, SD_L2_File_t *fileinfo)
+{
+    uint32_t clusters, first, dirsect;
+    uint16_t diroffset, direntry;
+    uint8_t  *dir, *entry;
+    char     fnentry[12];
+    uint8_t  retval;
+    
+    if((SD_L2_FAT.PartType == SD_L2_PARTTYPE_EXFAT) || (SD_L2_dev->WriteBlock == NULL)) return(SD_L2_ERROR_READ_ONLY);
+    if((SD_L2_FAT.PartType != SD_L2_PARTTYPE_FAT16) && (SD_L2_FAT.PartType != SD_L2_PARTTYPE_FAT32)) return(SD_L2_ERROR_FAT_NOT_INIT);
+    
+    // Name must not be used by files or directories
+    retval = SD_L2_SearchDir(filename, cluster, 0x00, 0x08, fileinfo);
+    if(retval == 0) return(SD_L2_ERROR_FILE_EXISTS);
+    if(retval != SD_L2_ERROR_FILE_NOT_FOUND) return(retval);
+    
+    retval = SD_L2_FindFreeEntry(cluster, &dirsect, &diroffset, &direntry);
+    if(retval) return(retval);
+    
+    // Allocate at least one cluster
+    clusters = (size + (512UL << SD_L2_FAT.ClusterSizeShift) - 1) >> (9 + SD_L2_FAT.ClusterSizeShift);
+    if(clusters == 0) clusters = 1;
+    retval = SD_L2_FindFreeRun(clusters, &first);
+    if(retval) return(retval);
+    retval = SD_L2_WriteFatRun(first, clusters);
+    if(retval) return(retval);
+    
+    // Fill directory entry
+    retval = SD_L2_CacheRead(dirsect, &dir);
+    if(retval) return(retval);
+    entry = dir + diroffset;
+    SD_L2_ConvertName(filename, fnentry);
+    for(uint8_t k = 0; k < 11; k++) entry[k] = fnentry[k];
+    for(uint8_t k = 11; k < 32; k++) entry[k] = 0;
+    entry[0x0b] = 0x20;     // archive
+    entry[0x10] = 0x21;     // creation date 1980-01-01
+    entry[0x12] = 0x21;     // last access date
+    entry[0x18] = 0x21;     // write date
+    entry[0x14] = (first >> 16) & 0xff;
+    entry[0x15] = (first >> 24) & 0xff;
+    entry[0x1a] = first & 0xff;
+    entry[0x1b] = (first >> 8) & 0xff;
+    retval = SD_L2_CacheWrite(dirsect, dir);
+    if(retval) return(retval);
+    
+    if(SD_L2_indexSlots && SD_L2_indexBuilt && (cluster == SD_L2_indexCluster)) {
+        SD_L2_IndexInsert(SD_L2_IndexHash(fnentry), direntry);
+    }
+    
+    fileinfo->Attributes = 0x20;
+    fileinfo->Size = clusters << (9 + SD_L2_FAT.ClusterSizeShift);
+    fileinfo->FirstCluster = first;
+    fileinfo->ActSector = SD_L2_Cluster2Sector(first);
+    fileinfo->ActBytePos = 0;
+    fileinfo->DirSector = dirsect;
+    fileinfo->DirOffset = diroffset;
+    fileinfo->Contiguous = 1;
+    return(0);
+}
+
+/**
+ * Start writing a file from its beginning with a pre-erased multiple 
+ * block write. The cluster chain must not be fragmented, use 
+ * SD_L2_CreateFile() or SD_L2_SearchFile() to get fileinfo. 
+ * fileinfo->Size is set to the allocated bytes of the whole chain,
+ * that much can be written.
+ *
+ * Until SD_L2_WriteClose() is called, no other card access is allowed.
+ *
+ * return Zero if successful, error code otherwise
+ */
+uint8_t SD_L2_WriteOpen(SD_L2_File_t *fileinfo)
+{
+    uint32_t cluster = fileinfo->FirstCluster;
+    uint32_t next;
+    uint32_t count = 1;
+    uint8_t  retval;
+    
+    if(SD_L2_FAT.PartType == SD_L2_PARTTYPE_EXFAT) return(SD_L2_ERROR_READ_ONLY);
+    if((SD_L2_dev->WriteRunStart == NULL) || (SD_L2_dev->WriteRun == NULL) || (SD_L2_dev->WriteRunStop == NULL)) return(SD_L2_ERROR_READ_ONLY);
+    if(cluster < 2) return(SD_L2_ERROR_FAT_ENTRY);
+    
+    // Follow chain to its end, must be contiguous
+    for(;;) {
+        next = cluster;
+        retval = SD_L2_NextCluster(&next);
+        if(retval) return(retval);
+        if(next >= SD_L2_FAT.ClusterEndMarker) break;
+        if(next != (cluster + 1)) return(SD_L2_ERROR_FRAGMET_FOUND);
+        cluster = next;
+        count++;
+    }
+    fileinfo->Size = count << (9 + SD_L2_FAT.ClusterSizeShift);
+    fileinfo->Contiguous = 1;
+    
+    fileinfo->ActSector = SD_L2_Cluster2Sector(fileinfo->FirstCluster);
+    fileinfo->ActBytePos = 0;
+    return(SD_L2_dev->WriteRunStart(fileinfo->ActSector, (fileinfo->Size + 511) >> 9));
+}
+
+/**
+ * Write the next 512 byte sector of a file opened by SD_L2_WriteOpen().
+ *
+ * return Zero if successful, error code otherwise
+ */
+uint8_t SD_L2_WriteSector(SD_L2_File_t *fileinfo, const uint8_t *src)
+{
+    uint8_t retval;
+    
+    if(fileinfo->ActBytePos >= fileinfo->Size) return(SD_L2_ERROR_EOF);
+    retval = SD_L2_dev->WriteRun(src);
+    if(retval) return(retval);
+    fileinfo->ActSector++;
+    fileinfo->ActBytePos += 512;
+    return(0);
+}
+
+/**
+ * Finish writing a file and store its size in the directory entry.
+ * Size is the number of valid bytes, at most the number of written
+ * sectors * 512 (fileinfo->ActBytePos). Unused preallocated clusters
+ * stay allocated to the file. The size is stored also if stopping the
+ * write run fails, e.g. after a write error, so the sectors written 
+ * before are kept.
+ *
+ * return Zero if successful, error code otherwise (of the stop first)
+ */
+uint8_t SD_L2_WriteClose(SD_L2_File_t *fileinfo, uint32_t size)
+{
+    uint8_t  *dir, *entry;
+    uint8_t  retval;
+    uint8_t  stopval;
+    
+    stopval = SD_L2_dev->WriteRunStop();
+    
+    if(size > fileinfo->ActBytePos) size = fileinfo->ActBytePos;
+    retval = SD_L2_CacheRead(fileinfo->DirSector, &dir);
+    if(retval) return(stopval ? stopval : retval);
+    entry = dir + fileinfo->DirOffset;
+    entry[0x1c] = size & 0xff;
+    entry[0x1d] = (size >> 8) & 0xff;
+    entry[0x1e] = (size >> 16) & 0xff;
+    entry[0x1f] = (size >> 24) & 0xff;
+    retval = SD_L2_CacheWrite(fileinfo->DirSector, dir);
+    if(retval) return(stopval ? stopval : retval);
+    
+    fileinfo->Size = size;
+    return(stopval);
 }
+#endif /* SD_ENABLE_WRITE_ACCESS && SD_ENABLE_MULTIBLOCK_ACCESS */
 
 #if SD_ENABLE_DIR_VIEW
 /**
@@ -348,6 +1940,9 @@ uint8_t SD_L2_SearchFile(uint8_t *filename, const uint32_t cluster, const uint8_
  * Set cluster to 0 to access root directory.
  *
  * Deleted files and long name entries are not shown generally.
+ * Files with a long name are shown by it (UTF-8), unless it is longer
+ * than SD_L2_LFN_MAX or split over two clusters, the callback gets 
+ * up to SD_L2_NAME_MAX bytes then.
  *
  * Only files are printed that has their attributes set/unset regarding maskSet/maskUnset.
  * Examples for maskSet, maskUnset:
@@ -364,47 +1959,246 @@ uint8_t SD_L2_Dir(const uint32_t cluster, const uint8_t maskSet, const uint8_t m
 {
     uint16_t maxsect = SD_L2_FAT.SecPerClus;
     uint32_t startsect = SD_L2_Cluster2Sector(cluster);
-    char buf[16];
+    char buf[SD_L2_NAME_MAX];
     
+#if SD_ENABLE_EXFAT
+    if(SD_L2_FAT.PartType == SD_L2_PARTTYPE_EXFAT) return(SD_L2_ExDir(cluster, maskSet, maskUnset, callback));
+#endif
     if((SD_L2_FAT.PartType != SD_L2_PARTTYPE_FAT16) && (SD_L2_FAT.PartType != SD_L2_PARTTYPE_FAT32)) return(SD_L2_ERROR_FAT_NOT_INIT);
     if(cluster == 0) {
         // Set root dir sector
         startsect = SD_L2_FAT.RootDirStart;
         if(SD_L2_FAT.PartType == SD_L2_PARTTYPE_FAT16) maxsect = (uint16_t)((32 * (uint32_t)SD_L2_FAT.RootEntryCount + 511)/512);
     }
+#if SD_ENABLE_LFN
+    SD_L2_lfnNext = 0;
+#endif
     
     for(uint16_t i = 0; i<maxsect; i++) {
-        uint8_t retval = SD_L1_ReadBlock(startsect + i, SD_L2_workBuf);
+        uint8_t *dir;
+        uint8_t retval = SD_L2_CacheRead(startsect + i, &dir);
         if(retval) return(retval);
         
         for(uint16_t j = 0; j<512; j+=32) {
             uint8_t attrib;
-            if(SD_L2_workBuf[j] == 0) return(0);    // Last entry when first character of filename == 0
-            if(SD_L2_workBuf[j] == 0xe5) continue;  // Skip deleted files
-            if(SD_L2_workBuf[j] == 0x05) SD_L2_workBuf[j] = 0xE5;
+            if(dir[j] == 0) return(0);    // Last entry when first character of filename == 0
+#if SD_ENABLE_LFN
+            uint8_t lfn = SD_L2_LfnFeed(dir + j, 1);
+#endif
+            if(dir[j] == 0xe5) continue;  // Skip deleted files
             
-            attrib = SD_L2_workBuf[j+0x0b];
+            attrib = dir[j+0x0b];
             
             // Test masks (skip long file name entries also)
             if(((attrib & maskSet) == maskSet) && ((attrib & maskUnset) == 0) && (attrib != 0x0f)) {
-                uint8_t z=0;
-                // Prepare output
-                for(uint16_t k = 0; k < 16; k++) buf[k] = ' ';
-                for(uint16_t k = 0; k < 8; k++) {
-                  buf[z] = SD_L2_workBuf[j+k];
-                  if(buf[z] > ' ') z++;     // Remove space
+#if SD_ENABLE_LFN
+                if(lfn) {
+                    SD_L2_LfnGetName(buf);
+                    callback(buf);
+                    continue;
                 }
-                buf[z++] = '.';
-                for(uint16_t k = 0; k < 3; k++) buf[z++] = SD_L2_workBuf[j+k+0x08];
-                //buf[z++] = ' ';
-                buf[z++] = 0;
-
+#endif
+                SD_L2_EntryName(dir + j, buf);
                 callback(buf);
             }
             
         }
     }
-    if(SD_L2_FAT.PartType == SD_L2_PARTTYPE_FAT16) return(0);
+    if((cluster == 0) && (SD_L2_FAT.PartType == SD_L2_PARTTYPE_FAT16)) return(0);
     return(SD_L2_ERROR_DIR_EOC);
 }
+
+/**
+ * Get the 8.3 name of a directory entry as SD_L2_Dir() shows it,
+ * buf must hold 13 bytes.
+ */
+void SD_L2_EntryName(const uint8_t *entry, char *buf)
+{
+    uint8_t z = 0;
+    
+    for(uint16_t k = 0; k < 13; k++) buf[k] = ' ';
+    for(uint16_t k = 0; k < 8; k++) {
+      buf[z] = entry[k];
+      if((k == 0) && (entry[0] == 0x05)) buf[z] = 0xE5;  // 0xE5 is stored as 0x05
+      if(buf[z] > ' ') z++;     // Remove space
+    }
+    buf[z++] = '.';
+    for(uint16_t k = 0; k < 3; k++) buf[z++] = entry[k+0x08];
+    buf[z++] = 0;
+}
+
+/**
+ * Open a cursor to go through a directory with SD_L2_DirNext().
+ * dirinfo is the directory as found by SD_L2_SearchPath() with 
+ * attribute 0x10, NULL for the root directory. Only entries with 
+ * attributes matching maskSet/maskUnset are returned (see 
+ * SD_L2_SearchFile).
+ *
+ * The cursor holds the position in the directory, so any other 
+ * SD_L2_* and card access may come between SD_L2_DirNext() calls.
+ *
+ * return Zero if successful, error code otherwise
+ */
+uint8_t SD_L2_DirOpen(SD_L2_DirCursor_t *cursor, const SD_L2_File_t *dirinfo, const uint8_t maskSet, const uint8_t maskUnset)
+{
+    cursor->Index = 0;
+    cursor->Clusters = 0;
+    cursor->MaskSet = maskSet;
+    cursor->MaskUnset = maskUnset;
+    cursor->Done = 1;
+    
+    if((SD_L2_FAT.PartType != SD_L2_PARTTYPE_FAT16) && (SD_L2_FAT.PartType != SD_L2_PARTTYPE_FAT32)
+#if SD_ENABLE_EXFAT
+       && (SD_L2_FAT.PartType != SD_L2_PARTTYPE_EXFAT)
+#endif
+      ) return(SD_L2_ERROR_FAT_NOT_INIT);
+    
+    if(dirinfo && !(dirinfo->Attributes & 0x10)) return(SD_L2_ERROR_FILE_NOT_FOUND);
+    if(dirinfo && dirinfo->FirstCluster) {
+        cursor->ActCluster = dirinfo->FirstCluster;
+        if(dirinfo->Contiguous) {
+            cursor->Clusters = (dirinfo->Size + (512UL << SD_L2_FAT.ClusterSizeShift) - 1) >> (9 + SD_L2_FAT.ClusterSizeShift);
+        }
+    } else {
+        // root directory, also for ".." of a subdirectory of it
+        cursor->ActCluster = (SD_L2_FAT.PartType == SD_L2_PARTTYPE_FAT16) ? 0 : SD_L2_FAT.RootClus;
+    }
+    cursor->Done = 0;
+    return(0);
+}
+
+/**
+ * Move a cursor to the next entry, following the cluster chain of
+ * the directory. Done is set behind its last cluster.
+ *
+ * return Zero if successful, error code otherwise
+ */
+uint8_t SD_L2_DirAdvance(SD_L2_DirCursor_t *cursor)
+{
+    uint8_t retval;
+    
+    cursor->Index++;
+    if(cursor->ActCluster == 0) {
+        // FAT16 root directory, a fixed number of entries
+        if(cursor->Index >= SD_L2_FAT.RootEntryCount) cursor->Done = 1;
+        return(0);
+    }
+    if(cursor->Index & ((16UL << SD_L2_FAT.ClusterSizeShift) - 1)) return(0);
+    
+    // first entry of the next cluster
+    if(cursor->Clusters) {
+        if((cursor->Index >> (4 + SD_L2_FAT.ClusterSizeShift)) >= cursor->Clusters) {
+            cursor->Done = 1;
+        } else {
+            cursor->ActCluster++;
+        }
+        return(0);
+    }
+    retval = SD_L2_NextCluster(&cursor->ActCluster);
+    if(retval) return(retval);
+    if((cursor->ActCluster < 2) || (cursor->ActCluster >= SD_L2_FAT.ClusterCount + 2)) cursor->Done = 1;
+    return(0);
+}
+
+/**
+ * Get the next entry of a directory opened with SD_L2_DirOpen().
+ * name gets the name as SD_L2_Dir() shows it (SD_L2_NAME_MAX bytes),
+ * fileinfo the file to use with SD_L2_GetExtents() etc., both may be 
+ * NULL.
+ *
+ * One call reads one directory sector at most, only a long name that
+ * goes on in the next sector is read to its end. So going through a 
+ * large directory can be mixed with other work, e.g. keeping an 
+ * audio buffer filled, in small steps.
+ *
+ * return Zero if an entry was found, SD_L2_ERROR_DIR_EOC if there was 
+ *        none in the sector read (call again), SD_L2_ERROR_FILE_NOT_FOUND
+ *        behind the last entry, error code otherwise
+ */
+uint8_t SD_L2_DirNext(SD_L2_DirCursor_t *cursor, char *name, SD_L2_File_t *fileinfo)
+{
+    uint8_t sectors = (cursor->Index & 15) ? 1 : 0;    // sectors read in this call
+#if SD_ENABLE_EXFAT
+    uint8_t exfat = (SD_L2_FAT.PartType == SD_L2_PARTTYPE_EXFAT);
+#endif
+    
+    // a call never ends within a long name, so there is none pending now
+#if SD_ENABLE_LFN
+    SD_L2_lfnNext = 0;
+#endif
+#if SD_ENABLE_EXFAT
+    SD_L2_exLeft = 0;
+#endif
+    
+    while(!cursor->Done) {
+        uint16_t offset = (uint16_t)(cursor->Index & 15) << 5;
+        uint32_t sector;
+        uint8_t  *dir;
+        uint8_t  retval;
+        uint8_t  found = 0;
+#if SD_ENABLE_LFN
+        uint8_t  lfn = 0;
+#endif
+        
+        if(offset == 0) {
+            uint8_t pending = 0;
+#if SD_ENABLE_LFN
+            pending |= SD_L2_lfnNext;
+#endif
+#if SD_ENABLE_EXFAT
+            pending |= SD_L2_exLeft;
+#endif
+            if(sectors && !pending) return(SD_L2_ERROR_DIR_EOC);
+            sectors++;
+        }
+        
+        if(cursor->ActCluster == 0) {
+            sector = SD_L2_FAT.RootDirStart + (cursor->Index >> 4);
+        } else {
+            sector = SD_L2_Cluster2Sector(cursor->ActCluster) + ((cursor->Index >> 4) & (SD_L2_FAT.SecPerClus - 1));
+        }
+        retval = SD_L2_CacheRead(sector, &dir);
+        if(retval) return(retval);
+        dir += offset;
+        if(dir[0] == 0) break;      // Last entry when first character of filename == 0
+        
+#if SD_ENABLE_EXFAT
+        if(exfat) {
+            if(SD_L2_ExFeed(dir, sector, offset, 1)) {
+                uint8_t attrib = SD_L2_exFile.Attributes;
+                found = ((attrib & cursor->MaskSet) == cursor->MaskSet) && ((attrib & cursor->MaskUnset) == 0);
+                lfn = 1;
+            }
+        } else
+#endif
+        {
+#if SD_ENABLE_LFN
+            lfn = SD_L2_LfnFeed(dir, 1);
+#endif
+            found = SD_L2_MatchEntry(dir, NULL, cursor->MaskSet, cursor->MaskUnset);
+        }
+        
+        if(found) {
+            if(name) {
+#if SD_ENABLE_LFN
+                if(lfn) SD_L2_LfnGetName(name); else
+#endif
+                SD_L2_EntryName(dir, name);
+            }
+            if(fileinfo) {
+#if SD_ENABLE_EXFAT
+                if(exfat) *fileinfo = SD_L2_exFile; else
+#endif
+                SD_L2_FillFileInfo(dir, sector, offset, fileinfo);
+            }
+        }
+        
+        // may read the FAT and replace dir in the cache, so done last
+        retval = SD_L2_DirAdvance(cursor);
+        if(retval) return(retval);
+        if(found) return(0);
+    }
+    cursor->Done = 1;
+    return(SD_L2_ERROR_FILE_NOT_FOUND);
+}
 #endif  /* SD_ENABLE_DIR_VIEW */
\ No newline at end of file
@@ -1,7 +1,41 @@
 #ifndef SD_L2_H
 #define SD_L2_H
 
+#include "sd_l1.h"
+
 #define SD_ENABLE_DIR_VIEW          1
+#define SD_ENABLE_LFN               1
+#define SD_ENABLE_EXFAT             1   // read only, needs SD_ENABLE_LFN
+
+/** Longest long file name in characters SD_L2_SearchFile finds and SD_L2_Dir shows */
+#define SD_L2_LFN_MAX               64
+#if SD_ENABLE_LFN
+  /** Buffer size for a name in UTF-8 with terminator */
+  #define SD_L2_NAME_MAX            (SD_L2_LFN_MAX * 3 + 1)
+#else
+  #define SD_L2_NAME_MAX            13
+#endif
+
+/** 
+ * Number of 512 byte sectors cached for directory reads and FAT writes.
+ * 0 saves the static RAM: the work buffer given to SD_L2_Init() is the 
+ * only cache sector then, like before the cache (see SD_L2_Init()).
+ */
+#ifndef SD_L2_CACHE_SECTORS
+#define SD_L2_CACHE_SECTORS         2
+#endif
+/** 
+ * Number of consecutive FAT sectors read at once into the FAT window.
+ * One sector is read with a single block read (CMD17) and holds the
+ * chain of 1 MB (FAT32) to 2 MB (FAT16) of file at 4 KB clusters.
+ * A larger window is loaded with one multiple block read (CMD18 and
+ * CMD12), so a long or widely fragmented chain needs fewer commands
+ * to walk, at 512 bytes of static RAM per sector.
+ * 0 saves the static RAM, FAT sectors go through the sector cache then.
+ */
+#ifndef SD_L2_FAT_WINDOW_SECTORS
+#define SD_L2_FAT_WINDOW_SECTORS    1
+#endif
 
 /** No valid MBR/FAT-BS signature found in sector 0 */
 #define SD_L2_ERROR_INVAL_SECT0     0x30
@@ -23,18 +57,33 @@
 #define SD_L2_ERROR_EOF             0x38
 /** WorkBuf not set */
 #define SD_L2_ERROR_WORKBUF         0x39
+/** File to be created exists already */
+#define SD_L2_ERROR_FILE_EXISTS     0x3a
+/** No free directory entry found */
+#define SD_L2_ERROR_DIR_FULL        0x3b
+/** Not enough contiguous free clusters found */
+#define SD_L2_ERROR_DISK_FULL       0x3c
+/** No block device selected (SD_L2_dev) */
+#define SD_L2_ERROR_NO_DEVICE       0x3d
+/** File has more extents than the extent table holds */
+#define SD_L2_ERROR_EXTENTS_FULL    0x3e
+/** Index file is malformed or does not match the directory (run tools/bsda_mkindex.py again) */
+#define SD_L2_ERROR_INDEX_INVALID   0x3f
+/** File system can not be written (exFAT, or the block device has no write functions) */
+#define SD_L2_ERROR_READ_ONLY       0x40
 
 
 #define SD_L2_PARTTYPE_UNKNOWN      0
 #define SD_L2_PARTTYPE_SUPERFLOPPY  1
 #define SD_L2_PARTTYPE_FAT16        2
 #define SD_L2_PARTTYPE_FAT32        3
+#define SD_L2_PARTTYPE_EXFAT        4
 
 typedef struct  {
-    uint8_t     PartType;       // Use this to test whether it is FAT16 or FAT32 or not initialized
+    uint8_t     PartType;       // Use this to test whether it is FAT16, FAT32, exFAT or not initialized
 	
 	// Stuff from FAT boot sector
-	uint8_t     SecPerClus;
+	uint16_t    SecPerClus;
 	uint16_t    RsvdSecCnt;
 	uint8_t     NumFATs;
 	uint16_t    RootEntryCount;
@@ -63,20 +112,72 @@ typedef struct {
     
 	uint32_t    ActSector;      // 0 to (SD_L2_FAT.SecPerClus - 1)
 	uint32_t    ActBytePos;     // 0 to Size
+	
+	uint32_t    DirSector;      // Sector holding the directory entry
+	uint16_t    DirOffset;      // Offset of the directory entry in DirSector
+	uint8_t     Contiguous;     // 1 if the clusters are known to be one run (no FAT walk needed, exFAT NoFatChain)
 } SD_L2_File_t;
 
+typedef struct {
+	uint32_t    StartSector;    // First sector of a run of contiguous sectors
+	uint32_t    Sectors;        // Length of the run
+	uint32_t    FileSector;     // Index of StartSector within the file
+} SD_L2_Extent_t;
+
+typedef struct {
+	uint16_t    Hash;           // Hash of the 8.3 name as stored in the directory
+	uint16_t    Entry;          // Number of the directory entry + 1, 0 if slot is free
+} SD_L2_IndexSlot_t;
+
+typedef struct {
+	uint32_t    Hits;           // Sector cache reads served from the cache
+	uint32_t    Misses;         // ... and read from the device
+	uint32_t    FatHits;        // FAT entries found in the FAT window
+	uint32_t    FatLoads;       // Windows of FAT sectors read from the device
+} SD_L2_CacheStats_t;
+
+typedef struct {
+	uint32_t    ActCluster;     // Cluster of the next entry, 0 in the FAT16 root directory
+	uint32_t    Index;          // Number of the next entry (32 bytes each) in the directory
+	uint32_t    Clusters;       // Clusters of a directory without FAT chain (exFAT NoFatChain), 0 otherwise
+	uint8_t     MaskSet;        // Attribute filter, see SD_L2_SearchFile
+	uint8_t     MaskUnset;
+	uint8_t     Done;           // 1 behind the last entry
+} SD_L2_DirCursor_t;
+
 extern SD_L2_FAT_t SD_L2_FAT;
+/** Block device of the file system, the SD card (SD_L1_BlkDev) by default */
+extern const SD_BLK_Dev_t *SD_L2_dev;
+extern SD_L2_CacheStats_t SD_L2_cacheStats;
 
 uint8_t     SD_L2_Init(uint8_t *pWorkBuf);
 void        SD_L2_DeInit();
+void        SD_L2_CacheInvalidate();
+
+void        SD_L2_IndexSetup(const uint32_t cluster, SD_L2_IndexSlot_t *slots, uint16_t count);
+uint8_t     SD_L2_IndexBuild();
+uint8_t     SD_L2_IndexFileLoad(uint8_t *filename);
 
 uint8_t     SD_L2_SearchFile(uint8_t *filename, const uint32_t cluster, const uint8_t maskSet, const uint8_t maskUnset, SD_L2_File_t *fileinfo);
+uint8_t     SD_L2_SearchDir(uint8_t *filename, const uint32_t cluster, const uint8_t maskSet, const uint8_t maskUnset, SD_L2_File_t *fileinfo);
+uint8_t     SD_L2_SearchPath(uint8_t *path, const uint8_t maskSet, const uint8_t maskUnset, SD_L2_File_t *fileinfo);
 uint32_t    SD_L2_Cluster2Sector(uint32_t cluster);
 
 uint8_t     SD_L2_IsFileFragmented(SD_L2_File_t *fileinfo);
+uint8_t     SD_L2_GetExtents(SD_L2_File_t *fileinfo, SD_L2_Extent_t *extents, uint16_t maxExtents, uint16_t *count);
+uint16_t    SD_L2_FindExtent(const SD_L2_Extent_t *extents, uint16_t count, uint32_t fileSector);
+
+#if SD_ENABLE_WRITE_ACCESS && SD_ENABLE_MULTIBLOCK_ACCESS
+  uint8_t   SD_L2_CreateFile(uint8_t *filename, const uint32_t cluster, uint32_t size, SD_L2_File_t *fileinfo);
+  uint8_t   SD_L2_WriteOpen(SD_L2_File_t *fileinfo);
+  uint8_t   SD_L2_WriteSector(SD_L2_File_t *fileinfo, const uint8_t *src);
+  uint8_t   SD_L2_WriteClose(SD_L2_File_t *fileinfo, uint32_t size);
+#endif /* SD_ENABLE_WRITE_ACCESS && SD_ENABLE_MULTIBLOCK_ACCESS */
 
 #if SD_ENABLE_DIR_VIEW 
   uint8_t SD_L2_Dir(const uint32_t cluster, const uint8_t maskSet, const uint8_t maskUnset, void (*callback)(char *entryLine));
+  uint8_t SD_L2_DirOpen(SD_L2_DirCursor_t *cursor, const SD_L2_File_t *dirinfo, const uint8_t maskSet, const uint8_t maskUnset);
+  uint8_t SD_L2_DirNext(SD_L2_DirCursor_t *cursor, char *name, SD_L2_File_t *fileinfo);
 #endif  /* SD_ENABLE_DIR_VIEW */
 
 #endif
\ No newline at end of file
@@ -0,0 +1,258 @@
+#!/usr/bin/env python3
+"""
+Build the lookup index file of BasicSDAudio (SD_L2_IndexFileLoad).
+
+The index maps the names of all files in the root directory, long names
+and 8.3 names, to their directory entry, first cluster, size and number
+of extents. It is sorted by a 64 bit hash of the name, so the library
+finds a file by binary search with two block reads instead of scanning
+the directory.
+
+The tool works on a card reader device or an image of the card and
+writes into an existing file, so the directory is not changed by it:
+
+  1. Copy the clips to the card, then create the index file with
+     (at least) the size printed by a dry run:
+       bsda_mkindex.py /dev/sdX --dry-run
+       dd if=/dev/zero of=/media/card/BSDAIDX.BIN bs=512 count=N
+     Unmount the card.
+  2. Write the index:
+       bsda_mkindex.py /dev/sdX
+
+Run it again whenever files in the root directory were changed; the
+library rejects an index that does not match the directory any more.
+
+File layout (little endian, 512 byte sectors):
+  sector 0       header: "BSDAIDX1", records, fence sectors, data
+                 sectors, directory entries, directory checksum,
+                 directory cluster (0 = root)
+  fence sectors  first key of each data sector, 64 keys per sector
+  data sectors   records sorted by key, 16 per sector:
+                 key (8), 8.3 name (11), attributes (1),
+                 first cluster (4), size (4), entry number (2),
+                 extents (2)
+
+The key is the 64 bit FNV-1a hash of the name in UTF-8 with a-z
+converted to upper case. The checksum is the 32 bit FNV-1a hash of the
+directory sector holding the last used entry.
+"""
+import argparse
+import struct
+import sys
+
+MAGIC = b"BSDAIDX1"
+RECORD = struct.Struct("<Q11sBLLHH")
+RECORDS_PER_SECTOR = 512 // RECORD.size
+KEYS_PER_SECTOR = 512 // 8
+
+
+def fnv1a64(data):
+    h = 0xcbf29ce484222325
+    for b in data:
+        h = ((h ^ b) * 0x100000001b3) & 0xffffffffffffffff
+    return h
+
+
+def fnv1a32(data):
+    h = 2166136261
+    for b in data:
+        h = ((h ^ b) * 16777619) & 0xffffffff
+    return h
+
+
+def name_key(name):
+    return fnv1a64(bytes(c - 0x20 if 0x61 <= c <= 0x7a else c for c in name))
+
+
+class Fat:
+    """Just enough FAT16/FAT32 to read the root directory, like SD_L2_Init."""
+
+    def __init__(self, f):
+        self.f = f
+        mbr = self.read(0)
+        if mbr[0x1fe:0x200] != b"\x55\xaa":
+            raise ValueError("no MBR/boot sector signature in sector 0")
+        ptype = mbr[0x1be + 4]
+        start = struct.unpack_from("<L", mbr, 0x1be + 8)[0]
+        if (mbr[0x1be] & 0x7f) != 0 or ptype not in (0x04, 0x06, 0x0b, 0x0c, 0x0e):
+            start = 0   # super floppy
+        bs = self.read(start)
+        if bs[0x1fe:0x200] != b"\x55\xaa" or bs[0x0b:0x0d] != b"\x00\x02":
+            raise ValueError("no FAT boot sector found")
+        self.spc = bs[0x0d]
+        rsvd, nfats, rootents, tot16, _, spf16 = struct.unpack_from("<HBHHBH", bs, 0x0e)
+        tot32, spf32 = struct.unpack_from("<L", bs, 0x20)[0], struct.unpack_from("<L", bs, 0x24)[0]
+        total = tot16 or tot32
+        spf = spf16 or spf32
+        self.fatstart = start + rsvd
+        self.rootstart = self.fatstart + nfats * spf
+        self.rootsects = (32 * rootents + 511) // 512
+        self.datastart = self.rootstart + self.rootsects - 2 * self.spc
+        clusters = (total - (self.datastart + 2 * self.spc - start)) // self.spc
+        if clusters < 4085:
+            raise ValueError("FAT12 is not supported")
+        self.fat32 = clusters >= 65525
+        self.rootclus = struct.unpack_from("<L", bs, 0x2c)[0] if self.fat32 else 0
+        self.end = 0x0ffffff8 if self.fat32 else 0xfff8
+
+    def read(self, sector):
+        self.f.seek(sector * 512)
+        data = self.f.read(512)
+        if len(data) != 512:
+            raise ValueError("cannot read sector %u" % sector)
+        return data
+
+    def write(self, sector, data):
+        self.f.seek(sector * 512)
+        self.f.write(data)
+
+    def next_cluster(self, cluster):
+        if self.fat32:
+            sect, off, fmt = cluster >> 7, (cluster & 0x7f) * 4, "<L"
+        else:
+            sect, off, fmt = cluster >> 8, (cluster & 0xff) * 2, "<H"
+        value = struct.unpack_from(fmt, self.read(self.fatstart + sect), off)[0]
+        return value & 0x0fffffff if self.fat32 else value
+
+    def chain(self, cluster):
+        clusters = []
+        while 2 <= cluster < self.end:
+            clusters.append(cluster)
+            cluster = self.next_cluster(cluster)
+        return clusters
+
+    def cluster_sector(self, cluster):
+        return self.datastart + cluster * self.spc
+
+    def root_sectors(self):
+        if not self.fat32:
+            return list(range(self.rootstart, self.rootstart + self.rootsects))
+        return [self.cluster_sector(c) + i for c in self.chain(self.rootclus) for i in range(self.spc)]
+
+
+def lfn_checksum(short):
+    s = 0
+    for b in short:
+        s = (((s & 1) << 7) + (s >> 1) + b) & 0xff
+    return s
+
+
+def short_display(short):
+    base = short[:8].rstrip(b" ")
+    ext = short[8:].rstrip(b" ")
+    if base[:1] == b"\x05":
+        base = b"\xe5" + base[1:]
+    return base + (b"." + ext if ext else b"")
+
+
+def scan_root(fat):
+    """Returns the files, the number of used entries and the root sectors."""
+    sectors = fat.root_sectors()
+    files = []
+    lfn = {}
+    lfn_sum = None
+    used = 0
+    for si, sector in enumerate(sectors):
+        data = fat.read(sector)
+        for j in range(0, 512, 32):
+            e = data[j:j + 32]
+            if e[0] == 0:
+                return files, used, sectors
+            used += 1
+            if e[0] == 0xe5:
+                lfn = {}
+                continue
+            attrib = e[0x0b]
+            if attrib == 0x0f:
+                order = e[0] & 0x1f
+                if e[0] & 0x40:
+                    lfn = {}
+                    lfn_sum = e[13]
+                lfn[order] = e[1:11] + e[14:26] + e[28:32]
+                continue
+            short = e[0:11]
+            longname = None
+            if lfn and lfn_sum == lfn_checksum(short) and sorted(lfn) == list(range(1, len(lfn) + 1)):
+                raw = b"".join(lfn[i] for i in sorted(lfn)).decode("utf-16-le", "replace")
+                longname = raw.split("\x00")[0].encode("utf-8")
+            lfn = {}
+            if attrib & 0x18:
+                continue    # directories and volume label
+            first = struct.unpack_from("<H", e, 0x1a)[0]
+            if fat.fat32:
+                first |= struct.unpack_from("<H", e, 0x14)[0] << 16
+            size = struct.unpack_from("<L", e, 0x1c)[0]
+            files.append(dict(short=short, long=longname, attrib=attrib, first=first,
+                              size=size, entry=si * 16 + j // 32))
+    return files, used, sectors
+
+
+def extents(fat, file):
+    clusters = fat.chain(file["first"]) if file["size"] else []
+    return max(1, sum(1 for i, c in enumerate(clusters) if i == 0 or c != clusters[i - 1] + 1))
+
+
+def main():
+    ap = argparse.ArgumentParser(description="Build the BasicSDAudio lookup index file.")
+    ap.add_argument("device", help="card reader device or card image")
+    ap.add_argument("--name", default="BSDAIDX.BIN", help="8.3 name of the index file in root")
+    ap.add_argument("--dry-run", action="store_true", help="only print the size needed")
+    args = ap.parse_args()
+
+    with open(args.device, "rb" if args.dry_run else "r+b") as f:
+        fat = Fat(f)
+        files, used, sectors = scan_root(fat)
+        if used > 65536:
+            sys.exit("directory too large")
+
+        records = {}
+        for file in files:
+            names = [short_display(file["short"])]
+            if file["long"] and name_key(file["long"]) != name_key(names[0]):
+                names.append(file["long"])
+            ext = extents(fat, file)
+            for name in names:
+                key = name_key(name)
+                if key in records:
+                    sys.exit("hash collision or duplicate name: %r" % name)
+                records[key] = RECORD.pack(key, file["short"], file["attrib"], file["first"],
+                                           file["size"], file["entry"], ext)
+
+        keys = sorted(records)
+        data_sectors = (len(keys) + RECORDS_PER_SECTOR - 1) // RECORDS_PER_SECTOR
+        fence_sectors = (data_sectors + KEYS_PER_SECTOR - 1) // KEYS_PER_SECTOR
+        total = 1 + fence_sectors + data_sectors
+        print("%u files, %u records, index needs %u sectors (%u bytes)"
+              % (len(files), len(keys), total, total * 512))
+        if args.dry_run:
+            return
+
+        idx = [fl for fl in files if short_display(fl["short"]).upper() == args.name.upper().encode()]
+        if not idx:
+            sys.exit("%s not found in root directory, create it with %u bytes first"
+                     % (args.name, total * 512))
+        chain = fat.chain(idx[0]["first"])
+        if idx[0]["size"] < total * 512 or len(chain) * fat.spc < total:
+            sys.exit("%s is too small, it needs %u bytes" % (args.name, total * 512))
+        if any(c != chain[0] + i for i, c in enumerate(chain)):
+            sys.exit("%s is fragmented, create it again" % args.name)
+
+        last = sectors[(used - 1) // 16] if used else sectors[0]
+        header = MAGIC + struct.pack("<LLLLLL", len(keys), fence_sectors, data_sectors,
+                                     used, fnv1a32(fat.read(last)), 0)
+        out = [header.ljust(512, b"\0")]
+        for s in range(fence_sectors):
+            fence = keys[s * KEYS_PER_SECTOR * RECORDS_PER_SECTOR:(s + 1) * KEYS_PER_SECTOR * RECORDS_PER_SECTOR:RECORDS_PER_SECTOR]
+            out.append(b"".join(struct.pack("<Q", k) for k in fence).ljust(512, b"\0"))
+        for s in range(data_sectors):
+            part = keys[s * RECORDS_PER_SECTOR:(s + 1) * RECORDS_PER_SECTOR]
+            out.append(b"".join(records[k] for k in part).ljust(512, b"\0"))
+
+        start = fat.cluster_sector(chain[0])
+        for i, data in enumerate(out):
+            fat.write(start + i, data)
+        print("written to %s" % args.name)
+
+
+if __name__ == "__main__":
+    main()
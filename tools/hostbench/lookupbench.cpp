@@ -0,0 +1,123 @@
+/*
+ * Directory lookup benchmark for host builds.
+ *
+ * Looks up every file of the root directory of a FAT image with
+ * SD_L2_SearchFile, once searching the directory and once through the
+ * hashed index (SD_L2_IndexSetup), and prints the lookup time against
+ * the position of the file in the directory. Times are virtual SPI
+ * times of the SD card emulator (sd_l0_emu.cpp) at the negotiated
+ * clock. The sector cache is emptied before every lookup, so each one
+ * starts cold like the first setFile() after init.
+ *
+ * Build (from this folder):
+ *   g++ -O2 -I../.. lookupbench.cpp ../../sd_l0_emu.cpp ../../sd_l1.cpp
+ *       ../../sd_l2.cpp -o lookupbench
+ *
+ * Usage:
+ *   lookupbench image [slots]
+ * e.g. lookupbench card.img 1024
+ */
+#include "sd_l2.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BENCH_MAX_FILES 4096
+#define BENCH_BUCKETS   10
+
+uint8_t  workBuf[512];
+char     names[BENCH_MAX_FILES][SD_L2_NAME_MAX];
+uint32_t scanUs[BENCH_MAX_FILES];
+uint32_t indexUs[BENCH_MAX_FILES];
+uint16_t fileCount = 0;
+
+SD_L2_IndexSlot_t *slots;
+
+void benchCollect(char *entryLine)
+{
+  if (fileCount < BENCH_MAX_FILES) {
+    strncpy(names[fileCount], entryLine, SD_L2_NAME_MAX - 1);
+    names[fileCount++][SD_L2_NAME_MAX - 1] = 0;
+  }
+}
+
+/** time of one cold lookup, 0xffffffff if not found */
+uint32_t benchLookup(const char *name)
+{
+  SD_L2_File_t fileinfo;
+  uint32_t t0;
+
+  SD_L2_CacheInvalidate();
+  t0 = SD_L0_EmuMicros();
+  if (SD_L2_SearchFile((uint8_t *)name, 0, 0x00, 0x18, &fileinfo)) return 0xffffffffUL;
+  return SD_L0_EmuMicros() - t0;
+}
+
+int main(int argc, char **argv)
+{
+  uint16_t slotCount = (argc > 2) ? atoi(argv[2]) : 1024;
+  uint32_t t0;
+  uint8_t  ret;
+
+  if (argc < 2) {
+    printf("usage: %s image [slots]\n", argv[0]);
+    return 1;
+  }
+  if (SD_L0_EmuOpen(argv[1])) {
+    printf("cannot open %s\n", argv[1]);
+    return 1;
+  }
+  SD_L2_dev = &SD_L1_BlkDev;
+  ret = SD_L2_Init(workBuf);
+  if (ret) {
+    printf("mount failed, error 0x%02x\n", ret);
+    return 1;
+  }
+
+  // files of the first cluster of the root directory (all of it on FAT16)
+  SD_L2_Dir(0, 0x00, 0x18, benchCollect);
+  if (fileCount == 0) {
+    printf("no files in root directory\n");
+    return 1;
+  }
+
+  for (uint16_t i = 0; i < fileCount; i++) {
+    scanUs[i] = benchLookup(names[i]);
+  }
+
+  slots = (SD_L2_IndexSlot_t *)malloc(slotCount * sizeof(SD_L2_IndexSlot_t));
+  SD_L2_IndexSetup(0, slots, slotCount);
+  SD_L2_CacheInvalidate();
+  t0 = SD_L0_EmuMicros();
+  ret = SD_L2_IndexBuild();
+  if (ret) {
+    printf("index build failed, error 0x%02x\n", ret);
+    return 1;
+  }
+  printf("%u files, index of %u slots (%u bytes) built in %u us\n", fileCount, slotCount,
+         (unsigned)(slotCount * sizeof(SD_L2_IndexSlot_t)), SD_L0_EmuMicros() - t0);
+
+  for (uint16_t i = 0; i < fileCount; i++) {
+    indexUs[i] = benchLookup(names[i]);
+  }
+
+  // mean and worst lookup per tenth of the directory
+  printf("entries          scan us mean/max     index us mean/max\n");
+  for (uint16_t b = 0; b < BENCH_BUCKETS; b++) {
+    uint16_t first = (uint32_t)fileCount * b / BENCH_BUCKETS;
+    uint16_t last = (uint32_t)fileCount * (b + 1) / BENCH_BUCKETS;
+    uint32_t scanSum = 0, scanMax = 0, indexSum = 0, indexMax = 0;
+
+    if (first == last) continue;
+    for (uint16_t i = first; i < last; i++) {
+      scanSum += scanUs[i];
+      indexSum += indexUs[i];
+      if (scanUs[i] > scanMax) scanMax = scanUs[i];
+      if (indexUs[i] > indexMax) indexMax = indexUs[i];
+    }
+    printf("%5u - %5u   %8u / %8u   %8u / %8u\n", first, last - 1,
+           scanSum / (last - first), scanMax, indexSum / (last - first), indexMax);
+  }
+  return 0;
+}
@@ -0,0 +1,316 @@
+/*
+ * Read throughput benchmark for host builds.
+ *
+ * Reads a file of a FAT image with every read strategy of the library
+ * and prints MB/s, sectors/s and percentiles of the per-sector latency:
+ *
+ * - single:  one SD_L2_dev->ReadBlock (CMD17) per sector
+ * - multi:   one read run (CMD18) per extent, i.e. over the whole file
+ *            if it is not fragmented
+ * - cluster: one read run per cluster, stopped at cluster boundaries
+ * - worker:  the background read path of SdPlayClass::worker(), one
+ *            sector per call, polled until done
+ *
+ * The file may be fragmented into up to BENCH_MAX_EXTENTS extents.
+ * Building the extent list walks the FAT chain of the file, its time
+ * is also given per MB of file. Every sector read is compared with the
+ * same sector of the image file read with stdio, a mismatch counts as
+ * an error of the strategy and the exit code is 1. Build with
+ * -DSD_L2_FAT_WINDOW_SECTORS=n to compare window sizes.
+ *
+ * Backends:
+ * - emu:  the real SD_L1 code on the SD card emulator (sd_l0_emu.cpp),
+ *         times are virtual SPI times at the negotiated clock, busyUs
+ *         sets the busy time of the card after CMD12
+ * - file: the image file backend (sd_blk_file.cpp) with the given
+ *         command and block latency, times are wall clock
+ *
+ * Build (from this folder):
+ *   g++ -O2 -I../.. readbench.cpp ../../sd_l0_emu.cpp ../../sd_l1.cpp
+ *       ../../sd_l2.cpp ../../sd_blk_file.cpp -o readbench
+ * or with make in ../hosttest, whose test target runs it on a test image.
+ *
+ * Usage:
+ *   readbench image [file [emu [busyUs]|file [commandUs blockUs]]]
+ * e.g. readbench card.img BENCH.BIN emu
+ */
+#include "sd_l2.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/types.h>
+
+#define BENCH_MAX_SECTORS 65536
+#define BENCH_MAX_EXTENTS 256
+
+uint8_t  workBuf[512];
+uint8_t  ringBuf[4 * 512];
+uint32_t latency[BENCH_MAX_SECTORS];
+uint8_t  useEmu = 1;
+
+FILE     *image;            // the image again, to verify the data read
+uint8_t  imageBuf[512];
+uint32_t badSectors;
+uint32_t verifyUs;          // time spent verifying, not counted
+uint8_t  failed;
+
+SD_L2_File_t   fileinfo;
+SD_L2_Extent_t extents[BENCH_MAX_EXTENTS];
+uint16_t       extentCount;
+uint32_t       sectors;
+
+uint32_t benchMicros()
+{
+  struct timespec ts;
+
+  if (useEmu) return SD_L0_EmuMicros();
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint32_t)((uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000);
+}
+
+int compareU32(const void *a, const void *b)
+{
+  uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+  return (x > y) - (x < y);
+}
+
+/** wait for a background read like worker() does */
+uint8_t benchPoll()
+{
+  uint8_t ret;
+  while ((ret = SD_L2_dev->ReadPoll()) == SD_CARD_READ_PENDING) ;
+  return ret;
+}
+
+/** compare sector of the card with the image file */
+void benchVerify(uint32_t sector, const uint8_t *data)
+{
+  uint32_t t = benchMicros();
+
+  if ((fseeko(image, (off_t)sector << 9, SEEK_SET) != 0) ||
+      (fread(imageBuf, 1, 512, image) != 512) ||
+      memcmp(imageBuf, data, 512)) badSectors++;
+  verifyUs += benchMicros() - t;
+}
+
+/** card sector of the i-th sector of the file */
+uint32_t benchSector(uint32_t i)
+{
+  uint16_t e = SD_L2_FindExtent(extents, extentCount, i);
+  return extents[e].StartSector + (i - extents[e].FileSector);
+}
+
+uint8_t benchSingle()
+{
+  for (uint32_t i = 0; i < sectors; i++) {
+    uint32_t t = benchMicros();
+    uint32_t sector = benchSector(i);
+    uint8_t ret = SD_L2_dev->ReadBlock(sector, workBuf);
+    if (ret) return ret;
+    latency[i] = benchMicros() - t;
+    benchVerify(sector, workBuf);
+  }
+  return 0;
+}
+
+/** runs of runLength sectors, also stopped where the file is fragmented */
+uint8_t benchRun(uint32_t runLength)
+{
+  uint32_t next = 0;
+  uint8_t  mbActive = 0;
+  uint8_t  ret;
+
+  for (uint32_t i = 0; i < sectors; i++) {
+    uint32_t t = benchMicros();
+    uint32_t sector = benchSector(i);
+    if (mbActive && (((i % runLength) == 0) || (sector != next))) {
+      mbActive = 0;
+      ret = SD_L2_dev->ReadRunStop();
+      if (ret) return ret;
+    }
+    if (!mbActive) {
+      ret = SD_L2_dev->ReadRunStart(sector);
+      if (ret) return ret;
+      mbActive = 1;
+    }
+    ret = SD_L2_dev->ReadRunAsync(workBuf);
+    if (!ret) ret = benchPoll();
+    if (ret) return ret;
+    next = sector + 1;
+    latency[i] = benchMicros() - t;
+    benchVerify(sector, workBuf);
+  }
+  return mbActive ? SD_L2_dev->ReadRunStop() : 0;
+}
+
+/**
+ * Same calls as SdPlayClass::readSectorStart/readSectorDone/streamStop
+ * with BSDA_USE_MULTIBLOCK: a run is kept open within an extent, the
+ * sectors go to a ring buffer of four sectors.
+ */
+uint8_t benchWorker()
+{
+  uint16_t extIndex = 0;
+  uint32_t sector = extents[0].StartSector;
+  uint32_t extLeft = extents[0].Sectors;
+  uint16_t bufin = 0;
+  uint8_t  mbActive = 0;
+  uint8_t  ret;
+
+  for (uint32_t i = 0; i < sectors; i++) {
+    uint32_t t = benchMicros();
+    if (!mbActive) {
+      ret = SD_L2_dev->ReadRunStart(sector);
+      if (ret) return ret;
+      mbActive = 1;
+    }
+    ret = SD_L2_dev->ReadRunAsync(ringBuf + bufin);
+    if (!ret) ret = benchPoll();
+    if (ret) return ret;
+    uint32_t done = sector++;
+    uint16_t doneAt = bufin;
+    bufin = (bufin + 512) % sizeof(ringBuf);
+    if (--extLeft == 0) {
+      mbActive = 0;
+      ret = SD_L2_dev->ReadRunStop();
+      if (ret) return ret;
+      if (++extIndex < extentCount) {
+        sector = extents[extIndex].StartSector;
+        extLeft = extents[extIndex].Sectors;
+      }
+    }
+    latency[i] = benchMicros() - t;
+    benchVerify(done, ringBuf + doneAt);
+  }
+  return mbActive ? SD_L2_dev->ReadRunStop() : 0;
+}
+
+void benchReport(const char *name, uint8_t ret, uint32_t us)
+{
+  if (ret) {
+    printf("%-8s error 0x%02x\n", name, ret);
+    return;
+  }
+  qsort(latency, sectors, sizeof(latency[0]), compareU32);
+  if (us == 0) us = 1;
+  printf("%-8s %8.3f MB/s %8.0f sectors/s  latency us p50 %5u p90 %5u p99 %5u max %6u\n",
+         name, sectors * 512.0 / us, sectors * 1000000.0 / us,
+         latency[sectors / 2], latency[sectors * 9 / 10], latency[sectors * 99 / 100],
+         latency[sectors - 1]);
+}
+
+uint32_t benchT0;
+
+/** start timing a strategy */
+void benchStart()
+{
+  badSectors = 0;
+  verifyUs = 0;
+  benchT0 = benchMicros();
+}
+
+/** report a strategy, the verification is not counted */
+void benchEnd(const char *name, uint8_t ret)
+{
+  uint32_t us = benchMicros() - benchT0 - verifyUs;
+
+  if (ret || badSectors) failed = 1;
+  if (!ret && badSectors) {
+    printf("%-8s %u sectors differ from the image\n", name, badSectors);
+    return;
+  }
+  benchReport(name, ret, us);
+}
+
+int main(int argc, char **argv)
+{
+  const char *fileName = (argc > 2) ? argv[2] : "BENCH.BIN";
+  uint32_t t0;
+  uint8_t  ret;
+
+  if (argc < 2) {
+    printf("usage: %s image [file [emu [busyUs]|file [commandUs blockUs]]]\n", argv[0]);
+    return 1;
+  }
+  useEmu = (argc < 4) || strcmp(argv[3], "file");
+
+  if (useEmu) {
+    ret = SD_L0_EmuOpen(argv[1]);
+    if (argc > 4) SD_L0_emuConfig.BusyUs = atoi(argv[4]);
+    SD_L2_dev = &SD_L1_BlkDev;
+  } else {
+    ret = SD_BLK_FileOpen(argv[1]);
+    if (argc > 5) SD_BLK_FileSetLatency(atoi(argv[4]), atoi(argv[5]));
+    SD_L2_dev = &SD_BLK_FileDev;
+  }
+  image = fopen(argv[1], "rb");
+  if (ret || !image) {
+    printf("cannot open %s\n", argv[1]);
+    return 1;
+  }
+
+  t0 = benchMicros();
+  ret = SD_L2_Init(workBuf);
+  if (ret) {
+    printf("mount failed, error 0x%02x\n", ret);
+    return 1;
+  }
+  printf("mount    %u us\n", benchMicros() - t0);
+
+  t0 = benchMicros();
+  ret = SD_L2_SearchFile((uint8_t *)fileName, 0, 0x00, 0x18, &fileinfo);
+  if (ret) {
+    printf("%s not found, error 0x%02x\n", fileName, ret);
+    return 1;
+  }
+  printf("lookup   %u us\n", benchMicros() - t0);
+
+  // again with FAT and directory sectors in the cache
+  t0 = benchMicros();
+  ret = SD_L2_SearchFile((uint8_t *)fileName, 0, 0x00, 0x18, &fileinfo);
+  printf("lookup   %u us (cached)\n", benchMicros() - t0);
+
+  // the FAT walk starts cold like setFile() right after init
+  SD_L2_CacheInvalidate();
+  t0 = benchMicros();
+  ret = SD_L2_GetExtents(&fileinfo, extents, BENCH_MAX_EXTENTS, &extentCount);
+  if (ret) {
+    printf("%s: no extents, error 0x%02x\n", fileName, ret);
+    return 1;
+  }
+  t0 = benchMicros() - t0;
+  printf("extents  %u us, %u FAT window loads of %u sectors, %.0f us per MB of file\n",
+         t0, SD_L2_cacheStats.FatLoads, SD_L2_FAT_WINDOW_SECTORS,
+         fileinfo.Size ? t0 * 1048576.0 / fileinfo.Size : 0.0);
+  sectors = fileinfo.Size / 512;
+  if (sectors > BENCH_MAX_SECTORS) sectors = BENCH_MAX_SECTORS;
+  if (sectors == 0) {
+    printf("%s is smaller than one sector\n", fileName);
+    return 1;
+  }
+  printf("%u sectors, %u sectors per cluster, %u extents\n", sectors, SD_L2_FAT.SecPerClus, extentCount);
+
+  benchStart();
+  benchEnd("single", benchSingle());
+
+  benchStart();
+  benchEnd("multi", benchRun(0xffffffffUL));
+
+  benchStart();
+  benchEnd("cluster", benchRun(SD_L2_FAT.SecPerClus));
+
+  benchStart();
+  benchEnd("worker", benchWorker());
+
+  printf("cache: %u hits, %u misses, FAT window: %u hits, %u loads\n",
+         SD_L2_cacheStats.Hits, SD_L2_cacheStats.Misses,
+         SD_L2_cacheStats.FatHits, SD_L2_cacheStats.FatLoads);
+  if (useEmu) {
+    printf("card: %u commands, %u blocks, %u bytes clocked\n",
+           SD_L0_emuStats.Commands, SD_L0_emuStats.Blocks, SD_L0_emuStats.Bytes);
+  }
+  fclose(image);
+  return failed;
+}
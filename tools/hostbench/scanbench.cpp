@@ -0,0 +1,139 @@
+/*
+ * Directory scan microbenchmark for host builds.
+ *
+ * Measures the CPU time SD_L2_SearchFile spends per 512 byte directory
+ * sector, without any card access: a directory is built in memory and
+ * searched for a name that is not in it, so every entry is looked at.
+ * Compared are the byte-wise scan SearchFile used before (first byte
+ * tested for the end of the directory, then SD_L2_MatchEntry) and
+ * SD_L2_ScanSector, which compares the name as 32 bit words.
+ *
+ * Directories:
+ * - short:   8.3 names only, TRACK001.WAV, TRACK002.WAV, ...
+ * - long:    every file with two long name entries before its 8.3 entry
+ * - deleted: every second entry deleted
+ *
+ * Times are TSC cycles on x86, nanoseconds elsewhere. They depend on
+ * the host CPU and compiler, the ratio is what to look at.
+ *
+ * Build (from this folder):
+ *   g++ -O2 -I../.. scanbench.cpp ../../sd_l0_emu.cpp ../../sd_l1.cpp
+ *       ../../sd_l2.cpp -o scanbench
+ *
+ * Usage:
+ *   scanbench [sectors [rounds]]
+ */
+#include "sd_l2.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// internal functions of sd_l2.cpp
+void    SD_L2_ConvertName(uint8_t *filename, char *fnentry);
+uint8_t SD_L2_MatchEntry(const uint8_t *entry, const char *fnentry, const uint8_t maskSet, const uint8_t maskUnset);
+uint8_t SD_L2_ScanSector(const uint8_t *dir, const uint32_t *name, const uint8_t maskSet, const uint8_t maskUnset, uint16_t *offset);
+
+#define BENCH_MAX_SECTORS 256
+
+uint32_t dirData[BENCH_MAX_SECTORS][128];   // word aligned like the sector cache
+uint32_t fnwords[3];
+volatile uint32_t sink;
+
+uint64_t benchTicks()
+{
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+void benchEntry(uint8_t *entry, const char *name83, uint8_t attrib)
+{
+  memset(entry, 0, 32);
+  memcpy(entry, name83, 11);
+  entry[0x0b] = attrib;
+}
+
+void benchFill(uint16_t sectors, char kind)
+{
+  uint8_t *dir = (uint8_t *)dirData;
+  char name83[12];
+
+  for (uint16_t e = 0; e < sectors * 16; e++) {
+    uint8_t *entry = dir + 32 * e;
+    snprintf(name83, sizeof(name83), "TRACK%03uWAV", e % 1000);
+    if ((kind == 'l') && ((e % 3) != 2)) {
+      benchEntry(entry, "\x41T\0R\0A\0C\0K", 0x0f);  // looks like a name in its first bytes
+      entry[0] = (e % 3) ? 0x01 : 0x42;
+    } else if ((kind == 'd') && (e & 1)) {
+      benchEntry(entry, name83, 0x20);
+      entry[0] = 0xe5;
+    } else {
+      benchEntry(entry, name83, 0x20);
+    }
+  }
+}
+
+/** the scan of SD_L2_SearchFile before SD_L2_ScanSector */
+uint8_t benchByteScan(const uint8_t *dir, const char *fnentry, uint16_t *offset)
+{
+  for (uint16_t j = 0; j < 512; j += 32) {
+    if (dir[j] == 0) return SD_L2_ERROR_FILE_NOT_FOUND;
+    if (!SD_L2_MatchEntry(dir + j, fnentry, 0x00, 0x18)) continue;
+    *offset = j;
+    return 0;
+  }
+  return SD_L2_ERROR_DIR_EOC;
+}
+
+double benchRun(uint16_t sectors, uint16_t rounds, uint8_t words)
+{
+  uint64_t best = ~0ULL;
+  uint16_t offset;
+
+  for (uint16_t r = 0; r < rounds; r++) {
+    uint64_t t = benchTicks();
+    for (uint16_t i = 0; i < sectors; i++) {
+      const uint8_t *dir = (const uint8_t *)dirData[i];
+      uint8_t ret = words ? SD_L2_ScanSector(dir, fnwords, 0x00, 0x18, &offset)
+                          : benchByteScan(dir, (const char *)fnwords, &offset);
+      sink += ret;
+    }
+    t = benchTicks() - t;
+    if (t < best) best = t;
+  }
+  return (double)best / sectors;
+}
+
+int main(int argc, char **argv)
+{
+  uint16_t sectors = (argc > 1) ? atoi(argv[1]) : 64;
+  uint16_t rounds = (argc > 2) ? atoi(argv[2]) : 200;
+  const char *kinds = "sld";
+  const char *names[] = { "short", "long", "deleted" };
+
+  if ((sectors == 0) || (sectors > BENCH_MAX_SECTORS)) sectors = BENCH_MAX_SECTORS;
+  // differs from the entries in the last character only
+  SD_L2_ConvertName((uint8_t *)"TRACK001.WAX", (char *)fnwords);
+
+#if defined(__x86_64__) || defined(__i386__)
+  printf("%u sectors, best of %u rounds, TSC cycles per sector\n", sectors, rounds);
+#else
+  printf("%u sectors, best of %u rounds, ns per sector\n", sectors, rounds);
+#endif
+  for (uint8_t k = 0; k < 3; k++) {
+    benchFill(sectors, kinds[k]);
+    double bytes = benchRun(sectors, rounds, 0);
+    double words = benchRun(sectors, rounds, 1);
+    printf("%-8s byte-wise %7.1f  word-wise %7.1f  %.2fx\n", names[k], bytes, words, bytes / words);
+  }
+  return 0;
+}
@@ -0,0 +1,67 @@
+/*
+ * Checks shared by the host tests.
+ *
+ * Every test program is a single translation unit linked with the
+ * library sources. It exits with 1 if a check failed, so make stops
+ * at the first failing program.
+ */
+#ifndef HOSTTEST_H
+#define HOSTTEST_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+int hostFailures = 0;
+int hostChecks = 0;
+
+/** Fail if cond is false, the test goes on */
+#define CHECK(cond) \
+  hostCheck((cond) ? 1 : 0, __FILE__, __LINE__, #cond)
+
+/** Fail if a != b, both are evaluated once and printed as unsigned numbers */
+#define CHECK_EQ(a, b) \
+  hostCheckEq((uint32_t)(a), (uint32_t)(b), __FILE__, __LINE__, #a " == " #b)
+
+int hostCheck(int ok, const char *file, int line, const char *text)
+{
+  hostChecks++;
+  if (ok) return 1;
+  hostFailures++;
+  printf("%s:%d: FAILED %s\n", file, line, text);
+  return 0;
+}
+
+int hostCheckEq(uint32_t a, uint32_t b, const char *file, int line, const char *text)
+{
+  hostChecks++;
+  if (a == b) return 1;
+  hostFailures++;
+  printf("%s:%d: FAILED %s (0x%x != 0x%x)\n", file, line, text, a, b);
+  return 0;
+}
+
+/** Run one test function and print its name */
+#define RUN(test) \
+  do { int f = hostFailures; test(); printf("%-40s %s\n", #test, (f == hostFailures) ? "ok" : "FAILED"); } while (0)
+
+/** Summary at the end of main(), returns the exit code */
+int hostDone()
+{
+  printf("%d checks, %d failed\n", hostChecks, hostFailures);
+  return hostFailures ? 1 : 0;
+}
+
+/**
+ * Number of bytes of buf that differ from the data the image builders
+ * write: byte pos of a file is (pos * 7 + pos / 512 + first cluster) & 0xff.
+ */
+uint32_t hostPatternErrors(const uint8_t *buf, uint32_t count, uint32_t pos, uint32_t firstCluster)
+{
+  uint32_t bad = 0;
+  for (uint32_t i = 0; i < count; i++) {
+    if (buf[i] != (uint8_t)((pos + i) * 7 + ((pos + i) >> 9) + firstCluster)) bad++;
+  }
+  return bad;
+}
+
+#endif
@@ -0,0 +1,177 @@
+#!/usr/bin/env python3
+"""
+Build an exFAT test image (64 MB volume, 4 KB clusters).
+
+  mkexfat.py out.img [dir/]name=size[/frag][+slack] ...
+
+Every argument creates a file of size bytes, parent directories are
+created as needed. Without /frag the file is contiguous and flagged
+NoFatChain, its FAT entries stay free. With /frag it has a FAT chain
+with a gap of one cluster after every frag clusters. With +slack the
+file has slack bytes allocated behind its data: DataLength is
+size + slack, ValidDataLength is size, the slack is filled with 0xff.
+
+Byte i of a file holds (i * 7 + i / 512 + first cluster) & 0xff, like
+the files of mkfat16.py.
+
+Subdirectories are contiguous (NoFatChain), the root directory has a
+FAT chain with a gap after each cluster.
+
+Environment: MBR=1 puts the volume into an MBR partition (type 0x07)
+at sector 2048, otherwise the image is a superfloppy.
+"""
+import os
+import struct
+import sys
+
+SHIFT = 3
+VOL_SECTORS = 65536 * 2
+FAT_OFFSET = 128
+
+spc = 1 << SHIFT
+cb = spc * 512
+part = 2048 if os.environ.get('MBR') == '1' else 0
+fatlen = ((VOL_SECTORS // spc + 2) * 4 + 511) // 512
+heap = FAT_OFFSET + fatlen
+heap += -heap % spc
+clusters = (VOL_SECTORS - heap) // spc
+
+img = bytearray((part + VOL_SECTORS) * 512)
+fat = [0xfffffff8, 0xffffffff] + [0] * clusters
+state = {'next': 2}
+dirs = {'': []}
+
+
+def alloc(n, frag, chain):
+    clus = []
+    for i in range(n):
+        clus.append(state['next'])
+        state['next'] += 1
+        if frag and (i % frag) == frag - 1:
+            state['next'] += 1
+    if chain:
+        for i, c in enumerate(clus):
+            fat[c] = clus[i + 1] if i < n - 1 else 0xffffffff
+    return clus
+
+
+def write(clus, data):
+    for i in range(0, len(data), cb):
+        o = (part + heap + (clus[i // cb] - 2) * spc) * 512
+        img[o:o + len(data[i:i + cb])] = data[i:i + cb]
+
+
+def name_hash(name):
+    h = 0
+    for ch in name.upper():
+        c = ord(ch)
+        for b in (c & 0xff, c >> 8):
+            h = (((h & 1) << 15) + (h >> 1) + b) & 0xffff
+    return h
+
+
+def entry_set(name, attr, first, valid, length, nofat):
+    u = name.encode('utf-16-le')
+    names = [u[i:i + 30].ljust(30, b'\0') for i in range(0, len(u), 30)]
+    f = bytearray(32)
+    f[0] = 0x85
+    f[1] = 1 + len(names)
+    struct.pack_into('<H', f, 4, attr)
+    st = bytearray(32)
+    st[0] = 0xc0
+    st[1] = 0x01 | (0x02 if nofat else 0)
+    st[3] = len(name)
+    struct.pack_into('<HxxQxxxxLQ', st, 4, name_hash(name), valid, first, length)
+    data = bytes(f) + bytes(st) + b''.join(b'\xc1\0' + n for n in names)
+    cs = 0
+    for i, b in enumerate(data):
+        if i not in (2, 3):
+            cs = (((cs & 1) << 15) + (cs >> 1) + b) & 0xffff
+    return data[:2] + struct.pack('<H', cs) + data[4:]
+
+
+def build(path, dclus, bitmap, upcase):
+    data = b''
+    if not path:
+        label = bytearray(32)
+        label[0] = 0x83
+        label[1] = 4
+        label[2:10] = 'TEST'.encode('utf-16-le')
+        data += bytes(label)
+        data += struct.pack('<BB18xLQ', 0x81, 0, bitmap, (clusters + 7) // 8)
+        data += struct.pack('<B3xL12xLQ', 0x82, 0, upcase, 128)
+    for it in dirs[path]:
+        if it[0] == 'D':
+            size = len(dclus[it[2]]) * cb
+            data += entry_set(it[1], 0x10, dclus[it[2]][0], size, size, True)
+        else:
+            data += entry_set(it[1], 0x20, it[2], it[3], it[4], it[5])
+    return data
+
+
+def main():
+    bitmap = alloc(1, 0, True)[0]
+    upcase = alloc(1, 0, True)[0]
+    root = alloc(1, 0, False)[0]
+
+    for arg in sys.argv[2:]:
+        name, size = arg.rsplit('=', 1)
+        slack = 0
+        frag = None
+        if '+' in size:
+            size, slack = size.split('+')
+            slack = int(slack)
+        if '/' in size:
+            size, frag = size.split('/')
+            frag = int(frag)
+        size = int(size)
+        d, _, name = name.rpartition('/')
+        path = ''
+        for p in [p for p in d.split('/') if p]:
+            sub = path + '/' + p
+            if sub not in dirs:
+                dirs[sub] = []
+                dirs[path].append(('D', p, sub))
+            path = sub
+        clus = alloc(max(1, (size + slack + cb - 1) // cb), frag, frag is not None)
+        first = clus[0]
+        data = bytes((i * 7 + (i >> 9) + first) & 0xff for i in range(size))
+        write(clus, data + b'\xff' * slack)
+        dirs[path].append(('F', name, first, size, size + slack, frag is None))
+
+    # deepest first, a directory entry set needs the size of the subdirectory
+    dclus = {}
+    for p in sorted([p for p in dirs if p], key=lambda p: -p.count('/')):
+        n = sum(3 + (len(it[1]) + 14) // 15 for it in dirs[p]) * 32
+        dclus[p] = alloc(max(1, (n + cb - 1) // cb), 0, False)
+        write(dclus[p], build(p, dclus, bitmap, upcase))
+    data = build('', dclus, bitmap, upcase)
+    rootclus = [root] + alloc((len(data) - 1) // cb, 1, False)
+    for i, c in enumerate(rootclus):
+        fat[c] = rootclus[i + 1] if i < len(rootclus) - 1 else 0xffffffff
+    write(rootclus, data)
+
+    bs = bytearray(512)
+    bs[0:3] = b'\xeb\x76\x90'
+    bs[3:11] = b'EXFAT   '
+    struct.pack_into('<QQLLLLLL', bs, 0x40, part, VOL_SECTORS, FAT_OFFSET, fatlen,
+                     heap, clusters, root, 0x12345678)
+    struct.pack_into('<HHBBBB', bs, 0x68, 0x100, 0, 9, SHIFT, 1, 0x80)
+    bs[510] = 0x55
+    bs[511] = 0xaa
+    img[part * 512:part * 512 + 512] = bs
+    for i, v in enumerate(fat[:fatlen * 128]):
+        struct.pack_into('<L', img, (part + FAT_OFFSET) * 512 + i * 4, v)
+    if part:
+        mbr = bytearray(512)
+        mbr[0x1be + 4] = 0x07
+        struct.pack_into('<LL', mbr, 0x1be + 8, part, VOL_SECTORS)
+        mbr[510] = 0x55
+        mbr[511] = 0xaa
+        img[0:512] = mbr
+    with open(sys.argv[1], 'wb') as f:
+        f.write(img)
+
+
+if __name__ == '__main__':
+    main()
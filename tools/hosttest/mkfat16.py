@@ -0,0 +1,167 @@
+#!/usr/bin/env python3
+"""
+Build a FAT16 test image (superfloppy, 64 MB, 4 KB clusters).
+
+  mkfat16.py out.img [dir/]name=size[/frag] ...
+
+Every argument creates a file of size bytes, parent directories are
+created as needed. Names that are not valid 8.3 names (or use mixed
+case) get long name entries and a NAME~N short name, N counts per
+directory. With /frag a gap of one cluster is left after every frag
+clusters of the file, so its cluster chain is fragmented.
+Subdirectories always have a gap after each cluster.
+
+Byte i of a file holds (i * 7 + i / 512 + first cluster) & 0xff, so
+the tests verify data without a copy of the image, and a sector read
+from the wrong place of the file is noticed.
+
+Environment: ROOTENT number of root directory entries (default 512).
+"""
+import os
+import struct
+import sys
+
+SEC_PER_CLUS = 8
+RSVD = 1
+NFATS = 2
+TOTAL = 65536 * 2
+
+rootent = int(os.environ.get('ROOTENT', '512'))
+clusters = TOTAL // SEC_PER_CLUS
+spf = (clusters * 2 + 511) // 512
+cb = SEC_PER_CLUS * 512
+
+img = bytearray(TOTAL * 512)
+fat = [0xfff8, 0xffff] + [0] * clusters
+state = {'next': 2}
+short_count = {}
+dirs = {'': []}
+
+
+def alloc(n, frag):
+    chain = []
+    for i in range(n):
+        chain.append(state['next'])
+        state['next'] += 1
+        if frag and (i % frag) == frag - 1:
+            state['next'] += 1
+    for i, c in enumerate(chain):
+        fat[c] = chain[i + 1] if i < n - 1 else 0xffff
+    return chain
+
+
+def entries(path, name, attr, first, size):
+    base, _, ext = name.rpartition('.') if '.' in name else (name, '', '')
+    fits = (len(base) <= 8 and len(ext) <= 3 and name.isascii() and ' ' not in name
+            and base and name.count('.') <= 1)
+    lfn = name if not fits or (name != name.upper() and name != name.lower()) else None
+    if not fits:
+        short_count[path] = short_count.get(path, 0) + 1
+        base = ''.join(c for c in base.upper() if c.isascii() and c.isalnum())[:6]
+        base = (base + '~%d' % short_count[path])[:8]
+        ext = ''.join(c for c in ext.upper() if c.isascii() and c.isalnum())[:3]
+    short = (base.upper().ljust(8) + ext.upper().ljust(3)).encode()
+    res = []
+    if lfn:
+        cs = 0
+        for b in short:
+            cs = (((cs & 1) << 7) + (cs >> 1) + b) & 0xff
+        u = lfn.encode('utf-16-le')
+        if len(u) % 26:
+            u += b'\0\0'
+        while len(u) % 26:
+            u += b'\xff\xff'
+        parts = [u[i:i + 26] for i in range(0, len(u), 26)]
+        for k in range(len(parts), 0, -1):
+            p = parts[k - 1]
+            e = bytearray(32)
+            e[0] = k | (0x40 if k == len(parts) else 0)
+            e[1:11] = p[0:10]
+            e[11] = 0x0f
+            e[13] = cs
+            e[14:26] = p[10:22]
+            e[28:32] = p[22:26]
+            res.append(bytes(e))
+    res.append(struct.pack('<11sB10sHHHL', short, attr, b'\0' * 10, 0, 0, first, size))
+    return res
+
+
+def build(path, dclus):
+    ents = []
+    if path:
+        parent = path.rpartition('/')[0]
+        ents.append(struct.pack('<11sB10sHHHL', b'.          ', 0x10, b'\0' * 10, 0, 0, dclus[path][0], 0))
+        ents.append(struct.pack('<11sB10sHHHL', b'..         ', 0x10, b'\0' * 10, 0, 0,
+                                dclus[parent][0] if parent else 0, 0))
+    for it in dirs[path]:
+        if it[0] == 'D':
+            ents += entries(path, it[1], 0x10, dclus[it[2]][0], 0)
+        else:
+            ents += entries(path, it[1], 0x20, it[2], it[3])
+    return b''.join(ents)
+
+
+def main():
+    bs = bytearray(512)
+    bs[0:3] = b'\xeb\x3c\x90'
+    bs[3:11] = b'MSDOS5.0'
+    struct.pack_into('<HBHBHHBHHHLL', bs, 11, 512, SEC_PER_CLUS, RSVD, NFATS, rootent,
+                     0, 0xf8, spf, 32, 64, 0, TOTAL)
+    bs[36] = 0x80
+    bs[38] = 0x29
+    bs[43:54] = b'NO NAME    '
+    bs[54:62] = b'FAT16   '
+    bs[510] = 0x55
+    bs[511] = 0xaa
+    img[0:512] = bs
+    fatstart = RSVD * 512
+    rootstart = (RSVD + NFATS * spf) * 512
+    datastart = rootstart + rootent * 32
+
+    for arg in sys.argv[2:]:
+        name, size = arg.rsplit('=', 1)
+        frag = 0
+        if '/' in size:
+            size, frag = size.split('/')
+            frag = int(frag)
+        size = int(size)
+        d, _, name = name.rpartition('/')
+        path = ''
+        for part in [p for p in d.split('/') if p]:
+            sub = path + '/' + part
+            if sub not in dirs:
+                dirs[sub] = []
+                dirs[path].append(('D', part, sub))
+            path = sub
+        chain = alloc(max(1, (size + cb - 1) // cb), frag)
+        first = chain[0]
+        data = bytes((i * 7 + (i >> 9) + first) & 0xff for i in range(size))
+        for i in range(0, size, cb):
+            o = datastart + (chain[i // cb] - 2) * cb
+            img[o:o + len(data[i:i + cb])] = data[i:i + cb]
+        dirs[path].append(('F', name, first, size))
+
+    # room for up to three long name entries per file
+    dclus = {'': [0]}
+    for p in sorted([p for p in dirs if p], key=lambda p: p.count('/')):
+        n = (len(dirs[p]) + 2) * 32 * 4
+        dclus[p] = alloc(max(1, (n + cb - 1) // cb), 1)
+    for p in dirs:
+        data = build(p, dclus)
+        if not p:
+            assert len(data) <= rootent * 32, 'root directory full'
+            img[rootstart:rootstart + len(data)] = data
+            continue
+        for i in range(0, len(data), cb):
+            o = datastart + (dclus[p][i // cb] - 2) * cb
+            img[o:o + len(data[i:i + cb])] = data[i:i + cb]
+
+    for k in range(NFATS):
+        for i, v in enumerate(fat[:spf * 256]):
+            struct.pack_into('<H', img, fatstart + k * spf * 512 + i * 2, v)
+    with open(sys.argv[1], 'wb') as f:
+        f.write(img)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,23 @@
+/*
+ * Host stand-in for the chipKIT WProgram.h, see p32_defs.h.
+ * Only what DSPI.cpp uses.
+ */
+#ifndef _WPROGRAM_H
+#define _WPROGRAM_H
+
+#include <stdint.h>
+#include <p32xxxx.h>
+
+#define	F_CPU			80000000UL
+#define	HIGH			1
+#define	LOW				0
+#define	INPUT			0
+#define	OUTPUT			1
+
+/* No DSPIn classes, the test derives its own port from DSPI */
+#define	NUM_DSPI_PORTS	0
+
+void	pinMode(uint8_t pin, uint8_t mode);
+void	digitalWrite(uint8_t pin, uint8_t val);
+
+#endif
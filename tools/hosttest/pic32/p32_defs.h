@@ -0,0 +1,57 @@
+/*
+ * Host stand-in for the chipKIT p32_defs.h, used by the SPI register
+ * model (spimodel.cpp) to run DSPI.cpp on the PC.
+ *
+ * Every register word is a SimReg. Reading or writing it calls the
+ * model, which lets the SPI controller, the DMA channels and the card
+ * behind them advance by one step. The CLR, SET and INV words work
+ * like on the PIC32, so p32_regset keeps its layout of four words.
+ */
+#ifndef _P32_DEFS_H
+#define _P32_DEFS_H
+
+#include <stdint.h>
+
+class SimReg {
+public:
+	uint32_t	val;
+
+	operator uint32_t() const;
+	SimReg &	operator=(uint32_t v);
+	SimReg &	operator=(const SimReg &r) { return *this = (uint32_t)r; }
+};
+
+/* Aligned, so the model finds the register set and the word of it
+** from the address of a SimReg.
+*/
+typedef struct __attribute__((aligned(16))) {
+	SimReg	reg;
+	SimReg	clr;
+	SimReg	set;
+	SimReg	inv;
+} p32_regset;
+
+typedef struct {
+	p32_regset	sxCon;
+	p32_regset	sxStat;
+	p32_regset	sxBuf;
+	p32_regset	sxBrg;
+} p32_spi;
+
+#define	_SPICON_ON			15
+#define	_SPICON_MSTEN		5
+#define	_SPICON_CKP			6
+#define	_SPICON_CKE			8
+#define	_SPICON_MODE16		10
+#define	_SPICON_MODE32		11
+#define	_SPICON_ENHBUF		16
+
+#define	_SPISTAT_SPIRBF		0
+#define	_SPISTAT_SPITBF		1
+#define	_SPISTAT_SPITBE		3
+#define	_SPISTAT_SPIRBE		5
+#define	_SPISTAT_SPIROV		6
+#define	_SPISTAT_SRMT		7
+#define	_SPISTAT_SPIBUSY	11
+
+#endif
@@ -0,0 +1,29 @@
+/*
+ * Host stand-in for the chipKIT p32xxxx.h, see p32_defs.h. The
+ * interrupt and DMA registers are arrays of the model.
+ */
+#ifndef _P32XXXX_H
+#define _P32XXXX_H
+
+#include <p32_defs.h>
+
+extern p32_regset	simIec[2];
+extern p32_regset	simIfs[2];
+extern p32_regset	simIpc[16];
+extern p32_regset	simDmacon;
+extern p32_regset	simDchRegs[4 * 12];	// 4 DMA channels of 12 registers
+
+#define	IEC0		(simIec[0].reg)
+#define	IFS0		(simIfs[0].reg)
+#define	IPC0		(simIpc[0].reg)
+#define	DMACONSET	(simDmacon.set)
+
+/* A part with DMA controller, and with enhanced buffer unless the
+** test is built with SIM_NO_FIFO.
+*/
+#define	_DMAC0_BASE_ADDRESS	simDchRegs
+#if !defined(SIM_NO_FIFO)
+#define	_SPI1CON_ENHBUF_POSITION	16
+#endif
+
+#endif
@@ -0,0 +1,2 @@
+/* Host stand-in, no interrupt attributes */
+#define	__ISR(v, ipl)
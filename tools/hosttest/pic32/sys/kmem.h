@@ -0,0 +1,15 @@
+/*
+ * Host stand-in for sys/kmem.h: the model hands out a physical
+ * address for every buffer the DMA controller is given, see
+ * spimodel.cpp.
+ */
+#ifndef _SYS_KMEM_H
+#define _SYS_KMEM_H
+
+#include <stdint.h>
+
+uint32_t	simPhys(const volatile void *p);
+
+#define	KVA_TO_PA(v)	simPhys((const volatile void *)(v))
+
+#endif
@@ -0,0 +1,358 @@
+/*
+ * Register model of the SPI controller and DMA channels, see
+ * spimodel.h. The model never uses the SimReg operators itself, it
+ * works on the stored values, so only the accesses of DSPI.cpp count
+ * as steps.
+ */
+#include "spimodel.h"
+
+#include <stddef.h>
+
+#define SPI_ON        (1UL << _SPICON_ON)
+#define SPI_ENHBUF    (1UL << _SPICON_ENHBUF)
+#define SPI_MODES     ((1UL << _SPICON_MODE32) | (1UL << _SPICON_MODE16) | (1UL << _SPICON_ENHBUF))
+#define STEPS_PER_BYTE 8        // register accesses per byte on the bus, about 20 MHz SCK
+
+#define DCH_CON       0         // register numbers within p32_dch
+#define DCH_ECON      1
+#define DCH_INT       2
+#define DCH_SSA       3
+#define DCH_DSA       4
+#define DCH_SSIZ      5
+#define DCH_DSIZ      6
+#define DCH_SPTR      7
+#define DCH_DPTR      8
+#define DCH_CSIZ      9
+#define DCH_REGS      12
+
+#define DCH_CHEN      (1UL << 7)
+#define DCH_CFORCE    (1UL << 7)
+#define DCH_CABORT    (1UL << 6)
+#define DCH_SIRQEN    (1UL << 4)
+#define DCH_CHBCIF    (1UL << 3)
+
+#define PHYS_MAX      256       // buffers handed to the DMA channels
+
+p32_spi    simSpi;
+p32_regset simDchRegs[4 * DCH_REGS];
+p32_regset simIec[2];
+p32_regset simIfs[2];
+p32_regset simIpc[16];
+p32_regset simDmacon;
+SimStats_t simStats;
+uint8_t    simLog[SIM_LOG_MAX];
+uint8_t    simSs;
+
+// transmit and receive buffer, the shift register
+uint32_t simTx[16], simRx[16], simRxLast;
+uint8_t  simTxn, simRxn, simRov;
+uint8_t  simShifting, simShiftLeft;
+uint32_t simShiftIn;
+uint32_t simSlave;
+
+// DMA channels: bytes moved in the current block, start events pending
+uint32_t simDmaMoved[4];
+uint8_t  simEvtRx, simEvtTx;
+
+const volatile void *simPhysTab[PHYS_MAX];
+uint16_t simPhysCount;
+
+/* ------------------------------------------------------------ */
+
+static uint32_t conVal() { return simSpi.sxCon.reg.val; }
+
+static uint8_t wordBytes()
+{
+  if (conVal() & (1UL << _SPICON_MODE32)) return 4;
+  if (conVal() & (1UL << _SPICON_MODE16)) return 2;
+  return 1;
+}
+
+/** words the transmit and the receive buffer hold */
+static uint8_t depth()
+{
+#if !defined(SIM_NO_FIFO)
+  if (conVal() & (1UL << _SPICON_ENHBUF)) return 16 / wordBytes();
+#endif
+  return 1;
+}
+
+static void setIfs(uint8_t irq)
+{
+  simIfs[irq / 32].reg.val |= 1UL << (irq % 32);
+}
+
+static void spiWrite(uint32_t v)
+{
+  if (!(conVal() & SPI_ON) || (simTxn >= depth())) {
+    simStats.TxLost++;
+    return;
+  }
+  simTx[simTxn++] = (wordBytes() == 4) ? v : v & ((1UL << (8 * wordBytes())) - 1);
+}
+
+static uint32_t spiRead()
+{
+  if (simRxn) {
+    simRxLast = simRx[0];
+    for (uint8_t i = 1; i < simRxn; i++) simRx[i - 1] = simRx[i];
+    simRxn--;
+  }
+  return simRxLast;
+}
+
+static uint32_t spiStat()
+{
+  uint32_t s = 0;
+
+  if (simRxn >= depth()) s |= 1UL << _SPISTAT_SPIRBF;
+  if (simTxn >= depth()) s |= 1UL << _SPISTAT_SPITBF;
+  if (simTxn == 0)       s |= 1UL << _SPISTAT_SPITBE;
+  if (simRxn == 0)       s |= 1UL << _SPISTAT_SPIRBE;
+  if (simRov)            s |= 1UL << _SPISTAT_SPIROV;
+  if (!simShifting && !simTxn) s |= 1UL << _SPISTAT_SRMT;
+  if (simShifting || simTxn)   s |= 1UL << _SPISTAT_SPIBUSY;
+  return s;
+}
+
+static void spiCon(uint32_t old, uint32_t v)
+{
+  if ((old & SPI_ON) && (v & SPI_ON) && ((old ^ v) & SPI_ENHBUF)) {
+    // ENHBUF may only be written while off, the part keeps the old value
+    simStats.EnhbufOn++;
+    v = (v & ~SPI_ENHBUF) | (old & SPI_ENHBUF);
+    simSpi.sxCon.reg.val = v;
+  }
+  if ((old & SPI_ON) && !(v & SPI_ON)) {
+    // off: buffers and shift register are reset
+    simTxn = simRxn = simShifting = simRov = 0;
+  }
+  if ((old & SPI_ON) && (v & SPI_ON) && ((old ^ v) & SPI_MODES) &&
+      (simShifting || simTxn || simRxn)) {
+    simStats.ModeBusy++;
+  }
+}
+
+/* ------------------------------------------------------------ */
+
+uint32_t simPhys(const volatile void *p)
+{
+  for (uint16_t i = 0; i < simPhysCount; i++) {
+    if (simPhysTab[i] == p) return (uint32_t)(i + 1) << 20;
+  }
+  if (simPhysCount == PHYS_MAX) simPhysCount = 0;
+  simPhysTab[simPhysCount++] = p;
+  return (uint32_t)simPhysCount << 20;
+}
+
+static volatile uint8_t *physPtr(uint32_t pa)
+{
+  return (volatile uint8_t *)simPhysTab[(pa >> 20) - 1] + (pa & 0xfffff);
+}
+
+static uint8_t memRead(uint32_t pa)
+{
+  volatile uint8_t *p = physPtr(pa);
+  if (p == (volatile uint8_t *)&simSpi.sxBuf.reg) return (uint8_t)spiRead();
+  return *p;
+}
+
+static void memWrite(uint32_t pa, uint8_t b)
+{
+  volatile uint8_t *p = physPtr(pa);
+  if (p == (volatile uint8_t *)&simSpi.sxBuf.reg) spiWrite(b);
+  else *p = b;
+}
+
+static uint32_t dchReg(uint8_t ch, uint8_t reg)
+{
+  return (&simDch[ch].dchCon)[reg].reg.val;
+}
+
+static void dchSet(uint8_t ch, uint8_t reg, uint32_t v)
+{
+  (&simDch[ch].dchCon)[reg].reg.val = v;
+}
+
+static uint32_t dchSize(uint8_t ch, uint8_t reg)
+{
+  uint32_t v = dchReg(ch, reg) & 0xffff;
+  return v ? v : 65536;
+}
+
+static void dmaRestart(uint8_t ch)
+{
+  simDmaMoved[ch] = 0;
+  dchSet(ch, DCH_SPTR, 0);
+  dchSet(ch, DCH_DPTR, 0);
+}
+
+/** one cell of a channel, the block ends with the larger of the two sizes */
+static void dmaCell(uint8_t ch)
+{
+  uint32_t ssiz = dchSize(ch, DCH_SSIZ), dsiz = dchSize(ch, DCH_DSIZ);
+  uint32_t block = (ssiz > dsiz) ? ssiz : dsiz;
+
+  for (uint32_t i = dchSize(ch, DCH_CSIZ); i > 0 && simDmaMoved[ch] < block; i--) {
+    uint32_t sp = dchReg(ch, DCH_SPTR), dp = dchReg(ch, DCH_DPTR);
+    memWrite(dchReg(ch, DCH_DSA) + dp, memRead(dchReg(ch, DCH_SSA) + sp));
+    dchSet(ch, DCH_SPTR, (sp + 1) % ssiz);
+    dchSet(ch, DCH_DPTR, (dp + 1) % dsiz);
+    simDmaMoved[ch]++;
+  }
+  simStats.DmaCells++;
+  if (simDmaMoved[ch] >= block) {
+    dchSet(ch, DCH_INT, dchReg(ch, DCH_INT) | DCH_CHBCIF);
+    dchSet(ch, DCH_CON, dchReg(ch, DCH_CON) & ~DCH_CHEN);
+    dmaRestart(ch);
+  }
+}
+
+static void dchWrite(uint8_t ch, uint8_t reg, uint32_t old, uint32_t v)
+{
+  if ((reg == DCH_CON) && !(old & DCH_CHEN) && (v & DCH_CHEN)) dmaRestart(ch);
+  if ((reg == DCH_ECON) && (v & DCH_CABORT)) {
+    dchSet(ch, DCH_CON, dchReg(ch, DCH_CON) & ~DCH_CHEN);
+    dchSet(ch, DCH_ECON, v & ~(DCH_CABORT | DCH_CFORCE));
+    dmaRestart(ch);
+  }
+}
+
+/** time passes: the bus, then the DMA channels */
+static void simStep()
+{
+  simStats.Steps++;
+
+  if (simShifting && (--simShiftLeft == 0)) {
+    simShifting = 0;
+    if (simRxn < depth()) simRx[simRxn++] = simShiftIn;
+    else {
+      simStats.Overruns++;
+      simRov = 1;
+    }
+    simEvtRx = 1;
+    setIfs(SIM_IRQ_RX);
+  }
+  if (!simShifting && simTxn && (conVal() & SPI_ON)) {
+    uint32_t w = simTx[0];
+    for (uint8_t i = 1; i < simTxn; i++) simTx[i - 1] = simTx[i];
+    simTxn--;
+    // most significant byte first on the wire
+    simShiftIn = 0;
+    for (int8_t b = wordBytes() - 1; b >= 0; b--) {
+      if (simStats.Bytes < SIM_LOG_MAX) simLog[simStats.Bytes] = (uint8_t)(w >> (8 * b));
+      simStats.Bytes++;
+      simShiftIn = (simShiftIn << 8) | SimSlaveNext();
+    }
+    simShifting = 1;
+    simShiftLeft = STEPS_PER_BYTE * wordBytes();
+    simEvtTx = 1;
+    setIfs(SIM_IRQ_TX);
+  }
+
+  if (simDmacon.reg.val & (1UL << 15)) {
+    for (uint8_t ch = 0; ch < 4; ch++) {
+      uint32_t econ = dchReg(ch, DCH_ECON);
+      uint8_t  irq = (uint8_t)(econ >> 8);
+      if (!(dchReg(ch, DCH_CON) & DCH_CHEN)) continue;
+      if ((econ & DCH_CFORCE) ||
+          ((econ & DCH_SIRQEN) && (((irq == SIM_IRQ_RX) && simEvtRx) || ((irq == SIM_IRQ_TX) && simEvtTx)))) {
+        dchSet(ch, DCH_ECON, econ & ~DCH_CFORCE);
+        dmaCell(ch);
+      }
+    }
+  }
+  simEvtRx = simEvtTx = 0;
+}
+
+/* ------------------------------------------------------------ */
+
+SimReg::operator uint32_t() const
+{
+  simStep();
+  if (this == &simSpi.sxBuf.reg) return spiRead();
+  if (this == &simSpi.sxStat.reg) return spiStat();
+  return val;
+}
+
+SimReg &SimReg::operator=(uint32_t v)
+{
+  p32_regset *rs = (p32_regset *)((uintptr_t)this & ~(uintptr_t)15);
+  uint8_t     word = (uint8_t)(((uintptr_t)this >> 2) & 3);
+  uint32_t    old = rs->reg.val;
+
+  simStep();
+  if (rs == &simSpi.sxBuf) {
+    if (word == 0) spiWrite(v);
+    return *this;
+  }
+  if (rs == &simSpi.sxStat) {
+    if ((word == 1) && (v & (1UL << _SPISTAT_SPIROV))) simRov = 0;
+    return *this;
+  }
+  switch (word) {
+    case 0: rs->reg.val = v; break;
+    case 1: rs->reg.val = old & ~v; break;
+    case 2: rs->reg.val = old | v; break;
+    case 3: rs->reg.val = old ^ v; break;
+  }
+  if (rs == &simSpi.sxCon) spiCon(old, rs->reg.val);
+  if ((rs >= &simDch[0].dchCon) && (rs < &simDch[4].dchCon)) {
+    size_t n = rs - &simDch[0].dchCon;
+    dchWrite((uint8_t)(n / DCH_REGS), (uint8_t)(n % DCH_REGS), old, rs->reg.val);
+  }
+  return *this;
+}
+
+void pinMode(uint8_t, uint8_t)
+{
+}
+
+void digitalWrite(uint8_t pin, uint8_t val)
+{
+  if (pin == SIM_PIN_SS) simSs = val;
+}
+
+/* ------------------------------------------------------------ */
+
+static void clearRegs(p32_regset *r, size_t n)
+{
+  for (size_t i = 0; i < n; i++) r[i].reg.val = r[i].clr.val = r[i].set.val = r[i].inv.val = 0;
+}
+
+void SimReset()
+{
+  clearRegs(&simSpi.sxCon, sizeof(simSpi) / sizeof(p32_regset));
+  clearRegs(simDchRegs, 4 * DCH_REGS);
+  clearRegs(simIec, 2);
+  clearRegs(simIfs, 2);
+  clearRegs(simIpc, 16);
+  clearRegs(&simDmacon, 1);
+  simStats = SimStats_t();
+  simTxn = simRxn = simRov = simShifting = 0;
+  simRxLast = simSlave = 0;
+  simEvtRx = simEvtTx = 0;
+  simPhysCount = 0;
+  simSs = HIGH;
+  for (uint8_t ch = 0; ch < 4; ch++) simDmaMoved[ch] = 0;
+}
+
+uint8_t SimSlaveNext()
+{
+  return (uint8_t)simSlave++;
+}
+
+uint32_t SimSlaveCount()
+{
+  return simSlave;
+}
+
+void SimStaleRx(uint32_t w)
+{
+  simRx[simRxn++] = w;
+  simRxLast = w;
+}
+
+uint8_t SimTxCount() { return simTxn; }
+uint8_t SimRxCount() { return simRxn; }
+uint8_t SimShifting() { return simShifting; }
@@ -0,0 +1,57 @@
+/*
+ * Register model of a PIC32 SPI controller, the DMA channels and a
+ * slave device, to run DSPI.cpp on the PC (see pic32/p32_defs.h).
+ *
+ * Every register access is one step of the model. A step shifts a
+ * byte (8 bit mode) or a quarter of a word (32 bit mode) on the bus
+ * and lets the DMA channels move one cell on their start events.
+ * Besides the data, the model counts what real hardware would do
+ * wrong without telling: lost words, overruns, glitches of the clock
+ * while the slave is selected.
+ */
+#ifndef SPIMODEL_H
+#define SPIMODEL_H
+
+#include <p32xxxx.h>
+#include <sys/kmem.h>
+#include <DSPI.h>
+
+#define SIM_IRQ_ERR   37        // IRQ numbers given to DSPI::init()
+#define SIM_IRQ_RX    38
+#define SIM_IRQ_TX    39
+#define SIM_PIN_SS    10
+
+#define SIM_LOG_MAX   4096      // bytes sent to the slave that are kept
+
+typedef struct {
+  uint32_t Steps;               // register accesses
+  uint32_t Bytes;               // bytes shifted on the bus
+  uint32_t TxLost;              // words written to a full transmit buffer
+  uint32_t Overruns;            // words received into a full receive buffer
+  uint32_t EnhbufOn;            // writes to ENHBUF while on, ignored
+  uint32_t ModeBusy;            // mode bits changed while a word was on the way
+  uint32_t DmaCells;            // cells moved by the DMA channels
+} SimStats_t;
+
+extern p32_spi    simSpi;
+#define simDch     ((p32_dch *)simDchRegs)
+extern SimStats_t simStats;
+extern uint8_t    simLog[SIM_LOG_MAX];  // bytes sent to the slave, in order
+extern uint8_t    simSs;                // level of the SS pin
+
+/** Resets the model, the slave answers 0, 1, 2, ... from then on */
+void    SimReset();
+
+/** Next byte the slave answers, the count of bytes it answered so far */
+uint8_t SimSlaveNext();
+uint32_t SimSlaveCount();
+
+/** Puts a word into the receive buffer, as if left by an earlier transfer */
+void    SimStaleRx(uint32_t w);
+
+/** Words in the transmit and receive buffer, 1 if a word is being shifted */
+uint8_t SimTxCount();
+uint8_t SimRxCount();
+uint8_t SimShifting();
+
+#endif
@@ -0,0 +1,230 @@
+/*
+ * DSPI on the register model of spimodel.cpp: DMA transfers over
+ * several blocks, the progress count of a running DMA transfer,
+ * stale receive data before a transfer, cancelling
+ * a transfer at any point, and the 32 bit bulk transfers.
+ *
+ * Built twice, for parts with and without enhanced buffer, see Makefile.
+ */
+#include "spimodel.h"
+#include "hosttest.h"
+
+#include <string.h>
+
+#define POLL_MAX 100000         // register accesses before a transfer counts as hung
+
+class SimDspi : public DSPI {
+public:
+  SimDspi()
+  {
+    pspi = &simSpi;
+    vec = 24;
+    ipl = 3;
+    pinSS = SIM_PIN_SS;
+    init(SIM_IRQ_ERR, SIM_IRQ_RX, SIM_IRQ_TX);
+  }
+};
+
+SimDspi spi;
+uint8_t  buf[1024];
+
+/** calls isDmaBusy() until the transfer is done, returns the number of calls */
+uint32_t dmaWait()
+{
+  uint32_t n = 0;
+  while (spi.isDmaBusy() && (n < POLL_MAX)) n++;
+  return n;
+}
+
+/** bytes of buf that differ from the slave answers first, first + 1, ... */
+uint32_t dataErrors(uint16_t count, uint32_t first)
+{
+  uint32_t bad = 0;
+  for (uint16_t i = 0; i < count; i++) {
+    if (buf[i] != (uint8_t)(first + i)) bad++;
+  }
+  return bad;
+}
+
+/** bytes sent to the slave since byte first that are not pad */
+uint32_t padErrors(uint32_t first, uint8_t pad)
+{
+  uint32_t bad = 0;
+  for (uint32_t i = first; i < simStats.Bytes && i < SIM_LOG_MAX; i++) {
+    if (simLog[i] != pad) bad++;
+  }
+  return bad;
+}
+
+void setup()
+{
+  SimReset();
+  spi.begin();
+  spi.setDmaChannels(2, 3);
+  spi.setSelect(LOW);
+}
+
+void testTransfer()
+{
+  setup();
+  for (uint8_t i = 0; i < 8; i++) CHECK_EQ(spi.transfer(0xff), i);
+  CHECK_EQ(simStats.Bytes, 8);
+  CHECK_EQ(padErrors(0, 0xff), 0);
+}
+
+void testDmaTransfer()
+{
+  uint32_t first;
+
+  setup();
+  spi.transfer(0xff);
+  first = SimSlaveCount();
+
+  // three blocks of at most 256 bytes
+  memset(buf, 0, sizeof(buf));
+  spi.dmaTransfer(600, 0xff, buf);
+  CHECK(dmaWait() < POLL_MAX);
+  CHECK_EQ(dataErrors(600, first), 0);
+  CHECK_EQ(buf[600], 0);
+  CHECK_EQ(simStats.Bytes, first + 600);
+  CHECK_EQ(padErrors(first, 0xff), 0);
+  CHECK_EQ(simStats.TxLost, 0);
+  CHECK_EQ(simStats.Overruns, 0);
+  CHECK_EQ(simDch[2].dchCon.reg.val & 0x80, 0);
+  CHECK_EQ(simDch[3].dchCon.reg.val & 0x80, 0);
+  CHECK_EQ(spi.isDmaBusy(), 0);
+
+  // nothing left behind for the next byte
+  CHECK_EQ(SimRxCount(), 0);
+  CHECK_EQ(spi.transfer(0xff), (uint8_t)(first + 600));
+
+  // the pad byte is what goes out
+  first = SimSlaveCount();
+  spi.dmaTransfer(10, 0x5a, buf);
+  CHECK(dmaWait() < POLL_MAX);
+  CHECK_EQ(dataErrors(10, first), 0);
+  CHECK_EQ(padErrors(first, 0x5a), 0);
+}
+
+void testDmaCount()
+{
+  uint32_t first;
+  uint16_t n, last = 0, steps = 0, bad = 0;
+
+  // the count grows with the transfer and only covers stored bytes
+  setup();
+  first = SimSlaveCount();
+  spi.dmaTransfer(600, 0xff, buf);
+  for (uint32_t polls = 0; spi.isDmaBusy() && (polls < POLL_MAX); polls++) {
+    n = spi.dmaCount();
+    if ((n < last) || (n > 600) || dataErrors(n, first)) bad++;
+    if (n > last) steps++;
+    last = n;
+  }
+  CHECK_EQ(bad, 0);
+  CHECK(steps > 100);
+  CHECK(last > 550);
+  CHECK_EQ(dataErrors(600, first), 0);
+}
+
+void testDmaStale()
+{
+  uint32_t first;
+
+  // a byte nobody read and a stale receive flag do not start the channels
+  setup();
+  SimStaleRx(0xaa);
+  simIfs[SIM_IRQ_RX / 32].reg.val |= 1UL << (SIM_IRQ_RX % 32);
+  first = SimSlaveCount();
+  spi.dmaTransfer(16, 0xff, buf);
+  CHECK(dmaWait() < POLL_MAX);
+  CHECK_EQ(dataErrors(16, first), 0);
+  CHECK_EQ(simStats.Bytes, first + 16);
+  CHECK_EQ(simStats.Overruns, 0);
+}
+
+void testDmaCancel()
+{
+  uint32_t first;
+  uint16_t bad = 0;
+
+  // cancelled after any number of polls, in the middle of a byte or not
+  for (uint16_t polls = 0; polls < 80; polls++) {
+    setup();
+    spi.dmaTransfer(512, 0xff, buf);
+    for (uint16_t i = 0; i < polls; i++) spi.isDmaBusy();
+    spi.cancelDmaTransfer();
+    CHECK_EQ(spi.isDmaBusy(), 0);
+    CHECK_EQ(simDch[2].dchCon.reg.val & 0x80, 0);
+    CHECK_EQ(simDch[3].dchCon.reg.val & 0x80, 0);
+
+    // the bus is idle and the next byte is the next one of the slave
+    first = SimSlaveCount();
+    if (SimShifting() || SimTxCount() || SimRxCount()) bad++;
+    else if (spi.transfer(0xff) != (uint8_t)first) bad++;
+    CHECK_EQ(simStats.Overruns, 0);
+  }
+  CHECK_EQ(bad, 0);
+
+  // a new transfer after a cancelled one
+  setup();
+  spi.dmaTransfer(300, 0xff, buf);
+  for (uint16_t i = 0; i < 50; i++) spi.isDmaBusy();
+  spi.cancelDmaTransfer();
+  first = SimSlaveCount();
+  spi.dmaTransfer(300, 0xff, buf);
+  CHECK(dmaWait() < POLL_MAX);
+  CHECK_EQ(dataErrors(300, first), 0);
+}
+
+void testBulk()
+{
+  uint32_t first;
+
+  setup();
+  spi.transfer(0xff);
+
+  // received in 32 bit words, byte order as on the wire
+  first = SimSlaveCount();
+  spi.transferBulk(512, 0xff, buf);
+  CHECK_EQ(dataErrors(512, first), 0);
+  CHECK_EQ(simStats.Bytes, first + 512);
+  CHECK_EQ(padErrors(first, 0xff), 0);
+
+  // sent in 32 bit words
+  for (uint16_t i = 0; i < 512; i++) buf[i] = (uint8_t)(i * 3);
+  first = simStats.Bytes;
+  spi.transferBulk(512, buf);
+  CHECK_EQ(simStats.Bytes, first + 512);
+  CHECK(memcmp(simLog + first, buf, 512) == 0);
+
+  // back in 8 bit mode, nothing left in the buffers
+  CHECK_EQ(SimRxCount(), 0);
+  CHECK_EQ(simStats.Bytes, first + 512);
+  first = SimSlaveCount();
+  CHECK_EQ(spi.transfer(0xff), (uint8_t)first);
+  CHECK_EQ(SimSlaveCount(), first + 1);
+
+  // ENHBUF is switched while off, the mode changes only when idle
+  CHECK_EQ(simStats.EnhbufOn, 0);
+  CHECK_EQ(simStats.ModeBusy, 0);
+  CHECK_EQ(simStats.TxLost, 0);
+  CHECK_EQ(simStats.Overruns, 0);
+
+  // unaligned requests go byte by byte
+  first = SimSlaveCount();
+  spi.transferBulk(6, 0xff, buf + 1);
+  CHECK_EQ(buf[1], (uint8_t)first);
+  CHECK_EQ(buf[6], (uint8_t)(first + 5));
+}
+
+int main()
+{
+  RUN(testTransfer);
+  RUN(testDmaTransfer);
+  RUN(testDmaCount);
+  RUN(testDmaStale);
+  RUN(testDmaCancel);
+  RUN(testBulk);
+  return hostDone();
+}
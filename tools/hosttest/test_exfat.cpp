@@ -0,0 +1,186 @@
+/*
+ * SD_L2 on an exFAT image in an MBR partition (file backend): path
+ * lookup by long names, NoFatChain and FAT chained files, files with
+ * allocated space behind the valid data, and the directory cursor.
+ *
+ * Image: exfat.img, see Makefile.
+ */
+#include "sd_l2.h"
+#include "hosttest.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define MANY_FILES 150          // four clusters of entry sets
+
+uint8_t  workBuf[512];
+uint8_t  buf[512];
+
+/** bytes of the file that differ from the pattern, read sector by sector */
+uint32_t fileErrors(const SD_L2_File_t *f, const SD_L2_Extent_t *ext, uint16_t n)
+{
+  uint32_t bad = 0, pos = 0;
+
+  for (uint16_t e = 0; e < n; e++) {
+    if (ext[e].FileSector != pos / 512) bad++;
+    for (uint32_t s = 0; (s < ext[e].Sectors) && (pos < f->Size); s++) {
+      uint32_t count = (f->Size - pos > 512) ? 512 : f->Size - pos;
+      if (SD_L2_dev->ReadBlock(ext[e].StartSector + s, buf)) return 0xffffffffUL;
+      bad += hostPatternErrors(buf, count, pos, f->FirstCluster);
+      pos += count;
+    }
+  }
+  return (pos == f->Size) ? bad : bad + 1;
+}
+
+/** looks up path and checks size, contiguity and the first sector of data */
+void checkPath(const char *path, uint32_t size, uint8_t contiguous)
+{
+  SD_L2_File_t f;
+  uint8_t ret = SD_L2_SearchPath((uint8_t *)path, 0, 0x18, &f);
+
+  if (!CHECK_EQ(ret, 0)) {
+    printf("  %s\n", path);
+    return;
+  }
+  CHECK_EQ(f.Size, size);
+  CHECK_EQ(f.Contiguous, contiguous);
+  CHECK_EQ(f.ActBytePos, 0);
+  CHECK_EQ(f.ActSector, SD_L2_Cluster2Sector(f.FirstCluster));
+  CHECK_EQ(SD_L2_dev->ReadBlock(f.ActSector, buf), 0);
+  CHECK_EQ(hostPatternErrors(buf, (size < 512) ? size : 512, 0, f.FirstCluster), 0);
+}
+
+void testMount()
+{
+  CHECK_EQ(SD_BLK_FileOpen("exfat.img"), 0);
+  SD_L2_dev = &SD_BLK_FileDev;
+  CHECK_EQ(SD_L2_Init(workBuf), 0);
+  CHECK_EQ(SD_L2_FAT.PartType, SD_L2_PARTTYPE_EXFAT);
+  // partition at sector 2048, 129 sectors of FAT at 128, cluster aligned heap
+  CHECK_EQ(SD_L2_Cluster2Sector(2), 2048 + 264);
+}
+
+void testSearchPath()
+{
+  SD_L2_File_t f;
+
+  // long names in any case
+  checkPath("Long Contiguous Name.raw", 100000, 1);
+  checkPath("/LONG CONTIGUOUS NAME.RAW", 100000, 1);
+  checkPath("/frag.raw", 204800, 0);
+  checkPath("many/F000.RAW", 100, 1);
+  checkPath("/many/F149.RAW", 100, 1);           // in the last cluster of the directory
+  checkPath("/sub/Nested Directory/A Long Name In A Subdirectory.raw", 3000, 1);
+  checkPath("\\sub\\nested directory\\short.raw", 700, 1);
+
+  // not found
+  CHECK_EQ(SD_L2_SearchPath((uint8_t *)"/NOPE.RAW", 0, 0x18, &f), SD_L2_ERROR_FILE_NOT_FOUND);
+  CHECK_EQ(SD_L2_SearchPath((uint8_t *)"/many/F150.RAW", 0, 0x18, &f), SD_L2_ERROR_FILE_NOT_FOUND);
+  CHECK_EQ(SD_L2_SearchPath((uint8_t *)"/Long Contiguous Nam.raw", 0, 0x18, &f), SD_L2_ERROR_FILE_NOT_FOUND);
+
+  // directories only with maskSet 0x10
+  CHECK_EQ(SD_L2_SearchPath((uint8_t *)"/sub/Nested Directory", 0x10, 0x08, &f), 0);
+  CHECK_EQ(f.Attributes & 0x10, 0x10);
+  CHECK_EQ(SD_L2_SearchPath((uint8_t *)"/sub/Nested Directory", 0, 0x18, &f), SD_L2_ERROR_FILE_NOT_FOUND);
+}
+
+void testExtents()
+{
+  SD_L2_File_t   f;
+  SD_L2_Extent_t ext[64];
+  uint16_t       n = 0;
+  uint32_t       reads;
+
+  // NoFatChain: one extent, the FAT is not read
+  CHECK_EQ(SD_L2_SearchPath((uint8_t *)"/Long Contiguous Name.raw", 0, 0x18, &f), 0);
+  reads = SD_L2_cacheStats.FatHits + SD_L2_cacheStats.FatLoads;
+  CHECK_EQ(SD_L2_IsFileFragmented(&f), 0);
+  CHECK_EQ(SD_L2_GetExtents(&f, ext, 64, &n), 0);
+  CHECK_EQ(SD_L2_cacheStats.FatHits + SD_L2_cacheStats.FatLoads, reads);
+  CHECK_EQ(n, 1);
+  CHECK_EQ(ext[0].Sectors, (100000 + 511) / 512);
+  CHECK_EQ(fileErrors(&f, ext, n), 0);
+
+  // FAT chain, 50 clusters with a gap after every third one
+  CHECK_EQ(SD_L2_SearchPath((uint8_t *)"/FRAG.RAW", 0, 0x18, &f), 0);
+  CHECK_EQ(SD_L2_IsFileFragmented(&f), SD_L2_ERROR_FRAGMET_FOUND);
+  CHECK_EQ(SD_L2_GetExtents(&f, ext, 64, &n), 0);
+  CHECK_EQ(n, 17);
+  for (uint16_t e = 0; e + 1 < n; e++) CHECK_EQ(ext[e].Sectors, 3 * 8);
+  CHECK_EQ(fileErrors(&f, ext, n), 0);
+}
+
+void testValidLength()
+{
+  SD_L2_File_t   f;
+  SD_L2_Extent_t ext[4];
+  uint16_t       n = 0;
+
+  // 3000 valid bytes in 8000 allocated ones: the size is the valid
+  // length, the allocation behind it (0xff) is not part of the file
+  checkPath("/PART.RAW", 3000, 1);
+  CHECK_EQ(SD_L2_SearchPath((uint8_t *)"/PART.RAW", 0, 0x18, &f), 0);
+  CHECK_EQ(SD_L2_GetExtents(&f, ext, 4, &n), 0);
+  CHECK_EQ(n, 1);
+  CHECK_EQ(fileErrors(&f, ext, n), 0);
+  CHECK_EQ(SD_L2_dev->ReadBlock(f.ActSector + 5, buf), 0);
+  CHECK_EQ(buf[3000 - 5 * 512], 0xff);
+
+  // the same with a FAT chain
+  checkPath("/PARTFRAG.RAW", 5000, 0);
+}
+
+void testDirCursor()
+{
+  SD_L2_DirCursor_t cur;
+  SD_L2_File_t      dir, f;
+  char              name[SD_L2_NAME_MAX];
+  char              expect[16];
+  uint16_t          count = 0, calls = 0;
+  uint8_t           ret;
+
+  CHECK_EQ(SD_L2_SearchPath((uint8_t *)"/many", 0x10, 0x08, &dir), 0);
+  CHECK_EQ(dir.Contiguous, 1);
+  CHECK_EQ(SD_L2_DirOpen(&cur, &dir, 0, 0x18), 0);
+  for (;;) {
+    ret = SD_L2_DirNext(&cur, name, &f);
+    calls++;
+    // other lookups and an empty cache between the calls
+    SD_L2_SearchPath((uint8_t *)"/sub/Nested Directory/NOPE.RAW", 0, 0x18, &dir);
+    if (calls & 1) SD_L2_CacheInvalidate();
+    if (ret == SD_L2_ERROR_DIR_EOC) continue;
+    if (ret) break;
+    sprintf(expect, "F%03u.RAW", count);
+    if (!CHECK(strcmp(name, expect) == 0)) printf("  %s, expected %s\n", name, expect);
+    CHECK_EQ(f.Size, 100);
+    CHECK_EQ(f.ActSector, SD_L2_Cluster2Sector(f.FirstCluster));
+    count++;
+  }
+  CHECK_EQ(ret, SD_L2_ERROR_FILE_NOT_FOUND);
+  CHECK_EQ(count, MANY_FILES);
+  CHECK(cur.Done);
+  CHECK_EQ(SD_L2_DirNext(&cur, name, &f), SD_L2_ERROR_FILE_NOT_FOUND);
+
+  // root directory, behind the label, bitmap and up-case table entries
+  CHECK_EQ(SD_L2_DirOpen(&cur, NULL, 0, 0x18), 0);
+  count = 0;
+  while ((ret = SD_L2_DirNext(&cur, name, &f)) != SD_L2_ERROR_FILE_NOT_FOUND) {
+    if (ret == SD_L2_ERROR_DIR_EOC) continue;
+    if (!CHECK_EQ(ret, 0)) break;
+    if (!strcmp(name, "PART.RAW")) CHECK_EQ(f.Size, 3000);
+    count++;
+  }
+  CHECK_EQ(count, 4);
+}
+
+int main()
+{
+  RUN(testMount);
+  RUN(testSearchPath);
+  RUN(testExtents);
+  RUN(testValidLength);
+  RUN(testDirCursor);
+  SD_BLK_FileClose();
+  return hostDone();
+}
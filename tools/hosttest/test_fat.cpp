@@ -0,0 +1,325 @@
+/*
+ * SD_L2 on a FAT16 image (file backend): path lookup with 8.3 and
+ * long names, extents of a fragmented file, the directory cursor,
+ * the hashed directory index and creating files.
+ *
+ * Image: fat16.img, see Makefile. Files are created on a copy of it.
+ */
+#include "sd_l2.h"
+#include "hosttest.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define MANY_FILES 150          // more than the 128 entries of a 4 KB cluster
+
+uint8_t  workBuf[512];
+uint8_t  buf[512];
+
+/** bytes of the file that differ from the pattern, read sector by sector */
+uint32_t fileErrors(const SD_L2_File_t *f, const SD_L2_Extent_t *ext, uint16_t n)
+{
+  uint32_t bad = 0, pos = 0;
+
+  for (uint16_t e = 0; e < n; e++) {
+    if (ext[e].FileSector != pos / 512) bad++;
+    for (uint32_t s = 0; (s < ext[e].Sectors) && (pos < f->Size); s++) {
+      uint32_t count = (f->Size - pos > 512) ? 512 : f->Size - pos;
+      if (SD_L2_dev->ReadBlock(ext[e].StartSector + s, buf)) return 0xffffffffUL;
+      bad += hostPatternErrors(buf, count, pos, f->FirstCluster);
+      pos += count;
+    }
+  }
+  return (pos == f->Size) ? bad : bad + 1;
+}
+
+/** looks up path and checks size and the first sector of data */
+void checkPath(const char *path, uint32_t size)
+{
+  SD_L2_File_t f;
+  uint8_t ret = SD_L2_SearchPath((uint8_t *)path, 0, 0x18, &f);
+
+  if (!CHECK_EQ(ret, 0)) {
+    printf("  %s\n", path);
+    return;
+  }
+  CHECK_EQ(f.Size, size);
+  CHECK_EQ(SD_L2_dev->ReadBlock(SD_L2_Cluster2Sector(f.FirstCluster), buf), 0);
+  CHECK_EQ(hostPatternErrors(buf, (size < 512) ? size : 512, 0, f.FirstCluster), 0);
+}
+
+void testMount()
+{
+  CHECK_EQ(SD_BLK_FileOpen("fat16.img"), 0);
+  SD_L2_dev = &SD_BLK_FileDev;
+  CHECK_EQ(SD_L2_Init(workBuf), 0);
+  CHECK_EQ(SD_L2_FAT.PartType, SD_L2_PARTTYPE_FAT16);
+}
+
+void testSearchPath()
+{
+  SD_L2_File_t f;
+
+  // 8.3 names, any case, with and without leading slash
+  checkPath("TEST.WAV", 100000);
+  checkPath("/test.wav", 100000);
+  checkPath("many/F000.RAW", 100);
+  checkPath("/MANY/F149.RAW", 100);             // in the second cluster of the directory
+  checkPath("\\many\\f010.raw", 100);
+
+  // long names
+  checkPath("Long File Name.wav", 1000);
+  checkPath("/LONG FILE NAME.WAV", 1000);
+  checkPath("/sub/Nested Directory/A Long Name In A Subdirectory.raw", 3000);
+  checkPath("/sub/NESTED~1/SHORT.RAW", 700);      // 8.3 alias of the directory
+
+  // not found
+  CHECK_EQ(SD_L2_SearchPath((uint8_t *)"/NOPE.WAV", 0, 0x18, &f), SD_L2_ERROR_FILE_NOT_FOUND);
+  CHECK_EQ(SD_L2_SearchPath((uint8_t *)"/nope/F000.RAW", 0, 0x18, &f), SD_L2_ERROR_FILE_NOT_FOUND);
+  CHECK_EQ(SD_L2_SearchPath((uint8_t *)"/many/F150.RAW", 0, 0x18, &f), SD_L2_ERROR_FILE_NOT_FOUND);
+  CHECK_EQ(SD_L2_SearchPath((uint8_t *)"/TEST.WAV/X", 0, 0x18, &f), SD_L2_ERROR_FILE_NOT_FOUND);
+
+  // directories only with maskSet 0x10
+  CHECK_EQ(SD_L2_SearchPath((uint8_t *)"/sub/Nested Directory", 0x10, 0x08, &f), 0);
+  CHECK_EQ(f.Attributes & 0x10, 0x10);
+  CHECK_EQ(SD_L2_SearchPath((uint8_t *)"/sub/Nested Directory", 0, 0x18, &f), SD_L2_ERROR_FILE_NOT_FOUND);
+}
+
+void testExtents()
+{
+  SD_L2_File_t   f;
+  SD_L2_Extent_t ext[64];
+  uint16_t       n = 0;
+  uint32_t       clusters;
+
+  // 50 clusters with a gap after every third one
+  CHECK_EQ(SD_L2_SearchPath((uint8_t *)"/FRAG.RAW", 0, 0x18, &f), 0);
+  clusters = (f.Size + 4095) / 4096;
+  CHECK_EQ(clusters, 50);
+  CHECK_EQ(SD_L2_IsFileFragmented(&f), SD_L2_ERROR_FRAGMET_FOUND);
+  CHECK_EQ(SD_L2_GetExtents(&f, ext, 4, &n), SD_L2_ERROR_EXTENTS_FULL);
+  SD_L2_CacheInvalidate();
+  CHECK_EQ(SD_L2_GetExtents(&f, ext, 64, &n), 0);
+  CHECK_EQ(n, (clusters + 2) / 3);
+  for (uint16_t e = 0; e + 1 < n; e++) CHECK_EQ(ext[e].Sectors, 3 * 8);
+  CHECK_EQ(fileErrors(&f, ext, n), 0);
+  CHECK_EQ(SD_L2_FindExtent(ext, n, 0), 0);
+  CHECK_EQ(SD_L2_FindExtent(ext, n, 24), 1);
+  CHECK_EQ(SD_L2_FindExtent(ext, n, 399), 16);
+  CHECK_EQ(SD_L2_FindExtent(ext, n, 400), n);
+
+  // contiguous file: one extent
+  CHECK_EQ(SD_L2_SearchPath((uint8_t *)"/TEST.WAV", 0, 0x18, &f), 0);
+  CHECK_EQ(SD_L2_IsFileFragmented(&f), 0);
+  CHECK_EQ(SD_L2_GetExtents(&f, ext, 64, &n), 0);
+  CHECK_EQ(n, 1);
+  CHECK_EQ(fileErrors(&f, ext, n), 0);
+}
+
+void testDirCursor()
+{
+  SD_L2_DirCursor_t cur;
+  SD_L2_File_t      dir, f;
+  char              name[SD_L2_NAME_MAX];
+  char              expect[16];
+  uint16_t          count = 0, calls = 0;
+  uint8_t           ret;
+
+  CHECK_EQ(SD_L2_SearchPath((uint8_t *)"/many", 0x10, 0x08, &dir), 0);
+  CHECK_EQ(SD_L2_DirOpen(&cur, &dir, 0, 0x18), 0);
+  for (;;) {
+    ret = SD_L2_DirNext(&cur, name, &f);
+    calls++;
+    // other lookups and an empty cache between the calls
+    SD_L2_SearchPath((uint8_t *)"/sub/Nested Directory/NOPE.RAW", 0, 0x18, &dir);
+    if (calls & 1) SD_L2_CacheInvalidate();
+    if (ret == SD_L2_ERROR_DIR_EOC) continue;
+    if (ret) break;
+    sprintf(expect, "F%03u.RAW", count);
+    if (!CHECK(strcmp(name, expect) == 0)) printf("  %s, expected %s\n", name, expect);
+    CHECK_EQ(f.Size, 100);
+    count++;
+  }
+  CHECK_EQ(ret, SD_L2_ERROR_FILE_NOT_FOUND);
+  CHECK_EQ(count, MANY_FILES);
+  CHECK(cur.Done);
+  // the directory has a gap after every cluster, so the cursor followed the FAT
+  CHECK(cur.Index > 128);
+
+  // a finished cursor stays at the end
+  CHECK_EQ(SD_L2_DirNext(&cur, name, &f), SD_L2_ERROR_FILE_NOT_FOUND);
+
+  // root directory, long names are returned
+  CHECK_EQ(SD_L2_DirOpen(&cur, NULL, 0, 0x18), 0);
+  count = 0;
+  while ((ret = SD_L2_DirNext(&cur, name, &f)) != SD_L2_ERROR_FILE_NOT_FOUND) {
+    if (ret == SD_L2_ERROR_DIR_EOC) continue;
+    if (!CHECK_EQ(ret, 0)) break;
+    if (!strcmp(name, "Long File Name.wav")) count++;
+  }
+  CHECK_EQ(count, 1);
+}
+
+void testIndex()
+{
+  SD_L2_IndexSlot_t slots[256];
+  SD_L2_File_t      dir, f;
+  uint32_t          reads;
+  char              name[16];
+
+  // index of /many, a directory of two clusters
+  CHECK_EQ(SD_L2_SearchPath((uint8_t *)"/many", 0x10, 0x08, &dir), 0);
+  SD_L2_IndexSetup(dir.FirstCluster, slots, 256);
+  CHECK_EQ(SD_L2_IndexBuild(), 0);
+
+  // hit: the sector holding the entry is read, and the FAT sector
+  // for entries in the second cluster (behind ".", ".." and F000-F125)
+  for (uint16_t i = 0; i < MANY_FILES; i += 7) {
+    sprintf(name, "F%03u.RAW", i);
+    SD_L2_CacheInvalidate();
+    reads = SD_L2_cacheStats.Misses + SD_L2_cacheStats.FatLoads;
+    CHECK_EQ(SD_L2_SearchFile((uint8_t *)name, dir.FirstCluster, 0, 0x18, &f), 0);
+    if (!CHECK_EQ(SD_L2_cacheStats.Misses + SD_L2_cacheStats.FatLoads - reads, (i < 126) ? 1 : 2)) printf("  %s\n", name);
+    CHECK_EQ(f.Size, 100);
+    CHECK_EQ(SD_L2_dev->ReadBlock(SD_L2_Cluster2Sector(f.FirstCluster), buf), 0);
+    CHECK_EQ(hostPatternErrors(buf, 100, 0, f.FirstCluster), 0);
+  }
+
+  // miss: no read unless another name has the same hash
+  SD_L2_CacheInvalidate();
+  reads = SD_L2_cacheStats.Misses + SD_L2_cacheStats.FatLoads;
+  CHECK_EQ(SD_L2_SearchFile((uint8_t *)"F999.RAW", dir.FirstCluster, 0, 0x18, &f), SD_L2_ERROR_FILE_NOT_FOUND);
+  CHECK(SD_L2_cacheStats.Misses + SD_L2_cacheStats.FatLoads - reads <= 2);
+
+  // other directories are searched as before
+  CHECK_EQ(SD_L2_SearchFile((uint8_t *)"TEST.WAV", 0, 0, 0x18, &f), 0);
+
+  // an index too small for the directory: names not in it are searched
+  SD_L2_IndexSetup(dir.FirstCluster, slots, 64);
+  CHECK_EQ(SD_L2_IndexBuild(), 0);
+  CHECK_EQ(SD_L2_SearchDir((uint8_t *)"F000.RAW", dir.FirstCluster, 0, 0x18, &f), 0);
+  CHECK_EQ(SD_L2_SearchDir((uint8_t *)"F149.RAW", dir.FirstCluster, 0, 0x18, &f), 0);
+  CHECK_EQ(f.Size, 100);
+  CHECK_EQ(SD_L2_SearchDir((uint8_t *)"F999.RAW", dir.FirstCluster, 0, 0x18, &f), SD_L2_ERROR_FILE_NOT_FOUND);
+  SD_L2_IndexSetup(0, NULL, 0);
+}
+
+/** FAT16 entry of cluster, read from the first FAT */
+uint32_t fatEntry(uint32_t cluster)
+{
+  uint8_t fat[512];
+
+  if (SD_L2_dev->ReadBlock(SD_L2_FAT.FatStart + (cluster >> 8), fat)) return 0xffffffffUL;
+  return fat[(cluster & 0xff) * 2] | (fat[(cluster & 0xff) * 2 + 1] << 8);
+}
+
+/** first fit of count free clusters, entry by entry */
+uint32_t firstFreeRun(uint32_t count)
+{
+  uint32_t run = 0;
+
+  for (uint32_t c = 2; c < SD_L2_FAT.ClusterCount + 2; c++) {
+    run = fatEntry(c) ? 0 : run + 1;
+    if (run == count) return c + 1 - count;
+  }
+  return 0;
+}
+
+uint8_t writeRunStopFails()
+{
+  SD_BLK_FileDev.WriteRunStop();
+  return SD_CARD_ERROR_STOP_TRAN;
+}
+
+void testCreate()
+{
+  SD_L2_IndexSlot_t slots[256];
+  SD_L2_File_t      dir, f, g;
+  uint32_t          first, second;
+  FILE              *src, *dst;
+  size_t            n;
+
+  src = fopen("fat16.img", "rb");
+  dst = fopen("create.img", "wb");
+  if (!CHECK(src && dst)) return;
+  while ((n = fread(buf, 1, sizeof(buf), src)) > 0) fwrite(buf, 1, n, dst);
+  fclose(src);
+  fclose(dst);
+  CHECK_EQ(SD_BLK_FileOpen("create.img"), 0);
+  CHECK_EQ(SD_L2_Init(workBuf), 0);
+
+  // the first cluster of /many is full, F126-F149 are in the second one
+  CHECK_EQ(SD_L2_SearchPath((uint8_t *)"/many", 0x10, 0x08, &dir), 0);
+  SD_L2_IndexSetup(dir.FirstCluster, slots, 256);
+  CHECK_EQ(SD_L2_IndexBuild(), 0);
+  CHECK_EQ(SD_L2_CreateFile((uint8_t *)"F149.RAW", dir.FirstCluster, 100, &f), SD_L2_ERROR_FILE_EXISTS);
+
+  // FRAG.RAW leaves gaps of one cluster, three in a row are behind them
+  first = firstFreeRun(3);
+  CHECK(first != 0);
+  CHECK_EQ(SD_L2_CreateFile((uint8_t *)"NEW.RAW", dir.FirstCluster, 3 * 4096, &f), 0);
+  CHECK_EQ(f.FirstCluster, first);
+  CHECK_EQ(f.Size, 3 * 4096);
+  CHECK_EQ(fatEntry(first), first + 1);
+  CHECK_EQ(fatEntry(first + 1), first + 2);
+  CHECK(fatEntry(first + 2) >= 0xfff8);
+
+  // entry 24 of the second cluster of the directory
+  second = fatEntry(dir.FirstCluster);
+  CHECK_EQ(f.DirSector, SD_L2_Cluster2Sector(second) + 1);
+  CHECK_EQ(f.DirOffset, 8 * 32);
+
+  // found through the index, and after a new mount without it
+  CHECK_EQ(SD_L2_SearchFile((uint8_t *)"NEW.RAW", dir.FirstCluster, 0, 0x18, &g), 0);
+  CHECK_EQ(g.FirstCluster, first);
+  CHECK_EQ(SD_L2_Init(workBuf), 0);
+  CHECK_EQ(SD_L2_SearchPath((uint8_t *)"/many/NEW.RAW", 0, 0x18, &g), 0);
+  CHECK_EQ(g.FirstCluster, first);
+  CHECK_EQ(g.Size, 0);
+  CHECK_EQ(SD_L2_CreateFile((uint8_t *)"NEW.RAW", dir.FirstCluster, 100, &f), SD_L2_ERROR_FILE_EXISTS);
+
+  // a failing stop of the write run still stores the size written
+  SD_BLK_Dev_t failStop = SD_BLK_FileDev;
+  failStop.WriteRunStop = writeRunStopFails;
+  SD_L2_dev = &failStop;
+  CHECK_EQ(SD_L2_WriteOpen(&g), 0);
+  CHECK_EQ(SD_L2_WriteSector(&g, buf), 0);
+  CHECK_EQ(SD_L2_WriteSector(&g, buf), 0);
+  CHECK_EQ(SD_L2_WriteClose(&g, 1000), SD_CARD_ERROR_STOP_TRAN);
+  SD_L2_dev = &SD_BLK_FileDev;
+  CHECK_EQ(SD_L2_Init(workBuf), 0);
+  CHECK_EQ(SD_L2_SearchPath((uint8_t *)"/many/NEW.RAW", 0, 0x18, &g), 0);
+  CHECK_EQ(g.Size, 1000);
+
+  // more than the card holds
+  CHECK_EQ(SD_L2_CreateFile((uint8_t *)"HUGE.RAW", 0, 100000000UL, &f), SD_L2_ERROR_DISK_FULL);
+
+  // a device with single block reads only
+  SD_BLK_Dev_t ro = SD_BLK_FileDev;
+  ro.ReadRunStart = NULL;
+  ro.ReadRunAsync = NULL;
+  ro.ReadRunStop = NULL;
+  ro.WriteBlock = NULL;
+  ro.WriteRunStart = NULL;
+  ro.WriteRun = NULL;
+  ro.WriteRunStop = NULL;
+  SD_L2_dev = &ro;
+  SD_L2_CacheInvalidate();
+  CHECK_EQ(SD_L2_SearchPath((uint8_t *)"/many/F149.RAW", 0, 0x18, &g), 0);
+  CHECK_EQ(SD_L2_CreateFile((uint8_t *)"RO.RAW", 0, 100, &f), SD_L2_ERROR_READ_ONLY);
+  CHECK_EQ(SD_L2_WriteOpen(&g), SD_L2_ERROR_READ_ONLY);
+  SD_L2_dev = &SD_BLK_FileDev;
+  SD_L2_IndexSetup(0, NULL, 0);
+  SD_BLK_FileClose();
+}
+
+int main()
+{
+  RUN(testMount);
+  RUN(testSearchPath);
+  RUN(testExtents);
+  RUN(testDirCursor);
+  RUN(testIndex);
+  RUN(testCreate);
+  return hostDone();
+}
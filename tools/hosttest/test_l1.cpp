@@ -0,0 +1,194 @@
+/*
+ * SD_L1 on the SD card emulator: retries after CRC errors, token
+ * timeouts and error tokens, for the blocking, background and
+ * multiple block reads. test_l1_hist is built with the latency
+ * histograms and checks that failed token waits are counted.
+ *
+ * Image: l1.img with TEST.RAW (100 sectors), see Makefile.
+ */
+#include "sd_l2.h"
+#include "hosttest.h"
+
+#include <string.h>
+
+uint8_t  workBuf[512];
+uint8_t  buf[512];
+uint32_t first;         // first sector of TEST.RAW
+uint32_t firstCluster;
+
+/** wait for a background read */
+uint8_t poll()
+{
+  uint8_t ret;
+  while ((ret = SD_L1_ReadPoll()) == SD_CARD_READ_PENDING) ;
+  return ret;
+}
+
+#if SD_ENABLE_L1_HISTOGRAM
+/** token waits of cmd in all buckets */
+uint32_t tokenCount(uint8_t cmd)
+{
+  uint32_t n = 0;
+  for (uint8_t b = 0; b < SD_L1_HIST_BUCKETS; b++) n += SD_L1_HistGet(cmd, SD_L1_HIST_TOKEN, b);
+  return n;
+}
+#endif
+
+/** bytes of buf that differ from sector i of TEST.RAW */
+uint32_t errors(uint32_t i)
+{
+  return hostPatternErrors(buf, 512, i * 512, firstCluster);
+}
+
+void testMount()
+{
+  SD_L2_File_t f;
+
+  CHECK_EQ(SD_L0_EmuOpen("l1.img"), 0);
+  SD_L2_dev = &SD_L1_BlkDev;
+  CHECK_EQ(SD_L2_Init(workBuf), 0);
+  CHECK_EQ(SD_L2_SearchFile((uint8_t *)"TEST.RAW", 0, 0, 0x18, &f), 0);
+  CHECK_EQ(f.Size, 100 * 512);
+  firstCluster = f.FirstCluster;
+  first = SD_L2_Cluster2Sector(f.FirstCluster);
+}
+
+void testCrcRetry()
+{
+  uint32_t c0;
+
+  // one bad CRC: the block is read again
+  SD_L0_EmuInject(SD_L0_EMU_FAULT_CRC, first + 1, 1);
+  c0 = SD_L0_emuStats.Commands;
+  memset(buf, 0, 512);
+  CHECK_EQ(SD_L1_ReadBlock(first + 1, buf), 0);
+  CHECK_EQ(errors(1), 0);
+  CHECK_EQ(SD_L0_emuStats.Commands - c0, 2);
+
+  // SD_L1_CRC_RETRIES (3) retries, the fourth bad CRC is reported
+  for (uint8_t i = 0; i < 3; i++) SD_L0_EmuInject(SD_L0_EMU_FAULT_CRC, first + 2, 1);
+  CHECK_EQ(SD_L1_ReadBlock(first + 2, buf), 0);
+  CHECK_EQ(errors(2), 0);
+  for (uint8_t i = 0; i < 4; i++) SD_L0_EmuInject(SD_L0_EMU_FAULT_CRC, first + 2, 1);
+  CHECK_EQ(SD_L1_ReadBlock(first + 2, buf), SD_CARD_ERROR_CRC);
+  SD_L0_EmuClearFaults();
+
+  // background read
+  SD_L0_EmuInject(SD_L0_EMU_FAULT_CRC, first + 3, 1);
+  memset(buf, 0, 512);
+  CHECK_EQ(SD_L1_ReadBlockAsync(first + 3, buf), 0);
+  CHECK_EQ(poll(), 0);
+  CHECK_EQ(errors(3), 0);
+
+  // multiple block read: restarted at the failed block
+  SD_L0_EmuInject(SD_L0_EMU_FAULT_CRC, first + 7, 1);
+  CHECK_EQ(SD_L1_ReadMBStart(first + 4), 0);
+  for (uint32_t i = 4; i < 10; i++) {
+    memset(buf, 0, 512);
+    CHECK_EQ(SD_L1_ReadMBAsync(buf), 0);
+    CHECK_EQ(poll(), 0);
+    CHECK_EQ(errors(i), 0);
+  }
+  SD_L0_EmuInject(SD_L0_EMU_FAULT_CRC, first + 10, 1);
+  CHECK_EQ(SD_L1_ReadMB(buf), 0);
+  CHECK_EQ(errors(10), 0);
+  CHECK_EQ(SD_L1_ReadMBStop(), 0);
+}
+
+void testTokenTimeout()
+{
+  uint32_t t0;
+
+  // token later than SD_READ_TIMEOUT (300 ms)
+#if SD_ENABLE_L1_HISTOGRAM
+  SD_L1_HistReset();
+#endif
+  SD_L0_EmuInject(SD_L0_EMU_FAULT_TOKEN_DELAY, first + 20, 400000);
+  t0 = SD_L0_EmuMicros();
+  CHECK_EQ(SD_L1_ReadBlock(first + 20, buf), SD_CARD_ERROR_READ_TIMEOUT);
+  CHECK(SD_L0_EmuMicros() - t0 >= 300000);
+  CHECK(SD_L0_EmuMicros() - t0 < 400000);
+
+  SD_L0_EmuInject(SD_L0_EMU_FAULT_TOKEN_DELAY, first + 21, 400000);
+  CHECK_EQ(SD_L1_ReadBlockAsync(first + 21, buf), 0);
+  CHECK_EQ(poll(), SD_CARD_ERROR_READ_TIMEOUT);
+#if SD_ENABLE_L1_HISTOGRAM
+  // both timeouts are in the last bucket
+  CHECK_EQ(tokenCount(SD_L1_HIST_CMD17), 2);
+  CHECK_EQ(SD_L1_HistGet(SD_L1_HIST_CMD17, SD_L1_HIST_TOKEN, SD_L1_HIST_BUCKETS - 1), 2);
+#endif
+
+  // a late token within the timeout is waited for
+  SD_L0_EmuInject(SD_L0_EMU_FAULT_TOKEN_DELAY, first + 22, 100000);
+  CHECK_EQ(SD_L1_ReadBlockAsync(first + 22, buf), 0);
+  CHECK_EQ(poll(), 0);
+  CHECK_EQ(errors(22), 0);
+
+  // the card is usable again
+  CHECK_EQ(SD_L1_ReadBlock(first + 20, buf), 0);
+  CHECK_EQ(errors(20), 0);
+}
+
+void testErrorToken()
+{
+#if SD_ENABLE_L1_HISTOGRAM
+  SD_L1_HistReset();
+#endif
+  SD_L0_EmuInject(SD_L0_EMU_FAULT_ERROR_TOKEN, first + 30, 0x08);
+  CHECK_EQ(SD_L1_ReadBlock(first + 30, buf), SD_CARD_ERROR_READ);
+
+  SD_L0_EmuInject(SD_L0_EMU_FAULT_ERROR_TOKEN, first + 31, 0x04);
+  CHECK_EQ(SD_L1_ReadBlockAsync(first + 31, buf), 0);
+  CHECK_EQ(poll(), SD_CARD_ERROR_READ);
+#if SD_ENABLE_L1_HISTOGRAM
+  CHECK_EQ(tokenCount(SD_L1_HIST_CMD17), 2);
+  CHECK_EQ(SD_L1_HistGet(SD_L1_HIST_CMD17, SD_L1_HIST_TOKEN, SD_L1_HIST_BUCKETS - 1), 0);
+#endif
+
+  // within a multiple block read
+  SD_L0_EmuInject(SD_L0_EMU_FAULT_ERROR_TOKEN, first + 33, 0x08);
+  CHECK_EQ(SD_L1_ReadMBStart(first + 32), 0);
+  CHECK_EQ(SD_L1_ReadMBAsync(buf), 0);
+  CHECK_EQ(poll(), 0);
+  CHECK_EQ(errors(32), 0);
+  CHECK_EQ(SD_L1_ReadMBAsync(buf), 0);
+  CHECK_EQ(poll(), SD_CARD_ERROR_READ);
+  SD_L1_ReadMBStop();
+
+  CHECK_EQ(SD_L1_ReadBlock(first + 30, buf), 0);
+  CHECK_EQ(errors(30), 0);
+}
+
+void testWrite()
+{
+  uint8_t data[512];
+
+  for (uint16_t i = 0; i < 512; i++) data[i] = (uint8_t)(i ^ 0x5a);
+  CHECK_EQ(SD_L1_WriteBlock(first + 50, data), 0);
+  CHECK_EQ(SD_L1_ReadBlock(first + 50, buf), 0);
+  CHECK(memcmp(buf, data, 512) == 0);
+
+  // multiple block write with a long busy time after one block
+  SD_L1_ResetMaxBusyTime();
+  SD_L0_EmuInject(SD_L0_EMU_FAULT_BUSY, first + 61, 20000);
+  CHECK_EQ(SD_L1_WriteMBStart(first + 60, 4), 0);
+  for (uint8_t i = 0; i < 4; i++) {
+    data[0] = i;
+    CHECK_EQ(SD_L1_WriteMB(data), 0);
+  }
+  CHECK_EQ(SD_L1_WriteMBStop(), 0);
+  CHECK(SD_L1_GetMaxBusyTime() >= 20);
+  CHECK_EQ(SD_L1_ReadBlock(first + 63, buf), 0);
+  CHECK_EQ(buf[0], 3);
+  CHECK(memcmp(buf + 1, data + 1, 511) == 0);
+}
+
+int main()
+{
+  RUN(testMount);
+  RUN(testCrcRetry);
+  RUN(testTokenTimeout);
+  RUN(testErrorToken);
+  RUN(testWrite);
+  return hostDone();
+}